@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cluster.h"
+
+/* CRC16-CCITT (XMODEM), which is what the cluster hashes keys with. */
+static const unsigned short crc16_tab[] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+};
+
+static unsigned short
+redis_cluster_crc16(const char *buf, size_t len)
+{
+    unsigned short crc = 0;
+    size_t i = 0;
+
+    for(i = 0; i < len; i++)
+        crc = (crc << 8) ^ crc16_tab[((crc >> 8) ^ (unsigned char)buf[i]) & 0xff];
+
+    return crc;
+}
+
+/*
+ * The slot of a key. Only the part between the first "{" and the next "}"
+ * is hashed when that part is not empty, so related keys can be kept
+ * together.
+ */
+unsigned int
+redis_cluster_keyslot(const char *key, size_t len)
+{
+    const char *open = memchr(key, '{', len);
+    const char *close = NULL;
+
+    if(open != NULL)
+    {
+        close = memchr(open + 1, '}', len - (open + 1 - key));
+        if(close != NULL && close > open + 1)
+            return redis_cluster_crc16(open + 1, close - open - 1) & (REDIS_CLUSTER_SLOTS - 1);
+    }
+
+    return redis_cluster_crc16(key, len) & (REDIS_CLUSTER_SLOTS - 1);
+}
+
+/* Read "<type><number>\r\n" at *pos, moving past it. */
+static int
+redis_cluster_header(const char *cmd, size_t len, size_t *pos, char type, long *value)
+{
+    const char *p = cmd + *pos;
+    const char *end = cmd + len;
+    long v = 0;
+
+    if(p >= end || *p++ != type)
+        return -1;
+
+    while(p < end && *p >= '0' && *p <= '9')
+        v = v * 10 + (*p++ - '0');
+
+    if(p + 2 > end || p[0] != '\r' || p[1] != '\n')
+        return -1;
+
+    *value = v;
+    *pos = p + 2 - cmd;
+    return 0;
+}
+
+/*
+ * Find the key of a command encoded in RESP, taken to be its second
+ * argument like for every command treewalk and the reaper send. Returns
+ * -1 for commands without one.
+ */
+int
+redis_cluster_command_key(const char *cmd, size_t len, const char **key, size_t *keylen)
+{
+    size_t pos = 0;
+    long argc = 0;
+    long arglen = 0;
+
+    if(redis_cluster_header(cmd, len, &pos, '*', &argc) < 0 || argc < 2)
+        return -1;
+
+    if(redis_cluster_header(cmd, len, &pos, '$', &arglen) < 0)
+        return -1;
+    pos += arglen + 2;
+
+    if(redis_cluster_header(cmd, len, &pos, '$', &arglen) < 0 || pos + arglen > len)
+        return -1;
+
+    *key = cmd + pos;
+    *keylen = arglen;
+    return 0;
+}
+
+/*
+ * Turn a CLUSTER SLOTS reply into the ranges served by each master.
+ * Replicas are ignored. An empty host means the node that was asked, and
+ * is left empty for the caller to fill in. Returns the number of ranges,
+ * or -1 when the reply does not look right.
+ */
+int
+redis_cluster_parse_slots(redisReply *reply, redis_cluster_range_t **ranges)
+{
+    redis_cluster_range_t *r = NULL;
+    redisReply *range = NULL;
+    redisReply *master = NULL;
+    size_t i = 0;
+    size_t len = 0;
+
+    if(reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements == 0)
+        return -1;
+
+    r = (redis_cluster_range_t *)calloc(reply->elements, sizeof(*r));
+    if(r == NULL)
+        return -1;
+
+    for(i = 0; i < reply->elements; i++)
+    {
+        range = reply->element[i];
+        if(range->type != REDIS_REPLY_ARRAY || range->elements < 3 ||
+                range->element[0]->type != REDIS_REPLY_INTEGER ||
+                range->element[1]->type != REDIS_REPLY_INTEGER ||
+                range->element[2]->type != REDIS_REPLY_ARRAY)
+            goto bad;
+
+        master = range->element[2];
+        if(master->elements < 2 || master->element[0]->type != REDIS_REPLY_STRING ||
+                master->element[1]->type != REDIS_REPLY_INTEGER)
+            goto bad;
+
+        r[i].start = (int)range->element[0]->integer;
+        r[i].end = (int)range->element[1]->integer;
+        if(r[i].start < 0 || r[i].end >= REDIS_CLUSTER_SLOTS || r[i].start > r[i].end)
+            goto bad;
+
+        len = master->element[0]->len;
+        if(len >= sizeof(r[i].host))
+            goto bad;
+        memcpy(r[i].host, master->element[0]->str, len);
+        r[i].host[len] = '\0';
+        r[i].port = (int)master->element[1]->integer;
+    }
+
+    *ranges = r;
+    return (int)reply->elements;
+
+bad:
+    free(r);
+    return -1;
+}
+
+/*
+ * Recognize "MOVED <slot> <host>:<port>" and "ASK <slot> <host>:<port>".
+ * Returns REDIS_CLUSTER_MOVED or REDIS_CLUSTER_ASK with the rest filled
+ * in, or REDIS_CLUSTER_NO_REDIRECT for any other error.
+ */
+int
+redis_cluster_parse_redirect(const char *err, size_t len, int *slot, char *host, size_t host_len, int *port)
+{
+    const char *end = err + len;
+    const char *p = NULL;
+    const char *colon = NULL;
+    int kind = REDIS_CLUSTER_NO_REDIRECT;
+    long v = 0;
+
+    if(len > 6 && memcmp(err, "MOVED ", 6) == 0)
+    {
+        kind = REDIS_CLUSTER_MOVED;
+        p = err + 6;
+    }
+    else if(len > 4 && memcmp(err, "ASK ", 4) == 0)
+    {
+        kind = REDIS_CLUSTER_ASK;
+        p = err + 4;
+    }
+    else
+        return REDIS_CLUSTER_NO_REDIRECT;
+
+    while(p < end && *p >= '0' && *p <= '9')
+        v = v * 10 + (*p++ - '0');
+    if(p >= end || *p++ != ' ' || v >= REDIS_CLUSTER_SLOTS)
+        return REDIS_CLUSTER_NO_REDIRECT;
+    *slot = (int)v;
+
+    /* The port follows the last colon, IPv6 hosts have more. */
+    for(colon = end - 1; colon > p && *colon != ':'; colon--)
+        ;
+    if(colon <= p || (size_t)(colon - p) >= host_len)
+        return REDIS_CLUSTER_NO_REDIRECT;
+    memcpy(host, p, colon - p);
+    host[colon - p] = '\0';
+
+    v = 0;
+    for(p = colon + 1; p < end && *p >= '0' && *p <= '9'; p++)
+        v = v * 10 + (*p - '0');
+    if(p != end || v <= 0 || v > 65535)
+        return REDIS_CLUSTER_NO_REDIRECT;
+    *port = (int)v;
+
+    return kind;
+}
+
+/* EOF */
@@ -0,0 +1,32 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stddef.h>
+#include <hiredis.h>
+
+/*
+ * The parts of the Redis Cluster protocol that do not need a connection:
+ * key slots, finding the key of an encoded command, and reading the
+ * CLUSTER SLOTS and MOVED/ASK replies. The routing itself is in redis.c.
+ */
+#define REDIS_CLUSTER_SLOTS 16384
+
+#define REDIS_CLUSTER_NO_REDIRECT 0
+#define REDIS_CLUSTER_MOVED       1
+#define REDIS_CLUSTER_ASK         2
+
+/* Slots [start, end] are served by the master at host:port. */
+typedef struct
+{
+    int  start;
+    int  end;
+    char host[256];
+    int  port;
+} redis_cluster_range_t;
+
+unsigned int redis_cluster_keyslot(const char *key, size_t len);
+int          redis_cluster_command_key(const char *cmd, size_t len, const char **key, size_t *keylen);
+int          redis_cluster_parse_slots(redisReply *reply, redis_cluster_range_t **ranges);
+int          redis_cluster_parse_redirect(const char *err, size_t len, int *slot, char *host, size_t host_len, int *port);
+
+#endif /* CLUSTER_H */
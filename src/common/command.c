@@ -0,0 +1,35 @@
+#include <stdarg.h>
+
+#include "command.h"
+#include "log.h"
+
+/*
+ * Run a command on c through *tpl, which is compiled from format the first
+ * time it is used, so the format is only parsed once per run. The
+ * arguments are the same as for redisCommand(). Returns NULL when the
+ * format does not compile or the command fails, c->errstr says why in
+ * the second case.
+ */
+redisReply *
+purger_template_command(redisContext *c, redisCommandTemplate **tpl, const char *format, ...)
+{
+    redisReply *reply;
+    va_list ap;
+
+    if(*tpl == NULL)
+    {
+        *tpl = redisCompileCommand(format);
+
+        if(*tpl == NULL)
+        {
+            LOG(PURGER_LOG_ERR, "Unable to compile the redis command \"%s\".", format);
+            return NULL;
+        }
+    }
+
+    va_start(ap, format);
+    reply = redisvTemplateCommand(c, *tpl, ap);
+    va_end(ap);
+
+    return reply;
+}
@@ -0,0 +1,8 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <hiredis.h>
+
+redisReply *purger_template_command(redisContext *c, redisCommandTemplate **tpl, const char *format, ...);
+
+#endif /* COMMAND_H */
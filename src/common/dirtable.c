@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dirtable.h"
+
+/* The id of the directory "dir", whose path has no trailing '/'. */
+uint64_t
+purger_dir_id(const char *dir, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+
+    for(i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)dir[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/*
+ * Write the reference "<dir id>/<basename>" of the file at "path" into
+ * buf. The directory is everything before the last '/', or "/" when that
+ * is nothing. Returns the length of the reference, or -1 when path has
+ * no '/' or the reference does not fit with its NUL.
+ */
+int
+purger_dir_ref(const char *path, size_t len, char *buf, size_t size)
+{
+    const char *slash = NULL;
+    size_t dir_len = 0;
+    size_t base_len = 0;
+    uint64_t id = 0;
+
+    for(slash = path + len; slash > path && slash[-1] != '/'; slash--)
+        ;
+    if(slash == path)
+        return -1;
+
+    dir_len = (size_t)(slash - 1 - path);
+    base_len = len - dir_len - 1;
+    if(PURGER_DIR_ID_LEN + 1 + base_len + 1 > size)
+        return -1;
+
+    id = dir_len > 0 ? purger_dir_id(path, dir_len) : purger_dir_id("/", 1);
+    sprintf(buf, "%016llx/", (unsigned long long)id);
+    memcpy(buf + PURGER_DIR_ID_LEN + 1, slash, base_len);
+    buf[PURGER_DIR_ID_LEN + 1 + base_len] = '\0';
+
+    return (int)(PURGER_DIR_ID_LEN + 1 + base_len);
+}
+
+/* Split a reference into its directory id and basename. Returns -1 for
+ * anything else, a full path in particular. */
+int
+purger_dir_ref_parse(const char *name, size_t len, uint64_t *id,
+                     const char **base, size_t *base_len)
+{
+    uint64_t v = 0;
+    int i = 0;
+    char c = 0;
+
+    if(len < PURGER_DIR_ID_LEN + 1 || name[PURGER_DIR_ID_LEN] != '/')
+        return -1;
+
+    for(i = 0; i < PURGER_DIR_ID_LEN; i++)
+    {
+        c = name[i];
+        if(c >= '0' && c <= '9')
+            v = (v << 4) | (uint64_t)(c - '0');
+        else if(c >= 'a' && c <= 'f')
+            v = (v << 4) | (uint64_t)(c - 'a' + 10);
+        else
+            return -1;
+    }
+
+    *id = v;
+    *base = name + PURGER_DIR_ID_LEN + 1;
+    *base_len = len - PURGER_DIR_ID_LEN - 1;
+    return 0;
+}
+
+/* Slot of id in the cache: where it is, or the empty one it would go in. */
+static size_t
+purger_dir_cache_slot(purger_dir_cache_t *c, uint64_t id)
+{
+    size_t i = (size_t)(id & (c->size - 1));
+
+    while(c->paths[i] != NULL && c->ids[i] != id)
+        i = (i + 1) & (c->size - 1);
+
+    return i;
+}
+
+/* The path of directory "id", or NULL when it is not cached. */
+const char *
+purger_dir_cache_get(purger_dir_cache_t *c, uint64_t id)
+{
+    if(c->size == 0)
+        return NULL;
+
+    return c->paths[purger_dir_cache_slot(c, id)];
+}
+
+/*
+ * Cache the path of directory "id". Past PURGER_DIR_CACHE_MAX entries the
+ * cache is emptied first, readers tend to work through one part of the
+ * tree at a time. Returns -1 without memory.
+ */
+int
+purger_dir_cache_put(purger_dir_cache_t *c, uint64_t id, const char *path, size_t len)
+{
+    purger_dir_cache_t grown;
+    char *copy = NULL;
+    size_t slot = 0;
+    size_t i = 0;
+
+    if(c->count >= PURGER_DIR_CACHE_MAX)
+        purger_dir_cache_free(c);
+
+    if(2 * (c->count + 1) > c->size)
+    {
+        grown.size = c->size ? 2 * c->size : 1024;
+        grown.count = c->count;
+        grown.ids = (uint64_t *)calloc(grown.size, sizeof(uint64_t));
+        grown.paths = (char **)calloc(grown.size, sizeof(char *));
+        if(grown.ids == NULL || grown.paths == NULL)
+        {
+            free(grown.ids);
+            free(grown.paths);
+            return -1;
+        }
+        for(i = 0; i < c->size; i++)
+        {
+            if(c->paths[i] == NULL)
+                continue;
+            slot = purger_dir_cache_slot(&grown, c->ids[i]);
+            grown.ids[slot] = c->ids[i];
+            grown.paths[slot] = c->paths[i];
+        }
+        free(c->ids);
+        free(c->paths);
+        *c = grown;
+    }
+
+    copy = (char *)malloc(len + 1);
+    if(copy == NULL)
+        return -1;
+    memcpy(copy, path, len);
+    copy[len] = '\0';
+
+    slot = purger_dir_cache_slot(c, id);
+    if(c->paths[slot] != NULL)
+        free(c->paths[slot]);
+    else
+        c->count++;
+    c->ids[slot] = id;
+    c->paths[slot] = copy;
+    return 0;
+}
+
+void
+purger_dir_cache_free(purger_dir_cache_t *c)
+{
+    size_t i = 0;
+
+    for(i = 0; i < c->size; i++)
+        free(c->paths[i]);
+    free(c->ids);
+    free(c->paths);
+    memset(c, 0, sizeof(*c));
+}
+
+/* EOF */
@@ -0,0 +1,45 @@
+#ifndef DIRTABLE_H
+#define DIRTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The directory table. Every directory treewalk lists is stored once,
+ *
+ *     HSET dirs <dir id> <path of the directory>
+ *
+ * and the name of a file record is then a reference to it instead of
+ * the full path:
+ *
+ *     <dir id>/<basename>
+ *
+ * The id is 16 hex digits of a 64 bit FNV-1a hash of the directory's
+ * path, so whichever rank stores a file finds the id of its directory
+ * without asking anyone. A full path always starts with '/' and a
+ * reference never does, so readers can tell them apart record by record.
+ */
+#define PURGER_DIR_TABLE_KEY "dirs"
+#define PURGER_DIR_ID_LEN    16
+
+/* Directories a reader keeps before it forgets them all and starts over. */
+#define PURGER_DIR_CACHE_MAX (1 << 20)
+
+/* Directory paths by id, for readers turning references into paths. */
+typedef struct
+{
+    uint64_t *ids;
+    char    **paths;
+    size_t    size;
+    size_t    count;
+} purger_dir_cache_t;
+
+uint64_t purger_dir_id(const char *dir, size_t len);
+int      purger_dir_ref(const char *path, size_t len, char *buf, size_t size);
+int      purger_dir_ref_parse(const char *name, size_t len, uint64_t *id,
+                              const char **base, size_t *base_len);
+const char *purger_dir_cache_get(purger_dir_cache_t *c, uint64_t id);
+int      purger_dir_cache_put(purger_dir_cache_t *c, uint64_t id, const char *path, size_t len);
+void     purger_dir_cache_free(purger_dir_cache_t *c);
+
+#endif /* DIRTABLE_H */
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "endpoint.h"
+#include "log.h"
+
+/*
+ * Split "spec" into an endpoint. Only a single colon followed by digits is
+ * taken as a port, so bare IPv6 addresses still work. Returns -1 when the
+ * address does not fit.
+ */
+int
+redis_endpoint_parse(const char *spec, int default_port, redis_endpoint_t *ep)
+{
+    const char *colon = strchr(spec, ':');
+    size_t len = strlen(spec);
+    char *end = NULL;
+    long port = 0;
+
+    memset(ep, 0, sizeof(*ep));
+    ep->port = default_port;
+
+    if(strncmp(spec, "unix:", 5) == 0)
+    {
+        spec += 5;
+        len -= 5;
+        ep->unix_socket = 1;
+    }
+    else if(spec[0] == '/')
+    {
+        ep->unix_socket = 1;
+    }
+    else if(colon != NULL && strchr(colon + 1, ':') == NULL && colon[1] != '\0')
+    {
+        errno = 0;
+        port = strtol(colon + 1, &end, 10);
+        if(*end == '\0' && errno == 0 && port > 0 && port < 65536)
+        {
+            ep->port = (int)port;
+            len = colon - spec;
+        }
+    }
+
+    if(len == 0 || len >= sizeof(ep->address))
+        return -1;
+
+    memcpy(ep->address, spec, len);
+    ep->address[len] = '\0';
+    return 0;
+}
+
+/* Ask for "sockbuf" bytes of kernel buffer each way, 0 keeps the default. */
+static void
+redis_endpoint_tune(redisContext *c, int sockbuf)
+{
+    if(sockbuf <= 0 || c == NULL || c->err)
+        return;
+
+    if(setsockopt(c->fd, SOL_SOCKET, SO_SNDBUF, &sockbuf, sizeof(sockbuf)) < 0 ||
+            setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &sockbuf, sizeof(sockbuf)) < 0)
+    {
+        LOG(PURGER_LOG_WARN, "Unable to set redis socket buffers to %d bytes: %s", sockbuf, strerror(errno));
+    }
+}
+
+/* Blocking connection to one entry of a host list. */
+redisContext *
+redis_endpoint_connect(const char *spec, int default_port, int sockbuf)
+{
+    redis_endpoint_t ep;
+    redisContext *c = NULL;
+
+    if(redis_endpoint_parse(spec, default_port, &ep) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to make sense of redis address \"%s\".", spec);
+        return NULL;
+    }
+
+    if(ep.unix_socket)
+        c = redisConnectUnix(ep.address);
+    else
+        c = redisConnect(ep.address, ep.port);
+
+    redis_endpoint_tune(c, sockbuf);
+    return c;
+}
+
+/* Same as redis_endpoint_connect(), for the async API. */
+redisAsyncContext *
+redis_endpoint_connect_async(const char *spec, int default_port, int sockbuf)
+{
+    redis_endpoint_t ep;
+    redisAsyncContext *ac = NULL;
+
+    if(redis_endpoint_parse(spec, default_port, &ep) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to make sense of redis address \"%s\".", spec);
+        return NULL;
+    }
+
+    if(ep.unix_socket)
+        ac = redisAsyncConnectUnix(ep.address);
+    else
+        ac = redisAsyncConnect(ep.address, ep.port);
+
+    if(ac != NULL)
+        redis_endpoint_tune(&ac->c, sockbuf);
+    return ac;
+}
+
+/*
+ * Whether c talks to a node of a Redis Cluster: 1 if so, 0 for a plain
+ * server, -1 when the server did not say.
+ */
+int
+redis_endpoint_is_cluster(redisContext *c)
+{
+    redisReply *reply = redisCommand(c, "INFO cluster");
+    int cluster = -1;
+
+    if(reply == NULL)
+        return -1;
+    if(reply->type == REDIS_REPLY_STRING)
+        cluster = strstr(reply->str, "cluster_enabled:1") != NULL;
+    freeReplyObject(reply);
+    return cluster;
+}
+
+/* EOF */
@@ -0,0 +1,30 @@
+#ifndef ENDPOINT_H
+#define ENDPOINT_H
+
+#include <hiredis.h>
+#include <async.h>
+
+/*
+ * Where a redis server listens. Host lists accept, comma separated and
+ * mixed freely:
+ *
+ *     host            TCP, on the port given with -p
+ *     host:port       TCP
+ *     /path/to/sock   unix socket
+ *     unix:path       unix socket, path may be relative
+ *
+ * Unix sockets skip the loopback TCP stack for servers on the same node.
+ */
+typedef struct
+{
+    char address[256]; /* Host name, or socket path when unix_socket */
+    int  port;
+    int  unix_socket;
+} redis_endpoint_t;
+
+int                redis_endpoint_parse(const char *spec, int default_port, redis_endpoint_t *ep);
+redisContext      *redis_endpoint_connect(const char *spec, int default_port, int sockbuf);
+redisAsyncContext *redis_endpoint_connect_async(const char *spec, int default_port, int sockbuf);
+int                redis_endpoint_is_cluster(redisContext *c);
+
+#endif /* ENDPOINT_H */
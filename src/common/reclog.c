@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "reclog.h"
+
+/* A log being written. The store comes first so it can be cast back. */
+typedef struct
+{
+    purger_store_t store;
+    int            fd;
+    char          *buf;
+    size_t         len;
+    char           path[PATH_MAX];
+} purger_reclog_t;
+
+/* The log of "rank" in "dir". Returns its length like snprintf(). */
+int
+purger_reclog_path(char *buf, size_t size, const char *dir, int rank)
+{
+    return snprintf(buf, size, "%s/treewalk-%d.log", dir, rank);
+}
+
+static int
+purger_reclog_write(int fd, const char *buf, size_t len)
+{
+    ssize_t n = 0;
+
+    while(len > 0)
+    {
+        n = write(fd, buf, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+/* Write out the buffer. Returns -1 with errno set. */
+static int
+purger_reclog_flush(purger_reclog_t *log)
+{
+    if(log->len == 0)
+        return 0;
+    if(purger_reclog_write(log->fd, log->buf, log->len) < 0)
+        return -1;
+    log->len = 0;
+    return 0;
+}
+
+/*
+ * Add a record to a log opened by purger_reclog_open() or
+ * purger_reclog_create(). Returns -1 with errno set on failure.
+ */
+int
+purger_reclog_append(purger_store_t *s, const purger_record_t *r, int flags)
+{
+    purger_reclog_t *log = (purger_reclog_t *)s;
+    size_t len = PURGER_RECORD_HEADER + r->name_len;
+    uint32_t total = 0;
+    char *p = NULL;
+    int i = 0;
+
+    if(PURGER_RECLOG_PREFIX + len > PURGER_RECLOG_BUFFER)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if(log->len + PURGER_RECLOG_PREFIX + len > PURGER_RECLOG_BUFFER && purger_reclog_flush(log) < 0)
+        return -1;
+
+    p = log->buf + log->len;
+    total = (uint32_t)(len + 1);
+    for(i = 0; i < 4; i++)
+        p[i] = (char)((total >> (8 * i)) & 0xff);
+    p[4] = (char)flags;
+    purger_record_pack(p + PURGER_RECLOG_PREFIX, len, r);
+
+    log->len += PURGER_RECLOG_PREFIX + len;
+    return 0;
+}
+
+static int
+purger_reclog_file(purger_store_t *s, const char *path, const struct stat *st,
+                   const char *key, size_t key_len, int expired)
+{
+    purger_record_t r;
+
+    (void)key;
+    (void)key_len;
+
+    r.mtime = st->st_mtime;
+    r.size = st->st_size;
+    r.uid = st->st_uid;
+    r.gid = st->st_gid;
+    r.name = path;
+    r.name_len = strlen(path);
+
+    return purger_reclog_append(s, &r, expired ? PURGER_RECLOG_EXPIRED : 0);
+}
+
+static int
+purger_reclog_close(purger_store_t *s)
+{
+    purger_reclog_t *log = (purger_reclog_t *)s;
+    int status = purger_reclog_flush(log);
+
+    if(close(log->fd) < 0)
+        status = -1;
+    free(log->buf);
+    free(log);
+    return status;
+}
+
+/*
+ * Start the log of "rank" in the directory "dir", replacing one a
+ * previous walk left there. Returns NULL with errno set on failure.
+ */
+purger_store_t *
+purger_reclog_open(const char *dir, int rank)
+{
+    char path[PATH_MAX];
+
+    if(purger_reclog_path(path, sizeof(path), dir, rank) >= (int)sizeof(path))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    return purger_reclog_create(path);
+}
+
+/* Start a log at "path". Returns NULL with errno set on failure. */
+purger_store_t *
+purger_reclog_create(const char *path)
+{
+    purger_reclog_t *log = (purger_reclog_t *)calloc(1, sizeof(purger_reclog_t));
+    int saved = 0;
+
+    if(log == NULL)
+        return NULL;
+
+    if(strlen(path) >= sizeof(log->path))
+    {
+        free(log);
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(log->path, path);
+
+    log->buf = (char *)malloc(PURGER_RECLOG_BUFFER);
+    log->fd = open(log->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(log->buf == NULL || log->fd < 0 ||
+            purger_reclog_write(log->fd, PURGER_RECLOG_MAGIC, PURGER_RECLOG_MAGIC_LEN) < 0)
+    {
+        saved = errno;
+        if(log->fd >= 0)
+            close(log->fd);
+        free(log->buf);
+        free(log);
+        errno = saved;
+        return NULL;
+    }
+
+    log->store.name = "log";
+    log->store.keyed = 0;
+    log->store.dir = NULL;
+    log->store.file = purger_reclog_file;
+    log->store.close = purger_reclog_close;
+    return &log->store;
+}
+
+/* Open a log for reading. Returns -1 if it is not there or not a log. */
+int
+purger_reclog_reader_open(purger_reclog_reader_t *rd, const char *path)
+{
+    char magic[PURGER_RECLOG_MAGIC_LEN];
+    ssize_t n = 0;
+
+    memset(rd, 0, sizeof(*rd));
+    rd->fd = open(path, O_RDONLY);
+    if(rd->fd < 0)
+        return -1;
+
+    n = read(rd->fd, magic, sizeof(magic));
+    if(n != (ssize_t)sizeof(magic) || memcmp(magic, PURGER_RECLOG_MAGIC, sizeof(magic)) != 0)
+    {
+        close(rd->fd);
+        rd->fd = -1;
+        return -1;
+    }
+
+    rd->size = PURGER_RECLOG_READ_BUFFER;
+    rd->buf = (char *)malloc(rd->size);
+    if(rd->buf == NULL)
+    {
+        close(rd->fd);
+        rd->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Carry on reading at "offset", which has to be where a record starts,
+ * as recorded by the index of a run (see runs.h). Returns -1 when the
+ * log ends before it, as it does when cut short.
+ */
+int
+purger_reclog_reader_seek(purger_reclog_reader_t *rd, uint64_t offset)
+{
+    struct stat st;
+
+    if(offset < PURGER_RECLOG_MAGIC_LEN || fstat(rd->fd, &st) < 0)
+        return -1;
+    if(offset > PURGER_RECLOG_MAGIC_LEN && offset >= (uint64_t)st.st_size)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if(lseek(rd->fd, (off_t)offset, SEEK_SET) < 0)
+        return -1;
+
+    rd->len = 0;
+    rd->pos = 0;
+    rd->eof = 0;
+    return 0;
+}
+
+/* Make sure "want" bytes are buffered at rd->pos. Returns 0 at the end. */
+static int
+purger_reclog_fill(purger_reclog_reader_t *rd, size_t want)
+{
+    ssize_t n = 0;
+
+    if(rd->len - rd->pos >= want)
+        return 1;
+
+    memmove(rd->buf, rd->buf + rd->pos, rd->len - rd->pos);
+    rd->len -= rd->pos;
+    rd->pos = 0;
+
+    while(rd->len < want && !rd->eof)
+    {
+        n = read(rd->fd, rd->buf + rd->len, rd->size - rd->len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return -1;
+        if(n == 0)
+            rd->eof = 1;
+        rd->len += (size_t)n;
+    }
+
+    return rd->len >= want;
+}
+
+/*
+ * The next record of the log. r->name points into the reader's buffer
+ * until the next call. Returns 1 for a record, 0 at the end and -1 when
+ * the log is cut short or damaged.
+ */
+int
+purger_reclog_next(purger_reclog_reader_t *rd, purger_record_t *r, int *flags)
+{
+    const unsigned char *p = NULL;
+    uint32_t total = 0;
+    int status = 0;
+
+    status = purger_reclog_fill(rd, PURGER_RECLOG_PREFIX);
+    if(status <= 0)
+        return (status == 0 && rd->len == rd->pos) ? 0 : -1;
+
+    p = (const unsigned char *)rd->buf + rd->pos;
+    total = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    if(total < 1 + PURGER_RECORD_HEADER || 4 + (size_t)total > rd->size)
+        return -1;
+
+    if(purger_reclog_fill(rd, 4 + (size_t)total) <= 0)
+        return -1;
+
+    p = (const unsigned char *)rd->buf + rd->pos;
+    *flags = p[4];
+    if(purger_record_unpack(rd->buf + rd->pos + PURGER_RECLOG_PREFIX, total - 1, r) < 0)
+        return -1;
+
+    rd->pos += 4 + (size_t)total;
+    return 1;
+}
+
+void
+purger_reclog_reader_close(purger_reclog_reader_t *rd)
+{
+    if(rd->fd >= 0)
+        close(rd->fd);
+    free(rd->buf);
+    memset(rd, 0, sizeof(*rd));
+    rd->fd = -1;
+}
+
+/* EOF */
@@ -0,0 +1,51 @@
+#ifndef RECLOG_H
+#define RECLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "record.h"
+#include "store.h"
+
+/*
+ * The record log: a file per rank that a walk appends its files to,
+ * instead of sending them to redis. After an 8 byte magic it is a
+ * sequence of
+ *
+ *     length:4 flags:1 record:length-1
+ *
+ * where the length is little endian and the record is a packed record
+ * (see record.h) holding the full path. Writes go out in large buffered
+ * chunks, so a walk runs at the speed of the metadata it reads.
+ */
+#define PURGER_RECLOG_MAGIC      "PRGRLOG1"
+#define PURGER_RECLOG_MAGIC_LEN  8
+#define PURGER_RECLOG_PREFIX     5
+#define PURGER_RECLOG_BUFFER     (4*1024*1024)
+/* Readers get less, a merge has one per run. */
+#define PURGER_RECLOG_READ_BUFFER (1024*1024)
+
+/* Record flags. */
+#define PURGER_RECLOG_EXPIRED 0x01
+
+typedef struct
+{
+    int     fd;
+    char   *buf;
+    size_t  len;
+    size_t  pos;
+    size_t  size;
+    int     eof;
+} purger_reclog_reader_t;
+
+purger_store_t *purger_reclog_open(const char *dir, int rank);
+purger_store_t *purger_reclog_create(const char *path);
+int  purger_reclog_append(purger_store_t *s, const purger_record_t *r, int flags);
+int  purger_reclog_path(char *buf, size_t size, const char *dir, int rank);
+
+int  purger_reclog_reader_open(purger_reclog_reader_t *rd, const char *path);
+int  purger_reclog_reader_seek(purger_reclog_reader_t *rd, uint64_t offset);
+int  purger_reclog_next(purger_reclog_reader_t *rd, purger_record_t *r, int *flags);
+void purger_reclog_reader_close(purger_reclog_reader_t *rd);
+
+#endif /* RECLOG_H */
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hiredis.h>
+
+#include "record.h"
+
+static void
+purger_record_put(char *p, uint64_t v, int bytes)
+{
+    int i = 0;
+
+    for(i = 0; i < bytes; i++)
+        p[i] = (char)((v >> (8 * i)) & 0xff);
+}
+
+static uint64_t
+purger_record_get(const char *p, int bytes)
+{
+    uint64_t v = 0;
+    int i = 0;
+
+    for(i = 0; i < bytes; i++)
+        v |= (uint64_t)(unsigned char)p[i] << (8 * i);
+
+    return v;
+}
+
+/*
+ * Pack r into buf. Returns the length of the packed record; nothing is
+ * written unless it fits in "size" bytes, so a larger buffer can be tried.
+ */
+size_t
+purger_record_pack(char *buf, size_t size, const purger_record_t *r)
+{
+    size_t len = PURGER_RECORD_HEADER + r->name_len;
+
+    if(len > size)
+        return len;
+
+    buf[0] = PURGER_RECORD_VERSION;
+    purger_record_put(buf + 1, (uint64_t)r->mtime, 8);
+    purger_record_put(buf + 9, r->size, 8);
+    purger_record_put(buf + 17, r->uid, 4);
+    purger_record_put(buf + 21, r->gid, 4);
+    memcpy(buf + PURGER_RECORD_HEADER, r->name, r->name_len);
+
+    return len;
+}
+
+/* Read a packed record. r->name points into buf. Returns -1 when buf is
+ * not a record this version knows. */
+int
+purger_record_unpack(const char *buf, size_t len, purger_record_t *r)
+{
+    if(len < PURGER_RECORD_HEADER || buf[0] != PURGER_RECORD_VERSION)
+        return -1;
+
+    r->mtime = (int64_t)purger_record_get(buf + 1, 8);
+    r->size = purger_record_get(buf + 9, 8);
+    r->uid = (uint32_t)purger_record_get(buf + 17, 4);
+    r->gid = (uint32_t)purger_record_get(buf + 21, 4);
+    r->name = buf + PURGER_RECORD_HEADER;
+    r->name_len = len - PURGER_RECORD_HEADER;
+
+    return 0;
+}
+
+/*
+ * Where the record of "key" lives: the bucket hash's name goes into
+ * "bucket", and the field is the key without its "file:" prefix and the
+ * newline treewalk ends hashed keys with. The bucket is chosen by FNV-1a
+ * over the field, which spreads inode keys as well as name hashes.
+ * Returns the length of the bucket name, or -1.
+ */
+int
+purger_record_bucket(const char *key, size_t len, int digits, char *bucket, size_t bucket_size,
+                     const char **field, size_t *field_len)
+{
+    uint32_t hash = 2166136261u;
+    size_t i = 0;
+    int n = 0;
+
+    if(digits < 1 || digits > PURGER_RECORD_BUCKET_MAX)
+        return -1;
+
+    if(len >= 5 && memcmp(key, "file:", 5) == 0)
+    {
+        key += 5;
+        len -= 5;
+    }
+    if(len > 0 && key[len - 1] == '\n')
+        len--;
+
+    for(i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+
+    n = snprintf(bucket, bucket_size, "bucket:%0*x", digits, (unsigned int)(hash & ((1u << (4 * digits)) - 1)));
+    if(n < 0 || (size_t)n >= bucket_size)
+        return -1;
+
+    *field = key;
+    *field_len = len;
+    return n;
+}
+
+/* The bucket digits of a packed database, 0 for one hash per file, or -1
+ * for a schema this version does not know. */
+int
+purger_record_schema_parse(const char *value)
+{
+    char *end = NULL;
+    long digits = 0;
+
+    if(value == NULL || *value == '\0' || strcmp(value, "hash") == 0)
+        return 0;
+
+    if(strncmp(value, "packed:", 7) != 0)
+        return -1;
+
+    digits = strtol(value + 7, &end, 10);
+    if(*end != '\0' || digits < 1 || digits > PURGER_RECORD_BUCKET_MAX)
+        return -1;
+
+    return (int)digits;
+}
+
+/*
+ * Older treewalks stored every value wrapped in literal double quotes,
+ * newer ones store the raw value. Returns the value without them, with
+ * *len shortened to match.
+ */
+char *
+purger_record_unquote(char *str, size_t *len)
+{
+    if(*len >= 2 && str[0] == '"' && str[*len - 1] == '"')
+    {
+        *len -= 2;
+        return str + 1;
+    }
+
+    return str;
+}
+
+/*
+ * The record in the reply to HMGET <key> PURGER_RECORD_HASH_FIELDS. The
+ * name points into the reply and is not NUL terminated. Returns -1 when
+ * the reply is not for a file record, -2 when some fields are missing.
+ */
+int
+purger_record_hash_decode(const struct redisReply *reply, purger_record_t *r)
+{
+    redisReply **f = reply->element;
+    size_t len = 0;
+    int i = 0;
+
+    if(reply->type != REDIS_REPLY_ARRAY || reply->elements != PURGER_RECORD_HASH_COUNT)
+        return -1;
+    for(i = 0; i < PURGER_RECORD_HASH_COUNT; i++)
+        if(f[i]->type != REDIS_REPLY_STRING)
+            return -2;
+
+    r->name_len = (size_t)f[0]->len;
+    r->name = purger_record_unquote(f[0]->str, &r->name_len);
+    len = (size_t)f[1]->len;
+    r->gid = (uint32_t)strtoul(purger_record_unquote(f[1]->str, &len), NULL, 10);
+    len = (size_t)f[2]->len;
+    r->mtime = strtoll(purger_record_unquote(f[2]->str, &len), NULL, 10);
+    len = (size_t)f[3]->len;
+    r->size = strtoull(purger_record_unquote(f[3]->str, &len), NULL, 10);
+    len = (size_t)f[4]->len;
+    r->uid = (uint32_t)strtoul(purger_record_unquote(f[4]->str, &len), NULL, 10);
+    return 0;
+}
+
+/* EOF */
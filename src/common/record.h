@@ -0,0 +1,62 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The packed file record schema. Instead of one hash per file with a
+ * named field per attribute, a file is one field of a bucket hash:
+ *
+ *     HSET bucket:<n> <key without "file:"> <packed record>
+ *
+ * where the packed record is a version byte, the fixed width attributes
+ * in little endian order and then the path:
+ *
+ *     version:1 mtime:8 size:8 uid:4 gid:4 path:...
+ *
+ * The bucket is picked by hashing the key, so the "mtime" zset still
+ * holds plain keys and readers find the record from the key alone. With
+ * few enough fields per bucket redis keeps each bucket in its compact
+ * small hash encoding, provided hash-max-ziplist-value (listpack on newer
+ * servers) is raised above the longest record.
+ *
+ * Which schema the database holds is kept under PURGER_RECORD_SCHEMA_KEY,
+ * "packed:<digits>" or "hash" (also assumed when the key is missing).
+ */
+#define PURGER_RECORD_VERSION    1
+#define PURGER_RECORD_HEADER     25
+#define PURGER_RECORD_SCHEMA_KEY "PURGER_SCHEMA"
+
+/*
+ * The fields of the hash treewalk writes per file without packing, in
+ * the order purger_record_hash_decode() takes them from an HMGET.
+ */
+#define PURGER_RECORD_HASH_FIELDS "name gid_decimal mtime_decimal size uid_decimal"
+#define PURGER_RECORD_HASH_COUNT  5
+
+/* Buckets are numbered with this many hex digits, 16^digits of them. */
+#define PURGER_RECORD_BUCKET_DIGITS 4
+#define PURGER_RECORD_BUCKET_MAX    7
+
+struct redisReply;
+
+typedef struct
+{
+    int64_t     mtime;
+    uint64_t    size;
+    uint32_t    uid;
+    uint32_t    gid;
+    const char *name; /* Not NUL terminated */
+    size_t      name_len;
+} purger_record_t;
+
+size_t purger_record_pack(char *buf, size_t size, const purger_record_t *r);
+int    purger_record_unpack(const char *buf, size_t len, purger_record_t *r);
+int    purger_record_bucket(const char *key, size_t len, int digits, char *bucket, size_t bucket_size,
+                            const char **field, size_t *field_len);
+int    purger_record_schema_parse(const char *value);
+char  *purger_record_unquote(char *str, size_t *len);
+int    purger_record_hash_decode(const struct redisReply *reply, purger_record_t *r);
+
+#endif /* RECORD_H */
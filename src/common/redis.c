@@ -1,5 +1,19 @@
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
 #include "redis.h"
+#include "ring.h"
+#include "endpoint.h"
+#include "cluster.h"
+#include <adapters/epoll.h>
 
 
 extern redisContext **redis_rank;
@@ -8,80 +22,607 @@ extern redisContext *REDIS;
 extern redisContext *BLOCKING_redis;
 extern redisReply *REPLY;
 extern redisReply *BLOCKING_reply;
-extern int redis_pipeline_size;
 extern int redis_local_pipeline_max;
-extern int * redis_local_sharded_pipeline;
 extern int shard_count;
-int redis_finalize()
+extern redis_pipeline_t redis_pipeline;
+extern redis_pipeline_t *redis_shard_pipeline;
+extern int redis_async_flag;
+extern int redis_socket_buffer;
+
+/* The event loop of the async shard connections, see redis_async_wait(). */
+static int redis_async_epfd = -1;
+/* Where redis_init() connected to, for reconnecting the blocking connection. */
+static const char * redis_host;
+static int redis_port;
+/* Commands run on every reconnected pipeline before anything is sent
+ * again, see redis_reconnect_prelude(). */
+static sds redis_prelude;
+static int redis_prelude_count;
+
+/*
+ * A master of the cluster: its pipelined connection and a blocking one
+ * made on demand. The commands in the pipeline's replay log that come
+ * back redirected are sent again.
+ */
+typedef struct
+{
+    char host[256];
+    int port;
+    redis_pipeline_t pipe;
+    redisContext * blocking;
+} redis_cluster_node_t;
+/* A command to send again once the current drain is over. */
+typedef struct
+{
+    int kind;
+    int slot;
+    char host[256];
+    int port;
+    sds cmd;
+} redis_cluster_redirect_t;
+static redis_cluster_node_t ** redis_cluster_nodes;
+static int redis_cluster_node_count;
+static short redis_cluster_slot_node[REDIS_CLUSTER_SLOTS];
+static redisContext * redis_cluster_control;
+static char redis_cluster_control_host[256];
+static int redis_cluster_stale;
+static double redis_cluster_refreshed;
+static redis_cluster_redirect_t * redis_cluster_redirects;
+static int redis_cluster_redirect_count;
+static int redis_cluster_redirect_size;
+/* Redirects followed, for the log at the end. */
+static long long redis_cluster_moved_total;
+static long long redis_cluster_asked_total;
+
+/* The writer thread and the ring feeding it, see redis_writer_start(). */
+static ring_t redis_writer_ring;
+static pthread_t redis_writer_thread;
+static int (*redis_writer_formatted)(int rank, const char * cmd, size_t len);
+
+static double redis_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+/*
+ * Pipelined contexts are driven by redis_pipeline_pump() instead of
+ * redisGetReply(), so put their sockets in non-blocking mode. Their replies
+ * are only counted, so the reader does not build reply objects.
+ */
+static void redis_pipeline_attach(redis_pipeline_t * p, redisContext * context)
+{
+    p->context = context;
+    if(context == NULL || context->err)
+        return;
+    context->flags &= ~REDIS_BLOCK;
+    fcntl(context->fd,F_SETFL,fcntl(context->fd,F_GETFL) | O_NONBLOCK);
+    redisReaderSetDrain(context->reader,&p->errors);
+}
+/* A pipeline on context, connected to host:port, that keeps what it sends
+ * until it is answered. */
+static void redis_pipeline_setup(redis_pipeline_t * p, redisContext * context, const char * host, int port)
+{
+    memset(p,0,sizeof(*p));
+    p->window = redis_local_pipeline_max;
+    p->host = host;
+    p->port = port;
+    p->replay = sdsempty();
+    p->replay_off = (size_t *) malloc(sizeof(size_t) * REDIS_PIPELINE_REPLAY);
+    redis_pipeline_attach(p,context);
+}
+static void redis_pipeline_free(redis_pipeline_t * p)
+{
+    if(p->context != NULL)
+        redisFree(p->context);
+    p->context = NULL;
+    if(p->replay != NULL)
+        sdsfree(p->replay);
+    p->replay = NULL;
+    free(p->replay_off);
+    p->replay_off = NULL;
+}
+/* Forget the commands that have been answered. */
+static void redis_pipeline_replay_trim(redis_pipeline_t * p)
+{
+    size_t start = 0;
+    if(p->replay_first >= p->received)
+        return;
+    p->replay_first = p->received;
+    if(p->replay_first >= p->sent)
+    {
+        p->replay_base += sdslen(p->replay);
+        sdsclear(p->replay);
+        return;
+    }
+    start = p->replay_off[p->replay_first % REDIS_PIPELINE_REPLAY] - p->replay_base;
+    if(start >= REDIS_PIPELINE_WRITE_CHUNK && start * 2 >= sdslen(p->replay))
+    {
+        sdsrange(p->replay,start,-1);
+        p->replay_base += start;
+    }
+}
+/* Keep the command that was just appended to the output buffer. */
+static void redis_pipeline_keep(redis_pipeline_t * p)
+{
+    sds obuf = p->context->obuf;
+    redis_pipeline_replay_trim(p);
+    p->replay_off[p->sent % REDIS_PIPELINE_REPLAY] = p->replay_base + sdslen(p->replay);
+    p->replay = sdscatlen(p->replay,obuf + p->replay_obuf,sdslen(obuf) - p->replay_obuf);
+    p->replay_obuf = sdslen(obuf);
+}
+/*
+ * The server of p is gone for good. Forget what was in flight and what
+ * was kept to send again, and drop every command sent to p from now on
+ * without buffering it.
+ */
+static void redis_pipeline_give_up(redis_pipeline_t * p)
+{
+    if(p->dead)
+        return;
+    if(p->outstanding > 0)
+        LOG(PURGER_LOG_ERR,"Dropping %d outstanding redis commands.",p->outstanding);
+    LOG(PURGER_LOG_ERR,"Giving up on redis at %s, the commands for it are dropped from now on.",p->host);
+    p->dead = 1;
+    p->outstanding = 0;
+    if(p->replay != NULL)
+        sdsfree(p->replay);
+    p->replay = NULL;
+    free(p->replay_off);
+    p->replay_off = NULL;
+    p->replay_obuf = 0;
+    if(p->context != NULL && !p->async)
+    {
+        sdsfree(p->context->obuf);
+        p->context->obuf = sdsempty();
+        p->context->opos = 0;
+    }
+}
+/*
+ * Connect to host:port again, waiting REDIS_RECONNECT_DELAY before the
+ * first attempt and twice as long before each next one, so a restarting
+ * server gets time to come back. Returns NULL when it does not.
+ */
+static redisContext * redis_reconnect(const char * host, int port, int buffer)
+{
+    redisContext * c = NULL;
+    struct timespec ts;
+    double delay = REDIS_RECONNECT_DELAY;
+    int attempt = 0;
+    for(attempt = 1; attempt <= REDIS_RECONNECT_TRIES; attempt++)
+    {
+        ts.tv_sec = (time_t)delay;
+        ts.tv_nsec = (long)((delay - ts.tv_sec) * 1e9);
+        nanosleep(&ts,NULL);
+        delay = (2 * delay < REDIS_RECONNECT_DELAY_MAX) ? 2 * delay : REDIS_RECONNECT_DELAY_MAX;
+        c = redis_endpoint_connect(host,port,buffer);
+        if(c != NULL && !c->err)
+        {
+            LOG(PURGER_LOG_INFO,"Reconnected to redis at %s after %d attempts.",host,attempt);
+            return c;
+        }
+        LOG(PURGER_LOG_WARN,"Reconnecting to redis at %s failed (attempt %d of %d): %s",
+            host,attempt,REDIS_RECONNECT_TRIES,c ? c->errstr : "bad address");
+        if(c != NULL)
+            redisFree(c);
+    }
+    return NULL;
+}
+/*
+ * The connection of p broke. Reconnect, run the prelude and send every
+ * command that was not answered again, in order. Replies that did arrive
+ * are not asked for twice, the rest may run twice on the server, which
+ * the commands treewalk pipelines do not mind. Returns -1 when the
+ * server does not come back, and the commands are lost.
+ */
+static int redis_pipeline_recover(redis_pipeline_t * p)
 {
+    redisContext * c = NULL;
+    redisReply * reply = NULL;
+    size_t start = 0;
     int i = 0;
-    if(redis_pipeline_size > 0)
+    if(p->replay == NULL || p->host == NULL)
+        return -1;
+    LOG(PURGER_LOG_WARN,"Lost the connection to redis at %s with %d commands in flight, reconnecting.",p->host,p->outstanding);
+    c = redis_reconnect(p->host,p->port,redis_socket_buffer);
+    if(c != NULL && redis_prelude_count > 0)
     {
-        LOG(PURGER_LOG_DBG,"Flushing %d items from pipeline",redis_pipeline_size);
-        for(i = 0; i < redis_pipeline_size; i++)
-            if(redisGetReply(REDIS,(void*)&REPLY) == REDIS_OK)
+        c->obuf = sdscatlen(c->obuf,redis_prelude,sdslen(redis_prelude));
+        for(i = 0; i < redis_prelude_count && c != NULL; i++)
+        {
+            if(redisGetReply(c,(void **)&reply) != REDIS_OK)
             {
-                freeReplyObject(REPLY);
+                LOG(PURGER_LOG_ERR,"Redis at %s went away again: %s",p->host,c->errstr);
+                redisFree(c);
+                c = NULL;
+                break;
             }
+            if(reply->type == REDIS_REPLY_ERROR)
+                LOG(PURGER_LOG_ERR,"Redis replied with an error: %s",reply->str);
+            freeReplyObject(reply);
+        }
+    }
+    if(c == NULL)
+        return -1;
+    redisFree(p->context);
+    if(p == &redis_pipeline)
+        REDIS = c;
+    else if(redis_shard_pipeline != NULL && p >= redis_shard_pipeline && p < redis_shard_pipeline + shard_count)
+        redis_rank[p - redis_shard_pipeline] = c;
+    redis_pipeline_attach(p,c);
+    redis_pipeline_replay_trim(p);
+    if(p->received < p->sent)
+    {
+        start = p->replay_off[p->received % REDIS_PIPELINE_REPLAY] - p->replay_base;
+        c->obuf = sdscatlen(c->obuf,p->replay + start,sdslen(p->replay) - start);
+    }
+    p->replay_obuf = sdslen(c->obuf);
+    p->outstanding = (int)(p->sent - p->received);
+    p->probe_seq = 0;
+    p->errors.count = 0;
+    p->errors.kept = 0;
+    LOG(PURGER_LOG_INFO,"Sending %d unanswered commands to %s again.",p->outstanding,p->host);
+    return 0;
+}
+/*
+ * Every time the probe command's reply arrives we have one round trip
+ * time and the reply rate since the last probe. The window is sized to
+ * twice their product (the commands that fit "in the wire"), so a rank
+ * never waits on a full window unless redis itself is the bottleneck.
+ */
+static void redis_pipeline_sample(redis_pipeline_t * p)
+{
+    double now = redis_now();
+    double rtt = now - p->probe_start;
+    double rate = 0.0;
+    int window = 0;
+
+    if(p->rate_start > 0.0 && now > p->rate_start)
+        rate = (p->received - p->rate_received) / (now - p->rate_start);
+    p->rtt = (p->rtt > 0.0) ? 0.75 * p->rtt + 0.25 * rtt : rtt;
+    p->rate = (p->rate > 0.0) ? 0.75 * p->rate + 0.25 * rate : rate;
+    p->rate_start = now;
+    p->rate_received = p->received;
+    p->probe_seq = 0;
+
+    if(p->rate > 0.0)
+    {
+        window = (int)(2.0 * p->rate * p->rtt);
+        if(window < REDIS_PIPELINE_WINDOW_MIN) window = REDIS_PIPELINE_WINDOW_MIN;
+        if(window > REDIS_PIPELINE_WINDOW_MAX) window = REDIS_PIPELINE_WINDOW_MAX;
+        p->window = window;
     }
-    redisFree(REDIS);
+}
+/* Log the error replies the reader kept since the last call. */
+static void redis_pipeline_log_errors(redis_pipeline_t * p)
+{
+    int i = 0;
+    for(i = 0; i < p->errors.kept; i++)
+        LOG(PURGER_LOG_ERR,"Redis replied with an error: %s",p->errors.str[i]);
+    if(p->errors.count > p->errors.kept)
+        LOG(PURGER_LOG_ERR,"Redis replied with %ld more errors.",p->errors.count - p->errors.kept);
+    p->errors.count = 0;
+    p->errors.kept = 0;
+}
+/*
+ * Consume every reply that is already sitting in the reader. The drain
+ * stops at the probe command so its reply can be timed.
+ */
+static int redis_pipeline_read_replies(redis_pipeline_t * p)
+{
+    int max = 0;
+    int n = 0;
+    while(p->outstanding > 0)
+    {
+        max = p->outstanding;
+        if(p->probe_seq && p->probe_seq - p->received < max)
+            max = (int)(p->probe_seq - p->received);
+        n = redisDrainReplies(p->context,max);
+        if(p->errors.count)
+            redis_pipeline_log_errors(p);
+        if(n < 0)
+            return -1;
+        if(n == 0)
+            break;
+        p->outstanding -= n;
+        p->received += n;
+        if(p->probe_seq && p->received >= p->probe_seq)
+            redis_pipeline_sample(p);
+    }
+    return 0;
+}
+/*
+ * Move data between the pipeline and its socket. With block == 0 only what
+ * can be done without waiting is done. Otherwise this waits until no more
+ * than "target" commands are outstanding and the output buffer is empty.
+ */
+static int redis_pipeline_pump(redis_pipeline_t * p, int block, int target)
+{
+    redisContext * c = p->context;
+    struct pollfd pfd;
+    int wdone = 0;
+    int ready = 0;
+
+again:
+    for(;;)
+    {
+        if(redis_pipeline_read_replies(p) < 0)
+            goto err;
+        wdone = (sdslen(c->obuf) == 0);
+        if(!block && wdone)
+            return 0;
+        if(block && wdone && p->outstanding <= target)
+            return 0;
+
+        pfd.fd = c->fd;
+        pfd.events = POLLIN | (wdone ? 0 : POLLOUT);
+        pfd.revents = 0;
+        ready = poll(&pfd,1,block ? -1 : 0);
+        if(ready < 0)
+            continue;
+        if(ready == 0)
+            return 0;
+        if((pfd.revents & POLLOUT) && redisBufferWrite(c,&wdone) != REDIS_OK)
+            goto err;
+        p->replay_obuf = sdslen(c->obuf);
+        if((pfd.revents & (POLLIN | POLLHUP | POLLERR)) && redisBufferRead(c) != REDIS_OK)
+            goto err;
+    }
+err:
+    redis_print_error(c);
+    if(c->err != REDIS_ERR_PROTOCOL && redis_pipeline_recover(p) == 0)
+    {
+        c = p->context;
+        goto again;
+    }
+    redis_pipeline_give_up(p);
+    return -1;
+}
+/* Called for each reply on an async shard connection, and with a NULL
+ * reply for each command that was dropped with the connection. */
+static void redis_async_reply(redisAsyncContext * ac, void * reply, void * privdata)
+{
+    redis_pipeline_t * p = (redis_pipeline_t *) privdata;
+    (void)ac;
+    if(p->outstanding > 0)
+        p->outstanding--;
+    if(reply == NULL)
+        return;
+    p->received++;
+    if(p->errors.count)
+        redis_pipeline_log_errors(p);
+    if(p->probe_seq && p->received >= p->probe_seq)
+        redis_pipeline_sample(p);
+}
+/* Async shards are not reconnected: one that drops is given up on, and
+ * the commands for it are dropped from then on. */
+static void redis_async_disconnect(const redisAsyncContext * ac, int status)
+{
+    redis_pipeline_t * p = (redis_pipeline_t *) ac->data;
+    p->outstanding = 0;
+    p->async = NULL;
+    p->context = NULL;
+    if(status == REDIS_OK)
+        return;
+    LOG(PURGER_LOG_ERR,"Lost the connection to redis at %s: %s",p->host,ac->errstr);
+    redis_pipeline_give_up(p);
+}
+static void redis_async_connect(const redisAsyncContext * ac, int status)
+{
+    redis_pipeline_t * p = (redis_pipeline_t *) ac->data;
+    if(status == REDIS_OK)
+        return;
+    LOG(PURGER_LOG_ERR,"Unable to connect to redis at %s: %s",p->host,ac->errstr);
+    p->async = NULL;
+    p->context = NULL;
+    redis_pipeline_give_up(p);
+}
+/*
+ * Async shard connections all live in one epoll event loop per rank. The
+ * reader only counts replies, as with the blocking pipelines.
+ */
+static void redis_pipeline_setup_async(redis_pipeline_t * p, redisAsyncContext * ac, const char * host)
+{
+    memset(p,0,sizeof(*p));
+    p->host = host;
+    p->async = ac;
+    p->context = &ac->c;
+    p->window = redis_local_pipeline_max;
+    ac->data = p;
+    redisAsyncSetConnectCallback(ac,redis_async_connect);
+    redisAsyncSetDisconnectCallback(ac,redis_async_disconnect);
+    redisReaderSetDrain(ac->c.reader,&p->errors);
+    redisEpollAttach(redis_async_epfd,ac);
+}
+/*
+ * Run the event loop until p has no more than target commands outstanding.
+ * Every other shard keeps moving meanwhile, so a slow shard only costs its
+ * own latency instead of stalling the rest one after the other.
+ */
+static int redis_async_wait(redis_pipeline_t * p, int target)
+{
+    while(p->async != NULL && p->outstanding > target)
+    {
+        if(redisEpollProcess(redis_async_epfd,-1) < 0 && errno != EINTR)
+        {
+            LOG(PURGER_LOG_ERR,"Waiting on the redis shards failed: %s",strerror(errno));
+            return -1;
+        }
+    }
+    return (p->async != NULL) ? 0 : -1;
+}
+/*
+ * Account for a command that was just appended. Bytes go out once a
+ * reasonable chunk has built up, replies are picked up as they arrive, and
+ * the rank only waits when the window of outstanding commands is full.
+ */
+static int redis_pipeline_append(redis_pipeline_t * p)
+{
+    if(p->dead)
+    {
+        /* The caller checked, but a drain on the way may have given up. */
+        if(p->context != NULL && !p->async)
+            sdsclear(p->context->obuf);
+        return -1;
+    }
+    if(p->replay != NULL)
+        redis_pipeline_keep(p);
+    p->outstanding++;
+    p->sent++;
+    if(p->probe_seq == 0)
+    {
+        p->probe_seq = p->sent;
+        p->probe_start = redis_now();
+    }
+    if(p->outstanding >= p->window)
+    {
+        LOG(PURGER_LOG_DBG,"Pipeline window of %d is full, waiting.",p->window);
+        if(p->async)
+            return redis_async_wait(p,p->window * 3 / 4);
+        return redis_pipeline_pump(p,1,p->window * 3 / 4);
+    }
+    if(sdslen(p->context->obuf) >= REDIS_PIPELINE_WRITE_CHUNK)
+    {
+        /* Between callbacks, move whatever every shard is ready for. */
+        if(p->async)
+            return (redisEpollProcess(redis_async_epfd,0) < 0) ? -1 : 0;
+        return redis_pipeline_pump(p,0,0);
+    }
+    return 0;
+}
+/* Wait for every outstanding reply on a pipeline. */
+int redis_pipeline_drain(redis_pipeline_t * p)
+{
+    if(p->context == NULL || p->context->err)
+        return -1;
+    if(p->outstanding > 0)
+        LOG(PURGER_LOG_DBG,"Flushing %d items from pipeline",p->outstanding);
+    if(p->async)
+        return redis_async_wait(p,0);
+    return redis_pipeline_pump(p,1,0);
+}
+/* How many of the rank's pipelines gave up on their server, and so
+ * dropped commands. */
+int redis_lost()
+{
+    int lost = redis_pipeline.dead;
+    int i = 0;
+    for(i = 0; redis_shard_pipeline != NULL && i < shard_count; i++)
+        lost += redis_shard_pipeline[i].dead;
+    for(i = 0; i < redis_cluster_node_count; i++)
+        lost += redis_cluster_nodes[i]->pipe.dead;
+    return lost;
+}
+int redis_finalize()
+{
+    redis_pipeline_drain(&redis_pipeline);
+    LOG(PURGER_LOG_DBG,"Pipeline window settled at %d (rtt %.1f us, %.0f replies/s).",
+        redis_pipeline.window,redis_pipeline.rtt * 1e6,redis_pipeline.rate);
+    redis_pipeline_free(&redis_pipeline);
+    REDIS = NULL;
     redisFree(BLOCKING_redis);
+    if(redis_prelude != NULL)
+        sdsfree(redis_prelude);
+    redis_prelude = NULL;
+    redis_prelude_count = 0;
+    return 0;
 }
 int redis_shard_finalize()
 {
-    int i = 0, j = 0;
+    int i = 0;
+    /* Async shards drain concurrently: each wait also runs the others. */
+    for(i = 0; i < shard_count; i++)
+        redis_pipeline_drain(&redis_shard_pipeline[i]);
     for(i = 0; i < shard_count; i++)
     {
-        if(redis_local_sharded_pipeline[i] > 0)
+        if(redis_async_flag)
         {
-            LOG(PURGER_LOG_DBG,"Flushing %d items from sharded pipeline %d",i);
-            for(j = 0; j < redis_local_sharded_pipeline[i]; j++)
-                if(redisGetReply(redis_rank[i],(void*)&redis_rank_reply[i]) == REDIS_OK)
-                {
-                    freeReplyObject(redis_rank_reply[i]);
-                }
+            if(redis_shard_pipeline[i].async)
+                redisAsyncFree(redis_shard_pipeline[i].async);
         }
-        redisFree(redis_rank[i]);
+        else
+            redis_pipeline_free(&redis_shard_pipeline[i]);
+    }
+    if(redis_async_epfd >= 0)
+    {
+        close(redis_async_epfd);
+        redis_async_epfd = -1;
     }
+    return 0;
 }
 int redis_shard_init(char * hostnames, int port)
 {
     int i = 0;
     char * host = strtok(hostnames,",");
-    redis_rank = (redisContext **) malloc(sizeof(redisContext**));
+    /* The tokens point into hostnames, which outlives the pipelines. */
+    const char ** hosts = NULL;
+    redisAsyncContext * ac = NULL;
+    redis_rank = NULL;
+    if(redis_async_flag)
+    {
+        redis_async_epfd = epoll_create(16);
+        if(redis_async_epfd < 0)
+        {
+            LOG(PURGER_LOG_FATAL,"Unable to create the redis event loop: %s",strerror(errno));
+            return -1;
+        }
+    }
     while(host != NULL)
     {
         LOG(PURGER_LOG_INFO,"Initializing redis connection to %s",host);
-        redis_rank[i] = (redisContext *) malloc(sizeof(redisContext*));
-        redis_rank[i] = redisConnect(host,port);
-        LOG(PURGER_LOG_INFO,"Initialized redis connection to %s",host);
-        if(redis_rank[i] && redis_rank[i]->err)
+        redis_rank = (redisContext **) realloc(redis_rank,sizeof(redisContext*)*(i+1));
+        hosts = (const char **) realloc(hosts,sizeof(const char *)*(i+1));
+        hosts[i] = host;
+        if(redis_async_flag)
+        {
+            /* A redisAsyncContext starts with its redisContext. */
+            ac = redis_endpoint_connect_async(host,port,redis_socket_buffer);
+            redis_rank[i] = ac ? &ac->c : NULL;
+        }
+        else
+            redis_rank[i] = redis_endpoint_connect(host,port,redis_socket_buffer);
+        if(redis_rank[i] == NULL || redis_rank[i]->err)
         {
-            LOG(PURGER_LOG_FATAL,"Redis server (%s) error: %s",host[i],redis_rank[i]->errstr);
+            LOG(PURGER_LOG_FATAL,"Redis server (%s) error: %s",host,redis_rank[i] ? redis_rank[i]->errstr : "bad address");
+            free(hosts);
             return -1;
         }
+        LOG(PURGER_LOG_INFO,"Initialized redis connection to %s",host);
         i++;
         host = strtok(NULL,",");
     }
     shard_count = i;
-    redis_local_sharded_pipeline = (int *) calloc(i,sizeof(int));
+    redis_shard_pipeline = (redis_pipeline_t *) calloc(i,sizeof(redis_pipeline_t));
     redis_rank_reply = (redisReply**) malloc(sizeof(redisReply*)*i);
     for(i = 0; i < shard_count; i++)
-	redis_local_sharded_pipeline[i] = 0;
+    {
+        if(redis_async_flag)
+            redis_pipeline_setup_async(&redis_shard_pipeline[i],(redisAsyncContext *) redis_rank[i],hosts[i]);
+        else
+            redis_pipeline_setup(&redis_shard_pipeline[i],redis_rank[i],hosts[i],port);
+    }
+    free(hosts);
     LOG(PURGER_LOG_DBG,"Initialized %d redis connections.",shard_count);
     return shard_count;
 }
 int redis_init(char * hostname, int port)
 {
-    redis_pipeline_size = 0;
     redis_local_pipeline_max = rand() % REDIS_PIPELINE_MAX + 1000;
-    REDIS = redisConnect(hostname, port);
-    BLOCKING_redis = redisConnect(hostname, port);
+    /* A write to a dropped connection has to fail, not end the process,
+     * for redis_pipeline_recover() to get a go at it. */
+    signal(SIGPIPE,SIG_IGN);
+    REDIS = redis_endpoint_connect(hostname, port, redis_socket_buffer);
+    BLOCKING_redis = redis_endpoint_connect(hostname, port, 0);
+    if(REDIS == NULL || BLOCKING_redis == NULL)
+        return -1;
     if(REDIS->err || BLOCKING_redis->err)
     {
-        LOG(PURGER_LOG_FATAL, "Redis error: %s", REDIS->errstr);
+        LOG(PURGER_LOG_FATAL, "Redis error: %s", REDIS->err ? REDIS->errstr : BLOCKING_redis->errstr);
         return -1;	    
     }
+    redis_host = hostname;
+    redis_port = port;
+    redis_pipeline_setup(&redis_pipeline,REDIS,hostname,port);
     return 0; 
 }
 void redis_print_error(redisContext * context)
@@ -102,11 +643,38 @@ void redis_print_error(redisContext * context)
 }
 int redis_blocking_command(char * cmd, void * result, returnType ret)
 {
-    BLOCKING_reply = redisCommand(BLOCKING_redis,cmd);
+    redisContext * context = BLOCKING_redis;
+    if(redis_cluster_node_count > 0)
+    {
+        BLOCKING_reply = redis_cluster_blocking_command(cmd,&context);
+        if(BLOCKING_reply == NULL && context == NULL)
+        {
+            LOG(PURGER_LOG_ERR,"Redis command failed: %s",cmd);
+            return -1;
+        }
+    }
+    else
+    {
+        BLOCKING_reply = redisCommand(BLOCKING_redis,cmd);
+        if(BLOCKING_reply == NULL && BLOCKING_redis->err != REDIS_ERR_PROTOCOL && redis_host != NULL)
+        {
+            /* The server went away. The commands sent this way can be
+             * sent twice, so try once more on a new connection. */
+            redis_print_error(BLOCKING_redis);
+            context = redis_reconnect(redis_host,redis_port,0);
+            if(context != NULL)
+            {
+                redisFree(BLOCKING_redis);
+                BLOCKING_redis = context;
+                BLOCKING_reply = redisCommand(BLOCKING_redis,cmd);
+            }
+            context = BLOCKING_redis;
+        }
+    }
     if(BLOCKING_reply == NULL)
     {
 	LOG(PURGER_LOG_ERR,"Redis command failed: %s",cmd);
-        redis_print_error(BLOCKING_redis);
+        redis_print_error(context);
 	return -1; 
     }
     switch(BLOCKING_reply->type)
@@ -133,45 +701,595 @@ int redis_blocking_command(char * cmd, void * result, returnType ret)
 
 int redis_shard_command(int rank, char * cmd)
 {
-    LOG(PURGER_LOG_DBG,"Sending %s to %d. Pipeline has %d commands",cmd,rank,redis_local_sharded_pipeline[rank]);
-    redisAppendCommand(redis_rank[rank],cmd);
-    redis_local_sharded_pipeline[rank] = redis_local_sharded_pipeline[rank]+1;
-    if(redis_local_sharded_pipeline[rank] > REDIS_PIPELINE_MAX)
+    redis_pipeline_t * p = &redis_shard_pipeline[rank];
+    LOG(PURGER_LOG_DBG,"Sending %s to %d. Pipeline has %d commands",cmd,rank,p->outstanding);
+    if(p->context == NULL || p->dead)
+        return -1;
+    if(p->async)
+        redisAsyncCommand(p->async,redis_async_reply,p,cmd);
+    else
+        redisAppendCommand(p->context,cmd);
+    return redis_pipeline_append(p);
+}
+int redis_command(int rank,char * cmd)
+{
+    (void)rank;
+    if(redis_pipeline.dead)
+        return -1;
+    redisAppendCommand(REDIS,cmd);
+    return redis_pipeline_append(&redis_pipeline);
+} 
+/* Same as redis_shard_command, for a command already encoded as RESP. */
+int redis_shard_command_formatted(int rank, const char * cmd, size_t len)
+{
+    redis_pipeline_t * p = &redis_shard_pipeline[rank];
+    if(p->context == NULL || p->dead)
+        return -1;
+    if(p->async)
+        redisAsyncFormattedCommand(p->async,redis_async_reply,p,cmd,len);
+    else
+        redisAppendFormattedCommand(p->context,cmd,len);
+    return redis_pipeline_append(p);
+}
+/* Same as redis_command, for a command already encoded as RESP. */
+int redis_command_formatted(int rank, const char * cmd, size_t len)
+{
+    (void)rank;
+    if(redis_pipeline.dead)
+        return -1;
+    redisAppendFormattedCommand(REDIS,cmd,len);
+    return redis_pipeline_append(&redis_pipeline);
+}
+/* Same as redis_shard_command, rendering a compiled command template. */
+int redis_shard_command_template(int rank, const redisCommandTemplate * t, ...)
+{
+    redis_pipeline_t * p = &redis_shard_pipeline[rank];
+    va_list ap;
+    if(p->context == NULL || p->dead)
+        return -1;
+    va_start(ap,t);
+    if(p->async)
+        redisvAsyncTemplateCommand(p->async,redis_async_reply,p,t,ap);
+    else
+        redisvAppendTemplate(p->context,t,ap);
+    va_end(ap);
+    return redis_pipeline_append(p);
+}
+/* Same as redis_command, rendering a compiled command template. */
+int redis_command_template(int rank, const redisCommandTemplate * t, ...)
+{
+    va_list ap;
+    (void)rank;
+    if(redis_pipeline.dead)
+        return -1;
+    va_start(ap,t);
+    redisvAppendTemplate(REDIS,t,ap);
+    va_end(ap);
+    return redis_pipeline_append(&redis_pipeline);
+}
+/*
+ * Run cmd, already encoded as RESP, first thing on every pipeline that is
+ * reconnected, e.g. to load a script the commands being sent again need.
+ * Call it before the writer thread is started.
+ */
+int redis_reconnect_prelude(const char * cmd, size_t len)
+{
+    if(redis_prelude == NULL)
+        redis_prelude = sdsempty();
+    redis_prelude = sdscatlen(redis_prelude,cmd,len);
+    redis_prelude_count++;
+    return 0;
+}
+/*
+ * Redis Cluster. Every master gets a pipelined connection like a shard,
+ * and each command goes to the master of its key's slot. The slot map
+ * comes from CLUSTER SLOTS. MOVED and ASK replies are caught while the
+ * replies are drained, and the command is taken from the node's replay
+ * log and sent again to where it belongs. A MOVED also updates the slot
+ * and fetches the map again soon after, which picks up resharding and
+ * failovers.
+ */
+static int redis_cluster_on_error(void * privdata, long reply, const char * str, size_t len)
+{
+    redis_cluster_node_t * n = (redis_cluster_node_t *) privdata;
+    redis_cluster_redirect_t * r = NULL;
+    size_t start = 0;
+    size_t end = 0;
+    char host[256];
+    int slot = 0;
+    int port = 0;
+    int kind = redis_cluster_parse_redirect(str,len,&slot,host,sizeof(host),&port);
+    if(kind == REDIS_CLUSTER_NO_REDIRECT || reply < n->pipe.replay_first || reply >= n->pipe.sent)
+        return 0;
+    if(redis_cluster_redirect_count == redis_cluster_redirect_size)
     {
-        LOG(PURGER_LOG_INFO,"Flushing pipeline %d with %d commands.",rank,redis_local_sharded_pipeline[rank]);
-        int i;
-        for(i = 0; i < redis_local_sharded_pipeline[rank]; i++)
-            if(redisGetReply(redis_rank[rank],(void*)&redis_rank_reply[rank]) == REDIS_OK)
-            {
-                freeReplyObject(redis_rank_reply[rank]);
-            }
-            else 
-            {
-                redis_print_error(redis_rank[rank]);
-            }    
-        redis_local_sharded_pipeline[rank] = 0;
+        redis_cluster_redirect_size = redis_cluster_redirect_size ? redis_cluster_redirect_size * 2 : 64;
+        redis_cluster_redirects = (redis_cluster_redirect_t *) realloc(redis_cluster_redirects,
+            sizeof(redis_cluster_redirect_t) * redis_cluster_redirect_size);
     }
+    start = n->pipe.replay_off[reply % REDIS_PIPELINE_REPLAY] - n->pipe.replay_base;
+    end = (reply + 1 < n->pipe.sent) ? n->pipe.replay_off[(reply + 1) % REDIS_PIPELINE_REPLAY] - n->pipe.replay_base : sdslen(n->pipe.replay);
+    r = &redis_cluster_redirects[redis_cluster_redirect_count++];
+    r->kind = kind;
+    r->slot = slot;
+    strcpy(r->host,host);
+    r->port = port;
+    r->cmd = sdsnewlen(n->pipe.replay + start,end - start);
+    return 1;
+}
+/* The node at host:port, connected the first time it is asked for. */
+static redis_cluster_node_t * redis_cluster_node(const char * host, int port)
+{
+    redis_cluster_node_t * n = NULL;
+    redisContext * c = NULL;
+    int i = 0;
+    for(i = 0; i < redis_cluster_node_count; i++)
+        if(redis_cluster_nodes[i]->port == port && strcmp(redis_cluster_nodes[i]->host,host) == 0)
+            return redis_cluster_nodes[i];
+    if(redis_cluster_node_count >= SHRT_MAX)
+        return NULL;
+    c = redis_endpoint_connect(host,port,redis_socket_buffer);
+    if(c == NULL || c->err)
+    {
+        LOG(PURGER_LOG_ERR,"Unable to connect to cluster node %s:%d: %s",host,port,c ? c->errstr : "bad address");
+        if(c != NULL)
+            redisFree(c);
+        return NULL;
+    }
+    LOG(PURGER_LOG_INFO,"Connected to cluster node %s:%d",host,port);
+    n = (redis_cluster_node_t *) calloc(1,sizeof(redis_cluster_node_t));
+    strcpy(n->host,host);
+    n->port = port;
+    redis_pipeline_setup(&n->pipe,c,n->host,n->port);
+    n->pipe.errors.onError = redis_cluster_on_error;
+    n->pipe.errors.privdata = n;
+    redis_cluster_nodes = (redis_cluster_node_t **) realloc(redis_cluster_nodes,sizeof(redis_cluster_node_t *) * (redis_cluster_node_count + 1));
+    redis_cluster_nodes[redis_cluster_node_count++] = n;
+    return n;
+}
+static int redis_cluster_index(redis_cluster_node_t * n)
+{
+    int i = 0;
+    for(i = 0; i < redis_cluster_node_count; i++)
+        if(redis_cluster_nodes[i] == n)
+            return i;
+    return -1;
+}
+/* Fetch the slot map from the control connection, or from any node that
+ * answers when that one is gone. */
+static int redis_cluster_refresh()
+{
+    redis_cluster_range_t * ranges = NULL;
+    redis_cluster_node_t * n = NULL;
+    redisReply * reply = NULL;
+    int count = -1;
+    int i = 0;
+    int slot = 0;
+    for(i = -1; count < 0 && i < redis_cluster_node_count; i++)
+    {
+        if(i >= 0)
+        {
+            if(redis_cluster_control != NULL)
+                redisFree(redis_cluster_control);
+            redis_cluster_control = redis_endpoint_connect(redis_cluster_nodes[i]->host,redis_cluster_nodes[i]->port,0);
+            strcpy(redis_cluster_control_host,redis_cluster_nodes[i]->host);
+        }
+        if(redis_cluster_control == NULL || redis_cluster_control->err)
+            continue;
+        reply = redisCommand(redis_cluster_control,"CLUSTER SLOTS");
+        count = redis_cluster_parse_slots(reply,&ranges);
+        if(reply != NULL)
+            freeReplyObject(reply);
+    }
+    redis_cluster_refreshed = redis_now();
+    redis_cluster_stale = 0;
+    if(count < 0)
+    {
+        LOG(PURGER_LOG_ERR,"Unable to fetch the cluster slot map.");
+        return -1;
+    }
+    for(slot = 0; slot < REDIS_CLUSTER_SLOTS; slot++)
+        redis_cluster_slot_node[slot] = -1;
+    for(i = 0; i < count; i++)
+    {
+        /* An empty host is the node that was asked. */
+        n = redis_cluster_node(ranges[i].host[0] ? ranges[i].host : redis_cluster_control_host,ranges[i].port);
+        if(n == NULL)
+            continue;
+        for(slot = ranges[i].start; slot <= ranges[i].end; slot++)
+            redis_cluster_slot_node[slot] = (short)redis_cluster_index(n);
+    }
+    free(ranges);
+    LOG(PURGER_LOG_DBG,"Cluster slot map has %d ranges on %d nodes.",count,redis_cluster_node_count);
     return 0;
-
 }
-int redis_command(int rank,char * cmd)
+static int redis_cluster_send(redis_cluster_node_t * n, const char * cmd, size_t len)
 {
-
-    redisAppendCommand(REDIS,cmd);
-    if(redis_pipeline_size++ > REDIS_PIPELINE_MAX)
+    if(n->pipe.context == NULL || n->pipe.dead || n->pipe.context->err)
+        return -1;
+    redisAppendFormattedCommand(n->pipe.context,cmd,len);
+    return redis_pipeline_append(&n->pipe);
+}
+/* Send the commands that came back redirected to where they belong now. */
+static void redis_cluster_resend()
+{
+    redis_cluster_redirect_t * batch = NULL;
+    redis_cluster_node_t * n = NULL;
+    int count = 0;
+    int i = 0;
+    while(redis_cluster_redirect_count > 0)
     {
-        LOG(PURGER_LOG_INFO,"Flushing pipeline.");
-        int i;
-        for(i = 0; i < redis_pipeline_size; i++)
-            if(redisGetReply(REDIS,(void*)&REPLY) == REDIS_OK)
+        /* Sending can drain replies and queue up more, so take these out. */
+        batch = redis_cluster_redirects;
+        count = redis_cluster_redirect_count;
+        redis_cluster_redirects = NULL;
+        redis_cluster_redirect_count = 0;
+        redis_cluster_redirect_size = 0;
+        for(i = 0; i < count; i++)
+        {
+            n = redis_cluster_node(batch[i].host,batch[i].port);
+            if(n == NULL)
+                LOG(PURGER_LOG_ERR,"Dropping a command redirected to %s:%d.",batch[i].host,batch[i].port);
+            else if(batch[i].kind == REDIS_CLUSTER_MOVED)
             {
-                freeReplyObject(REPLY);
+                redis_cluster_moved_total++;
+                redis_cluster_slot_node[batch[i].slot] = (short)redis_cluster_index(n);
+                redis_cluster_stale = 1;
+                redis_cluster_send(n,batch[i].cmd,sdslen(batch[i].cmd));
             }
-            else 
+            else
             {
-                redis_print_error(REDIS);
-            }    
-        redis_pipeline_size = 0;
+                /* The slot is being migrated, only this command goes there. */
+                redis_cluster_asked_total++;
+                redis_cluster_send(n,"*1\r\n$6\r\nASKING\r\n",16);
+                redis_cluster_send(n,batch[i].cmd,sdslen(batch[i].cmd));
+            }
+            sdsfree(batch[i].cmd);
+        }
+        free(batch);
+    }
+}
+static redis_cluster_node_t * redis_cluster_route(const char * cmd, size_t len)
+{
+    const char * key = NULL;
+    size_t keylen = 0;
+    unsigned int slot = 0;
+    if(redis_cluster_redirect_count > 0)
+        redis_cluster_resend();
+    if(redis_cluster_stale && redis_now() - redis_cluster_refreshed > REDIS_CLUSTER_REFRESH)
+        redis_cluster_refresh();
+    if(redis_cluster_command_key(cmd,len,&key,&keylen) == 0)
+        slot = redis_cluster_keyslot(key,keylen);
+    if(redis_cluster_slot_node[slot] < 0)
+    {
+        LOG(PURGER_LOG_ERR,"No cluster node serves slot %u.",slot);
+        return NULL;
+    }
+    return redis_cluster_nodes[redis_cluster_slot_node[slot]];
+}
+/*
+ * Blocking command for the node of cmd's key, following redirects. When
+ * NULL is returned, *context has the error if there was a connection.
+ */
+redisReply * redis_cluster_blocking_command(char * cmd, redisContext ** context)
+{
+    redis_cluster_node_t * n = NULL;
+    redisReply * reply = NULL;
+    char * buf = NULL;
+    char host[256];
+    int len = redisFormatCommand(&buf,cmd);
+    int kind = 0;
+    int slot = 0;
+    int port = 0;
+    int asking = 0;
+    int hops = 0;
+    *context = NULL;
+    if(len < 0)
+        return NULL;
+    n = redis_cluster_route(buf,len);
+    for(hops = 0; n != NULL && hops < REDIS_CLUSTER_HOPS; hops++)
+    {
+        if(n->blocking == NULL)
+            n->blocking = redis_endpoint_connect(n->host,n->port,0);
+        *context = n->blocking;
+        if(n->blocking == NULL || n->blocking->err)
+            break;
+        if(asking)
+            redisAppendCommand(n->blocking,"ASKING");
+        redisAppendFormattedCommand(n->blocking,buf,len);
+        if(asking && redisGetReply(n->blocking,(void **)&reply) == REDIS_OK)
+            freeReplyObject(reply);
+        reply = NULL;
+        if(redisGetReply(n->blocking,(void **)&reply) != REDIS_OK)
+            break;
+        kind = (reply->type == REDIS_REPLY_ERROR) ?
+            redis_cluster_parse_redirect(reply->str,reply->len,&slot,host,sizeof(host),&port) : REDIS_CLUSTER_NO_REDIRECT;
+        if(kind == REDIS_CLUSTER_NO_REDIRECT)
+            break;
+        freeReplyObject(reply);
+        reply = NULL;
+        n = redis_cluster_node(host,port);
+        asking = (kind == REDIS_CLUSTER_ASK);
+        if(asking)
+            redis_cluster_asked_total++;
+        else
+            redis_cluster_moved_total++;
+        if(kind == REDIS_CLUSTER_MOVED && n != NULL)
+        {
+            redis_cluster_slot_node[slot] = (short)redis_cluster_index(n);
+            redis_cluster_stale = 1;
+        }
+    }
+    free(buf);
+    return reply;
+}
+/*
+ * Talk to the Redis Cluster that "seed" belongs to. Takes the place of
+ * redis_shard_init(), but the rank argument of the redis_cluster_command
+ * functions is ignored since the key decides.
+ */
+int redis_cluster_init(char * seed, int port)
+{
+    redis_endpoint_t ep;
+    int slot = 0;
+    if(redis_local_pipeline_max == 0)
+        redis_local_pipeline_max = rand() % REDIS_PIPELINE_MAX + 1000;
+    if(redis_async_flag)
+        LOG(PURGER_LOG_WARN,"Cluster mode uses blocking pipelines, ignoring the event loop.");
+    for(slot = 0; slot < REDIS_CLUSTER_SLOTS; slot++)
+        redis_cluster_slot_node[slot] = -1;
+    if(redis_endpoint_parse(seed,port,&ep) == 0)
+        strcpy(redis_cluster_control_host,ep.address);
+    redis_cluster_control = redis_endpoint_connect(seed,port,0);
+    if(redis_cluster_control == NULL || redis_cluster_control->err)
+    {
+        LOG(PURGER_LOG_FATAL,"Unable to reach cluster node %s.",seed);
+        return -1;
+    }
+    if(redis_cluster_refresh() < 0 || redis_cluster_node_count == 0)
+        return -1;
+    LOG(PURGER_LOG_INFO,"Connected to a cluster of %d masters.",redis_cluster_node_count);
+    return redis_cluster_node_count;
+}
+/* Wait for every node's replies, sending redirected commands again until
+ * nothing comes back redirected. */
+int redis_cluster_drain()
+{
+    int status = 0;
+    int round = 0;
+    int i = 0;
+    for(round = 0; round < REDIS_CLUSTER_HOPS; round++)
+    {
+        redis_cluster_resend();
+        status = 0;
+        for(i = 0; i < redis_cluster_node_count; i++)
+            if(redis_cluster_nodes[i]->pipe.context != NULL && redis_pipeline_drain(&redis_cluster_nodes[i]->pipe) < 0)
+                status = -1;
+        if(redis_cluster_redirect_count == 0)
+            return status;
+    }
+    LOG(PURGER_LOG_ERR,"Commands kept being redirected, giving up on %d.",redis_cluster_redirect_count);
+    return -1;
+}
+int redis_cluster_finalize()
+{
+    redis_cluster_node_t * n = NULL;
+    int status = redis_cluster_drain();
+    int i = 0;
+    LOG(PURGER_LOG_INFO,"Followed %lld MOVED and %lld ASK redirects.",redis_cluster_moved_total,redis_cluster_asked_total);
+    for(i = 0; i < redis_cluster_node_count; i++)
+    {
+        n = redis_cluster_nodes[i];
+        redis_pipeline_free(&n->pipe);
+        if(n->blocking != NULL)
+            redisFree(n->blocking);
+        free(n);
     }
+    free(redis_cluster_nodes);
+    redis_cluster_nodes = NULL;
+    redis_cluster_node_count = 0;
+    if(redis_cluster_control != NULL)
+        redisFree(redis_cluster_control);
+    redis_cluster_control = NULL;
+    return status;
+}
+/* Same as redis_command, for a command already encoded as RESP. */
+int redis_cluster_command_formatted(int rank, const char * cmd, size_t len)
+{
+    redis_cluster_node_t * n = redis_cluster_route(cmd,len);
+    (void)rank;
+    if(n == NULL)
+        return -1;
+    return redis_cluster_send(n,cmd,len);
+}
+int redis_cluster_command(int rank, char * cmd)
+{
+    char * buf = NULL;
+    int len = redisFormatCommand(&buf,cmd);
+    int status = -1;
+    if(len < 0)
+        return -1;
+    status = redis_cluster_command_formatted(rank,buf,len);
+    free(buf);
+    return status;
+}
+/* Same as redis_command_template. The command is rendered before it is
+ * sent to find its key, into a buffer that is kept around. */
+int redis_cluster_command_template(int rank, const redisCommandTemplate * t, ...)
+{
+    static char * buf;
+    static size_t size;
+    va_list ap;
+    va_list retry;
+    long len = 0;
+    va_start(ap,t);
+    va_copy(retry,ap);
+    len = redisvFormatTemplateBuf(buf,size,t,ap);
+    if(len >= 0 && (size_t)len > size)
+    {
+        buf = (char *) realloc(buf,len);
+        size = len;
+        redisvFormatTemplateBuf(buf,size,t,retry);
+    }
+    va_end(retry);
+    va_end(ap);
+    if(len < 0)
+        return -1;
+    return redis_cluster_command_formatted(rank,buf,len);
+}
+/*
+ * Push out whatever the writer's pipelines have buffered and take in the
+ * replies that are there, without waiting on anything.
+ */
+static void redis_writer_poll(void)
+{
+    redis_pipeline_t * p = NULL;
+    int i = 0;
+    if(redis_cluster_node_count > 0)
+    {
+        for(i = 0; i < redis_cluster_node_count; i++)
+            if(redis_cluster_nodes[i]->pipe.context != NULL && !redis_cluster_nodes[i]->pipe.context->err)
+                redis_pipeline_pump(&redis_cluster_nodes[i]->pipe,0,0);
+        redis_cluster_resend();
+        return;
+    }
+    if(redis_shard_pipeline != NULL && redis_async_flag)
+    {
+        redisEpollProcess(redis_async_epfd,0);
+        return;
+    }
+    for(i = 0; i < (redis_shard_pipeline != NULL ? shard_count : 1); i++)
+    {
+        p = (redis_shard_pipeline != NULL) ? &redis_shard_pipeline[i] : &redis_pipeline;
+        if(p->context != NULL && !p->context->err)
+            redis_pipeline_pump(p,0,0);
+    }
+}
+static void * redis_writer_main(void * arg)
+{
+    ring_t * r = &redis_writer_ring;
+    char * cmd = NULL;
+    size_t len = 0;
+    int rank = 0;
+    int spins = 0;
+    int closed = 0;
+    int i = 0;
+    (void)arg;
+    for(;;)
+    {
+        closed = ring_is_closed(r);
+        cmd = ring_read(r,&rank,&len);
+        if(cmd != NULL)
+        {
+            (*redis_writer_formatted)(rank,cmd,len);
+            ring_read_done(r);
+            spins = 0;
+            continue;
+        }
+        if(closed)
+            break;
+        /* Caught up with the walker: get the batch on the wire meanwhile. */
+        if(spins == 0)
+            redis_writer_poll();
+        ring_backoff(&spins);
+    }
+    if(redis_cluster_node_count > 0)
+        redis_cluster_drain();
+    else if(redis_shard_pipeline == NULL)
+        redis_pipeline_drain(&redis_pipeline);
+    for(i = 0; redis_shard_pipeline != NULL && i < shard_count; i++)
+        redis_pipeline_drain(&redis_shard_pipeline[i]);
+    return NULL;
+}
+/*
+ * Hand the pipelined connections over to a writer thread. From here until
+ * redis_writer_stop() the caller queues commands with redis_writer_command()
+ * and redis_writer_command_template() only, and may still use the blocking
+ * connection. Commands go to the cluster or the shards when
+ * redis_cluster_init() or redis_shard_init() was called.
+ */
+int redis_writer_start(size_t ring_size)
+{
+    if(redis_cluster_node_count > 0)
+        redis_writer_formatted = &redis_cluster_command_formatted;
+    else if(redis_shard_pipeline != NULL)
+        redis_writer_formatted = &redis_shard_command_formatted;
+    else
+        redis_writer_formatted = &redis_command_formatted;
+    if(ring_init(&redis_writer_ring,ring_size) < 0)
+    {
+        LOG(PURGER_LOG_FATAL,"Unable to allocate the redis writer ring.");
+        return -1;
+    }
+    if(pthread_create(&redis_writer_thread,NULL,redis_writer_main,NULL) != 0)
+    {
+        LOG(PURGER_LOG_FATAL,"Unable to start the redis writer thread.");
+        ring_free(&redis_writer_ring);
+        return -1;
+    }
+    LOG(PURGER_LOG_DBG,"Started the redis writer with a %zu byte ring.",redis_writer_ring.size);
     return 0;
-} 
+}
+/* Wait for the writer to send everything queued and collect the replies. */
+int redis_writer_stop()
+{
+    ring_close(&redis_writer_ring);
+    pthread_join(redis_writer_thread,NULL);
+    if(redis_writer_ring.full_waits)
+        LOG(PURGER_LOG_INFO,"Redis writer fell behind %ld times.",redis_writer_ring.full_waits);
+    ring_free(&redis_writer_ring);
+    return 0;
+}
+/* Queue a command for the writer thread, same arguments as redis_command(). */
+int redis_writer_command(int rank, char * cmd)
+{
+    char * buf = NULL;
+    int len = redisFormatCommand(&buf,cmd);
+    int status = -1;
+    if(len < 0)
+        return -1;
+    status = ring_write(&redis_writer_ring,rank,buf,len);
+    if(status < 0)
+        LOG(PURGER_LOG_ERR,"Command of %d bytes does not fit the redis writer ring.",len);
+    free(buf);
+    return status;
+}
+/* Queue a command already encoded as RESP for the writer thread. */
+int redis_writer_command_formatted(int rank, const char * cmd, size_t len)
+{
+    if(ring_write(&redis_writer_ring,rank,cmd,len) < 0)
+    {
+        LOG(PURGER_LOG_ERR,"Command of %zu bytes does not fit the redis writer ring.",len);
+        return -1;
+    }
+    return 0;
+}
+/* Queue a command for the writer thread, rendering the template straight
+ * into the ring. */
+int redis_writer_command_template(int rank, const redisCommandTemplate * t, ...)
+{
+    ring_t * r = &redis_writer_ring;
+    size_t room = 0;
+    char * buf = ring_write_begin(r,&room);
+    long len = 0;
+    va_list ap;
+    va_list retry;
+    va_start(ap,t);
+    va_copy(retry,ap);
+    len = redisvFormatTemplateBuf(buf,room,t,ap);
+    if(len >= 0 && (size_t)len > room)
+    {
+        buf = ring_write_reserve(r,len);
+        if(buf != NULL)
+            redisvFormatTemplateBuf(buf,len,t,retry);
+    }
+    va_end(retry);
+    va_end(ap);
+    if(len < 0 || buf == NULL)
+    {
+        LOG(PURGER_LOG_ERR,"Unable to queue a templated redis command of %ld bytes.",len);
+        return -1;
+    }
+    ring_write_commit(r,rank,len);
+    return 0;
+}
@@ -1,25 +1,100 @@
 #ifndef REDIS_H
 #define REDIS_H
 #include <hiredis.h>
+#include <async.h>
+#include <sds.h>
 #include "log.h"
 #define REDIS_PIPELINE_MAX 1000
+/* Bounds on the adaptive window of outstanding pipelined commands. */
+#define REDIS_PIPELINE_WINDOW_MIN 64
+#define REDIS_PIPELINE_WINDOW_MAX 65536
+/* Buffered command bytes that trigger a non-blocking write. */
+#define REDIS_PIPELINE_WRITE_CHUNK (16*1024)
+/* Commands in flight per pipeline that can be sent again after a redirect
+ * or a reconnect (more than a window holds). */
+#define REDIS_PIPELINE_REPLAY (128*1024)
+/* Attempts at reconnecting a lost connection, and the first and longest
+ * wait before one, in seconds. The wait doubles every time. The tests
+ * build with shorter ones. */
+#ifndef REDIS_RECONNECT_TRIES
+#define REDIS_RECONNECT_TRIES 10
+#endif
+#ifndef REDIS_RECONNECT_DELAY
+#define REDIS_RECONNECT_DELAY 0.1
+#endif
+#ifndef REDIS_RECONNECT_DELAY_MAX
+#define REDIS_RECONNECT_DELAY_MAX 5.0
+#endif
+/* How long to wait before fetching a changed slot map again, and how many
+ * redirects one command may take. */
+#define REDIS_CLUSTER_REFRESH 1.0
+#define REDIS_CLUSTER_HOPS 16
+/* Default size of the ring feeding the writer thread. */
+#define REDIS_WRITER_RING (8*1024*1024)
 typedef enum { INT, CHAR } returnType;
+/* A pipelined connection: commands in flight, the measurements that size
+ * its window and, unless it is async, the commands not answered yet. */
+typedef struct
+{
+    redisContext * context;
+    redisAsyncContext * async; /* Set when context belongs to an async connection */
+    const char * host;   /* Where to reconnect to */
+    int port;
+    sds replay;          /* Commands in flight, oldest first */
+    size_t replay_base;  /* Stream offset of replay[0] */
+    size_t * replay_off; /* Stream offset of command #seq at seq % REDIS_PIPELINE_REPLAY */
+    long replay_first;   /* Oldest command still in replay */
+    size_t replay_obuf;  /* Bytes at the start of context->obuf already in replay */
+    int outstanding;
+    int window;
+    long sent;
+    long received;
+    long probe_seq;
+    double probe_start;
+    double rate_start;
+    long rate_received;
+    double rtt;
+    double rate;
+    redisDrainErrors errors;
+    int dead;            /* Gave up on its server, commands are dropped */
+} redis_pipeline_t;
 redisContext *REDIS;
 redisReply *REPLY;
 redisContext *BLOCKING_redis;
 redisReply *BLOCKING_reply;
 redisContext **redis_rank;
 redisReply **redis_rank_reply;
-int * redis_local_sharded_pipeline;
+redis_pipeline_t redis_pipeline;
+redis_pipeline_t * redis_shard_pipeline;
 int shard_count;
-int redis_pipeline_size;
+int redis_async_flag;
+int redis_socket_buffer;
 int redis_local_pipeline_max;
 int redis_init(char * hostname, int port);
 int redis_shard_init(char * hostnames, int port);
 void redis_print_error(redisContext * context);
 int redis_command(int rank,char * cmd);
 int redis_shard_command(int rank, char * cmd);
+int redis_command_formatted(int rank, const char * cmd, size_t len);
+int redis_shard_command_formatted(int rank, const char * cmd, size_t len);
+int redis_command_template(int rank, const redisCommandTemplate * t, ...);
+int redis_shard_command_template(int rank, const redisCommandTemplate * t, ...);
 int redis_blocking_command(char * cmd, void * result, returnType ret);
+int redis_pipeline_drain(redis_pipeline_t * p);
+int redis_lost();
+int redis_reconnect_prelude(const char * cmd, size_t len);
+int redis_cluster_init(char * seed, int port);
+int redis_cluster_command(int rank, char * cmd);
+int redis_cluster_command_formatted(int rank, const char * cmd, size_t len);
+int redis_cluster_command_template(int rank, const redisCommandTemplate * t, ...);
+redisReply * redis_cluster_blocking_command(char * cmd, redisContext ** context);
+int redis_cluster_drain();
+int redis_cluster_finalize();
+int redis_writer_start(size_t ring_size);
+int redis_writer_stop();
+int redis_writer_command(int rank, char * cmd);
+int redis_writer_command_formatted(int rank, const char * cmd, size_t len);
+int redis_writer_command_template(int rank, const redisCommandTemplate * t, ...);
 int redis_finalize();
 int redis_shard_finalize();
 #endif
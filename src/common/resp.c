@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "resp.h"
+
+/* Make room for at least "need" more bytes. */
+static int
+resp_reserve(resp_buf_t *b, size_t need)
+{
+    size_t size = b->size ? b->size : 4096;
+    char *buf = NULL;
+
+    if(b->len + need <= b->size)
+        return 0;
+
+    while(size < b->len + need)
+        size *= 2;
+
+    buf = (char *)realloc(b->buf, size);
+    if(buf == NULL)
+        return -1;
+
+    b->buf = buf;
+    b->size = size;
+    return 0;
+}
+
+/* Write the decimal form of "value" to "out", returning its length. */
+static int
+resp_ll2str(char *out, long long value)
+{
+    char tmp[24];
+    unsigned long long v = (value < 0) ? -(unsigned long long)value : (unsigned long long)value;
+    int len = 0;
+    int i = 0;
+
+    do
+    {
+        tmp[len++] = (char)('0' + (v % 10));
+        v /= 10;
+    } while(v);
+
+    if(value < 0)
+        tmp[len++] = '-';
+
+    for(i = 0; i < len; i++)
+        out[i] = tmp[len - i - 1];
+
+    return len;
+}
+
+/* "<type><value>\r\n", used for both array and bulk headers. */
+static int
+resp_header(resp_buf_t *b, char type, long long value)
+{
+    if(resp_reserve(b, 24) < 0)
+        return -1;
+
+    b->buf[b->len++] = type;
+    b->len += resp_ll2str(b->buf + b->len, value);
+    b->buf[b->len++] = '\r';
+    b->buf[b->len++] = '\n';
+    return 0;
+}
+
+void
+resp_reset(resp_buf_t *b)
+{
+    b->len = 0;
+}
+
+void
+resp_free(resp_buf_t *b)
+{
+    free(b->buf);
+    b->buf = NULL;
+    b->len = b->size = 0;
+}
+
+int
+resp_array(resp_buf_t *b, long count)
+{
+    return resp_header(b, '*', count);
+}
+
+/* A binary safe argument; spaces and quotes need no escaping. */
+int
+resp_bulk(resp_buf_t *b, const char *str, size_t len)
+{
+    if(resp_header(b, '$', (long long)len) < 0 || resp_reserve(b, len + 2) < 0)
+        return -1;
+
+    memcpy(b->buf + b->len, str, len);
+    b->len += len;
+    b->buf[b->len++] = '\r';
+    b->buf[b->len++] = '\n';
+    return 0;
+}
+
+int
+resp_bulk_str(resp_buf_t *b, const char *str)
+{
+    return resp_bulk(b, str, strlen(str));
+}
+
+int
+resp_bulk_long(resp_buf_t *b, long long value)
+{
+    char num[24];
+    return resp_bulk(b, num, resp_ll2str(num, value));
+}
+
+/* Bytes that are already encoded, such as arguments built up in another
+ * buffer before their count was known. */
+int
+resp_raw(resp_buf_t *b, const char *data, size_t len)
+{
+    if(resp_reserve(b, len) < 0)
+        return -1;
+
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+/* EOF */
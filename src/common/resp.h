@@ -0,0 +1,26 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <stddef.h>
+
+/*
+ * A reusable output buffer that commands are encoded into directly in the
+ * redis protocol (RESP), so nothing has to be printf'd and re-parsed by
+ * hiredis. The buffer only grows; resp_reset() keeps the memory around.
+ */
+typedef struct
+{
+    char   *buf;
+    size_t  len;
+    size_t  size;
+} resp_buf_t;
+
+void resp_reset(resp_buf_t *b);
+void resp_free(resp_buf_t *b);
+int  resp_array(resp_buf_t *b, long count);
+int  resp_bulk(resp_buf_t *b, const char *str, size_t len);
+int  resp_bulk_str(resp_buf_t *b, const char *str);
+int  resp_bulk_long(resp_buf_t *b, long long value);
+int  resp_raw(resp_buf_t *b, const char *data, size_t len);
+
+#endif /* RESP_H */
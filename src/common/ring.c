@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#include "ring.h"
+
+/* Every record starts on an 8 byte boundary with this header. */
+typedef struct
+{
+    uint32_t len;
+    int32_t  tag;
+} ring_record_t;
+
+/* A header with this length sends the reader back to the start. */
+#define RING_SKIP ((uint32_t)-1)
+#define RING_ALIGN(n) (((n) + 7) & ~(size_t)7)
+#define RING_RECORD(len) (sizeof(ring_record_t) + RING_ALIGN(len))
+
+int
+ring_init(ring_t *r, size_t size)
+{
+    size_t pow2 = 4096;
+
+    while(pow2 < size)
+        pow2 *= 2;
+
+    memset(r, 0, sizeof(*r));
+    r->buf = (char *)malloc(pow2);
+    if(r->buf == NULL)
+        return -1;
+
+    r->size = pow2;
+    r->mask = pow2 - 1;
+    return 0;
+}
+
+void
+ring_free(ring_t *r)
+{
+    free(r->buf);
+    r->buf = NULL;
+}
+
+/*
+ * Spin briefly, then yield, then sleep. Used by both sides while the
+ * other one catches up.
+ */
+void
+ring_backoff(int *spins)
+{
+    struct timespec pause = { 0, 50000 };
+
+    if(*spins < 64)
+        __asm__ __volatile__("" ::: "memory");
+    else if(*spins < 128)
+        sched_yield();
+    else
+        nanosleep(&pause, NULL);
+
+    (*spins)++;
+}
+
+/* Free bytes as far as the producer knows, looking again if short. */
+static size_t
+ring_write_free(ring_t *r, size_t need)
+{
+    size_t space = r->size - (r->head - r->tail_seen);
+
+    if(space < need)
+    {
+        r->tail_seen = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        space = r->size - (r->head - r->tail_seen);
+    }
+
+    return space;
+}
+
+/*
+ * Where the next record's payload goes, and how much of it fits there
+ * without waiting. Never blocks, "room" may be 0.
+ */
+char *
+ring_write_begin(ring_t *r, size_t *room)
+{
+    size_t offset = r->head & r->mask;
+    size_t space = ring_write_free(r, r->size - offset);
+
+    if(space > r->size - offset)
+        space = r->size - offset;
+
+    *room = (space > sizeof(ring_record_t)) ? (space - sizeof(ring_record_t)) & ~(size_t)7 : 0;
+    return r->buf + offset + sizeof(ring_record_t);
+}
+
+/*
+ * Wait until a record of "len" payload bytes fits in one piece and return
+ * where its payload goes. Returns NULL when it could never fit.
+ */
+char *
+ring_write_reserve(ring_t *r, size_t len)
+{
+    size_t need = RING_RECORD(len);
+    size_t offset = r->head & r->mask;
+    size_t to_end = r->size - offset;
+    int spins = 0;
+    ring_record_t *rec = NULL;
+
+    if(need > r->size || len >= RING_SKIP)
+        return NULL;
+
+    if(ring_write_free(r, need) < need)
+        r->full_waits++;
+
+    if(to_end < need)
+    {
+        /* Give up the rest of the buffer and start over at the front. */
+        while(ring_write_free(r, to_end) < to_end)
+            ring_backoff(&spins);
+
+        rec = (ring_record_t *)(r->buf + offset);
+        rec->len = RING_SKIP;
+        __atomic_store_n(&r->head, r->head + to_end, __ATOMIC_RELEASE);
+    }
+
+    while(ring_write_free(r, need) < need)
+        ring_backoff(&spins);
+
+    return r->buf + (r->head & r->mask) + sizeof(ring_record_t);
+}
+
+/* Publish the record whose payload was written after ring_write_begin()
+ * or ring_write_reserve(). */
+void
+ring_write_commit(ring_t *r, int tag, size_t len)
+{
+    ring_record_t *rec = (ring_record_t *)(r->buf + (r->head & r->mask));
+
+    rec->len = (uint32_t)len;
+    rec->tag = tag;
+    __atomic_store_n(&r->head, r->head + RING_RECORD(len), __ATOMIC_RELEASE);
+}
+
+/* Copy a ready made record in. */
+int
+ring_write(ring_t *r, int tag, const char *data, size_t len)
+{
+    size_t room = 0;
+    char *buf = ring_write_begin(r, &room);
+
+    if(room < len)
+        buf = ring_write_reserve(r, len);
+    if(buf == NULL)
+        return -1;
+
+    memcpy(buf, data, len);
+    ring_write_commit(r, tag, len);
+    return 0;
+}
+
+/* No more records will follow the ones already written. */
+void
+ring_close(ring_t *r)
+{
+    __atomic_store_n(&r->closed, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * The oldest record, or NULL when the ring is empty. The payload stays
+ * valid until ring_read_done().
+ */
+char *
+ring_read(ring_t *r, int *tag, size_t *len)
+{
+    ring_record_t *rec = NULL;
+
+    for(;;)
+    {
+        if(r->tail == r->head_seen)
+        {
+            r->head_seen = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+            if(r->tail == r->head_seen)
+                return NULL;
+        }
+
+        rec = (ring_record_t *)(r->buf + (r->tail & r->mask));
+        if(rec->len != RING_SKIP)
+            break;
+
+        __atomic_store_n(&r->tail, r->tail + (r->size - (r->tail & r->mask)), __ATOMIC_RELEASE);
+    }
+
+    *tag = rec->tag;
+    *len = rec->len;
+    r->current = RING_RECORD(rec->len);
+    return (char *)(rec + 1);
+}
+
+void
+ring_read_done(ring_t *r)
+{
+    __atomic_store_n(&r->tail, r->tail + r->current, __ATOMIC_RELEASE);
+    r->current = 0;
+}
+
+/*
+ * Check this before a ring_read() that comes back empty: once the ring is
+ * closed, an empty read means everything has been consumed.
+ */
+int
+ring_is_closed(ring_t *r)
+{
+    return __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE);
+}
+
+/* EOF */
@@ -0,0 +1,60 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A bounded single-producer/single-consumer queue of variable length
+ * records, used to hand encoded commands from a walker to its writer
+ * thread. Neither side takes a lock: each owns one index and publishes it
+ * with a release store. A full ring makes the producer wait, which is the
+ * backpressure when the consumer falls behind.
+ *
+ * Records never wrap. The producer writes straight into the ring:
+ *
+ *     buf = ring_write_begin(r, &room);   (room may be too small)
+ *     buf = ring_write_reserve(r, len);   (waits until len fits)
+ *     ring_write_commit(r, tag, len);
+ *
+ * and the consumer reads in place with ring_read() / ring_read_done().
+ */
+#define RING_CACHE_LINE 64
+
+typedef struct
+{
+    char   *buf;
+    size_t  size;      /* Power of two */
+    size_t  mask;
+
+    /* Producer side */
+    size_t  head;      /* Bytes ever published */
+    size_t  tail_seen; /* Producer's last look at tail */
+    long    full_waits;
+    char    pad0[RING_CACHE_LINE];
+
+    /* Consumer side */
+    size_t  tail;      /* Bytes ever consumed */
+    size_t  head_seen; /* Consumer's last look at head */
+    size_t  current;   /* Size of the record handed out by ring_read() */
+    char    pad1[RING_CACHE_LINE];
+
+    int     closed;
+} ring_t;
+
+int    ring_init(ring_t *r, size_t size);
+void   ring_free(ring_t *r);
+
+char  *ring_write_begin(ring_t *r, size_t *room);
+char  *ring_write_reserve(ring_t *r, size_t len);
+void   ring_write_commit(ring_t *r, int tag, size_t len);
+int    ring_write(ring_t *r, int tag, const char *data, size_t len);
+void   ring_close(ring_t *r);
+
+char  *ring_read(ring_t *r, int *tag, size_t *len);
+void   ring_read_done(ring_t *r);
+int    ring_is_closed(ring_t *r);
+
+void   ring_backoff(int *spins);
+
+#endif /* RING_H */
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "runs.h"
+
+/* Average bytes of a record the entries of a buffer are sized for. */
+#define PURGER_RUN_AVERAGE 64
+
+/* The index of the run at "path". Returns its length like snprintf(). */
+int
+purger_run_index_path(char *buf, size_t size, const char *path)
+{
+    return snprintf(buf, size, "%s" PURGER_RUN_INDEX_SUFFIX, path);
+}
+
+static int
+purger_run_name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * The paths of the runs in "dir" whose names start with "prefix", in name
+ * order, in a new array. Returns -1 with errno set on failure.
+ */
+int
+purger_run_list(const char *dir, const char *prefix, char ***paths, size_t *count)
+{
+    size_t prefix_len = strlen(prefix);
+    size_t suffix_len = strlen(PURGER_RUN_SUFFIX);
+    struct dirent *ent = NULL;
+    char **grown = NULL;
+    size_t cap = 0;
+    size_t len = 0;
+    DIR *d = opendir(dir);
+
+    *paths = NULL;
+    *count = 0;
+    if(d == NULL)
+        return -1;
+
+    while((ent = readdir(d)) != NULL)
+    {
+        len = strlen(ent->d_name);
+        if(len <= prefix_len + suffix_len || strncmp(ent->d_name, prefix, prefix_len) != 0 ||
+                strcmp(ent->d_name + len - suffix_len, PURGER_RUN_SUFFIX) != 0)
+            continue;
+
+        if(*count == cap)
+        {
+            cap = cap ? 2 * cap : 64;
+            grown = (char **)realloc(*paths, cap * sizeof(char *));
+            if(grown == NULL)
+                break;
+            *paths = grown;
+        }
+        (*paths)[*count] = (char *)malloc(strlen(dir) + len + 2);
+        if((*paths)[*count] == NULL)
+            break;
+        sprintf((*paths)[*count], "%s/%s", dir, ent->d_name);
+        (*count)++;
+    }
+    closedir(d);
+
+    if(ent != NULL)
+    {
+        purger_run_list_free(*paths, *count);
+        *paths = NULL;
+        *count = 0;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    qsort(*paths, *count, sizeof(char *), purger_run_name_cmp);
+    return 0;
+}
+
+void
+purger_run_list_free(char **paths, size_t count)
+{
+    size_t i = 0;
+
+    for(i = 0; i < count; i++)
+        free(paths[i]);
+    free(paths);
+}
+
+static void
+purger_run_put64(unsigned char *p, uint64_t v)
+{
+    int i = 0;
+
+    for(i = 0; i < 8; i++)
+        p[i] = (unsigned char)((v >> (8 * i)) & 0xff);
+}
+
+static uint64_t
+purger_run_get64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    int i = 0;
+
+    for(i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/* Start a run and its index at "path". Returns -1 with errno set. */
+int
+purger_run_create(purger_run_writer_t *w, const char *path)
+{
+    char idx[PATH_MAX];
+    int saved = 0;
+
+    memset(w, 0, sizeof(*w));
+    w->idx = -1;
+    if(purger_run_index_path(idx, sizeof(idx), path) >= (int)sizeof(idx))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    w->log = purger_reclog_create(path);
+    if(w->log == NULL)
+        return -1;
+
+    w->idx = open(idx, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(w->idx < 0)
+    {
+        saved = errno;
+        (*w->log->close)(w->log);
+        w->log = NULL;
+        errno = saved;
+        return -1;
+    }
+
+    w->offset = PURGER_RECLOG_MAGIC_LEN;
+    return 0;
+}
+
+/* Add the next record. Records have to come in mtime order. */
+int
+purger_run_append(purger_run_writer_t *w, const purger_record_t *r)
+{
+    unsigned char mark[PURGER_RUN_MARK_LEN];
+
+    if(w->records % PURGER_RUN_STRIDE == 0)
+    {
+        purger_run_put64(mark, (uint64_t)r->mtime);
+        purger_run_put64(mark + 8, w->offset);
+        if(write(w->idx, mark, sizeof(mark)) != (ssize_t)sizeof(mark))
+            return -1;
+    }
+
+    if(purger_reclog_append(w->log, r, PURGER_RECLOG_EXPIRED) < 0)
+        return -1;
+
+    w->records++;
+    w->offset += PURGER_RECLOG_PREFIX + PURGER_RECORD_HEADER + r->name_len;
+    return 0;
+}
+
+int
+purger_run_close(purger_run_writer_t *w)
+{
+    int status = 0;
+
+    if(w->log != NULL && (*w->log->close)(w->log) < 0)
+        status = -1;
+    if(w->idx >= 0 && close(w->idx) < 0)
+        status = -1;
+
+    w->log = NULL;
+    w->idx = -1;
+    return status;
+}
+
+/*
+ * Read the index of the run at "path" into a new array of *count marks,
+ * which the caller frees. Returns -1 with errno set on failure.
+ */
+int
+purger_run_index_read(const char *path, purger_run_mark_t **marks, size_t *count)
+{
+    char idx[PATH_MAX];
+    unsigned char *buf = NULL;
+    struct stat st;
+    ssize_t n = 0;
+    size_t len = 0;
+    size_t i = 0;
+    int fd = -1;
+
+    *marks = NULL;
+    *count = 0;
+    if(purger_run_index_path(idx, sizeof(idx), path) >= (int)sizeof(idx))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    fd = open(idx, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) < 0)
+        goto fail;
+    if(st.st_size % PURGER_RUN_MARK_LEN != 0)
+    {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    buf = (unsigned char *)malloc((size_t)st.st_size + 1);
+    *marks = (purger_run_mark_t *)malloc(((size_t)st.st_size / PURGER_RUN_MARK_LEN + 1) * sizeof(purger_run_mark_t));
+    if(buf == NULL || *marks == NULL)
+        goto fail;
+
+    while(len < (size_t)st.st_size)
+    {
+        n = read(fd, buf + len, (size_t)st.st_size - len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+        {
+            errno = n == 0 ? EINVAL : errno;
+            goto fail;
+        }
+        len += (size_t)n;
+    }
+
+    for(i = 0; i < len / PURGER_RUN_MARK_LEN; i++)
+    {
+        (*marks)[i].mtime = (int64_t)purger_run_get64(buf + i * PURGER_RUN_MARK_LEN);
+        (*marks)[i].offset = purger_run_get64(buf + i * PURGER_RUN_MARK_LEN + 8);
+    }
+    *count = i;
+
+    free(buf);
+    close(fd);
+    return 0;
+
+fail:
+    free(buf);
+    free(*marks);
+    *marks = NULL;
+    if(fd >= 0)
+        close(fd);
+    return -1;
+}
+
+/*
+ * Where a reader looking for the records from "mtime" on can start: the
+ * last mark before it, or the first record when there is none.
+ */
+uint64_t
+purger_run_index_seek(const purger_run_mark_t *marks, size_t count, int64_t mtime)
+{
+    size_t lo = 0;
+    size_t hi = count;
+    size_t mid = 0;
+
+    /* The first mark that is not before mtime. */
+    while(lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if(marks[mid].mtime < mtime)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo == 0 ? PURGER_RECLOG_MAGIC_LEN : marks[lo - 1].offset;
+}
+
+/* Hold up to "size" bytes of packed records. */
+int
+purger_run_buffer_init(purger_run_buffer_t *b, size_t size)
+{
+    memset(b, 0, sizeof(*b));
+    b->size = size;
+    b->cap = size / PURGER_RUN_AVERAGE + 1;
+    b->buf = (char *)malloc(b->size);
+    b->entries = (purger_run_entry_t *)malloc(b->cap * sizeof(purger_run_entry_t));
+    if(b->buf == NULL || b->entries == NULL)
+    {
+        purger_run_buffer_free(b);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Hold on to a copy of the record. Returns -1 when the buffer is full,
+ * so the caller can spill it and try again.
+ */
+int
+purger_run_buffer_add(purger_run_buffer_t *b, const purger_record_t *r)
+{
+    size_t len = PURGER_RECORD_HEADER + r->name_len;
+
+    if(b->count == b->cap || b->len + len > b->size)
+        return -1;
+
+    purger_record_pack(b->buf + b->len, len, r);
+    b->entries[b->count].mtime = r->mtime;
+    b->entries[b->count].off = b->len;
+    b->entries[b->count].len = (uint32_t)len;
+    b->count++;
+    b->len += len;
+    return 0;
+}
+
+static int
+purger_run_entry_cmp(const void *a, const void *b)
+{
+    const purger_run_entry_t *x = (const purger_run_entry_t *)a;
+    const purger_run_entry_t *y = (const purger_run_entry_t *)b;
+
+    if(x->mtime != y->mtime)
+        return x->mtime < y->mtime ? -1 : 1;
+    return x->off < y->off ? -1 : (x->off > y->off);
+}
+
+/*
+ * Sort what is held by mtime and write it out as the run "path", leaving
+ * the buffer empty. Returns -1 with errno set on failure, the records are
+ * dropped either way.
+ */
+int
+purger_run_buffer_spill(purger_run_buffer_t *b, const char *path)
+{
+    purger_run_writer_t w;
+    purger_record_t r;
+    int status = 0;
+    size_t i = 0;
+
+    qsort(b->entries, b->count, sizeof(purger_run_entry_t), purger_run_entry_cmp);
+
+    if(purger_run_create(&w, path) < 0)
+        status = -1;
+    for(i = 0; status == 0 && i < b->count; i++)
+    {
+        if(purger_record_unpack(b->buf + b->entries[i].off, b->entries[i].len, &r) < 0 ||
+                purger_run_append(&w, &r) < 0)
+            status = -1;
+    }
+    if(purger_run_close(&w) < 0)
+        status = -1;
+
+    b->count = 0;
+    b->len = 0;
+    return status;
+}
+
+void
+purger_run_buffer_free(purger_run_buffer_t *b)
+{
+    free(b->buf);
+    free(b->entries);
+    memset(b, 0, sizeof(*b));
+}
+
+/* EOF */
@@ -0,0 +1,74 @@
+#ifndef RUNS_H
+#define RUNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "reclog.h"
+
+/*
+ * Sorted runs: record logs (see reclog.h) whose records are in mtime
+ * order, each with an index "<run>.idx" holding the mtime and offset of
+ * every PURGER_RUN_STRIDE-th record, little endian, so that a reader can
+ * start part way through. treewalk -R spills the expired files of each
+ * rank as runs, purgemerge merges them into a purge list partitioned by
+ * mtime, and reaper -P works through that a stride at a time.
+ */
+#define PURGER_RUN_STRIDE       4096
+#define PURGER_RUN_INDEX_SUFFIX ".idx"
+#define PURGER_RUN_SUFFIX       ".log"
+/* What treewalk names its runs and purgemerge its partitions. */
+#define PURGER_RUN_PREFIX       "run-"
+#define PURGER_PURGE_PREFIX     "purge-"
+#define PURGER_RUN_MARK_LEN     16
+
+typedef struct
+{
+    int64_t  mtime;
+    uint64_t offset;
+} purger_run_mark_t;
+
+/* A run being written. */
+typedef struct
+{
+    purger_store_t *log;
+    int             idx;
+    uint64_t        records;
+    uint64_t        offset;
+} purger_run_writer_t;
+
+typedef struct
+{
+    int64_t  mtime;
+    size_t   off;
+    uint32_t len;
+} purger_run_entry_t;
+
+/* Packed records held in memory until they are spilled as a run. */
+typedef struct
+{
+    char               *buf;
+    size_t              len;
+    size_t              size;
+    purger_run_entry_t *entries;
+    size_t              count;
+    size_t              cap;
+} purger_run_buffer_t;
+
+int  purger_run_index_path(char *buf, size_t size, const char *path);
+int  purger_run_list(const char *dir, const char *prefix, char ***paths, size_t *count);
+void purger_run_list_free(char **paths, size_t count);
+
+int  purger_run_create(purger_run_writer_t *w, const char *path);
+int  purger_run_append(purger_run_writer_t *w, const purger_record_t *r);
+int  purger_run_close(purger_run_writer_t *w);
+
+int  purger_run_index_read(const char *path, purger_run_mark_t **marks, size_t *count);
+uint64_t purger_run_index_seek(const purger_run_mark_t *marks, size_t count, int64_t mtime);
+
+int  purger_run_buffer_init(purger_run_buffer_t *b, size_t size);
+int  purger_run_buffer_add(purger_run_buffer_t *b, const purger_record_t *r);
+int  purger_run_buffer_spill(purger_run_buffer_t *b, const char *path);
+void purger_run_buffer_free(purger_run_buffer_t *b);
+
+#endif /* RUNS_H */
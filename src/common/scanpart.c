@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "scanpart.h"
+
+/*
+ * How many parts to cut a SCAN over "keys" keys into: the smallest power
+ * of two holding "want", but no more than leave PURGER_SCAN_PART_KEYS
+ * keys in each. Always at least one.
+ */
+unsigned
+purger_scan_parts(long long keys, unsigned want)
+{
+    unsigned parts = 1;
+
+    while(parts < want && parts < PURGER_SCAN_PARTS_MAX)
+        parts <<= 1;
+    while(parts > 1 && keys / parts < PURGER_SCAN_PART_KEYS)
+        parts >>= 1;
+
+    return parts;
+}
+
+/* The cursor part "part" of "parts" starts at: its low bits reversed. */
+uint64_t
+purger_scan_part_start(unsigned part, unsigned parts)
+{
+    uint64_t cursor = 0;
+    unsigned bit = 0;
+
+    for(bit = 1; bit < parts; bit <<= 1)
+    {
+        cursor <<= 1;
+        if(part & bit)
+            cursor |= 1;
+    }
+
+    return cursor;
+}
+
+/* The cursor the walk is at once part "part" is done: the next one's start. */
+uint64_t
+purger_scan_part_end(unsigned part, unsigned parts)
+{
+    return part + 1 < parts ? purger_scan_part_start(part + 1, parts) : 0;
+}
+
+/* Whether "cursor", as SCAN returned it, is still within part "part". */
+int
+purger_scan_part_owns(uint64_t cursor, unsigned part, unsigned parts)
+{
+    if(cursor == 0)
+        return 0;
+    return (cursor & (parts - 1)) == purger_scan_part_start(part, parts);
+}
+
+/*
+ * The next part rank "rank" of "ranks" works on, when shard s is cut into
+ * parts[s] parts. The parts go round robin, part 0 of every shard, then
+ * part 1 of every shard and so on, so every shard has as many ranks on it
+ * as can be. Returns the shard, with the part in t->part, or -1 once this
+ * rank has had all of its parts.
+ */
+int
+purger_scan_part_next(const unsigned *parts, int shards, int rank, int ranks, purger_scan_turn_t *t)
+{
+    unsigned most = 0;
+    int s = 0;
+
+    for(s = 0; s < shards; s++)
+        if(parts[s] > most)
+            most = parts[s];
+
+    while(t->part < most)
+    {
+        while(t->shard < shards)
+        {
+            s = t->shard++;
+            if(t->part < parts[s] && t->turn++ % ranks == rank)
+                return s;
+        }
+        t->part++;
+        t->shard = 0;
+    }
+
+    return -1;
+}
+
+/* EOF */
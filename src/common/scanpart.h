@@ -0,0 +1,47 @@
+#ifndef SCANPART_H
+#define SCANPART_H
+
+#include <stdint.h>
+
+/*
+ * Disjoint slices of one redis SCAN. The server walks its hash table in
+ * reverse binary order: the top bits of the cursor change fastest and
+ * the lowest bit slowest, whatever the size of the table, so it can grow
+ * or shrink between calls. With "parts" a power of two, the low bits of
+ * the cursor stay the same for a whole 1/parts of the walk. Part p starts
+ * at the cursor made of those bits and is done once they change, or the
+ * cursor is back at 0.
+ *
+ * One SCAN with a COUNT walks many buckets and can run past the end of
+ * its part into the next one. When the cursor it returns is neither in
+ * the part nor where the part ends, its keys are not all the part's. A
+ * SCAN with COUNT 1 stops at the first bucket holding a key, so the keys
+ * it returns all come from that bucket. The bucket is the part's own
+ * only when the returned cursor is exactly where the part ends.
+ *
+ * That holds for tables with at least "parts" buckets. Below that the
+ * slices overlap, so a database is only cut into as many parts as leave
+ * each with PURGER_SCAN_PART_KEYS keys. This also leaves room for a
+ * table loaded up to five keys a bucket while the server forks.
+ */
+#define PURGER_SCAN_PART_KEYS 4096
+#define PURGER_SCAN_PARTS_MAX (1 << 16)
+
+/*
+ * Where a rank is in handing out the parts of several shards, see
+ * purger_scan_part_next(). Zeroed before the first call.
+ */
+typedef struct
+{
+    unsigned  part;
+    int       shard;
+    long long turn;
+} purger_scan_turn_t;
+
+unsigned purger_scan_parts(long long keys, unsigned want);
+uint64_t purger_scan_part_start(unsigned part, unsigned parts);
+uint64_t purger_scan_part_end(unsigned part, unsigned parts);
+int      purger_scan_part_owns(uint64_t cursor, unsigned part, unsigned parts);
+int      purger_scan_part_next(const unsigned *parts, int shards, int rank, int ranks, purger_scan_turn_t *t);
+
+#endif /* SCANPART_H */
@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#include "shards.h"
+#include "log.h"
+#include "redis.h"
+#include "endpoint.h"
+#include "record.h"
+#include "scanpart.h"
+
+/*
+ * How the database stores records, see record.h. Rank 0 asks the server
+ * treewalk tells and hands the answer to every rank. Returns the bucket
+ * digits of a packed database, 0 for one hash per file, or -1 on every
+ * rank when it could not be told.
+ */
+int
+purger_shards_schema(char *host, int port, int rank)
+{
+    char schema[256] = "";
+    char cmd[256];
+    int digits = 0;
+
+    if(rank == 0)
+    {
+        sprintf(cmd, "GET %s", PURGER_RECORD_SCHEMA_KEY);
+        if(redis_init(host, port) < 0 || redis_blocking_command(cmd, schema, CHAR) < 0)
+        {
+            LOG(PURGER_LOG_FATAL, "Unable to ask %s how records are stored.", host);
+            digits = -2;
+        }
+        else if((digits = purger_record_schema_parse(schema)) < 0)
+        {
+            LOG(PURGER_LOG_FATAL, "The records are stored as %s, which is not a schema this tool knows.", schema);
+        }
+        if(digits > -2)
+            redis_finalize();
+    }
+    MPI_Bcast(&digits, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    return digits < 0 ? -1 : digits;
+}
+
+/* The shards of a comma separated host list, which is cut up in place. */
+int
+purger_shards_init(purger_shards_t *set, char *hostlist, int port, purger_shard_setup_t setup)
+{
+    char *tok = NULL;
+
+    memset(set, 0, sizeof(*set));
+    set->port = port;
+    set->setup = setup;
+    for(tok = strtok(hostlist, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        set->shards = (purger_shard_t *)realloc(set->shards, (set->count + 1) * sizeof(purger_shard_t));
+        if(set->shards == NULL)
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        memset(&set->shards[set->count], 0, sizeof(purger_shard_t));
+        set->shards[set->count++].host = tok;
+    }
+
+    set->parts = (unsigned *)calloc(set->count + 1, sizeof(unsigned));
+    if(set->parts == NULL)
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    return set->count;
+}
+
+/*
+ * Cut every shard into parts by its size, which one rank asks for, so
+ * each rank working on a shard gets about "per_rank" of them. A shard
+ * nobody could reach gets no parts and is left out. Returns how many
+ * were left out.
+ */
+int
+purger_shards_cut(purger_shards_t *set, unsigned per_rank, int rank, int ranks)
+{
+    redisReply *reply = NULL;
+    long long *keys = NULL;
+    int left = 0;
+    int s = 0;
+
+    keys = (long long *)malloc((set->count + 1) * sizeof(long long));
+    if(keys == NULL)
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    for(s = 0; s < set->count; s++)
+        keys[s] = -1;
+    for(s = rank; s < set->count; s += ranks)
+    {
+        if(purger_shard_connect(&set->shards[s], set->port, set->setup) < 0)
+            continue;
+        reply = (redisReply *)redisCommand(set->shards[s].context, "DBSIZE");
+        if(reply != NULL && reply->type == REDIS_REPLY_INTEGER)
+            keys[s] = reply->integer;
+        if(reply != NULL)
+            freeReplyObject(reply);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, keys, set->count, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+
+    set->most = 0;
+    set->keys = 0;
+    for(s = 0; s < set->count; s++)
+    {
+        set->parts[s] = 0;
+        if(keys[s] < 0)
+        {
+            if(rank == 0)
+                LOG(PURGER_LOG_ERR, "Leaving out %s, it could not be reached.", set->shards[s].host);
+            left++;
+            continue;
+        }
+        set->parts[s] = purger_scan_parts(keys[s], per_rank * ((ranks + set->count - 1) / set->count));
+        if(set->parts[s] > set->most)
+            set->most = set->parts[s];
+        set->keys += keys[s];
+    }
+
+    free(keys);
+    return left;
+}
+
+void
+purger_shards_free(purger_shards_t *set)
+{
+    int s = 0;
+
+    for(s = 0; s < set->count; s++)
+        purger_shard_drop(&set->shards[s]);
+    free(set->shards);
+    free(set->parts);
+    memset(set, 0, sizeof(*set));
+}
+
+/*
+ * (Re)connect to a shard and run "setup" on the connection, waiting
+ * longer after every failed attempt like redis.c does for the pipelines.
+ */
+int
+purger_shard_connect(purger_shard_t *sh, int port, purger_shard_setup_t setup)
+{
+    double delay = REDIS_RECONNECT_DELAY;
+    int tries = 0;
+
+    for(tries = 0; tries < REDIS_RECONNECT_TRIES; tries++)
+    {
+        if(tries > 0)
+        {
+            usleep((useconds_t)(delay * 1e6));
+            delay = 2 * delay < REDIS_RECONNECT_DELAY_MAX ? 2 * delay : REDIS_RECONNECT_DELAY_MAX;
+        }
+        purger_shard_drop(sh);
+        sh->context = redis_endpoint_connect(sh->host, port, 0);
+        if(sh->context == NULL || sh->context->err)
+            continue;
+        if(setup == NULL || (*setup)(sh) == 0)
+            return 0;
+        if(!sh->context->err)
+            break;
+    }
+
+    LOG(PURGER_LOG_ERR, "Unable to connect to %s.", sh->host);
+    purger_shard_drop(sh);
+    return -1;
+}
+
+void
+purger_shard_drop(purger_shard_t *sh)
+{
+    if(sh->context != NULL)
+        redisFree(sh->context);
+    sh->context = NULL;
+}
+
+/* EOF */
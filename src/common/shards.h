@@ -0,0 +1,44 @@
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include <hiredis.h>
+
+/*
+ * The servers an MPI tool reads the records from: the -s host list, or
+ * the one -h server when the records are not sharded. Every shard is cut
+ * into SCAN parts by its size, see scanpart.h, and the parts are handed
+ * out over the ranks with purger_scan_part_next(). A rank keeps its own
+ * connection to every shard it works on.
+ */
+typedef struct purger_shard
+{
+    const char   *host;
+    redisContext *context;
+} purger_shard_t;
+
+/*
+ * Run on every new connection before it is used, e.g. to load a script.
+ * When it fails and the connection broke, connecting is tried again;
+ * when the server is there and said no, asking again will not help.
+ */
+typedef int (*purger_shard_setup_t)(purger_shard_t *sh);
+
+typedef struct
+{
+    purger_shard_t      *shards;
+    int                  count;
+    int                  port;
+    purger_shard_setup_t setup;
+    unsigned            *parts;  /* SCAN parts of every shard, 0 when left out */
+    unsigned             most;
+    long long            keys;   /* In all the shards that were reached */
+} purger_shards_t;
+
+int  purger_shards_schema(char *host, int port, int rank);
+int  purger_shards_init(purger_shards_t *set, char *hostlist, int port, purger_shard_setup_t setup);
+int  purger_shards_cut(purger_shards_t *set, unsigned per_rank, int rank, int ranks);
+void purger_shards_free(purger_shards_t *set);
+int  purger_shard_connect(purger_shard_t *sh, int port, purger_shard_setup_t setup);
+void purger_shard_drop(purger_shard_t *sh);
+
+#endif /* SHARDS_H */
@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "snapshot.h"
+#include "dirtable.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define PURGER_SNAPSHOT_AVX2 1
+#endif
+
+/* Columns of a block and the bytes of one row of each. */
+#define PURGER_SNAPSHOT_COLUMNS 6
+static const size_t purger_snapshot_width[PURGER_SNAPSHOT_COLUMNS] = { 8, 8, 4, 4, 4, 4 };
+
+/* Slots the string hash starts with, a power of two. */
+#define PURGER_SNAPSHOT_SLOTS 4096
+
+struct purger_snapshot_writer
+{
+    int                     fd;
+    uint64_t                offset;
+    /* The block being filled. */
+    int64_t                *mtime;
+    uint64_t               *size;
+    uint32_t               *uid;
+    uint32_t               *gid;
+    uint32_t               *dir;
+    uint32_t               *name;
+    purger_snapshot_zone_t  zone;
+    /* The zone maps of the blocks written so far. */
+    purger_snapshot_zone_t *zones;
+    size_t                  blocks;
+    size_t                  zone_cap;
+    uint64_t                rows;
+    /* The string table, and a hash of it holding ids plus one. */
+    char                   *heap;
+    size_t                  heap_len;
+    size_t                  heap_cap;
+    uint64_t               *offsets;
+    size_t                  count;
+    size_t                  offsets_cap;
+    uint32_t               *slots;
+    size_t                  slots_size;
+};
+
+/* The snapshot of "rank" in "dir". Returns its length like snprintf(). */
+int
+purger_snapshot_path(char *buf, size_t size, const char *dir, int rank)
+{
+    return snprintf(buf, size, "%s/snapshot-%d" PURGER_SNAPSHOT_SUFFIX, dir, rank);
+}
+
+static uint64_t
+purger_snapshot_align(uint64_t x)
+{
+    return (x + PURGER_SNAPSHOT_ALIGN - 1) & ~(uint64_t)(PURGER_SNAPSHOT_ALIGN - 1);
+}
+
+/* Where each column of a block of "rows" at "offset" starts. Returns its end. */
+static uint64_t
+purger_snapshot_columns(uint64_t offset, uint64_t rows, uint64_t *col)
+{
+    int i = 0;
+
+    for(i = 0; i < PURGER_SNAPSHOT_COLUMNS; i++)
+    {
+        col[i] = offset;
+        offset = purger_snapshot_align(offset + rows * purger_snapshot_width[i]);
+    }
+
+    return offset;
+}
+
+/* Write "len" bytes, then zeros up to the next boundary. */
+static int
+purger_snapshot_write(purger_snapshot_writer_t *w, const void *buf, size_t len)
+{
+    static const char zeros[PURGER_SNAPSHOT_ALIGN];
+    const char *p = (const char *)buf;
+    size_t pad = (size_t)(purger_snapshot_align(w->offset + len) - w->offset - len);
+    ssize_t n = 0;
+
+    w->offset += len + pad;
+    while(len > 0 || pad > 0)
+    {
+        if(len == 0)
+        {
+            p = zeros;
+            len = pad;
+            pad = 0;
+        }
+        n = write(w->fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+/* Write out the block being filled along with its zone map. */
+static int
+purger_snapshot_flush(purger_snapshot_writer_t *w)
+{
+    const void *cols[PURGER_SNAPSHOT_COLUMNS];
+    purger_snapshot_zone_t *grown = NULL;
+    size_t n = (size_t)w->zone.rows;
+    int i = 0;
+
+    if(n == 0)
+        return 0;
+
+    if(w->blocks == w->zone_cap)
+    {
+        w->zone_cap = w->zone_cap ? 2 * w->zone_cap : 64;
+        grown = (purger_snapshot_zone_t *)realloc(w->zones, w->zone_cap * sizeof(purger_snapshot_zone_t));
+        if(grown == NULL)
+            return -1;
+        w->zones = grown;
+    }
+
+    cols[0] = w->mtime;
+    cols[1] = w->size;
+    cols[2] = w->uid;
+    cols[3] = w->gid;
+    cols[4] = w->dir;
+    cols[5] = w->name;
+
+    w->zone.offset = w->offset;
+    for(i = 0; i < PURGER_SNAPSHOT_COLUMNS; i++)
+        if(purger_snapshot_write(w, cols[i], n * purger_snapshot_width[i]) < 0)
+            return -1;
+
+    w->zones[w->blocks++] = w->zone;
+    memset(&w->zone, 0, sizeof(w->zone));
+    return 0;
+}
+
+static int
+purger_snapshot_grow_slots(purger_snapshot_writer_t *w)
+{
+    size_t size = w->slots_size ? 2 * w->slots_size : PURGER_SNAPSHOT_SLOTS;
+    uint32_t *slots = (uint32_t *)calloc(size, sizeof(uint32_t));
+    size_t i = 0;
+    size_t j = 0;
+
+    if(slots == NULL)
+        return -1;
+
+    for(i = 0; i < w->count; i++)
+    {
+        j = (size_t)purger_dir_id(w->heap + w->offsets[i], (size_t)(w->offsets[i + 1] - w->offsets[i])) & (size - 1);
+        while(slots[j] != 0)
+            j = (j + 1) & (size - 1);
+        slots[j] = (uint32_t)i + 1;
+    }
+
+    free(w->slots);
+    w->slots = slots;
+    w->slots_size = size;
+    return 0;
+}
+
+/* The id of a string in the table, adding it if it is not there yet. */
+static int
+purger_snapshot_intern(purger_snapshot_writer_t *w, const char *str, size_t len, uint32_t *id)
+{
+    size_t mask = 0;
+    size_t i = 0;
+    size_t c = 0;
+    void *grown = NULL;
+
+    if(2 * (w->count + 1) > w->slots_size && purger_snapshot_grow_slots(w) < 0)
+        return -1;
+
+    mask = w->slots_size - 1;
+    for(i = (size_t)purger_dir_id(str, len) & mask; w->slots[i] != 0; i = (i + 1) & mask)
+    {
+        c = w->slots[i] - 1;
+        if(w->offsets[c + 1] - w->offsets[c] == len && memcmp(w->heap + w->offsets[c], str, len) == 0)
+        {
+            *id = (uint32_t)c;
+            return 0;
+        }
+    }
+
+    if(w->count >= UINT32_MAX - 1)
+    {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    if(w->heap_len + len > w->heap_cap)
+    {
+        w->heap_cap = 2 * (w->heap_cap + len);
+        grown = realloc(w->heap, w->heap_cap);
+        if(grown == NULL)
+            return -1;
+        w->heap = (char *)grown;
+    }
+    if(w->count + 2 > w->offsets_cap)
+    {
+        w->offsets_cap = 2 * (w->count + 2);
+        grown = realloc(w->offsets, w->offsets_cap * sizeof(uint64_t));
+        if(grown == NULL)
+            return -1;
+        w->offsets = (uint64_t *)grown;
+    }
+
+    memcpy(w->heap + w->heap_len, str, len);
+    w->heap_len += len;
+    w->offsets[w->count + 1] = w->heap_len;
+    w->slots[i] = (uint32_t)w->count + 1;
+    *id = (uint32_t)w->count++;
+    return 0;
+}
+
+/* Start the snapshot at "path". Returns NULL with errno set on failure. */
+purger_snapshot_writer_t *
+purger_snapshot_create(const char *path)
+{
+    purger_snapshot_writer_t *w = (purger_snapshot_writer_t *)calloc(1, sizeof(purger_snapshot_writer_t));
+    purger_snapshot_header_t header;
+    int saved = 0;
+
+    if(w == NULL)
+        return NULL;
+
+    w->mtime = (int64_t *)malloc(PURGER_SNAPSHOT_BLOCK * sizeof(int64_t));
+    w->size = (uint64_t *)malloc(PURGER_SNAPSHOT_BLOCK * sizeof(uint64_t));
+    w->uid = (uint32_t *)malloc(PURGER_SNAPSHOT_BLOCK * sizeof(uint32_t));
+    w->gid = (uint32_t *)malloc(PURGER_SNAPSHOT_BLOCK * sizeof(uint32_t));
+    w->dir = (uint32_t *)malloc(PURGER_SNAPSHOT_BLOCK * sizeof(uint32_t));
+    w->name = (uint32_t *)malloc(PURGER_SNAPSHOT_BLOCK * sizeof(uint32_t));
+    w->offsets = (uint64_t *)calloc(2, sizeof(uint64_t));
+    w->offsets_cap = 2;
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PURGER_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.order = PURGER_SNAPSHOT_ORDER;
+    header.block_rows = PURGER_SNAPSHOT_BLOCK;
+
+    if(w->mtime == NULL || w->size == NULL || w->uid == NULL || w->gid == NULL ||
+            w->dir == NULL || w->name == NULL || w->offsets == NULL || w->fd < 0 ||
+            purger_snapshot_write(w, &header, sizeof(header)) < 0)
+    {
+        saved = errno;
+        if(w->fd >= 0)
+            close(w->fd);
+        w->fd = -1;
+        purger_snapshot_finish(w);
+        errno = saved;
+        return NULL;
+    }
+
+    return w;
+}
+
+/* Add a regular file, "path" being "len" bytes of its full path. */
+int
+purger_snapshot_add(purger_snapshot_writer_t *w, const char *path, size_t len, const struct stat *st)
+{
+    purger_snapshot_zone_t *z = &w->zone;
+    size_t i = (size_t)z->rows;
+    size_t base = len;
+    uint32_t dir = 0;
+    uint32_t name = 0;
+
+    while(base > 0 && path[base - 1] != '/')
+        base--;
+
+    /* The directory keeps its slash only when it is the root. */
+    if(purger_snapshot_intern(w, path, base > 1 ? base - 1 : base, &dir) < 0 ||
+            purger_snapshot_intern(w, path + base, len - base, &name) < 0)
+        return -1;
+
+    w->mtime[i] = (int64_t)st->st_mtime;
+    w->size[i] = (uint64_t)st->st_size;
+    w->uid[i] = (uint32_t)st->st_uid;
+    w->gid[i] = (uint32_t)st->st_gid;
+    w->dir[i] = dir;
+    w->name[i] = name;
+
+    if(i == 0 || w->mtime[i] < z->mtime_min) z->mtime_min = w->mtime[i];
+    if(i == 0 || w->mtime[i] > z->mtime_max) z->mtime_max = w->mtime[i];
+    if(i == 0 || w->size[i] < z->size_min) z->size_min = w->size[i];
+    if(i == 0 || w->size[i] > z->size_max) z->size_max = w->size[i];
+    if(i == 0 || w->uid[i] < z->uid_min) z->uid_min = w->uid[i];
+    if(i == 0 || w->uid[i] > z->uid_max) z->uid_max = w->uid[i];
+    if(i == 0 || w->gid[i] < z->gid_min) z->gid_min = w->gid[i];
+    if(i == 0 || w->gid[i] > z->gid_max) z->gid_max = w->gid[i];
+
+    z->rows++;
+    w->rows++;
+    if(z->rows == PURGER_SNAPSHOT_BLOCK)
+        return purger_snapshot_flush(w);
+    return 0;
+}
+
+/*
+ * Write out the last block, the string table and the footer, and let go
+ * of the writer. Returns -1 with errno set when the snapshot is not
+ * complete.
+ */
+int
+purger_snapshot_finish(purger_snapshot_writer_t *w)
+{
+    purger_snapshot_trailer_t t;
+    int status = 0;
+
+    if(w->fd >= 0)
+    {
+        memset(&t, 0, sizeof(t));
+        memcpy(t.magic, PURGER_SNAPSHOT_MAGIC, sizeof(t.magic));
+        if(purger_snapshot_flush(w) < 0)
+            status = -1;
+
+        t.strings = w->offset;
+        t.string_count = w->count;
+        if(status == 0 && purger_snapshot_write(w, w->heap, w->heap_len) < 0)
+            status = -1;
+        t.string_offsets = w->offset;
+        if(status == 0 && purger_snapshot_write(w, w->offsets, (w->count + 1) * sizeof(uint64_t)) < 0)
+            status = -1;
+        t.zones = w->offset;
+        t.blocks = w->blocks;
+        t.rows = w->rows;
+        if(status == 0 && purger_snapshot_write(w, w->zones, w->blocks * sizeof(purger_snapshot_zone_t)) < 0)
+            status = -1;
+        if(status == 0 && purger_snapshot_write(w, &t, sizeof(t)) < 0)
+            status = -1;
+        if(close(w->fd) < 0)
+            status = -1;
+    }
+
+    free(w->mtime);
+    free(w->size);
+    free(w->uid);
+    free(w->gid);
+    free(w->dir);
+    free(w->name);
+    free(w->zones);
+    free(w->heap);
+    free(w->offsets);
+    free(w->slots);
+    free(w);
+    return status;
+}
+
+/*
+ * Map the snapshot at "path" and check that its footer fits in it.
+ * Returns -1 with errno set when it is not a snapshot this host can read.
+ */
+int
+purger_snapshot_open(purger_snapshot_t *s, const char *path)
+{
+    const purger_snapshot_header_t *h = NULL;
+    const purger_snapshot_trailer_t *t = NULL;
+    struct stat st;
+    void *map = NULL;
+    size_t end = 0;
+    int fd = -1;
+
+    memset(s, 0, sizeof(*s));
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return -1;
+    if(fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if((size_t)st.st_size < sizeof(*h) + sizeof(*t))
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+    s->map = (const char *)map;
+    s->len = (size_t)st.st_size;
+
+    h = (const purger_snapshot_header_t *)s->map;
+    t = (const purger_snapshot_trailer_t *)(s->map + s->len - sizeof(*t));
+    end = s->len - sizeof(*t);
+    if(memcmp(h->magic, PURGER_SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+            memcmp(t->magic, PURGER_SNAPSHOT_MAGIC, sizeof(t->magic)) != 0 ||
+            h->order != PURGER_SNAPSHOT_ORDER ||
+            t->strings > t->string_offsets ||
+            t->string_offsets > t->zones || t->zones > end ||
+            t->string_count >= (end - t->string_offsets) / sizeof(uint64_t) ||
+            t->blocks > (end - t->zones) / sizeof(purger_snapshot_zone_t))
+    {
+        purger_snapshot_close(s);
+        errno = EINVAL;
+        return -1;
+    }
+
+    s->zones = (const purger_snapshot_zone_t *)(s->map + t->zones);
+    s->blocks = t->blocks;
+    s->rows = t->rows;
+    s->strings = s->map + t->strings;
+    s->string_offsets = (const uint64_t *)(s->map + t->string_offsets);
+    s->string_count = t->string_count;
+    if(s->string_offsets[s->string_count] > t->string_offsets - t->strings)
+    {
+        purger_snapshot_close(s);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The columns of block "i". Returns -1 when it does not fit the file. */
+int
+purger_snapshot_block(const purger_snapshot_t *s, uint64_t i, purger_snapshot_block_t *b)
+{
+    const purger_snapshot_zone_t *z = NULL;
+    uint64_t col[PURGER_SNAPSHOT_COLUMNS];
+
+    if(i >= s->blocks)
+        return -1;
+    z = &s->zones[i];
+    if(z->rows > PURGER_SNAPSHOT_BLOCK || z->offset % PURGER_SNAPSHOT_ALIGN != 0 ||
+            purger_snapshot_columns(z->offset, z->rows, col) > (uint64_t)(s->strings - s->map))
+        return -1;
+
+    b->rows = (size_t)z->rows;
+    b->mtime = (const int64_t *)(s->map + col[0]);
+    b->size = (const uint64_t *)(s->map + col[1]);
+    b->uid = (const uint32_t *)(s->map + col[2]);
+    b->gid = (const uint32_t *)(s->map + col[3]);
+    b->dir = (const uint32_t *)(s->map + col[4]);
+    b->name = (const uint32_t *)(s->map + col[5]);
+    return 0;
+}
+
+/* String "id" of the table, not terminated. NULL when there is none. */
+const char *
+purger_snapshot_string(const purger_snapshot_t *s, uint32_t id, size_t *len)
+{
+    if(id >= s->string_count || s->string_offsets[id] > s->string_offsets[id + 1])
+        return NULL;
+
+    *len = (size_t)(s->string_offsets[id + 1] - s->string_offsets[id]);
+    return s->strings + s->string_offsets[id];
+}
+
+void
+purger_snapshot_close(purger_snapshot_t *s)
+{
+    if(s->map != NULL)
+        munmap((void *)s->map, s->len);
+    memset(s, 0, sizeof(*s));
+}
+
+#ifdef PURGER_SNAPSHOT_AVX2
+/* Four mtimes per compare, the matches come out of the mask in order. */
+__attribute__((target("avx2")))
+static size_t
+purger_snapshot_select_older_avx2(const int64_t *mtime, size_t rows, int64_t cutoff, uint32_t *sel)
+{
+    __m256i c = _mm256_set1_epi64x(cutoff);
+    __m256i m;
+    size_t n = 0;
+    size_t i = 0;
+    int bits = 0;
+
+    for(; i + 4 <= rows; i += 4)
+    {
+        m = _mm256_loadu_si256((const __m256i *)(mtime + i));
+        bits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(c, m)));
+        while(bits != 0)
+        {
+            sel[n++] = (uint32_t)(i + (size_t)__builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+
+    for(; i < rows; i++)
+    {
+        sel[n] = (uint32_t)i;
+        n += mtime[i] < cutoff;
+    }
+
+    return n;
+}
+#endif
+
+/*
+ * Put the rows of a block's mtime column that are older than "cutoff"
+ * into "sel", which has room for all of them. Returns how many there are.
+ */
+size_t
+purger_snapshot_select_older(const int64_t *mtime, size_t rows, int64_t cutoff, uint32_t *sel)
+{
+    size_t n = 0;
+    size_t i = 0;
+
+#ifdef PURGER_SNAPSHOT_AVX2
+    if(__builtin_cpu_supports("avx2"))
+        return purger_snapshot_select_older_avx2(mtime, rows, cutoff, sel);
+#endif
+
+    for(i = 0; i < rows; i++)
+    {
+        sel[n] = (uint32_t)i;
+        n += mtime[i] < cutoff;
+    }
+
+    return n;
+}
+
+/* EOF */
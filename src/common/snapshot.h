@@ -0,0 +1,107 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/*
+ * The columnar snapshot: every regular file one treewalk rank saw, laid
+ * out to be mapped and scanned in place. Files are grouped in blocks of
+ * up to PURGER_SNAPSHOT_BLOCK rows and each block holds one packed array
+ * per column,
+ *
+ *     mtime:int64 size:uint64 uid:uint32 gid:uint32 dir:uint32 name:uint32
+ *
+ * each starting on a PURGER_SNAPSHOT_ALIGN boundary. dir and name are ids
+ * in the string table, which holds every directory path and basename
+ * once. The footer has the zone map of each block, the minimum and
+ * maximum of its numeric columns, so a scan can skip or take whole blocks
+ * without looking at their rows. Numbers are in the byte order of the
+ * host that wrote the snapshot, and readers on another refuse it.
+ *
+ *     header | block 0 | block 1 | ... | strings | string offsets
+ *            | zone maps | trailer
+ */
+#define PURGER_SNAPSHOT_MAGIC  "PRGRCOL1"
+#define PURGER_SNAPSHOT_ORDER  0x01020304u
+#define PURGER_SNAPSHOT_BLOCK  65536
+#define PURGER_SNAPSHOT_ALIGN  64
+#define PURGER_SNAPSHOT_SUFFIX ".col"
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t order;
+    uint32_t block_rows;
+    char     pad[PURGER_SNAPSHOT_ALIGN - 16];
+} purger_snapshot_header_t;
+
+/* Where a block is and what its rows hold. */
+typedef struct
+{
+    uint64_t offset;
+    uint64_t rows;
+    int64_t  mtime_min;
+    int64_t  mtime_max;
+    uint64_t size_min;
+    uint64_t size_max;
+    uint32_t uid_min;
+    uint32_t uid_max;
+    uint32_t gid_min;
+    uint32_t gid_max;
+} purger_snapshot_zone_t;
+
+typedef struct
+{
+    uint64_t strings;
+    uint64_t string_count;
+    uint64_t string_offsets;
+    uint64_t zones;
+    uint64_t blocks;
+    uint64_t rows;
+    char     pad[8];
+    char     magic[8];
+} purger_snapshot_trailer_t;
+
+/* The columns of one block, pointing into the mapped snapshot. */
+typedef struct
+{
+    size_t          rows;
+    const int64_t  *mtime;
+    const uint64_t *size;
+    const uint32_t *uid;
+    const uint32_t *gid;
+    const uint32_t *dir;
+    const uint32_t *name;
+} purger_snapshot_block_t;
+
+/* A mapped snapshot. */
+typedef struct
+{
+    const char                   *map;
+    size_t                        len;
+    const purger_snapshot_zone_t *zones;
+    uint64_t                      blocks;
+    uint64_t                      rows;
+    const uint64_t               *string_offsets;
+    const char                   *strings;
+    uint64_t                      string_count;
+} purger_snapshot_t;
+
+typedef struct purger_snapshot_writer purger_snapshot_writer_t;
+
+int  purger_snapshot_path(char *buf, size_t size, const char *dir, int rank);
+
+purger_snapshot_writer_t *purger_snapshot_create(const char *path);
+int  purger_snapshot_add(purger_snapshot_writer_t *w, const char *path, size_t len, const struct stat *st);
+int  purger_snapshot_finish(purger_snapshot_writer_t *w);
+
+int  purger_snapshot_open(purger_snapshot_t *s, const char *path);
+int  purger_snapshot_block(const purger_snapshot_t *s, uint64_t i, purger_snapshot_block_t *b);
+const char *purger_snapshot_string(const purger_snapshot_t *s, uint32_t id, size_t *len);
+void purger_snapshot_close(purger_snapshot_t *s);
+
+size_t purger_snapshot_select_older(const int64_t *mtime, size_t rows, int64_t cutoff, uint32_t *sel);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,28 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+ * Where treewalk puts what it finds. The redis database the other tools
+ * read is one backend, an append-only log per rank (see reclog.h) is
+ * another that needs no server at all. A backend fills in the functions
+ * it needs; dir may be NULL.
+ */
+typedef struct purger_store
+{
+    const char *name;
+    /* Whether file() needs the record key, which costs a hash per file. */
+    int keyed;
+    /* A directory was listed. */
+    int (*dir)(struct purger_store *s, const char *path);
+    /* A regular file; key is NULL unless keyed, expired is set when the
+     * file is past the expiry threshold. */
+    int (*file)(struct purger_store *s, const char *path, const struct stat *st,
+                const char *key, size_t key_len, int expired);
+    /* The walk is over: write out what is buffered and let go. */
+    int (*close)(struct purger_store *s);
+} purger_store_t;
+
+#endif /* STORE_H */
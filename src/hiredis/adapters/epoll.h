@@ -0,0 +1,127 @@
+#ifndef __HIREDIS_EPOLL_H__
+#define __HIREDIS_EPOLL_H__
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include "../hiredis.h"
+#include "../async.h"
+
+/* Number of events taken from the kernel per epoll_wait() */
+#define REDIS_EPOLL_BATCH 64
+
+typedef struct redisEpollEvents {
+    redisAsyncContext *context;
+    int epfd, fd;
+    int reading, writing;
+    int registered; /* Event mask the kernel currently has for fd */
+    int dispatching; /* Inside redisEpollProcess(), see redisEpollCleanup() */
+} redisEpollEvents;
+
+/* Bring the kernel's interest set for fd in line with reading/writing. */
+static void redisEpollUpdate(redisEpollEvents *e) {
+    struct epoll_event ev;
+    int mask = (e->reading ? EPOLLIN : 0) | (e->writing ? EPOLLOUT : 0);
+    int op;
+
+    if (mask == e->registered)
+        return;
+    if (mask == 0)
+        op = EPOLL_CTL_DEL;
+    else if (e->registered == 0)
+        op = EPOLL_CTL_ADD;
+    else
+        op = EPOLL_CTL_MOD;
+
+    ev.events = mask;
+    ev.data.ptr = e;
+    epoll_ctl(e->epfd,op,e->fd,&ev);
+    e->registered = mask;
+}
+
+static void redisEpollAddRead(void *privdata) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+    e->reading = 1;
+    redisEpollUpdate(e);
+}
+
+static void redisEpollDelRead(void *privdata) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+    e->reading = 0;
+    redisEpollUpdate(e);
+}
+
+static void redisEpollAddWrite(void *privdata) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+    e->writing = 1;
+    redisEpollUpdate(e);
+}
+
+static void redisEpollDelWrite(void *privdata) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+    e->writing = 0;
+    redisEpollUpdate(e);
+}
+
+static void redisEpollCleanup(void *privdata) {
+    redisEpollEvents *e = (redisEpollEvents*)privdata;
+    redisEpollDelRead(privdata);
+    redisEpollDelWrite(privdata);
+
+    /* The context can go away while one of its events is being handled.
+     * Leave freeing the container to redisEpollProcess() then. */
+    if (e->dispatching)
+        e->context = NULL;
+    else
+        free(e);
+}
+
+static int redisEpollAttach(int epfd, redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    redisEpollEvents *e;
+
+    /* Nothing should be attached when something is already attached */
+    if (ac->ev.data != NULL)
+        return REDIS_ERR;
+
+    /* Create container for context and r/w events */
+    e = (redisEpollEvents*)calloc(1,sizeof(*e));
+    if (e == NULL)
+        return REDIS_ERR;
+    e->context = ac;
+    e->epfd = epfd;
+    e->fd = c->fd;
+
+    /* Register functions to start/stop listening for events */
+    ac->ev.addRead = redisEpollAddRead;
+    ac->ev.delRead = redisEpollDelRead;
+    ac->ev.addWrite = redisEpollAddWrite;
+    ac->ev.delWrite = redisEpollDelWrite;
+    ac->ev.cleanup = redisEpollCleanup;
+    ac->ev.data = e;
+    return REDIS_OK;
+}
+
+/* Wait up to timeout milliseconds (-1 for no limit, 0 to only poll) for
+ * the contexts attached to epfd and handle whatever is ready. Returns the
+ * number of contexts that had events, or -1 when epoll_wait() failed. */
+static int redisEpollProcess(int epfd, int timeout) {
+    struct epoll_event events[REDIS_EPOLL_BATCH];
+    redisEpollEvents *e;
+    int n, j;
+
+    n = epoll_wait(epfd,events,REDIS_EPOLL_BATCH,timeout);
+    for (j = 0; j < n; j++) {
+        e = (redisEpollEvents*)events[j].data.ptr;
+        e->dispatching = 1;
+        if (events[j].events & EPOLLOUT)
+            redisAsyncHandleWrite(e->context);
+        if (e->context != NULL && (events[j].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+            redisAsyncHandleRead(e->context);
+        e->dispatching = 0;
+        if (e->context == NULL)
+            free(e);
+    }
+    return n;
+}
+
+#endif
@@ -602,3 +602,43 @@ int redisAsyncCommandArgv(redisAsyncContext *ac, redisCallbackFn *fn, void *priv
     free(cmd);
     return status;
 }
+
+/* Same as redisAsyncCommand(), for a command that is already encoded. */
+int redisAsyncFormattedCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
+    return __redisAsyncCommand(ac,fn,privdata,(char*)cmd,len);
+}
+
+/* Same as redisAsyncCommand(), rendering a compiled template straight into
+ * the output buffer. The command is not inspected, so templates must not
+ * be used for (P)SUBSCRIBE and (P)UNSUBSCRIBE. */
+int redisvAsyncTemplateCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const redisCommandTemplate *t, va_list ap) {
+    redisContext *c = &(ac->c);
+    redisCallback cb;
+
+    /* Don't accept new commands when the connection is about to be closed. */
+    if (c->flags & (REDIS_DISCONNECTING | REDIS_FREEING)) return REDIS_ERR;
+
+    if (redisvAppendTemplate(c,t,ap) != REDIS_OK)
+        return REDIS_ERR;
+
+    cb.fn = fn;
+    cb.privdata = privdata;
+    if (c->flags & REDIS_SUBSCRIBED)
+        __redisPushCallback(&ac->sub.invalid,&cb);
+    else
+        __redisPushCallback(&ac->replies,&cb);
+
+    /* Always schedule a write when the write buffer is non-empty */
+    _EL_ADD_WRITE(ac);
+
+    return REDIS_OK;
+}
+
+int redisAsyncTemplateCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const redisCommandTemplate *t, ...) {
+    va_list ap;
+    int status;
+    va_start(ap,t);
+    status = redisvAsyncTemplateCommand(ac,fn,privdata,t,ap);
+    va_end(ap);
+    return status;
+}
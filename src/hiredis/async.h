@@ -117,6 +117,9 @@ void redisAsyncHandleWrite(redisAsyncContext *ac);
 int redisvAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const char *format, va_list ap);
 int redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const char *format, ...);
 int redisAsyncCommandArgv(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen);
+int redisAsyncFormattedCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len);
+int redisvAsyncTemplateCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const redisCommandTemplate *t, va_list ap);
+int redisAsyncTemplateCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const redisCommandTemplate *t, ...);
 
 #ifdef __cplusplus
 }
@@ -46,6 +46,13 @@ static void *createStringObject(const redisReadTask *task, char *str, size_t len
 static void *createArrayObject(const redisReadTask *task, int elements);
 static void *createIntegerObject(const redisReadTask *task, long long value);
 static void *createNilObject(const redisReadTask *task);
+static void *drainStringObject(const redisReadTask *task, char *str, size_t len);
+static void drainFreeObject(void *reply);
+static void *arenaStringObject(const redisReadTask *task, char *str, size_t len);
+static void *arenaArrayObject(const redisReadTask *task, int elements);
+static void *arenaIntegerObject(const redisReadTask *task, long long value);
+static void *arenaNilObject(const redisReadTask *task);
+static void freeReplyArena(redisReplyArena *a);
 
 /* Default set of functions to build the reply. Keep in mind that such a
  * function returning NULL is interpreted as OOM. */
@@ -57,6 +64,28 @@ static redisReplyObjectFunctions defaultFunctions = {
     freeReplyObject
 };
 
+/* Functions for a reader in drain mode. Only error strings are looked at,
+ * everything else falls back to the type placeholders the reader uses when
+ * no function is set, so nothing is allocated and nothing needs freeing. */
+static redisReplyObjectFunctions drainFunctions = {
+    drainStringObject,
+    NULL,
+    NULL,
+    NULL,
+    drainFreeObject
+};
+
+/* Functions for a reader in arena mode. Each reply, including the strings
+ * and element vectors of its children, is carved out of a few large blocks
+ * and freeReplyObject() releases all of it at once. */
+static redisReplyObjectFunctions arenaFunctions = {
+    arenaStringObject,
+    arenaArrayObject,
+    arenaIntegerObject,
+    arenaNilObject,
+    freeReplyObject
+};
+
 /* Create a reply object */
 static redisReply *createReplyObject(int type) {
     redisReply *r = calloc(1,sizeof(*r));
@@ -73,6 +102,11 @@ void freeReplyObject(void *reply) {
     redisReply *r = reply;
     size_t j;
 
+    if (r->arena != NULL) {
+        freeReplyArena(r->arena);
+        return;
+    }
+
     switch(r->type) {
     case REDIS_REPLY_INTEGER:
         break; /* Nothing to free */
@@ -126,6 +160,30 @@ static void *createStringObject(const redisReadTask *task, char *str, size_t len
     return r;
 }
 
+static void *drainStringObject(const redisReadTask *task, char *str, size_t len) {
+    redisDrainErrors *e = task->privdata;
+
+    if (task->type == REDIS_REPLY_ERROR && e != NULL) {
+        if (e->onError != NULL && e->onError(e->privdata,e->replies,str,len))
+            return (void*)(size_t)task->type;
+        if (e->kept < REDIS_DRAIN_ERRORS) {
+            if (len > sizeof(e->str[0])-1)
+                len = sizeof(e->str[0])-1;
+            memcpy(e->str[e->kept],str,len);
+            e->str[e->kept][len] = '\0';
+            e->kept++;
+        }
+        e->count++;
+    }
+    return (void*)(size_t)task->type;
+}
+
+/* Placeholders own nothing. This is set so that code which frees every
+ * reply through the reader's functions, like async.c, works in drain mode. */
+static void drainFreeObject(void *reply) {
+    ((void)reply);
+}
+
 static void *createArrayObject(const redisReadTask *task, int elements) {
     redisReply *r, *parent;
 
@@ -183,6 +241,147 @@ static void *createNilObject(const redisReadTask *task) {
     return r;
 }
 
+#define REDIS_ARENA_ALIGN(_n) (((_n)+sizeof(long long)-1) & ~(sizeof(long long)-1))
+#define REDIS_ARENA_MIN 4096
+
+static void freeReplyArena(redisReplyArena *a) {
+    redisReplyArena *next;
+
+    while (a != NULL) {
+        next = a->next;
+        free(a);
+        a = next;
+    }
+}
+
+/* Take len bytes from the arena whose first chunk is head. The chunk being
+ * filled is always head->next (or head itself while it is the only one),
+ * so chunks are only ever appended right behind head. */
+static void *arenaAlloc(redisReplyArena *head, size_t len) {
+    redisReplyArena *cur = head->next ? head->next : head;
+    redisReplyArena *chunk;
+    size_t size;
+    void *p;
+
+    len = REDIS_ARENA_ALIGN(len);
+    if (cur->size - cur->used < len) {
+        size = cur->size*2;
+        if (size < len) size = len;
+        chunk = malloc(REDIS_ARENA_ALIGN(sizeof(*chunk))+size);
+        if (chunk == NULL)
+            return NULL;
+        chunk->next = head->next;
+        chunk->used = 0;
+        chunk->size = size;
+        head->next = chunk;
+        cur = chunk;
+    }
+    p = (char*)cur + REDIS_ARENA_ALIGN(sizeof(*cur)) + cur->used;
+    cur->used += len;
+    return p;
+}
+
+/* The arena of the reply task belongs to. Only valid for tasks below the
+ * root, whose ancestors already have their objects. */
+static redisReplyArena *arenaOfTask(const redisReadTask *task) {
+    while (task->parent != NULL)
+        task = task->parent;
+    return ((redisReply*)task->obj)->arena;
+}
+
+/* Allocate a reply node for task. The root of a reply gets a fresh arena
+ * sized by hint, children are allocated from the root's arena. Only the
+ * root carries the arena, so children must never be freed on their own. */
+static redisReply *arenaReplyObject(const redisReadTask *task, int type, size_t hint) {
+    redisReplyArena *a;
+    redisReply *r, *parent;
+    size_t size;
+
+    if (task->parent == NULL) {
+        size = REDIS_ARENA_ALIGN(sizeof(*r))+hint;
+        a = malloc(REDIS_ARENA_ALIGN(sizeof(*a))+size);
+        if (a == NULL)
+            return NULL;
+        a->next = NULL;
+        a->used = 0;
+        a->size = size;
+        r = arenaAlloc(a,sizeof(*r));
+        memset(r,0,sizeof(*r));
+        r->arena = a;
+    } else {
+        r = arenaAlloc(arenaOfTask(task),sizeof(*r));
+        if (r == NULL)
+            return NULL;
+        memset(r,0,sizeof(*r));
+        parent = task->parent->obj;
+        assert(parent->type == REDIS_REPLY_ARRAY);
+        parent->element[task->idx] = r;
+    }
+    r->type = type;
+    return r;
+}
+
+static void *arenaStringObject(const redisReadTask *task, char *str, size_t len) {
+    redisReply *r;
+
+    r = arenaReplyObject(task,task->type,REDIS_ARENA_ALIGN(len+1));
+    if (r == NULL)
+        return NULL;
+
+    r->str = arenaAlloc(r->arena ? r->arena : arenaOfTask(task),len+1);
+    if (r->str == NULL) {
+        /* Below the root the reader frees the whole reply on OOM. */
+        if (r->arena) freeReplyArena(r->arena);
+        return NULL;
+    }
+    memcpy(r->str,str,len);
+    r->str[len] = '\0';
+    r->len = len;
+    return r;
+}
+
+static void *arenaArrayObject(const redisReadTask *task, int elements) {
+    redisReply *r;
+    size_t hint = 0;
+
+    /* Guess at the room the elements will take so that a typical reply of
+     * short strings fits in the first chunk. */
+    if (elements > 0)
+        hint = (size_t)elements*(sizeof(redisReply*)+REDIS_ARENA_ALIGN(sizeof(redisReply))+64);
+    if (hint < REDIS_ARENA_MIN)
+        hint = REDIS_ARENA_MIN;
+
+    r = arenaReplyObject(task,REDIS_REPLY_ARRAY,hint);
+    if (r == NULL)
+        return NULL;
+
+    if (elements > 0) {
+        r->element = arenaAlloc(r->arena ? r->arena : arenaOfTask(task),
+                                elements*sizeof(redisReply*));
+        if (r->element == NULL) {
+            if (r->arena) freeReplyArena(r->arena);
+            return NULL;
+        }
+        memset(r->element,0,elements*sizeof(redisReply*));
+    }
+    r->elements = elements;
+    return r;
+}
+
+static void *arenaIntegerObject(const redisReadTask *task, long long value) {
+    redisReply *r;
+
+    r = arenaReplyObject(task,REDIS_REPLY_INTEGER,0);
+    if (r == NULL)
+        return NULL;
+    r->integer = value;
+    return r;
+}
+
+static void *arenaNilObject(const redisReadTask *task) {
+    return arenaReplyObject(task,REDIS_REPLY_NIL,0);
+}
+
 static void __redisReaderSetError(redisReader *r, int type, const char *str) {
     size_t len;
 
@@ -446,10 +645,10 @@ static int processMultiBulkItem(redisReader *r) {
     long elements;
     int root = 0;
 
-    /* Set error for nested multi bulks with depth > 1 */
-    if (r->ridx == 2) {
+    /* Set error for nested multi bulks with depth > 7 */
+    if (r->ridx == 8) {
         __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
-            "No support for nested multi bulk replies with depth > 1");
+            "No support for nested multi bulk replies with depth > 7");
         return REDIS_ERR;
     }
 
@@ -646,9 +845,14 @@ int redisReaderGetReply(redisReader *r, void **reply) {
     if (r->err)
         return REDIS_ERR;
 
-    /* Discard part of the buffer when we've consumed at least 1k, to avoid
-     * doing unnecessary calls to memmove() in sds.c. */
-    if (r->pos >= 1024) {
+    /* Discard the consumed part of the buffer. When everything has been
+     * consumed this is free. Otherwise the remainder is only moved once it
+     * is no larger than what was consumed, which keeps the total amount of
+     * memmove() in sds.c linear in the bytes read. */
+    if (r->pos == r->len) {
+        sdsclear(r->buf);
+        r->pos = r->len = 0;
+    } else if (r->pos >= 1024 && r->pos >= r->len - r->pos) {
         r->buf = sdsrange(r->buf,r->pos,-1);
         r->pos = 0;
         r->len = sdslen(r->buf);
@@ -663,6 +867,44 @@ int redisReaderGetReply(redisReader *r, void **reply) {
     return REDIS_OK;
 }
 
+/* Put the reader in drain mode: replies are still parsed but no objects are
+ * built, redisReaderGetReply only hands out placeholders, and error replies
+ * are recorded in errors (which may be NULL). This is meant for pipelines
+ * whose replies are never looked at, and should be set before the first
+ * reply is read since objects of both kinds cannot be mixed in one reply. */
+void redisReaderSetDrain(redisReader *r, redisDrainErrors *errors) {
+    r->fn = &drainFunctions;
+    r->privdata = errors;
+}
+
+/* Put the reader in arena mode: each reply is built in a few large blocks
+ * instead of one allocation per object and string. The replies are freed
+ * with freeReplyObject() as usual, which takes a single pass over the
+ * blocks. This pays off for large array replies. */
+void redisReaderSetArena(redisReader *r) {
+    r->fn = &arenaFunctions;
+}
+
+/* Consume up to max complete replies from a reader in drain mode. Returns
+ * the number of replies consumed, or REDIS_ERR. */
+int redisReaderDrain(redisReader *r, int max) {
+    redisDrainErrors *e = r->privdata;
+    void *aux;
+    int n = 0;
+
+    assert(r->fn == &drainFunctions);
+    while (n < max) {
+        if (redisReaderGetReply(r,&aux) == REDIS_ERR)
+            return REDIS_ERR;
+        if (aux == NULL)
+            break;
+        n++;
+        if (e != NULL)
+            e->replies++;
+    }
+    return n;
+}
+
 /* Calculate the number of bytes needed to represent an integer as string. */
 static int intlen(int i) {
     int len = 0;
@@ -968,6 +1210,441 @@ int redisFormatCommandArgv(char **target, int argc, const char **argv, const siz
     return totlen;
 }
 
+/* Command templates: a format as accepted by redisFormatCommand() parsed
+ * once into a list of arguments, each made of literal bytes and
+ * conversions. Rendering one only fetches the arguments and copies bytes,
+ * and can write straight into a context's output buffer. */
+#define REDIS_TPL_RAW 0 /* Literal bytes */
+#define REDIS_TPL_STRING 1 /* %s */
+#define REDIS_TPL_BINARY 2 /* %b */
+#define REDIS_TPL_INT 3 /* %d or %i, rendered without printf */
+#define REDIS_TPL_LONG 4 /* %ld or %li */
+#define REDIS_TPL_LONGLONG 5 /* %lld or %lli */
+#define REDIS_TPL_PRINTF 6 /* Any other conversion, rendered by snprintf */
+
+/* Type to fetch with va_arg for a REDIS_TPL_PRINTF piece */
+#define REDIS_TPL_ARG_INT 0
+#define REDIS_TPL_ARG_UINT 1
+#define REDIS_TPL_ARG_LONG 2
+#define REDIS_TPL_ARG_ULONG 3
+#define REDIS_TPL_ARG_LONGLONG 4
+#define REDIS_TPL_ARG_ULONGLONG 5
+#define REDIS_TPL_ARG_DOUBLE 6
+
+/* Room for the rendered numbers of one command */
+#define REDIS_TPL_SCRATCH 2048
+
+typedef struct redisTemplatePiece {
+    int type;
+    int argtype; /* REDIS_TPL_ARG_* for REDIS_TPL_PRINTF */
+    char *str; /* Literal bytes, or the printf conversion */
+    size_t len;
+} redisTemplatePiece;
+
+typedef struct redisTemplateArg {
+    int first; /* Index of the first piece */
+    int count; /* Number of pieces */
+    int framed; /* The only piece already holds "$<len>\r\n...\r\n" */
+} redisTemplateArg;
+
+struct redisCommandTemplate {
+    char header[16]; /* "*<argc>\r\n" */
+    size_t headerlen;
+    int argc;
+    redisTemplateArg *arg;
+    int npieces;
+    redisTemplatePiece *piece;
+};
+
+static int templateAddPiece(redisCommandTemplate *t, int type, int argtype,
+                            const char *str, size_t len) {
+    redisTemplatePiece *newpiece, *p;
+
+    if (t->npieces == REDIS_TEMPLATE_MAX_PIECES)
+        return REDIS_ERR;
+
+    /* Literal bytes right after literal bytes extend the same piece. */
+    if (type == REDIS_TPL_RAW && t->npieces > t->arg[t->argc].first &&
+        t->piece[t->npieces-1].type == REDIS_TPL_RAW)
+    {
+        p = &t->piece[t->npieces-1];
+        p->str = sdscatlen(p->str,str,len);
+        if (p->str == NULL)
+            return REDIS_ERR;
+        p->len = sdslen(p->str);
+        return REDIS_OK;
+    }
+
+    newpiece = realloc(t->piece,sizeof(*p)*(t->npieces+1));
+    if (newpiece == NULL)
+        return REDIS_ERR;
+    t->piece = newpiece;
+    p = &t->piece[t->npieces++];
+    p->type = type;
+    p->argtype = argtype;
+    p->str = sdsnewlen(str,len);
+    if (p->str == NULL) {
+        t->npieces--;
+        return REDIS_ERR;
+    }
+    p->len = len;
+    t->arg[t->argc].count++;
+    return REDIS_OK;
+}
+
+/* Close the argument being built. Arguments without conversions are framed
+ * as a bulk string right away. */
+static int templateEndArg(redisCommandTemplate *t) {
+    redisTemplateArg *a = &t->arg[t->argc];
+    redisTemplateArg *newarg;
+    redisTemplatePiece *p;
+    sds framed;
+
+    if (a->count == 1 && t->piece[a->first].type == REDIS_TPL_RAW) {
+        p = &t->piece[a->first];
+        framed = sdscatprintf(sdsempty(),"$%zu\r\n",p->len);
+        if (framed == NULL)
+            return REDIS_ERR;
+        framed = sdscatlen(framed,p->str,p->len);
+        if (framed == NULL)
+            return REDIS_ERR;
+        framed = sdscatlen(framed,"\r\n",2);
+        if (framed == NULL)
+            return REDIS_ERR;
+        sdsfree(p->str);
+        p->str = framed;
+        p->len = sdslen(framed);
+        a->framed = 1;
+    }
+
+    newarg = realloc(t->arg,sizeof(*a)*(t->argc+2));
+    if (newarg == NULL)
+        return REDIS_ERR;
+    t->arg = newarg;
+    t->argc++;
+    t->arg[t->argc].first = t->npieces;
+    t->arg[t->argc].count = 0;
+    t->arg[t->argc].framed = 0;
+    return REDIS_OK;
+}
+
+/* Parse the printf conversion starting at c (which points at the '%') the
+ * same way redisvFormatCommand() does. Returns the length of the
+ * conversion, or 0 when it is not supported. */
+static size_t templateParseConversion(const char *c, int *type, int *argtype) {
+    const char *_p = c+1;
+    int plain = 1;
+    int size = 0; /* 0: int, 1: long, 2: long long */
+
+    /* Flags */
+    if (*_p != '\0' && *_p == '#') { _p++; plain = 0; }
+    if (*_p != '\0' && *_p == '0') { _p++; plain = 0; }
+    if (*_p != '\0' && *_p == '-') { _p++; plain = 0; }
+    if (*_p != '\0' && *_p == ' ') { _p++; plain = 0; }
+    if (*_p != '\0' && *_p == '+') { _p++; plain = 0; }
+
+    /* Field width */
+    while (*_p != '\0' && isdigit(*_p)) { _p++; plain = 0; }
+
+    /* Precision */
+    if (*_p == '.') {
+        _p++;
+        plain = 0;
+        while (*_p != '\0' && isdigit(*_p)) _p++;
+    }
+
+    if (strchr("eEfFgGaA",*_p) != NULL && *_p != '\0') {
+        *type = REDIS_TPL_PRINTF;
+        *argtype = REDIS_TPL_ARG_DOUBLE;
+        return (_p+1)-c;
+    }
+
+    if (_p[0] == 'h' && _p[1] == 'h') {
+        _p += 2;
+        plain = 0;
+    } else if (_p[0] == 'h') {
+        _p += 1;
+        plain = 0;
+    } else if (_p[0] == 'l' && _p[1] == 'l') {
+        _p += 2;
+        size = 2;
+    } else if (_p[0] == 'l') {
+        _p += 1;
+        size = 1;
+    }
+
+    if (*_p == '\0' || strchr("diouxX",*_p) == NULL)
+        return 0;
+
+    if (plain && (*_p == 'd' || *_p == 'i')) {
+        *type = size == 0 ? REDIS_TPL_INT :
+                size == 1 ? REDIS_TPL_LONG : REDIS_TPL_LONGLONG;
+    } else {
+        *type = REDIS_TPL_PRINTF;
+        if (*_p == 'd' || *_p == 'i')
+            *argtype = size == 0 ? REDIS_TPL_ARG_INT :
+                       size == 1 ? REDIS_TPL_ARG_LONG : REDIS_TPL_ARG_LONGLONG;
+        else
+            *argtype = size == 0 ? REDIS_TPL_ARG_UINT :
+                       size == 1 ? REDIS_TPL_ARG_ULONG : REDIS_TPL_ARG_ULONGLONG;
+    }
+    return (_p+1)-c;
+}
+
+/* Compile a format as accepted by redisCommand() into a template. Returns
+ * NULL when the format is invalid or has more than REDIS_TEMPLATE_MAX_PIECES
+ * literal runs and conversions. */
+redisCommandTemplate *redisCompileCommand(const char *format) {
+    redisCommandTemplate *t;
+    const char *c = format;
+    size_t len;
+    int type, argtype = 0, j;
+
+    t = calloc(1,sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    t->arg = calloc(1,sizeof(*t->arg));
+    if (t->arg == NULL)
+        goto err;
+
+    while (*c != '\0') {
+        if (*c != '%' || c[1] == '\0') {
+            if (*c == ' ') {
+                if (t->arg[t->argc].count > 0 && templateEndArg(t) != REDIS_OK)
+                    goto err;
+            } else if (templateAddPiece(t,REDIS_TPL_RAW,0,c,1) != REDIS_OK) {
+                goto err;
+            }
+            c++;
+            continue;
+        }
+
+        switch (c[1]) {
+        case 's':
+            type = REDIS_TPL_STRING;
+            len = 2;
+            break;
+        case 'b':
+            type = REDIS_TPL_BINARY;
+            len = 2;
+            break;
+        case '%':
+            type = REDIS_TPL_RAW;
+            len = 2;
+            break;
+        default:
+            len = templateParseConversion(c,&type,&argtype);
+            if (len == 0 || len >= 14)
+                goto err;
+            break;
+        }
+
+        if (type == REDIS_TPL_RAW) {
+            if (templateAddPiece(t,REDIS_TPL_RAW,0,"%",1) != REDIS_OK)
+                goto err;
+        } else if (templateAddPiece(t,type,argtype,c,len) != REDIS_OK) {
+            goto err;
+        }
+        c += len;
+    }
+
+    if (t->arg[t->argc].count > 0 && templateEndArg(t) != REDIS_OK)
+        goto err;
+
+    t->headerlen = sprintf(t->header,"*%d\r\n",t->argc);
+    return t;
+
+err:
+    for (j = 0; j < t->npieces; j++)
+        sdsfree(t->piece[j].str);
+    free(t->piece);
+    free(t->arg);
+    free(t);
+    return NULL;
+}
+
+void redisFreeCommandTemplate(redisCommandTemplate *t) {
+    int j;
+
+    if (t == NULL)
+        return;
+    for (j = 0; j < t->npieces; j++)
+        sdsfree(t->piece[j].str);
+    free(t->piece);
+    free(t->arg);
+    free(t);
+}
+
+/* Render v in decimal at the end of buf, returning where it starts. */
+static char *templateRenderLong(char *end, long long v) {
+    unsigned long long u = v < 0 ? -(unsigned long long)v : (unsigned long long)v;
+    char *p = end;
+
+    do {
+        *--p = '0'+(u%10);
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        *--p = '-';
+    return p;
+}
+
+typedef struct redisTemplateValue {
+    const char *str;
+    size_t len;
+} redisTemplateValue;
+
+/* Fetch the arguments of t from ap and work out what every piece expands
+ * to. Numbers are rendered into scratch. Returns the length of the whole
+ * command, or -1 when a number does not fit in scratch. */
+static long templateCollect(const redisCommandTemplate *t, va_list ap,
+                            redisTemplateValue *v, char *scratch) {
+    const redisTemplatePiece *p;
+    char *sp = scratch;
+    char *end;
+    long total = t->headerlen;
+    size_t arglen;
+    int a, j, n;
+
+    for (a = 0; a < t->argc; a++) {
+        arglen = 0;
+        for (j = t->arg[a].first; j < t->arg[a].first+t->arg[a].count; j++) {
+            p = &t->piece[j];
+            switch (p->type) {
+            case REDIS_TPL_RAW:
+                v[j].str = p->str;
+                v[j].len = p->len;
+                break;
+            case REDIS_TPL_STRING:
+                v[j].str = va_arg(ap,char*);
+                v[j].len = strlen(v[j].str);
+                break;
+            case REDIS_TPL_BINARY:
+                v[j].str = va_arg(ap,char*);
+                v[j].len = va_arg(ap,size_t);
+                break;
+            case REDIS_TPL_INT:
+            case REDIS_TPL_LONG:
+            case REDIS_TPL_LONGLONG:
+                if (sp+21 > scratch+REDIS_TPL_SCRATCH)
+                    return -1;
+                end = sp+21;
+                if (p->type == REDIS_TPL_INT)
+                    v[j].str = templateRenderLong(end,va_arg(ap,int));
+                else if (p->type == REDIS_TPL_LONG)
+                    v[j].str = templateRenderLong(end,va_arg(ap,long));
+                else
+                    v[j].str = templateRenderLong(end,va_arg(ap,long long));
+                v[j].len = end-v[j].str;
+                sp = end;
+                break;
+            default:
+                n = REDIS_TPL_SCRATCH-(sp-scratch);
+                switch (p->argtype) {
+                case REDIS_TPL_ARG_INT: n = snprintf(sp,n,p->str,va_arg(ap,int)); break;
+                case REDIS_TPL_ARG_UINT: n = snprintf(sp,n,p->str,va_arg(ap,unsigned int)); break;
+                case REDIS_TPL_ARG_LONG: n = snprintf(sp,n,p->str,va_arg(ap,long)); break;
+                case REDIS_TPL_ARG_ULONG: n = snprintf(sp,n,p->str,va_arg(ap,unsigned long)); break;
+                case REDIS_TPL_ARG_LONGLONG: n = snprintf(sp,n,p->str,va_arg(ap,long long)); break;
+                case REDIS_TPL_ARG_ULONGLONG: n = snprintf(sp,n,p->str,va_arg(ap,unsigned long long)); break;
+                default: n = snprintf(sp,n,p->str,va_arg(ap,double)); break;
+                }
+                if (n < 0 || n >= REDIS_TPL_SCRATCH-(sp-scratch))
+                    return -1;
+                v[j].str = sp;
+                v[j].len = n;
+                sp += n;
+                break;
+            }
+            arglen += v[j].len;
+        }
+        total += t->arg[a].framed ? arglen : bulklen(arglen);
+    }
+    return total;
+}
+
+/* Write the command described by t and v to buf, which has room for it. */
+static void templateWrite(const redisCommandTemplate *t, const redisTemplateValue *v, char *buf) {
+    char num[21];
+    char *start;
+    size_t arglen;
+    int a, j, first, last;
+
+    memcpy(buf,t->header,t->headerlen);
+    buf += t->headerlen;
+    for (a = 0; a < t->argc; a++) {
+        first = t->arg[a].first;
+        last = first+t->arg[a].count;
+        if (!t->arg[a].framed) {
+            arglen = 0;
+            for (j = first; j < last; j++)
+                arglen += v[j].len;
+            start = templateRenderLong(num+sizeof(num),arglen);
+            *buf++ = '$';
+            memcpy(buf,start,num+sizeof(num)-start);
+            buf += num+sizeof(num)-start;
+            *buf++ = '\r';
+            *buf++ = '\n';
+        }
+        for (j = first; j < last; j++) {
+            memcpy(buf,v[j].str,v[j].len);
+            buf += v[j].len;
+        }
+        if (!t->arg[a].framed) {
+            *buf++ = '\r';
+            *buf++ = '\n';
+        }
+    }
+}
+
+/* Same as redisvFormatCommand(), for a compiled template. */
+int redisvFormatTemplate(char **target, const redisCommandTemplate *t, va_list ap) {
+    redisTemplateValue v[REDIS_TEMPLATE_MAX_PIECES];
+    char scratch[REDIS_TPL_SCRATCH];
+    char *cmd;
+    long totlen;
+
+    if (target == NULL)
+        return -1;
+
+    totlen = templateCollect(t,ap,v,scratch);
+    if (totlen < 0)
+        return -1;
+    cmd = malloc(totlen+1);
+    if (cmd == NULL)
+        return -1;
+    templateWrite(t,v,cmd);
+    cmd[totlen] = '\0';
+
+    *target = cmd;
+    return totlen;
+}
+
+/* Render t into buf when the command fits in size bytes. Returns the
+ * length of the command either way, so a caller that got more than size
+ * back can make room and try again with a copy of ap. No terminating nul
+ * is written. Returns -1 on error. */
+long redisvFormatTemplateBuf(char *buf, size_t size, const redisCommandTemplate *t, va_list ap) {
+    redisTemplateValue v[REDIS_TEMPLATE_MAX_PIECES];
+    char scratch[REDIS_TPL_SCRATCH];
+    long totlen;
+
+    totlen = templateCollect(t,ap,v,scratch);
+    if (totlen >= 0 && (size_t)totlen <= size)
+        templateWrite(t,v,buf);
+    return totlen;
+}
+
+int redisFormatTemplate(char **target, const redisCommandTemplate *t, ...) {
+    va_list ap;
+    int len;
+
+    va_start(ap,t);
+    len = redisvFormatTemplate(target,t,ap);
+    va_end(ap);
+    return len;
+}
+
 void __redisSetError(redisContext *c, int type, const char *str) {
     size_t len;
 
@@ -1063,17 +1740,34 @@ int redisSetTimeout(redisContext *c, struct timeval tv) {
 /* Use this function to handle a read event on the descriptor. It will try
  * and read some bytes from the socket and feed them to the reply parser.
  *
+ * The bytes are read straight into the free space at the end of the
+ * reader's buffer, which is kept at least REDIS_READER_CHUNK large, so a
+ * burst of pipelined replies takes few read() calls and no extra copy.
+ *
  * After this function is called, you may use redisContextReadReply to
  * see if there is a reply available. */
 int redisBufferRead(redisContext *c) {
-    char buf[2048];
+    redisReader *r = c->reader;
+    sds newbuf;
     int nread;
 
     /* Return early when the context has seen an error. */
     if (c->err)
         return REDIS_ERR;
 
-    nread = read(c->fd,buf,sizeof(buf));
+    if (r->err) {
+        __redisSetError(c,r->err,r->errstr);
+        return REDIS_ERR;
+    }
+
+    newbuf = sdsMakeRoomFor(r->buf,REDIS_READER_CHUNK);
+    if (newbuf == NULL) {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    r->buf = newbuf;
+
+    nread = read(c->fd,r->buf+sdslen(r->buf),sdsavail(r->buf));
     if (nread == -1) {
         if (errno == EAGAIN && !(c->flags & REDIS_BLOCK)) {
             /* Try again later */
@@ -1085,15 +1779,20 @@ int redisBufferRead(redisContext *c) {
         __redisSetError(c,REDIS_ERR_EOF,"Server closed the connection");
         return REDIS_ERR;
     } else {
-        if (redisReaderFeed(c->reader,buf,nread) != REDIS_OK) {
-            __redisSetError(c,c->reader->err,c->reader->errstr);
-            return REDIS_ERR;
-        }
+        sdsIncrLen(r->buf,nread);
+        r->len = sdslen(r->buf);
     }
     return REDIS_OK;
 }
 
 /* Write the output buffer to the socket.
+ *
+ * Written bytes are not removed from the buffer; c->opos tracks how far
+ * the socket has consumed it. The buffer is emptied (not freed) once it
+ * has been written completely, and the unwritten tail is only moved to
+ * the front once it is no larger than what was already written, so
+ * flushing a large pipeline costs a few write() calls and no quadratic
+ * memmove().
  *
  * Returns REDIS_OK when the buffer is empty, or (a part of) the buffer was
  * succesfully written to the socket. When the buffer is empty after the
@@ -1109,8 +1808,8 @@ int redisBufferWrite(redisContext *c, int *done) {
     if (c->err)
         return REDIS_ERR;
 
-    if (sdslen(c->obuf) > 0) {
-        nwritten = write(c->fd,c->obuf,sdslen(c->obuf));
+    if (sdslen(c->obuf) > c->opos) {
+        nwritten = write(c->fd,c->obuf+c->opos,sdslen(c->obuf)-c->opos);
         if (nwritten == -1) {
             if (errno == EAGAIN && !(c->flags & REDIS_BLOCK)) {
                 /* Try again later */
@@ -1119,11 +1818,20 @@ int redisBufferWrite(redisContext *c, int *done) {
                 return REDIS_ERR;
             }
         } else if (nwritten > 0) {
-            if (nwritten == (signed)sdslen(c->obuf)) {
-                sdsfree(c->obuf);
-                c->obuf = sdsempty();
-            } else {
-                c->obuf = sdsrange(c->obuf,nwritten,-1);
+            c->opos += nwritten;
+            if (c->opos == sdslen(c->obuf)) {
+                /* Keep the memory for the next batch unless it got huge. */
+                if (sdslen(c->obuf)+sdsavail(c->obuf) > REDIS_OBUF_KEEP) {
+                    sdsfree(c->obuf);
+                    c->obuf = sdsempty();
+                } else {
+                    sdsclear(c->obuf);
+                }
+                c->opos = 0;
+            } else if (c->opos >= REDIS_WRITER_CHUNK &&
+                       c->opos >= sdslen(c->obuf)-c->opos) {
+                c->obuf = sdsrange(c->obuf,c->opos,-1);
+                c->opos = 0;
             }
         }
     }
@@ -1141,6 +1849,14 @@ int redisGetReplyFromReader(redisContext *c, void **reply) {
     return REDIS_OK;
 }
 
+int redisDrainReplies(redisContext *c, int max) {
+    int n = redisReaderDrain(c->reader,max);
+
+    if (n == REDIS_ERR)
+        __redisSetError(c,c->reader->err,c->reader->errstr);
+    return n;
+}
+
 int redisGetReply(redisContext *c, void **reply) {
     int wdone = 0;
     void *aux = NULL;
@@ -1191,6 +1907,11 @@ int __redisAppendCommand(redisContext *c, char *cmd, size_t len) {
     return REDIS_OK;
 }
 
+/* Append a command that is already encoded in the Redis protocol. */
+int redisAppendFormattedCommand(redisContext *c, const char *cmd, size_t len) {
+    return __redisAppendCommand(c,(char*)cmd,len);
+}
+
 int redisvAppendCommand(redisContext *c, const char *format, va_list ap) {
     char *cmd;
     int len;
@@ -1220,6 +1941,40 @@ int redisAppendCommand(redisContext *c, const char *format, ...) {
     return ret;
 }
 
+/* Render a compiled template straight into the output buffer. */
+int redisvAppendTemplate(redisContext *c, const redisCommandTemplate *t, va_list ap) {
+    redisTemplateValue v[REDIS_TEMPLATE_MAX_PIECES];
+    char scratch[REDIS_TPL_SCRATCH];
+    long totlen;
+    sds newbuf;
+
+    totlen = templateCollect(t,ap,v,scratch);
+    if (totlen < 0) {
+        __redisSetError(c,REDIS_ERR_OTHER,"Template argument too long");
+        return REDIS_ERR;
+    }
+
+    newbuf = sdsMakeRoomFor(c->obuf,totlen);
+    if (newbuf == NULL) {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    c->obuf = newbuf;
+    templateWrite(t,v,c->obuf+sdslen(c->obuf));
+    sdsIncrLen(c->obuf,totlen);
+    return REDIS_OK;
+}
+
+int redisAppendTemplate(redisContext *c, const redisCommandTemplate *t, ...) {
+    va_list ap;
+    int ret;
+
+    va_start(ap,t);
+    ret = redisvAppendTemplate(c,t,ap);
+    va_end(ap);
+    return ret;
+}
+
 int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen) {
     char *cmd;
     int len;
@@ -1276,6 +2031,21 @@ void *redisCommand(redisContext *c, const char *format, ...) {
     return reply;
 }
 
+void *redisvTemplateCommand(redisContext *c, const redisCommandTemplate *t, va_list ap) {
+    if (redisvAppendTemplate(c,t,ap) != REDIS_OK)
+        return NULL;
+    return __redisBlockForReply(c);
+}
+
+void *redisTemplateCommand(redisContext *c, const redisCommandTemplate *t, ...) {
+    va_list ap;
+    void *reply = NULL;
+    va_start(ap,t);
+    reply = redisvTemplateCommand(c,t,ap);
+    va_end(ap);
+    return reply;
+}
+
 void *redisCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen) {
     if (redisAppendCommandArgv(c,argc,argv,argvlen) != REDIS_OK)
         return NULL;
@@ -76,6 +76,13 @@
 /* Flag that is set when the async context has one or more subscriptions. */
 #define REDIS_SUBSCRIBED 0x20
 
+/* Minimum free space kept in a context's read buffer, the largest
+ * emptied output buffer that is kept around for reuse, and how much of
+ * the output buffer must be written before the rest is moved down. */
+#define REDIS_READER_CHUNK (64*1024)
+#define REDIS_OBUF_KEEP (4*1024*1024)
+#define REDIS_WRITER_CHUNK (64*1024)
+
 #define REDIS_REPLY_STRING 1
 #define REDIS_REPLY_ARRAY 2
 #define REDIS_REPLY_INTEGER 3
@@ -95,8 +102,17 @@ typedef struct redisReply {
     char *str; /* Used for both REDIS_REPLY_ERROR and REDIS_REPLY_STRING */
     size_t elements; /* number of elements, for REDIS_REPLY_ARRAY */
     struct redisReply **element; /* elements vector for REDIS_REPLY_ARRAY */
+    struct redisReplyArena *arena; /* Memory of the whole reply, set on the root of arena replies */
 } redisReply;
 
+/* Memory for one reply read in arena mode. The root reply lives at the
+ * start of the first chunk, further chunks are chained behind it. */
+typedef struct redisReplyArena {
+    struct redisReplyArena *next;
+    size_t used;
+    size_t size;
+} redisReplyArena;
+
 typedef struct redisReadTask {
     int type;
     int elements; /* number of elements in multibulk container */
@@ -114,6 +130,21 @@ typedef struct redisReplyObjectFunctions {
     void (*freeObject)(void*);
 } redisReplyObjectFunctions;
 
+/* Error replies seen by a reader in drain mode. Only the first
+ * REDIS_DRAIN_ERRORS of them are kept, the rest are only counted. When
+ * onError is set it sees every error first, along with the number of
+ * replies redisReaderDrain() consumed before it, and errors it returns
+ * non-zero for are neither kept nor counted. */
+#define REDIS_DRAIN_ERRORS 4
+typedef struct redisDrainErrors {
+    long count; /* Number of error replies seen */
+    int kept; /* Number of entries used in str */
+    char str[REDIS_DRAIN_ERRORS][128];
+    long replies; /* Replies consumed by redisReaderDrain() */
+    int (*onError)(void *privdata, long reply, const char *str, size_t len);
+    void *privdata;
+} redisDrainErrors;
+
 /* State for the protocol parser */
 typedef struct redisReader {
     int err; /* Error flags, 0 when there is no error */
@@ -123,7 +154,7 @@ typedef struct redisReader {
     size_t pos; /* Buffer cursor */
     size_t len; /* Buffer length */
 
-    redisReadTask rstack[3];
+    redisReadTask rstack[9];
     int ridx; /* Index of current read task */
     void *reply; /* Temporary reply pointer */
 
@@ -136,6 +167,9 @@ redisReader *redisReaderCreate(void);
 void redisReaderFree(redisReader *r);
 int redisReaderFeed(redisReader *r, const char *buf, size_t len);
 int redisReaderGetReply(redisReader *r, void **reply);
+void redisReaderSetDrain(redisReader *r, redisDrainErrors *errors);
+void redisReaderSetArena(redisReader *r);
+int redisReaderDrain(redisReader *r, int max);
 
 /* Backwards compatibility, can be removed on big version bump. */
 #define redisReplyReaderCreate redisReaderCreate
@@ -154,6 +188,16 @@ int redisvFormatCommand(char **target, const char *format, va_list ap);
 int redisFormatCommand(char **target, const char *format, ...);
 int redisFormatCommandArgv(char **target, int argc, const char **argv, const size_t *argvlen);
 
+/* A format parsed once by redisCompileCommand() and then rendered for many
+ * argument sets. The arguments are the same as for redisCommand(). */
+#define REDIS_TEMPLATE_MAX_PIECES 64
+typedef struct redisCommandTemplate redisCommandTemplate;
+redisCommandTemplate *redisCompileCommand(const char *format);
+void redisFreeCommandTemplate(redisCommandTemplate *t);
+int redisvFormatTemplate(char **target, const redisCommandTemplate *t, va_list ap);
+int redisFormatTemplate(char **target, const redisCommandTemplate *t, ...);
+long redisvFormatTemplateBuf(char *buf, size_t size, const redisCommandTemplate *t, va_list ap);
+
 /* Context for a connection to Redis */
 typedef struct redisContext {
     int err; /* Error flags, 0 when there is no error */
@@ -161,6 +205,7 @@ typedef struct redisContext {
     int fd;
     int flags;
     char *obuf; /* Write buffer */
+    size_t opos; /* Bytes of obuf already written to the socket */
     redisReader *reader; /* Protocol reader */
 } redisContext;
 
@@ -182,11 +227,19 @@ int redisBufferWrite(redisContext *c, int *done);
 int redisGetReply(redisContext *c, void **reply);
 int redisGetReplyFromReader(redisContext *c, void **reply);
 
+/* For a context whose reader is in drain mode (see redisReaderSetDrain),
+ * consume up to max unconsumed replies without building reply objects and
+ * return how many there were, or REDIS_ERR with the error set. */
+int redisDrainReplies(redisContext *c, int max);
+
 /* Write a command to the output buffer. Use these functions in blocking mode
  * to get a pipeline of commands. */
 int redisvAppendCommand(redisContext *c, const char *format, va_list ap);
 int redisAppendCommand(redisContext *c, const char *format, ...);
 int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen);
+int redisvAppendTemplate(redisContext *c, const redisCommandTemplate *t, va_list ap);
+int redisAppendTemplate(redisContext *c, const redisCommandTemplate *t, ...);
+int redisAppendFormattedCommand(redisContext *c, const char *cmd, size_t len);
 
 /* Issue a command to Redis. In a blocking context, it is identical to calling
  * redisAppendCommand, followed by redisGetReply. The function will return
@@ -196,6 +249,8 @@ int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const s
 void *redisvCommand(redisContext *c, const char *format, va_list ap);
 void *redisCommand(redisContext *c, const char *format, ...);
 void *redisCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen);
+void *redisvTemplateCommand(redisContext *c, const redisCommandTemplate *t, va_list ap);
+void *redisTemplateCommand(redisContext *c, const redisCommandTemplate *t, ...);
 
 #ifdef __cplusplus
 }
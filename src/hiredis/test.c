@@ -200,7 +200,72 @@ static void test_format_commands(void) {
     free(cmd);
 }
 
+/* Render format both ways and compare. */
+#define test_template(_desc, _format, ...) do {                               \
+    redisCommandTemplate *_t;                                                  \
+    char *_a = NULL, *_b = NULL;                                               \
+    int _la, _lb;                                                              \
+    test("Template renders like the format (" _desc "): ");                   \
+    _t = redisCompileCommand(_format);                                        \
+    _la = redisFormatCommand(&_a,_format,__VA_ARGS__);                        \
+    _lb = _t ? redisFormatTemplate(&_b,_t,__VA_ARGS__) : -1;                  \
+    test_cond(_la > 0 && _la == _lb && memcmp(_a,_b,_la) == 0);               \
+    free(_a);                                                                  \
+    free(_b);                                                                  \
+    redisFreeCommandTemplate(_t);                                              \
+} while(0)
+
+static long formatTemplateBuf(char *buf, size_t size, const redisCommandTemplate *t, ...) {
+    va_list ap;
+    long len;
+    va_start(ap,t);
+    len = redisvFormatTemplateBuf(buf,size,t,ap);
+    va_end(ap);
+    return len;
+}
+
+static void test_command_templates(void) {
+    redisCommandTemplate *t;
+    char buf[64];
+    long len;
+
+    test_template("literals","SET foo bar",0);
+    test_template("strings and binary","HMSET %b name %s","file:ab\0cd",(size_t)10,"a path");
+    test_template("empty string","SET %s %s","foo","");
+    test_template("mixed argument","SET key:%s:%d %%",(char*)"x",-42);
+    test_template("integers","ZADD %s %ld %lld %d","mtime",(long)1315257600,
+        (long long)-9223372036854775807LL,7);
+    test_template("printf delegation","SET %08d %.3f %lu %hx",123,1.5,
+        (unsigned long)42,(unsigned short)0xbeef);
+
+    test("Template renders into a caller buffer only when it fits: ");
+    t = redisCompileCommand("SET %s %lld");
+    memset(buf,'x',sizeof(buf));
+    len = formatTemplateBuf(buf,10,t,"foo",(long long)12);
+    assert(len == 30 && buf[0] == 'x');
+    len = formatTemplateBuf(buf,30,t,"foo",(long long)12);
+    test_cond(len == 30 && buf[30] == 'x' &&
+        memcmp(buf,"*3\r\n$3\r\nSET\r\n$3\r\nfoo\r\n$2\r\n12\r\n",30) == 0);
+    redisFreeCommandTemplate(t);
+
+    test("Template rejects an invalid conversion: ");
+    t = redisCompileCommand("SET %w");
+    test_cond(t == NULL);
+}
+
+/* Takes the MOVED errors, marking which replies they were. */
+static int drainMovedOnly(void *privdata, long reply, const char *str, size_t len) {
+    if (len < 6 || memcmp(str,"MOVED ",6) != 0)
+        return 0;
+    *(long*)privdata |= 1L << reply;
+    return 1;
+}
+
 static void test_reply_reader(void) {
+    redisDrainErrors errors;
+    long moved = 0;
+    char big[208];
+    int i;
     redisReader *reader;
     void *reply;
     int ret;
@@ -225,11 +290,10 @@ static void test_reply_reader(void) {
               strcasecmp(reader->errstr,"Protocol error, got \"@\" as reply type byte") == 0);
     redisReaderFree(reader);
 
-    test("Set error on nested multi bulks with depth > 1: ");
+    test("Set error on nested multi bulks with depth > 7: ");
     reader = redisReaderCreate();
-    redisReaderFeed(reader,(char*)"*1\r\n",4);
-    redisReaderFeed(reader,(char*)"*1\r\n",4);
-    redisReaderFeed(reader,(char*)"*1\r\n",4);
+    for (i = 0; i < 9; i++)
+        redisReaderFeed(reader,(char*)"*1\r\n",4);
     ret = redisReaderGetReply(reader,NULL);
     test_cond(ret == REDIS_ERR &&
               strncasecmp(reader->errstr,"No support for",14) == 0);
@@ -274,6 +338,69 @@ static void test_reply_reader(void) {
         ((redisReply*)reply)->elements == 0);
     freeReplyObject(reply);
     redisReaderFree(reader);
+
+    test("Drain mode counts replies and keeps error strings: ");
+    reader = redisReaderCreate();
+    memset(&errors,0,sizeof(errors));
+    redisReaderSetDrain(reader,&errors);
+    redisReaderFeed(reader,(char*)"+OK\r\n:1\r\n-ERR a\r\n*2\r\n$1\r\nx\r\n$-1\r\n",33);
+    redisReaderFeed(reader,(char*)"-ERR b\r\n-ERR c\r\n-ERR d\r\n-ERR e\r\n$3\r\nab",38);
+    ret = redisReaderDrain(reader,100);
+    test_cond(ret == 8 && errors.count == 5 &&
+        errors.kept == REDIS_DRAIN_ERRORS &&
+        strcmp(errors.str[0],"ERR a") == 0 &&
+        strcmp(errors.str[3],"ERR d") == 0);
+
+    test("Drain mode picks up a reply split over two feeds: ");
+    redisReaderFeed(reader,(char*)"c\r\n:2\r\n",7);
+    ret = redisReaderDrain(reader,1);
+    assert(ret == 1);
+    ret = redisReaderDrain(reader,1);
+    test_cond(ret == 1 && redisReaderDrain(reader,1) == 0);
+    redisReaderFree(reader);
+
+    test("Drain mode hands errors to onError with their reply number: ");
+    reader = redisReaderCreate();
+    memset(&errors,0,sizeof(errors));
+    errors.onError = drainMovedOnly;
+    errors.privdata = &moved;
+    redisReaderSetDrain(reader,&errors);
+    redisReaderFeed(reader,(char*)"+OK\r\n-MOVED 1 h:1\r\n-ERR x\r\n-MOVED 2 h:1\r\n",41);
+    ret = redisReaderDrain(reader,100);
+    test_cond(ret == 4 && errors.replies == 4 && moved == 0xa &&
+        errors.count == 1 && strcmp(errors.str[0],"ERR x") == 0);
+    redisReaderFree(reader);
+
+    test("Arena mode builds the same replies: ");
+    reader = redisReaderCreate();
+    redisReaderSetArena(reader);
+    redisReaderFeed(reader,(char*)"*4\r\n$3\r\nfoo\r\n:42\r\n$-1\r\n*1\r\n+OK\r\n",32);
+    ret = redisReaderGetReply(reader,&reply);
+    test_cond(ret == REDIS_OK &&
+        ((redisReply*)reply)->type == REDIS_REPLY_ARRAY &&
+        ((redisReply*)reply)->elements == 4 &&
+        strcmp(((redisReply*)reply)->element[0]->str,"foo") == 0 &&
+        ((redisReply*)reply)->element[1]->integer == 42 &&
+        ((redisReply*)reply)->element[2]->type == REDIS_REPLY_NIL &&
+        strcmp(((redisReply*)reply)->element[3]->element[0]->str,"OK") == 0);
+    freeReplyObject(reply);
+
+    test("Arena mode grows past its first block: ");
+    redisReaderFeed(reader,(char*)"*2000\r\n",7);
+    for (i = 0; i < 2000; i++) {
+        memcpy(big,"$200\r\n",6);
+        memset(big+6,'a'+i%26,200);
+        memcpy(big+206,"\r\n",2);
+        redisReaderFeed(reader,big,208);
+    }
+    ret = redisReaderGetReply(reader,&reply);
+    test_cond(ret == REDIS_OK &&
+        ((redisReply*)reply)->elements == 2000 &&
+        ((redisReply*)reply)->arena->next != NULL &&
+        ((redisReply*)reply)->element[1999]->len == 200 &&
+        ((redisReply*)reply)->element[1999]->str[199] == 'a'+1999%26);
+    freeReplyObject(reply);
+    redisReaderFree(reader);
 }
 
 static void test_blocking_connection_errors(void) {
@@ -627,6 +754,7 @@ int main(int argc, char **argv) {
     }
 
     test_format_commands();
+    test_command_templates();
     test_reply_reader();
     test_blocking_connection_errors();
 
@@ -0,0 +1,398 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <mpi.h>
+
+#include "config.h"
+#include "purgemerge.h"
+
+#include "../common/log.h"
+
+FILE *PURGER_debug_stream;
+PURGER_loglevel PURGER_debug_level;
+int PURGER_global_rank;
+
+/*
+ * The runs in "dir", listed once by rank 0 and sent to the others as
+ * their names back to back. Returns -1 on every rank when rank 0 could
+ * not list them.
+ */
+int
+purgemerge_list(const char *dir, int rank, char ***paths, size_t *count)
+{
+    long long len = 0;
+    char *names = NULL;
+    char *p = NULL;
+    size_t i = 0;
+
+    if(rank == 0)
+    {
+        if(purger_run_list(dir, PURGER_RUN_PREFIX, paths, count) < 0)
+        {
+            LOG(PURGER_LOG_ERR, "Unable to list the runs in %s: %s", dir, strerror(errno));
+            len = -1;
+        }
+        for(i = 0; len >= 0 && i < *count; i++)
+            len += strlen((*paths)[i]) + 1;
+    }
+
+    MPI_Bcast(&len, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    if(len < 0)
+        return -1;
+
+    names = (char *)malloc((size_t)len + 1);
+    if(names == NULL)
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    if(rank == 0)
+        for(i = 0, p = names; i < *count; i++)
+            p = stpcpy(p, (*paths)[i]) + 1;
+
+    MPI_Bcast(names, (int)len, MPI_CHAR, 0, MPI_COMM_WORLD);
+    if(rank != 0)
+    {
+        *count = 0;
+        for(p = names; p < names + len; p += strlen(p) + 1)
+            (*count)++;
+        *paths = (char **)malloc((*count + 1) * sizeof(char *));
+        if(*paths == NULL)
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        for(i = 0, p = names; i < *count; i++, p += strlen(p) + 1)
+            (*paths)[i] = strdup(p);
+    }
+
+    free(names);
+    return 0;
+}
+
+static int
+purgemerge_mtime_cmp(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Pick the mtimes that split the runs into one range per rank. Every mark
+ * of an index stands for PURGER_RUN_STRIDE records, so the marks of all
+ * runs, sorted, are an even sample of the whole. Each rank reads the
+ * indexes of its share of the runs and rank 0 picks from all of them.
+ */
+int
+purgemerge_splitters(char **paths, size_t count, int rank, int ranks, int64_t *split)
+{
+    purger_run_mark_t *marks = NULL;
+    size_t nmarks = 0;
+    int64_t *mine = NULL;
+    int64_t *all = NULL;
+    int *counts = NULL;
+    int *displs = NULL;
+    int64_t *grown = NULL;
+    int nmine = 0;
+    int total = 0;
+    size_t i = 0;
+    size_t j = 0;
+    int k = 0;
+
+    for(i = (size_t)rank; i < count; i += (size_t)ranks)
+    {
+        if(purger_run_index_read(paths[i], &marks, &nmarks) < 0)
+        {
+            LOG(PURGER_LOG_ERR, "Unable to read the index of %s: %s", paths[i], strerror(errno));
+            continue;
+        }
+        grown = (int64_t *)realloc(mine, ((size_t)nmine + nmarks + 1) * sizeof(int64_t));
+        if(grown == NULL)
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        mine = grown;
+        for(j = 0; j < nmarks; j++)
+            mine[nmine++] = marks[j].mtime;
+        free(marks);
+    }
+
+    if(rank == 0)
+    {
+        counts = (int *)malloc(ranks * sizeof(int));
+        displs = (int *)malloc(ranks * sizeof(int));
+        if(counts == NULL || displs == NULL)
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    MPI_Gather(&nmine, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    if(rank == 0)
+    {
+        for(k = 0; k < ranks; k++)
+        {
+            displs[k] = total;
+            total += counts[k];
+        }
+        all = (int64_t *)malloc(((size_t)total + 1) * sizeof(int64_t));
+        if(all == NULL)
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    MPI_Gatherv(mine, nmine, MPI_INT64_T, all, counts, displs, MPI_INT64_T, 0, MPI_COMM_WORLD);
+
+    if(rank == 0)
+    {
+        qsort(all, (size_t)total, sizeof(int64_t), purgemerge_mtime_cmp);
+        for(k = 0; k < ranks - 1; k++)
+            split[k] = total ? all[(size_t)(k + 1) * (size_t)total / (size_t)ranks] : 0;
+        LOG(PURGER_LOG_DBG, "Split %d index marks into %d ranges.", total, ranks);
+    }
+    if(ranks > 1)
+        MPI_Bcast(split, ranks - 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+
+    free(mine);
+    free(all);
+    free(counts);
+    free(displs);
+    return 0;
+}
+
+/* Read the next record of a run, 0 at its end or when it is damaged. */
+static int
+purgemerge_next(purgemerge_run_t *run)
+{
+    int flags = 0;
+    int status = purger_reclog_next(&run->rd, &run->r, &flags);
+
+    if(status < 0)
+        LOG(PURGER_LOG_ERR, "The run %s is cut short or damaged, merging what came before.", run->path);
+    return status > 0;
+}
+
+static void
+purgemerge_sift(purgemerge_run_t **heap, size_t n, size_t i)
+{
+    purgemerge_run_t *t = NULL;
+    size_t least = i;
+    size_t c = 0;
+
+    for(;;)
+    {
+        for(c = 2 * i + 1; c <= 2 * i + 2 && c < n; c++)
+            if(heap[c]->r.mtime < heap[least]->r.mtime)
+                least = c;
+        if(least == i)
+            return;
+        t = heap[i];
+        heap[i] = heap[least];
+        heap[least] = t;
+        i = least;
+    }
+}
+
+/*
+ * Merge the records with an mtime from "lo" up to "hi" out of every run
+ * into the partition "out", in mtime order. The last rank takes the rest,
+ * however recent. Each run is read from the index mark before "lo" on and
+ * left once past "hi". Returns the records written, or -1.
+ */
+long long
+purgemerge_range(char **paths, size_t count, int64_t lo, int64_t hi, int last, const char *out)
+{
+    purgemerge_run_t *runs = (purgemerge_run_t *)calloc(count + 1, sizeof(purgemerge_run_t));
+    purgemerge_run_t **heap = (purgemerge_run_t **)calloc(count + 1, sizeof(purgemerge_run_t *));
+    purger_run_mark_t *marks = NULL;
+    purger_run_writer_t w;
+    size_t nmarks = 0;
+    size_t n = 0;
+    size_t i = 0;
+    long long records = 0;
+    int more = 0;
+
+    if(runs == NULL || heap == NULL)
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+
+    for(i = 0; i < count; i++)
+    {
+        runs[i].path = paths[i];
+        runs[i].rd.fd = -1;
+        if(purger_run_index_read(paths[i], &marks, &nmarks) < 0 ||
+                purger_reclog_reader_open(&runs[i].rd, paths[i]) < 0 ||
+                purger_reclog_reader_seek(&runs[i].rd, purger_run_index_seek(marks, nmarks, lo)) < 0)
+        {
+            LOG(PURGER_LOG_ERR, "Unable to read the run %s: %s", paths[i], strerror(errno));
+            free(marks);
+            continue;
+        }
+        free(marks);
+
+        while((more = purgemerge_next(&runs[i])) && runs[i].r.mtime < lo)
+            ;
+        if(more && (last || runs[i].r.mtime < hi))
+            heap[n++] = &runs[i];
+    }
+
+    for(i = n; i-- > 0;)
+        purgemerge_sift(heap, n, i);
+
+    if(purger_run_create(&w, out) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to write the partition %s: %s", out, strerror(errno));
+        records = -1;
+        n = 0;
+    }
+
+    while(n > 0)
+    {
+        if(purger_run_append(&w, &heap[0]->r) < 0)
+        {
+            LOG(PURGER_LOG_ERR, "Unable to write to the partition %s: %s", out, strerror(errno));
+            records = -1;
+            break;
+        }
+        records++;
+
+        if(!purgemerge_next(heap[0]) || (!last && heap[0]->r.mtime >= hi))
+            heap[0] = heap[--n];
+        purgemerge_sift(heap, n, 0);
+    }
+
+    if(records >= 0 && purger_run_close(&w) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to write the partition %s: %s", out, strerror(errno));
+        records = -1;
+    }
+    else if(records < 0)
+    {
+        purger_run_close(&w);
+    }
+
+    for(i = 0; i < count; i++)
+        if(runs[i].rd.fd >= 0)
+            purger_reclog_reader_close(&runs[i].rd);
+    free(runs);
+    free(heap);
+    return records;
+}
+
+void
+print_usage(char **argv)
+{
+    fprintf(stderr, "Usage: %s -i <run directory> -o <purge list directory> [-l <log level>]\n", argv[0]);
+}
+
+int
+main (int argc, char **argv)
+{
+    int index;
+    int c;
+
+    char *run_dir = NULL;
+    char *out_dir = NULL;
+    char out[PATH_MAX];
+    char **paths = NULL;
+    size_t count = 0;
+    int64_t *split = NULL;
+    int64_t lo = 0;
+    int64_t hi = 0;
+    long long records = 0;
+    long long total = 0;
+    int failed = 0;
+    int any_failed = 0;
+    double start = 0.0;
+    int ranks = 0;
+    int rank = 0;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    PURGER_global_rank = rank;
+    PURGER_debug_stream = stdout;
+    PURGER_debug_level = PURGER_LOG_INFO;
+
+    opterr = 0;
+    while((c = getopt(argc, argv, "i:o:l:")) != -1)
+    {
+        switch(c)
+        {
+            case 'i':
+                run_dir = optarg;
+                break;
+
+            case 'o':
+                out_dir = optarg;
+                break;
+
+            case 'l':
+                PURGER_debug_level = atoi(optarg);
+                break;
+
+            case '?':
+                if(rank == 0)
+                {
+                    print_usage(argv);
+                    if(optopt == 'i' || optopt == 'o' || optopt == 'l')
+                        fprintf(stderr, "Option -%c requires an argument.\n", optopt);
+                    else if(isprint(optopt))
+                        fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+                    else
+                        fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+                }
+                MPI_Finalize();
+                exit(EXIT_FAILURE);
+
+            default:
+                abort();
+        }
+    }
+
+    for(index = optind; index < argc; index++)
+        LOG(PURGER_LOG_WARN, "Non-option argument %s", argv[index]);
+
+    if(run_dir == NULL || out_dir == NULL)
+    {
+        if(rank == 0)
+        {
+            print_usage(argv);
+            LOG(PURGER_LOG_FATAL, "You must give the directory of the runs and the one to put the purge list in.");
+        }
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    start = MPI_Wtime();
+    if(rank == 0 && mkdir(out_dir, 0755) < 0 && errno != EEXIST)
+        LOG(PURGER_LOG_ERR, "Unable to create %s: %s", out_dir, strerror(errno));
+    if(purgemerge_list(run_dir, rank, &paths, &count) < 0)
+    {
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+    if(rank == 0)
+        LOG(PURGER_LOG_INFO, "Merging %zu runs from %s on %d ranks.", count, run_dir, ranks);
+
+    split = (int64_t *)malloc(ranks * sizeof(int64_t));
+    if(split == NULL)
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    purgemerge_splitters(paths, count, rank, ranks, split);
+
+    /* Rank r takes [split[r - 1], split[r]), the ends are open. */
+    lo = rank == 0 ? INT64_MIN : split[rank - 1];
+    hi = rank == ranks - 1 ? INT64_MAX : split[rank];
+    snprintf(out, sizeof(out), "%s/" PURGER_PURGE_PREFIX "%06d" PURGER_RUN_SUFFIX, out_dir, rank);
+    records = purgemerge_range(paths, count, lo, hi, rank == ranks - 1, out);
+    LOG(PURGER_LOG_DBG, "Merged %lld expired files from %lld to %lld into %s.", records, (long long)lo, (long long)hi, out);
+
+    failed = records < 0;
+    MPI_Reduce(&records, &total, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&failed, &any_failed, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    if(rank == 0 && any_failed)
+        LOG(PURGER_LOG_ERR, "Some partitions of the purge list in %s could not be written.", out_dir);
+    else if(rank == 0)
+        LOG(PURGER_LOG_INFO, "Merged %lld expired files into %d partitions in %s in %.3f s.", total, ranks, out_dir, MPI_Wtime() - start);
+
+    purger_run_list_free(paths, count);
+    free(split);
+    MPI_Finalize();
+    exit(any_failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/* EOF */
@@ -0,0 +1,22 @@
+#ifndef PURGEMERGE_H
+#define PURGEMERGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../common/runs.h"
+
+/* A run being merged, kept on a heap by the mtime of its next record. */
+typedef struct
+{
+    purger_reclog_reader_t rd;
+    purger_record_t        r;
+    const char            *path;
+} purgemerge_run_t;
+
+int  purgemerge_list(const char *dir, int rank, char ***paths, size_t *count);
+int  purgemerge_splitters(char **paths, size_t count, int rank, int ranks, int64_t *split);
+long long purgemerge_range(char **paths, size_t count, int64_t lo, int64_t hi, int last, const char *out);
+void print_usage(char **argv);
+
+#endif /* PURGEMERGE_H */
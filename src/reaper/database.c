@@ -6,12 +6,48 @@
 
 #include "config.h"
 #include "../common/log.h"
+#include "../common/record.h"
+#include "../common/command.h"
 #include "database.h"
 
 extern int PURGER_global_rank;
 
 redisContext *REDIS;
 
+/*
+ * Find out how treewalk stored the records, see record.h. Returns the
+ * bucket digits of a packed database, 0 for one hash per file, or -1.
+ */
+int
+reaper_load_record_schema(void)
+{
+    static redisCommandTemplate *get;
+    redisReply *getReply = purger_template_command(REDIS, &get, "GET %s", PURGER_RECORD_SCHEMA_KEY);
+    int digits = -1;
+
+    if(getReply == NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to read the record schema: %s", REDIS->errstr);
+        return -1;
+    }
+
+    if(getReply->type == REDIS_REPLY_NIL)
+    {
+        digits = 0;
+    }
+    else if(getReply->type == REDIS_REPLY_STRING)
+    {
+        digits = purger_record_schema_parse(getReply->str);
+        if(digits < 0)
+        {
+            LOG(PURGER_LOG_ERR, "Unknown record schema \"%s\".", getReply->str);
+        }
+    }
+
+    freeReplyObject(getReply);
+    return digits;
+}
+
 void
 reaper_backoff_database(CIRCLE_handle *handle)
 {
@@ -66,24 +102,48 @@ reaper_msleep(unsigned long milisec)
     return 1;
 }
 
+/* Drop the transaction reaper_pop_zset() started. */
+static void
+reaper_discard(void)
+{
+    static redisCommandTemplate *discard;
+    redisReply *reply = purger_template_command(REDIS, &discard, "DISCARD");
+
+    if(reply != NULL)
+        freeReplyObject(reply);
+}
+
 int
 reaper_pop_zset(char **results, char *zset, long long start, long long end)
 {
+    static redisCommandTemplate *watch, *zrange, *multi, *zrem, *exec;
     size_t num_poped = 0;
 
-    redisReply *watchReply = redisCommand(REDIS, "WATCH %s", zset);
-    if(watchReply->type == REDIS_REPLY_STATUS)
+    redisReply *watchReply = purger_template_command(REDIS, &watch, "WATCH %s", zset);
+    if(watchReply == NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to watch %s: %s", zset, REDIS->errstr);
+        return REAPER_DB_FATAL;
+    }
+    else if(watchReply->type == REDIS_REPLY_STATUS)
     {
         LOG(PURGER_LOG_DBG, "Watch returned: %s", watchReply->str);
+        freeReplyObject(watchReply);
     }
     else
     {
         LOG(PURGER_LOG_ERR, "Redis didn't return a status when trying to watch %s.", zset);
+        freeReplyObject(watchReply);
         return REAPER_DB_FATAL;
     }
 
-    redisReply *zrangeReply = redisCommand(REDIS, "ZRANGE %s %lld %lld", zset, start, end - 1);
-    if(zrangeReply->type == REDIS_REPLY_ARRAY)
+    redisReply *zrangeReply = purger_template_command(REDIS, &zrange, "ZRANGE %s %lld %lld", zset, start, end - 1);
+    if(zrangeReply == NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to zrange %s: %s", zset, REDIS->errstr);
+        return REAPER_DB_FATAL;
+    }
+    else if(zrangeReply->type == REDIS_REPLY_ARRAY)
     {
         LOG(PURGER_LOG_DBG, "Zrange returned an array of size: %zu", zrangeReply->elements);
 
@@ -91,49 +151,74 @@ reaper_pop_zset(char **results, char *zset, long long start, long long end)
         {
             strcpy(*(results+num_poped), zrangeReply->element[num_poped]->str);
         }
+        freeReplyObject(zrangeReply);
     }
     else
     {
         LOG(PURGER_LOG_ERR, "Redis didn't return an array when trying to zrange %s.", zset);
+        freeReplyObject(zrangeReply);
         return REAPER_DB_FATAL;
     }
 
-    redisReply *multiReply = redisCommand(REDIS, "MULTI");
-    if(multiReply->type == REDIS_REPLY_STATUS)
+    redisReply *multiReply = purger_template_command(REDIS, &multi, "MULTI");
+    if(multiReply == NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to multi %s: %s", zset, REDIS->errstr);
+        return REAPER_DB_FATAL;
+    }
+    else if(multiReply->type == REDIS_REPLY_STATUS)
     {
         /* Multi always returns OK. So lets only worry about the exec return. */
         LOG(PURGER_LOG_DBG, "Multi returned a status of: %s", multiReply->str);
+        freeReplyObject(multiReply);
     }
     else
     {
         LOG(PURGER_LOG_ERR, "Redis didn't return a status when trying to multi %s. Discarding transaction.", zset);
-        redisCommand(REDIS, "DISCARD");
+        freeReplyObject(multiReply);
+        reaper_discard();
         return REAPER_DB_FATAL;
     }
 
-    redisReply *zremReply = redisCommand(REDIS, "ZREMRANGEBYRANK %s %lld %lld", zset, start, end);
-    if(zremReply->type == REDIS_REPLY_STATUS)
+    redisReply *zremReply = purger_template_command(REDIS, &zrem, "ZREMRANGEBYRANK %s %lld %lld", zset, start, end);
+    if(zremReply == NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to zremrangebyrank %s: %s", zset, REDIS->errstr);
+        return REAPER_DB_FATAL;
+    }
+    else if(zremReply->type == REDIS_REPLY_STATUS)
     {
         LOG(PURGER_LOG_DBG, "Zremrangebyrank returned a status of: %s", zremReply->str);
+        freeReplyObject(zremReply);
     }
     else
     {
         LOG(PURGER_LOG_ERR, "Redis didn't return an integer when trying to zremrangebyrank %s. Discarding transaction.", zset);
-        redisCommand(REDIS, "DISCARD");
+        freeReplyObject(zremReply);
+        reaper_discard();
         return REAPER_DB_FATAL;
     }
 
-    redisReply *execReply = redisCommand(REDIS, "EXEC");
-    if(execReply->type == REDIS_REPLY_ERROR)
+    redisReply *execReply = purger_template_command(REDIS, &exec, "EXEC");
+    if(execReply == NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to exec %s: %s", zset, REDIS->errstr);
+        return REAPER_DB_FATAL;
+    }
+    int execType = execReply->type;
+    size_t execElements = execReply->elements;
+    freeReplyObject(execReply);
+
+    if(execType == REDIS_REPLY_ERROR)
     {
         LOG(PURGER_LOG_DBG, "Normal pop from the zset clashed. Try it again later. (%s)", REDIS->errstr);
         return REAPER_DB_COLLISION;
     }
-    else if(execReply->type == REDIS_REPLY_ARRAY)
+    else if(execType == REDIS_REPLY_ARRAY)
     {
-        LOG(PURGER_LOG_DBG, "Exec returned an array of size: %ld", execReply->elements);
+        LOG(PURGER_LOG_DBG, "Exec returned an array of size: %ld", execElements);
 
-        if(execReply->elements > 1)
+        if(execElements > 1)
         {
             LOG(PURGER_LOG_DBG, "Success on a reaper transaction. (%s)", zset);
             return num_poped;
@@ -196,12 +281,18 @@ reaper_check_database_for_more(CIRCLE_handle *handle)
 void
 reaper_redis_zrangebyscore(char *zset, long long from, long long to)
 {
+    static redisCommandTemplate *zrangebyscore;
     redisReply *reply;
     int numReplies = 0;
 
-    reply = redisCommand(REDIS, "ZRANGEBYSCORE %s %lld %lld", zset, from, to);
+    reply = purger_template_command(REDIS, &zrangebyscore, "ZRANGEBYSCORE %s %lld %lld", zset, from, to);
 
-    if(reply->type == REDIS_REPLY_ARRAY)
+    if(reply == NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to zrangebyscore %s: %s", zset, REDIS->errstr);
+        return;
+    }
+    else if(reply->type == REDIS_REPLY_ARRAY)
     {
         LOG(PURGER_LOG_DBG, "We have an array.");
 
@@ -221,6 +312,8 @@ reaper_redis_zrangebyscore(char *zset, long long from, long long to)
     {
         LOG(PURGER_LOG_DBG, "Reply was something wheird.");
     }
+
+    freeReplyObject(reply);
 }
 
 /* EOF */
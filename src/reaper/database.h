@@ -2,10 +2,12 @@
 #define DATABASE_H
 
 #include <libcircle.h>
+#include <hiredis.h>
 
 #define REAPER_DB_FATAL -1
 #define REAPER_DB_COLLISION -2
 
+int  reaper_load_record_schema(void);
 int  reaper_msleep(unsigned long milisec);
 int  reaper_pop_zset(char **results, char *zset, long long start, long long end);
 int  reaper_check_database_for_more(CIRCLE_handle *handle);
@@ -9,11 +9,21 @@
 #include "config.h"
 
 #include "local.h"
+#include "database.h"
 #include "../common/log.h"
+#include "../common/record.h"
+#include "../common/dirtable.h"
+#include "../common/runs.h"
+#include "../common/command.h"
 
 extern redisContext *REDIS;
 extern int PURGER_global_rank;
 
+/* Bucket digits of the packed record schema, 0 for one hash per file. */
+int reaper_record_digits;
+/* Directories already looked up in the directory table. */
+static purger_dir_cache_t reaper_dirs;
+
 unsigned long int
 reaper_strtoul(const char *nptr, int *ret_code)
 {
@@ -38,41 +48,241 @@ reaper_strtoul(const char *nptr, int *ret_code)
     return value;
 }
 
+/*
+ * The path of a record's name. Names that refer to the directory table
+ * are resolved through reaper_dirs, going to redis only for directories
+ * not seen before. Returns NULL when the directory is not in the table.
+ */
+static char *
+reaper_resolve_name(char *name, size_t len)
+{
+    static redisCommandTemplate *hget;
+    static char path[CIRCLE_MAX_STRING_LEN];
+    char id_str[PURGER_DIR_ID_LEN + 1];
+    redisReply *hgetReply = NULL;
+    const char *dir = NULL;
+    const char *base = NULL;
+    size_t base_len = 0;
+    uint64_t id = 0;
+
+    if(purger_dir_ref_parse(name, len, &id, &base, &base_len) < 0)
+        return name;
+
+    dir = purger_dir_cache_get(&reaper_dirs, id);
+    if(dir == NULL)
+    {
+        memcpy(id_str, name, PURGER_DIR_ID_LEN);
+        id_str[PURGER_DIR_ID_LEN] = '\0';
+        hgetReply = purger_template_command(REDIS, &hget, "HGET " PURGER_DIR_TABLE_KEY " %s", id_str);
+        if(hgetReply != NULL && hgetReply->type == REDIS_REPLY_STRING &&
+                purger_dir_cache_put(&reaper_dirs, id, hgetReply->str, hgetReply->len) == 0)
+        {
+            dir = purger_dir_cache_get(&reaper_dirs, id);
+        }
+        if(hgetReply != NULL)
+            freeReplyObject(hgetReply);
+    }
+
+    if(dir == NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Directory %s of \"%.*s\" is not in the directory table.", id_str, (int)base_len, base);
+        return NULL;
+    }
+    if(snprintf(path, sizeof(path), "%s/%.*s", dir, (int)base_len, base) >= (int)sizeof(path))
+        return NULL;
+
+    return path;
+}
+
+/*
+ * Look key up in its bucket when the database is packed. Returns -1 when
+ * the record is not there, so that files left over from a database that
+ * was only partly migrated are still found in their own hash.
+ */
+static int
+reaper_check_packed_record(char *key)
+{
+    static redisCommandTemplate *hget;
+    static char filename[CIRCLE_MAX_STRING_LEN];
+    char *path = NULL;
+    char bucket[32];
+    const char *field = NULL;
+    size_t field_len = 0;
+    purger_record_t r;
+    redisReply *hgetReply = NULL;
+
+    if(purger_record_bucket(key, strlen(key), reaper_record_digits, bucket, sizeof(bucket), &field, &field_len) < 0)
+        return -1;
+
+    hgetReply = purger_template_command(REDIS, &hget, "HGET %s %b", bucket, field, field_len);
+    if(hgetReply == NULL)
+    {
+        return -1;
+    }
+    else if(hgetReply->type != REDIS_REPLY_STRING)
+    {
+        freeReplyObject(hgetReply);
+        return -1;
+    }
+
+    if(purger_record_unpack(hgetReply->str, hgetReply->len, &r) < 0 || r.name_len >= sizeof(filename))
+    {
+        LOG(PURGER_LOG_ERR, "The record of \"%s\" in %s is not in a format this reaper knows.", key, bucket);
+    }
+    else
+    {
+        memcpy(filename, r.name, r.name_len);
+        filename[r.name_len] = '\0';
+        path = reaper_resolve_name(filename, r.name_len);
+
+        if(r.mtime > 0 && path != NULL)
+        {
+            reaper_check_and_delete_file(path, (long int)r.mtime);
+        }
+    }
+
+    freeReplyObject(hgetReply);
+    return 0;
+}
+
 void
 reaper_check_local_queue(char *key)
 {
-    redisReply *hmgetReply = redisCommand(REDIS, "HMGET %s mtime_decimal name", key);
-    if(hmgetReply->type == REDIS_REPLY_ARRAY)
+    static redisCommandTemplate *hmget;
+    static char filename[CIRCLE_MAX_STRING_LEN];
+    redisReply *hmgetReply;
+    purger_record_t r;
+    char *path = NULL;
+
+    if(reaper_record_digits > 0 && reaper_check_packed_record(key) == 0)
     {
-        LOG(PURGER_LOG_DBG, "Hmget returned an array of size: %zu", hmgetReply->elements);
+        return;
+    }
 
-        if(hmgetReply->element[1]->type != REDIS_REPLY_STRING || \
-                hmgetReply->element[0]->type != REDIS_REPLY_STRING || \
-                hmgetReply->elements != 2)
+    hmgetReply = purger_template_command(REDIS, &hmget, "HMGET %s " PURGER_RECORD_HASH_FIELDS, key);
+    if(hmgetReply == NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to hmget %s: %s", key, REDIS->errstr);
+        return;
+    }
+    else if(hmgetReply->type != REDIS_REPLY_ARRAY)
+    {
+        LOG(PURGER_LOG_ERR, "Redis didn't return an array when trying to hmget %s.", key);
+    }
+    else if(purger_record_hash_decode(hmgetReply, &r) < 0 || r.name_len >= sizeof(filename))
+    {
+        LOG(PURGER_LOG_ERR, "Hmget elements were not in the correct format (bad key? \"%s\")", key);
+    }
+    else
+    {
+        memcpy(filename, r.name, r.name_len);
+        filename[r.name_len] = '\0';
+        path = reaper_resolve_name(filename, r.name_len);
+
+        if(r.mtime > 0 && path != NULL)
         {
-            LOG(PURGER_LOG_ERR, "Hmget elements were not in the correct format (bad key? \"%s\")", key);
-            return;
+            /* It looks like we might delete this one. Lets run it through a final check. */
+            reaper_check_and_delete_file(path, (long int)r.mtime);
         }
-        else
-        {
-            char *filename = hmgetReply->element[1]->str + 1;
-            filename[strlen(filename)-1] = '\0';
-            char *mtime_str = hmgetReply->element[0]->str + 1;
-            mtime_str[strlen(mtime_str)-1] = '\0';
+    }
 
-            long int db_mtime_number = reaper_mtime_to_number(mtime_str);
+    freeReplyObject(hmgetReply);
+}
 
-            if(db_mtime_number > 0)
-            {
-                /* It looks like we might delete this one. Lets run it through a final check. */
-                reaper_check_and_delete_file(filename, db_mtime_number);
-            }
+/*
+ * Queue the purge list purgemerge wrote to "dir" a stride of records at
+ * a time, as "<offset> <partition>" with the offset of an index mark.
+ */
+void
+reaper_queue_purge_list(CIRCLE_handle *handle, char *dir)
+{
+    static char item[CIRCLE_MAX_STRING_LEN];
+    purger_run_mark_t *marks = NULL;
+    char **paths = NULL;
+    size_t nmarks = 0;
+    size_t count = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    if(purger_run_list(dir, PURGER_PURGE_PREFIX, &paths, &count) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to list the purge list in %s: %s", dir, strerror(errno));
+        return;
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        if(purger_run_index_read(paths[i], &marks, &nmarks) < 0)
+        {
+            LOG(PURGER_LOG_ERR, "Unable to read the index of %s: %s", paths[i], strerror(errno));
+            continue;
+        }
+        for(j = 0; j < nmarks; j++)
+        {
+            if(snprintf(item, sizeof(item), "%llu %s", (unsigned long long)marks[j].offset, paths[i]) >= (int)sizeof(item))
+                break;
+            handle->enqueue(item);
         }
+        LOG(PURGER_LOG_DBG, "Queued %zu strides of %s.", nmarks, paths[i]);
+        free(marks);
     }
-    else
+
+    purger_run_list_free(paths, count);
+}
+
+/*
+ * Check the files of one stride of the purge list, as queued by
+ * reaper_queue_purge_list(). Records hold the path and mtime the walk
+ * saw, so redis is not asked about any of them.
+ */
+void
+reaper_check_purge_stride(char *item)
+{
+    static char filename[CIRCLE_MAX_STRING_LEN];
+    purger_reclog_reader_t rd;
+    purger_record_t r;
+    unsigned long long offset = 0;
+    char *path = NULL;
+    int flags = 0;
+    int status = 0;
+    int i = 0;
+
+    offset = strtoull(item, &path, 10);
+    if(path == item || *path != ' ')
     {
-        LOG(PURGER_LOG_ERR, "Redis didn't return an array when trying to hmget %s.", key);
+        LOG(PURGER_LOG_ERR, "Not a stride of a purge list: \"%s\"", item);
+        return;
+    }
+    path++;
+
+    if(purger_reclog_reader_open(&rd, path) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to read the purge list %s: %s", path, strerror(errno));
+        return;
+    }
+    if(purger_reclog_reader_seek(&rd, offset) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to find offset %llu of the purge list %s.", offset, path);
+        purger_reclog_reader_close(&rd);
+        return;
     }
+
+    for(i = 0; i < PURGER_RUN_STRIDE && (status = purger_reclog_next(&rd, &r, &flags)) > 0; i++)
+    {
+        if(r.name_len >= sizeof(filename))
+            continue;
+        memcpy(filename, r.name, r.name_len);
+        filename[r.name_len] = '\0';
+
+        if(r.mtime > 0)
+        {
+            reaper_check_and_delete_file(filename, (long int)r.mtime);
+        }
+    }
+
+    if(status < 0)
+        LOG(PURGER_LOG_ERR, "The purge list %s is damaged after offset %llu.", path, offset);
+    purger_reclog_reader_close(&rd);
 }
 
 long int
@@ -7,6 +7,8 @@
 
 unsigned long int reaper_strtoul(const char *nptr, int *ret_code);
 void reaper_check_local_queue(char *key);
+void reaper_queue_purge_list(CIRCLE_handle *handle, char *dir);
+void reaper_check_purge_stride(char *item);
 long int reaper_mtime_to_number(char *mtime_str);
 void reaper_check_and_delete_file(char *filename, long int db_mtime);
 int reaper_is_file_expired(long int old_db_mtime, long int new_stat_mtime, int age_allowed_in_days, char *filename);
@@ -18,12 +18,22 @@
 #include "database.h"
 
 #include "../common/log.h"
+#include "../common/endpoint.h"
 
 FILE *PURGER_debug_stream;
 int  PURGER_global_rank;
 PURGER_loglevel PURGER_debug_level;
 
 extern redisContext *REDIS;
+extern int reaper_record_digits;
+/* The purge list given with -P, see reaper_queue_purge_list(). */
+static char *reaper_purge_list;
+
+void
+add_purge_list(CIRCLE_handle *handle)
+{
+    reaper_queue_purge_list(handle, reaper_purge_list);
+}
 
 void
 process_files(CIRCLE_handle *handle)
@@ -32,7 +42,13 @@ process_files(CIRCLE_handle *handle)
     char *key = (char *)malloc(CIRCLE_MAX_STRING_LEN);
     handle->dequeue(key);
 
-    if(key != NULL && strlen(key) > 0)
+    if(reaper_purge_list != NULL)
+    {
+        /* The list is all there is, nothing to back off for. */
+        if(strlen(key) > 0)
+            reaper_check_purge_stride(key);
+    }
+    else if(key != NULL && strlen(key) > 0)
     {
         reaper_check_local_queue(key);
     }
@@ -48,7 +64,7 @@ process_files(CIRCLE_handle *handle)
 void
 print_usage(char **argv)
 {
-    fprintf(stderr, "Usage: %s [-h <redis_hostname> -p <redis_port> -y]\n", argv[0]);
+    fprintf(stderr, "Usage: %s [-h <redis_hostname> -p <redis_port> -P <purge list directory> -y]\n", argv[0]);
 }
 
 void
@@ -102,7 +118,7 @@ main (int argc, char **argv)
     PURGER_debug_level = PURGER_LOG_DBG;
 
     opterr = 0;
-    while((c = getopt(argc, argv, "h:p:y")) != -1)
+    while((c = getopt(argc, argv, "h:p:P:y")) != -1)
     {
         switch(c)
         {
@@ -116,12 +132,16 @@ main (int argc, char **argv)
                 redis_port_flag = 1;
                 break;
 
+            case 'P':
+                reaper_purge_list = optarg;
+                break;
+
             case 'y':
                 yes_flag = 1;
                 break;
 
             case '?':
-                if(optopt == 'h' || optopt == 'p')
+                if(optopt == 'h' || optopt == 'p' || optopt == 'P')
                 {
                     print_usage(argv);
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
@@ -152,6 +172,17 @@ main (int argc, char **argv)
         reaper_confirm_exec();
     }
 
+    if(reaper_purge_list != NULL)
+    {
+        LOG(PURGER_LOG_INFO, "Reaping the purge list in %s, redis is not used.", reaper_purge_list);
+        PURGER_global_rank = CIRCLE_init(argc, argv);
+        CIRCLE_cb_create(&add_purge_list);
+        CIRCLE_cb_process(&process_files);
+        CIRCLE_begin();
+        CIRCLE_finalize();
+        exit(EXIT_SUCCESS);
+    }
+
     if(redis_hostname_flag == 0)
     {
         LOG(PURGER_LOG_WARN, "A hostname for redis was not specified, defaulting to localhost.");
@@ -167,12 +198,29 @@ main (int argc, char **argv)
     for (index = optind; index < argc; index++)
         LOG(PURGER_LOG_WARN, "Non-option argument %s", argv[index]);
 
-    REDIS = redisConnect(redis_hostname, redis_port);
+    REDIS = redis_endpoint_connect(redis_hostname, redis_port, 0);
+    if (REDIS == NULL)
+        exit(EXIT_FAILURE);
     if (REDIS->err)
     {
         LOG(PURGER_LOG_FATAL, "Redis error: %s", REDIS->errstr);
         exit(EXIT_FAILURE);
     }
+    /* Records are spread over the nodes of a cluster by key slot, and
+     * this one reads them from a single server. */
+    if(redis_endpoint_is_cluster(REDIS) == 1)
+    {
+        LOG(PURGER_LOG_FATAL, "reaper does not support Redis Cluster yet. Point it at a single redis server.");
+        exit(EXIT_FAILURE);
+    }
+    /* The reaper reads keys in large ZRANGE batches. */
+    redisReaderSetArena(REDIS->reader);
+
+    reaper_record_digits = reaper_load_record_schema();
+    if(reaper_record_digits < 0)
+        exit(EXIT_FAILURE);
+    if(reaper_record_digits > 0)
+        LOG(PURGER_LOG_INFO, "Reading packed records from %d buckets.", 1 << (4 * reaper_record_digits));
 
     PURGER_global_rank = CIRCLE_init(argc, argv);
     CIRCLE_cb_process(&process_files);
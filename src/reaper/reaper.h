@@ -4,6 +4,7 @@
 #include <libcircle.h>
 
 void process_files(CIRCLE_handle *handle);
+void add_purge_list(CIRCLE_handle *handle);
 void print_usage(char **argv);
 
 #endif /* REAPER_H */
@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include <hiredis.h>
+
+#include "config.h"
+#include "recordmigrate.h"
+
+#include "../common/log.h"
+#include "../common/endpoint.h"
+#include "../common/record.h"
+
+FILE *PURGER_debug_stream;
+PURGER_loglevel PURGER_debug_level;
+int PURGER_global_rank;
+redisContext *REDIS;
+
+/* Bytes of memory redis reports in use, -1 when it does not say. */
+long long
+recordmigrate_used_memory(void)
+{
+    redisReply *reply = redisCommand(REDIS, "INFO memory");
+    long long used = -1;
+    char *p = NULL;
+
+    if(reply != NULL && reply->type == REDIS_REPLY_STRING &&
+            (p = strstr(reply->str, "used_memory:")) != NULL)
+    {
+        used = atoll(p + strlen("used_memory:"));
+    }
+
+    if(reply != NULL)
+        freeReplyObject(reply);
+    return used;
+}
+
+/*
+ * Migrate the keys of one SCAN batch: one pipeline of HMGETs, then one
+ * of HSETs into the buckets and DELs of the old hashes. Returns the
+ * number of records moved, or -1 when redis went away.
+ */
+long
+recordmigrate_batch(redisReply *keys, int digits, int keep, long *skipped)
+{
+    static char packed[PURGER_RECORD_HEADER + PATH_MAX];
+    redisReply **values = NULL;
+    redisReply *reply = NULL;
+    purger_record_t r;
+    char bucket[32];
+    const char *field = NULL;
+    size_t field_len = 0;
+    size_t len = 0;
+    size_t i = 0;
+    long appended = 0;
+    long moved = 0;
+    int status = 0;
+
+    values = (redisReply **)calloc(keys->elements, sizeof(redisReply *));
+
+    for(i = 0; i < keys->elements; i++)
+    {
+        redisAppendCommand(REDIS, "HMGET %b " PURGER_RECORD_HASH_FIELDS,
+                           keys->element[i]->str, keys->element[i]->len);
+    }
+    for(i = 0; i < keys->elements; i++)
+    {
+        if(redisGetReply(REDIS, (void **)&values[i]) != REDIS_OK)
+        {
+            status = -1;
+            goto done;
+        }
+    }
+
+    for(i = 0; i < keys->elements; i++)
+    {
+        switch(purger_record_hash_decode(values[i], &r))
+        {
+            case -1:
+                LOG(PURGER_LOG_DBG, "Skipping %s, it is not a file record.", keys->element[i]->str);
+                (*skipped)++;
+                continue;
+            case -2:
+                LOG(PURGER_LOG_WARN, "Skipping %s, some of its fields are missing.", keys->element[i]->str);
+                (*skipped)++;
+                continue;
+        }
+
+        len = purger_record_pack(packed, sizeof(packed), &r);
+        if(len > sizeof(packed) ||
+                purger_record_bucket(keys->element[i]->str, keys->element[i]->len, digits,
+                                     bucket, sizeof(bucket), &field, &field_len) < 0)
+        {
+            LOG(PURGER_LOG_WARN, "Skipping %s, it does not fit a packed record.", keys->element[i]->str);
+            (*skipped)++;
+            continue;
+        }
+
+        redisAppendCommand(REDIS, "HSET %s %b %b", bucket, field, field_len, packed, len);
+        appended++;
+        if(!keep)
+        {
+            redisAppendCommand(REDIS, "DEL %b", keys->element[i]->str, keys->element[i]->len);
+            appended++;
+        }
+        moved++;
+    }
+
+    for(; appended > 0; appended--)
+    {
+        if(redisGetReply(REDIS, (void **)&reply) != REDIS_OK)
+        {
+            status = -1;
+            goto done;
+        }
+        if(reply->type == REDIS_REPLY_ERROR)
+            LOG(PURGER_LOG_ERR, "Redis replied with an error: %s", reply->str);
+        freeReplyObject(reply);
+    }
+
+done:
+    for(i = 0; i < keys->elements; i++)
+    {
+        if(values[i] != NULL)
+            freeReplyObject(values[i]);
+    }
+    free(values);
+
+    if(status < 0)
+    {
+        LOG(PURGER_LOG_FATAL, "Redis error: %s", REDIS->errstr);
+        return -1;
+    }
+    return moved;
+}
+
+void
+print_usage(char **argv)
+{
+    fprintf(stderr, "Usage: %s [-h <redis host[:port] or socket path> -p <redis_port> -z <bucket digits> -c <scan count> -k -l <loglevel>]\n", argv[0]);
+}
+
+int
+main (int argc, char **argv)
+{
+    int index;
+    int c;
+
+    char *redis_hostname = "localhost";
+    int redis_port = 6379;
+    int digits = PURGER_RECORD_BUCKET_DIGITS;
+    int scan_count = RECORDMIGRATE_SCAN_COUNT;
+    int keep_flag = 0;
+    int current = 0;
+
+    char cursor[32] = "0";
+    redisReply *reply = NULL;
+    long long memory_before = 0;
+    long long memory_after = 0;
+    long moved = 0;
+    long total = 0;
+    long skipped = 0;
+
+    PURGER_debug_stream = stdout;
+    PURGER_debug_level = PURGER_LOG_INFO;
+
+    opterr = 0;
+    while((c = getopt(argc, argv, "h:p:z:c:kl:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                redis_hostname = optarg;
+                break;
+
+            case 'p':
+                redis_port = atoi(optarg);
+                break;
+
+            case 'z':
+                digits = atoi(optarg);
+                break;
+
+            case 'c':
+                scan_count = atoi(optarg);
+                break;
+
+            case 'k':
+                keep_flag = 1;
+                break;
+
+            case 'l':
+                PURGER_debug_level = atoi(optarg);
+                break;
+
+            case '?':
+                if(optopt == 'h' || optopt == 'p' || optopt == 'z' || optopt == 'c' || optopt == 'l')
+                {
+                    print_usage(argv);
+                    fprintf(stderr, "Option -%c requires an argument.\n", optopt);
+                }
+                else if(isprint(optopt))
+                {
+                    print_usage(argv);
+                    fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+                }
+                else
+                {
+                    print_usage(argv);
+                    fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+                }
+                exit(EXIT_FAILURE);
+
+            default:
+                abort();
+        }
+    }
+
+    for(index = optind; index < argc; index++)
+        LOG(PURGER_LOG_WARN, "Non-option argument %s", argv[index]);
+
+    if(digits < 1 || digits > PURGER_RECORD_BUCKET_MAX || scan_count < 1)
+    {
+        print_usage(argv);
+        exit(EXIT_FAILURE);
+    }
+
+    REDIS = redis_endpoint_connect(redis_hostname, redis_port, 0);
+    if(REDIS == NULL)
+        exit(EXIT_FAILURE);
+    if(REDIS->err)
+    {
+        LOG(PURGER_LOG_FATAL, "Redis error: %s", REDIS->errstr);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Carrying on after an interrupted run is fine, repacking is not. */
+    reply = redisCommand(REDIS, "GET %s", PURGER_RECORD_SCHEMA_KEY);
+    if(reply != NULL && reply->type == REDIS_REPLY_STRING)
+        current = purger_record_schema_parse(reply->str);
+    if(reply != NULL)
+        freeReplyObject(reply);
+    if(current != 0 && current != digits)
+    {
+        LOG(PURGER_LOG_FATAL, "The database is already packed in a way this tool cannot migrate to %d digits.", digits);
+        exit(EXIT_FAILURE);
+    }
+
+    memory_before = recordmigrate_used_memory();
+
+    do
+    {
+        reply = redisCommand(REDIS, "SCAN %s MATCH file:* COUNT %d", cursor, scan_count);
+        if(reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2 ||
+                reply->element[0]->type != REDIS_REPLY_STRING || (size_t)reply->element[0]->len >= sizeof(cursor))
+        {
+            LOG(PURGER_LOG_FATAL, "SCAN failed: %s", reply == NULL ? REDIS->errstr : "unexpected reply");
+            exit(EXIT_FAILURE);
+        }
+        strcpy(cursor, reply->element[0]->str);
+
+        moved = recordmigrate_batch(reply->element[1], digits, keep_flag, &skipped);
+        freeReplyObject(reply);
+        if(moved < 0)
+            exit(EXIT_FAILURE);
+
+        total += moved;
+        LOG(PURGER_LOG_DBG, "Migrated %ld records so far.", total);
+    }
+    while(strcmp(cursor, "0") != 0);
+
+    reply = redisCommand(REDIS, "SET %s packed:%d", PURGER_RECORD_SCHEMA_KEY, digits);
+    if(reply == NULL || reply->type == REDIS_REPLY_ERROR)
+    {
+        LOG(PURGER_LOG_FATAL, "Unable to record the new schema.");
+        exit(EXIT_FAILURE);
+    }
+    freeReplyObject(reply);
+
+    memory_after = recordmigrate_used_memory();
+    LOG(PURGER_LOG_INFO, "Migrated %ld records into %d buckets, skipped %ld keys.", total, 1 << (4 * digits), skipped);
+    if(memory_before > 0 && memory_after > 0)
+        LOG(PURGER_LOG_INFO, "Redis memory went from %lld to %lld bytes.", memory_before, memory_after);
+
+    redisFree(REDIS);
+    exit(EXIT_SUCCESS);
+}
+
+/* EOF */
@@ -0,0 +1,13 @@
+#ifndef RECORDMIGRATE_H
+#define RECORDMIGRATE_H
+
+#include <hiredis.h>
+
+/* Keys SCAN is asked for at a time, each batch is one round of pipelines. */
+#define RECORDMIGRATE_SCAN_COUNT 1000
+
+long long recordmigrate_used_memory(void);
+long recordmigrate_batch(redisReply *keys, int digits, int keep, long *skipped);
+void print_usage(char **argv);
+
+#endif /* RECORDMIGRATE_H */
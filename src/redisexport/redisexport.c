@@ -0,0 +1,514 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#include "config.h"
+#include "redisexport.h"
+
+#include "../common/log.h"
+#include "../common/redis.h"
+#include "../common/endpoint.h"
+#include "../common/record.h"
+#include "../common/reclog.h"
+#include "../common/scanpart.h"
+#include "../common/shards.h"
+
+FILE *PURGER_debug_stream;
+PURGER_loglevel PURGER_debug_level;
+int PURGER_global_rank;
+
+/*
+ * The path of a record's name. Names that refer to the directory table
+ * are resolved through the cache, going to the first shard, where
+ * treewalk keeps the table, only for directories not seen before.
+ * Returns -1 when the directory is not in the table.
+ */
+static int
+redisexport_resolve(redisexport_out_t *out, purger_record_t *r)
+{
+    static char path[PATH_MAX];
+    char id_str[PURGER_DIR_ID_LEN + 1];
+    redisReply *reply = NULL;
+    const char *dir = NULL;
+    const char *base = NULL;
+    size_t base_len = 0;
+    uint64_t id = 0;
+    int tries = 0;
+
+    if(purger_dir_ref_parse(r->name, r->name_len, &id, &base, &base_len) < 0)
+        return 0;
+
+    memcpy(id_str, r->name, PURGER_DIR_ID_LEN);
+    id_str[PURGER_DIR_ID_LEN] = '\0';
+    dir = purger_dir_cache_get(&out->cache, id);
+    for(tries = 0; dir == NULL && tries < 2; tries++)
+    {
+        if(out->dirs.context == NULL && purger_shard_connect(&out->dirs, out->port, NULL) < 0)
+            break;
+        reply = (redisReply *)redisCommand(out->dirs.context, "HGET " PURGER_DIR_TABLE_KEY " %s", id_str);
+        if(reply == NULL)
+        {
+            purger_shard_drop(&out->dirs);
+            continue;
+        }
+        if(reply->type == REDIS_REPLY_STRING &&
+                purger_dir_cache_put(&out->cache, id, reply->str, reply->len) == 0)
+        {
+            dir = purger_dir_cache_get(&out->cache, id);
+        }
+        freeReplyObject(reply);
+        break;
+    }
+
+    if(dir == NULL)
+    {
+        LOG(PURGER_LOG_WARN, "Skipping \"%.*s\", directory %s is not in the directory table.",
+            (int)base_len, base, id_str);
+        return -1;
+    }
+    if(snprintf(path, sizeof(path), "%s/%.*s", dir, (int)base_len, base) >= (int)sizeof(path))
+        return -1;
+
+    r->name = path;
+    r->name_len = strlen(path);
+    return 0;
+}
+
+/* Append a record to the log. Returns -1 when the log cannot be written. */
+static int
+redisexport_write(redisexport_out_t *out, purger_record_t *r, redisexport_count_t *n)
+{
+    if(redisexport_resolve(out, r) < 0)
+    {
+        n->skipped++;
+        return 0;
+    }
+    if(purger_reclog_append(out->store, r, 0) < 0)
+    {
+        LOG(PURGER_LOG_FATAL, "Unable to write the export log: %s", strerror(errno));
+        return -1;
+    }
+
+    n->records++;
+    return 0;
+}
+
+/*
+ * Write out the records of one batch: for every key SCAN returned, the
+ * reply to its HMGET, or its HVALS when the database is packed.
+ */
+static int
+redisexport_batch(redisexport_out_t *out, redisReply *keys, redisReply **values, redisexport_count_t *n)
+{
+    redisReply **f = NULL;
+    purger_record_t r;
+    size_t i = 0;
+    size_t j = 0;
+
+    for(i = 0; i < keys->elements; i++)
+    {
+        f = values[i]->element;
+        if(values[i]->type != REDIS_REPLY_ARRAY)
+        {
+            LOG(PURGER_LOG_DBG, "Skipping %s, it is not a %s.", keys->element[i]->str,
+                out->digits ? "bucket" : "file record");
+            n->skipped++;
+            continue;
+        }
+
+        if(out->digits)
+        {
+            for(j = 0; j < values[i]->elements; j++)
+            {
+                if(f[j]->type != REDIS_REPLY_STRING || purger_record_unpack(f[j]->str, f[j]->len, &r) < 0)
+                {
+                    LOG(PURGER_LOG_WARN, "Skipping a record of %s that does not unpack.", keys->element[i]->str);
+                    n->skipped++;
+                    continue;
+                }
+                if(redisexport_write(out, &r, n) < 0)
+                    return -1;
+            }
+            continue;
+        }
+
+        if(purger_record_hash_decode(values[i], &r) < 0)
+        {
+            LOG(PURGER_LOG_WARN, "Skipping %s, some of its fields are missing.", keys->element[i]->str);
+            n->skipped++;
+            continue;
+        }
+        if(redisexport_write(out, &r, n) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+redisexport_scan_ok(const redisReply *reply)
+{
+    return reply->type == REDIS_REPLY_ARRAY && reply->elements == 2 &&
+           reply->element[0]->type == REDIS_REPLY_STRING &&
+           reply->element[1]->type == REDIS_REPLY_ARRAY;
+}
+
+static void
+redisexport_free_values(redisReply **values, size_t count)
+{
+    size_t i = 0;
+
+    for(i = 0; i < count; i++)
+    {
+        if(values[i] != NULL)
+            freeReplyObject(values[i]);
+    }
+    free(values);
+}
+
+/*
+ * The connection to a shard broke in the middle of a batch. Let it go
+ * and wait before the batch at "cursor" is read again, longer for every
+ * loss in a row. Returns -1 once the shard was lost too often to go on.
+ */
+static int
+redisexport_lost(purger_shard_t *sh, uint64_t cursor, int *lost, redisexport_count_t *n)
+{
+    double delay = REDIS_RECONNECT_DELAY;
+    int i = 0;
+
+    LOG(PURGER_LOG_WARN, "Lost %s (%s), reading the batch at %llu again.", sh->host,
+        sh->context->errstr, (unsigned long long)cursor);
+    purger_shard_drop(sh);
+    n->resent++;
+    if(++(*lost) >= REDIS_RECONNECT_TRIES)
+        return -1;
+
+    for(i = 1; i < *lost; i++)
+        delay = 2 * delay < REDIS_RECONNECT_DELAY_MAX ? 2 * delay : REDIS_RECONNECT_DELAY_MAX;
+    usleep((useconds_t)(delay * 1e6));
+    return 0;
+}
+
+/*
+ * Export part "part" of "parts" of a shard's SCAN into the log. The keys
+ * of every SCAN batch are read with one pipeline of HMGETs (HVALS of the
+ * buckets when packed), and the SCAN for the next batch goes out with
+ * them. A SCAN that runs past the end of the part is done again a bucket
+ * at a time, see scanpart.h. A batch is only written once all its
+ * replies are in, so when the connection drops the batch is read again
+ * from the cursor it started at. Returns the records written, or -1 when
+ * the shard was lost or the log could not be written.
+ */
+long long
+redisexport_part(purger_shard_t *sh, unsigned part, unsigned parts,
+                 redisexport_out_t *out, redisexport_count_t *n)
+{
+    const char *match = out->digits ? "bucket:*" : "file:*";
+    uint64_t cursor = purger_scan_part_start(part, parts);
+    uint64_t end = purger_scan_part_end(part, parts);
+    uint64_t next = 0;
+    long long before = n->records;
+    redisReply *keys = NULL;
+    redisReply *ahead = NULL;
+    redisReply **values = NULL;
+    redisReply **k = NULL;
+    size_t got = 0;
+    size_t i = 0;
+    int stride = out->count;
+    int more = 0;
+    int lost = 0;
+    int status = -1;
+
+    for(;;)
+    {
+        if(sh->context == NULL && purger_shard_connect(sh, out->port, NULL) < 0)
+            break;
+
+        /* The batch at the cursor, unless the last pipeline brought it. */
+        if(keys == NULL)
+        {
+            keys = (redisReply *)redisCommand(sh->context, "SCAN %llu MATCH %s COUNT %d",
+                                              (unsigned long long)cursor, match, stride);
+            if(keys == NULL)
+            {
+                if(redisexport_lost(sh, cursor, &lost, n) < 0)
+                    break;
+                continue;
+            }
+        }
+        if(!redisexport_scan_ok(keys))
+        {
+            LOG(PURGER_LOG_ERR, "SCAN on %s failed in part %u of %u: %s", sh->host, part, parts,
+                keys->type == REDIS_REPLY_ERROR ? keys->str : "unexpected reply");
+            break;
+        }
+
+        next = strtoull(keys->element[0]->str, NULL, 10);
+        if(!purger_scan_part_owns(next, part, parts) && next != end)
+        {
+            freeReplyObject(keys);
+            keys = NULL;
+            if(stride == 1)
+            {
+                /* The one bucket it found is another part's, this one is done. */
+                status = 0;
+                break;
+            }
+            stride = 1;
+            continue;
+        }
+
+        k = keys->element[1]->element;
+        got = keys->element[1]->elements;
+        more = purger_scan_part_owns(next, part, parts);
+        values = (redisReply **)calloc(got + 1, sizeof(redisReply *));
+        if(values == NULL)
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+
+        for(i = 0; i < got; i++)
+        {
+            if(out->digits)
+                redisAppendCommand(sh->context, "HVALS %b", k[i]->str, k[i]->len);
+            else
+                redisAppendCommand(sh->context, "HMGET %b " PURGER_RECORD_HASH_FIELDS, k[i]->str, k[i]->len);
+        }
+        if(more)
+            redisAppendCommand(sh->context, "SCAN %llu MATCH %s COUNT %d",
+                               (unsigned long long)next, match, stride);
+
+        for(i = 0; i < got && redisGetReply(sh->context, (void **)&values[i]) == REDIS_OK; i++)
+            ;
+        if(i == got && more && redisGetReply(sh->context, (void **)&ahead) != REDIS_OK)
+            ahead = NULL;
+
+        if(i == got)
+        {
+            if(redisexport_batch(out, keys->element[1], values, n) < 0)
+            {
+                redisexport_free_values(values, got);
+                break;
+            }
+            n->batches++;
+            cursor = next;
+            lost = 0;
+        }
+        redisexport_free_values(values, got);
+        freeReplyObject(keys);
+        keys = ahead;
+        ahead = NULL;
+
+        if(i < got || (more && keys == NULL))
+        {
+            if(redisexport_lost(sh, cursor, &lost, n) < 0)
+                break;
+            continue;
+        }
+
+        if(!more)
+        {
+            status = 0;
+            break;
+        }
+    }
+
+    if(keys != NULL)
+        freeReplyObject(keys);
+    if(status < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Gave up on %s, part %u of %u is incomplete.", sh->host, part, parts);
+        return -1;
+    }
+
+    LOG(PURGER_LOG_DBG, "Exported %lld records of part %u of %u on %s.", n->records - before, part, parts, sh->host);
+    return n->records - before;
+}
+
+void
+print_usage(char **argv)
+{
+    fprintf(stderr, "Usage: %s -o <export directory> [-h <redis host[:port] or socket path> -p <redis_port> -s <redis_hostlist> -c <scan count> -l <log level>]\n", argv[0]);
+}
+
+int
+main (int argc, char **argv)
+{
+    int index;
+    int c;
+
+    char *redis_hostname = "localhost";
+    char *redis_hostlist = NULL;
+    int redis_port = 6379;
+    char *out_dir = NULL;
+    int scan_count = 0;
+
+    redisexport_out_t out;
+    redisexport_count_t count;
+    redisexport_count_t total;
+    purger_shards_t set;
+    purger_scan_turn_t turn;
+    int s = 0;
+
+    int digits = 0;
+    int opened = 0;
+    int all_opened = 0;
+    int failed = 0;
+    int any_failed = 0;
+    double start = 0.0;
+    double elapsed = 0.0;
+    double slowest = 0.0;
+    int ranks = 0;
+    int rank = 0;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    PURGER_global_rank = rank;
+    PURGER_debug_stream = stderr;
+    PURGER_debug_level = PURGER_LOG_INFO;
+    memset(&out, 0, sizeof(out));
+    memset(&count, 0, sizeof(count));
+    memset(&total, 0, sizeof(total));
+
+    opterr = 0;
+    while((c = getopt(argc, argv, "h:p:s:o:c:l:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                redis_hostname = optarg;
+                break;
+
+            case 'p':
+                redis_port = atoi(optarg);
+                break;
+
+            case 's':
+                redis_hostlist = optarg;
+                break;
+
+            case 'o':
+                out_dir = optarg;
+                break;
+
+            case 'c':
+                scan_count = atoi(optarg);
+                break;
+
+            case 'l':
+                PURGER_debug_level = atoi(optarg);
+                break;
+
+            case '?':
+                if(rank == 0)
+                {
+                    print_usage(argv);
+                    if(optopt == 'h' || optopt == 'p' || optopt == 's' || optopt == 'o' || optopt == 'c' || optopt == 'l')
+                        fprintf(stderr, "Option -%c requires an argument.\n", optopt);
+                    else if(isprint(optopt))
+                        fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+                    else
+                        fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+                }
+                MPI_Finalize();
+                exit(EXIT_FAILURE);
+
+            default:
+                abort();
+        }
+    }
+
+    for(index = optind; index < argc; index++)
+        LOG(PURGER_LOG_WARN, "Non-option argument %s", argv[index]);
+
+    if(out_dir == NULL || scan_count < 0)
+    {
+        if(rank == 0)
+            print_usage(argv);
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    /* Shards can drop and come back, which must not end the process. */
+    signal(SIGPIPE, SIG_IGN);
+    start = MPI_Wtime();
+
+    /* How the database stores records, from the server treewalk tells. */
+    digits = purger_shards_schema(redis_hostname, redis_port, rank);
+    if(digits < 0)
+    {
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    /* Every rank writes its own log, the same a walk with -o leaves. */
+    out.store = purger_reclog_open(out_dir, rank);
+    if(out.store == NULL)
+        LOG(PURGER_LOG_FATAL, "Unable to start the export log of rank %d in %s: %s", rank, out_dir, strerror(errno));
+    opened = out.store != NULL;
+    MPI_Allreduce(&opened, &all_opened, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if(!all_opened)
+    {
+        if(out.store != NULL)
+            (*out.store->close)(out.store);
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+    out.port = redis_port;
+    out.digits = digits;
+    out.count = scan_count ? scan_count : digits ? REDISEXPORT_BUCKET_COUNT : REDISEXPORT_SCAN_COUNT;
+
+    /* The shards, or the one server when the records are not sharded. */
+    purger_shards_init(&set, redis_hostlist != NULL ? redis_hostlist : redis_hostname, redis_port, NULL);
+    out.dirs.host = set.shards[0].host;
+    if(purger_shards_cut(&set, REDISEXPORT_PARTS_PER_RANK, rank, ranks) > 0)
+        failed = rank == 0;
+    if(rank == 0)
+        LOG(PURGER_LOG_INFO, "Exporting %lld keys of %d shards, in up to %u parts each, on %d ranks to %s.",
+            set.keys, set.count, set.most, ranks, out_dir);
+
+    memset(&turn, 0, sizeof(turn));
+    while((s = purger_scan_part_next(set.parts, set.count, rank, ranks, &turn)) >= 0)
+    {
+        if(redisexport_part(&set.shards[s], turn.part, set.parts[s], &out, &count) < 0)
+            failed = 1;
+    }
+
+    purger_shard_drop(&out.dirs);
+    purger_dir_cache_free(&out.cache);
+    if((*out.store->close)(out.store) < 0)
+    {
+        LOG(PURGER_LOG_FATAL, "Unable to write the export log of rank %d in %s: %s", rank, out_dir, strerror(errno));
+        failed = 1;
+    }
+    elapsed = MPI_Wtime() - start;
+    LOG(PURGER_LOG_DBG, "Exported %lld records in %lld batches, %lld of them sent again.",
+        count.records, count.batches, count.resent);
+
+    MPI_Reduce(&count, &total, 4, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&failed, &any_failed, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if(rank == 0)
+    {
+        if(any_failed)
+            LOG(PURGER_LOG_ERR, "Some shards could not be exported, the logs are short.");
+        if(total.skipped > 0)
+            LOG(PURGER_LOG_WARN, "Skipped %lld keys or records that are not files.", total.skipped);
+        LOG(PURGER_LOG_INFO, "Exported %lld records from %d shards in %.3f s (%.0f records/s), %lld batches on %d ranks, %lld sent again.",
+            total.records, set.count, slowest, slowest > 0.0 ? total.records / slowest : 0.0,
+            total.batches, ranks, total.resent);
+    }
+
+    purger_shards_free(&set);
+    MPI_Finalize();
+    exit(any_failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/* EOF */
@@ -0,0 +1,43 @@
+#ifndef REDISEXPORT_H
+#define REDISEXPORT_H
+
+#include <stdint.h>
+
+#include <hiredis.h>
+
+#include "../common/store.h"
+#include "../common/dirtable.h"
+#include "../common/shards.h"
+
+/* Keys each SCAN asks for. A packed bucket holds many records, so fewer
+ * of those go into one pipeline. */
+#define REDISEXPORT_SCAN_COUNT      1000
+#define REDISEXPORT_BUCKET_COUNT    16
+/* SCAN parts per rank working on a shard, so the ranks even out. */
+#define REDISEXPORT_PARTS_PER_RANK  4
+
+/* What one rank has done. */
+typedef struct
+{
+    long long records;
+    long long skipped;
+    long long batches;
+    long long resent;
+} redisexport_count_t;
+
+/* Where the records of one rank go. */
+typedef struct
+{
+    purger_store_t      *store;
+    purger_shard_t       dirs;
+    purger_dir_cache_t   cache;
+    int                  port;
+    int                  digits;
+    int                  count;
+} redisexport_out_t;
+
+long long redisexport_part(purger_shard_t *sh, unsigned part, unsigned parts,
+                           redisexport_out_t *out, redisexport_count_t *n);
+void      print_usage(char **argv);
+
+#endif /* REDISEXPORT_H */
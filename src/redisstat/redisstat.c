@@ -0,0 +1,674 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#include "config.h"
+#include "redisstat.h"
+
+#include "../common/log.h"
+#include "../common/redis.h"
+#include "../common/endpoint.h"
+#include "../common/record.h"
+#include "../common/scanpart.h"
+#include "../common/shards.h"
+
+FILE *PURGER_debug_stream;
+PURGER_loglevel PURGER_debug_level;
+int PURGER_global_rank;
+
+#define SECONDS_PER_DAY 60.0*60.0*24.0
+
+/*
+ * Adds up one part of a SCAN server side. ARGV[1] is the cursor to go on
+ * from, then come the low bits every cursor of the part has, how many
+ * parts there are and the cursor the part ends at, the records to add up
+ * before returning, the COUNT of each SCAN, the bucket digits of a packed
+ * database (0 for one hash per file), "1" to count by gid instead of uid
+ * and the mtimes the age buckets are cut at, newest first. A SCAN that
+ * runs past the end of the part is done again a bucket at a time, see
+ * scanpart.h. Returns the cursor to go on from, the records it saw and
+ * owner, age bucket, files and bytes back to back for every owner and
+ * bucket it saw files in.
+ */
+static const char redisstat_script[] =
+    "local cursor, low, parts, finish = ARGV[1], tonumber(ARGV[2]), tonumber(ARGV[3]), ARGV[4]\n"
+    "local budget, count, packed = tonumber(ARGV[5]), ARGV[6], ARGV[7] ~= '0'\n"
+    "local by_gid = ARGV[8] == '1'\n"
+    "local cutoffs = {}\n"
+    "for i = 9, #ARGV do cutoffs[#cutoffs + 1] = tonumber(ARGV[i]) end\n"
+    "local sums, order, seen, work, stride = {}, {}, 0, 0, count\n"
+    "local function mine(c)\n"
+    "    return c ~= '0' and tonumber(c) % parts == low\n"
+    "end\n"
+    "local function add(mtime, size, owner)\n"
+    "    local age = 0\n"
+    "    while age < #cutoffs and mtime < cutoffs[age + 1] do age = age + 1 end\n"
+    "    local s = sums[owner * 64 + age]\n"
+    "    if s == nil then\n"
+    "        s = {owner, age, 0, 0}\n"
+    "        sums[owner * 64 + age] = s\n"
+    "        order[#order + 1] = s\n"
+    "    end\n"
+    "    s[3] = s[3] + 1\n"
+    "    s[4] = s[4] + size\n"
+    "    seen = seen + 1\n"
+    "end\n"
+    "local function num(v)\n"
+    "    return v and tonumber((string.gsub(v, '\"', '')))\n"
+    "end\n"
+    "local function tally(key)\n"
+    "    if packed then\n"
+    "        for _, rec in ipairs(redis.call('HVALS', key)) do\n"
+    "            if #rec >= 25 then\n"
+    "                local mtime, size, uid, gid = struct.unpack('<i8I8I4I4', rec, 2)\n"
+    "                add(mtime, size, by_gid and gid or uid)\n"
+    "            end\n"
+    "        end\n"
+    "    else\n"
+    "        local v = redis.pcall('HMGET', key, 'mtime_decimal', 'size', by_gid and 'gid_decimal' or 'uid_decimal')\n"
+    "        if v.err == nil then\n"
+    "            local mtime, size, owner = num(v[1]), num(v[2]), num(v[3])\n"
+    "            if mtime and size and owner then add(mtime, size, owner) end\n"
+    "        end\n"
+    "    end\n"
+    "end\n"
+    "repeat\n"
+    "    local r = redis.call('SCAN', cursor, 'MATCH', packed and 'bucket:*' or 'file:*', 'COUNT', stride)\n"
+    "    work = work + tonumber(stride)\n"
+    "    if mine(r[1]) or r[1] == finish then\n"
+    "        cursor = r[1]\n"
+    "        for _, key in ipairs(r[2]) do tally(key) end\n"
+    "    elseif stride ~= '1' then\n"
+    "        stride = '1'\n"
+    "    else\n"
+    "        cursor = r[1]\n"
+    "    end\n"
+    "until not mine(cursor) or seen >= budget or work >= 4 * budget\n"
+    "local out = {}\n"
+    "for _, s in ipairs(order) do\n"
+    "    out[#out + 1] = s[1]\n"
+    "    out[#out + 1] = s[2]\n"
+    "    out[#out + 1] = s[3]\n"
+    "    out[#out + 1] = s[4]\n"
+    "end\n"
+    "return {cursor, seen, out}\n";
+
+/* The SHA1 of the script once it is loaded. */
+static char redisstat_sha[41];
+
+static int
+redisstat_grow(redisstat_table_t *t)
+{
+    size_t size = t->size ? 2 * t->size : REDISSTAT_OWNERS;
+    redisstat_owner_t *slots = (redisstat_owner_t *)calloc(size, sizeof(redisstat_owner_t));
+    size_t i = 0;
+    size_t j = 0;
+
+    if(slots == NULL)
+        return -1;
+
+    for(i = 0; i < t->size; i++)
+    {
+        if(!t->slots[i].used)
+            continue;
+        for(j = (t->slots[i].id * 2654435761u) & (size - 1); slots[j].used; j = (j + 1) & (size - 1))
+            ;
+        slots[j] = t->slots[i];
+    }
+
+    free(t->slots);
+    t->slots = slots;
+    t->size = size;
+    return 0;
+}
+
+/* Count "files" of "bytes" against owner "id" in age bucket "age". */
+int
+redisstat_add(redisstat_table_t *t, uint32_t id, int age, uint64_t files, uint64_t bytes)
+{
+    size_t i = 0;
+
+    if(2 * (t->count + 1) > t->size && redisstat_grow(t) < 0)
+        return -1;
+
+    for(i = (id * 2654435761u) & (t->size - 1); t->slots[i].used && t->slots[i].id != id; i = (i + 1) & (t->size - 1))
+        ;
+
+    if(!t->slots[i].used)
+    {
+        t->slots[i].id = id;
+        t->slots[i].used = 1;
+        t->count++;
+    }
+    t->slots[i].files[age] += files;
+    t->slots[i].bytes[age] += bytes;
+    return 0;
+}
+
+/*
+ * Load the script on a new connection to a shard. Every shard hands back
+ * the same SHA1, that of the script.
+ */
+static int
+redisstat_load(purger_shard_t *sh)
+{
+    redisReply *reply = (redisReply *)redisCommand(sh->context, "SCRIPT LOAD %s", redisstat_script);
+
+    if(reply != NULL && reply->type == REDIS_REPLY_STRING && (size_t)reply->len < sizeof(redisstat_sha))
+    {
+        memcpy(redisstat_sha, reply->str, reply->len + 1);
+        freeReplyObject(reply);
+        return 0;
+    }
+    if(reply != NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to load the script on %s: %s", sh->host,
+            reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+        freeReplyObject(reply);
+    }
+    return -1;
+}
+
+/*
+ * Run the script on a shard. The script only reads, so when the
+ * connection drops or the server restarted without it the call is just
+ * sent again on a new connection.
+ */
+static redisReply *
+redisstat_call(purger_shard_t *sh, int port, int argc, const char **argv, size_t *argvlen)
+{
+    redisReply *reply = NULL;
+    int tries = 0;
+
+    for(tries = 0; tries < 2; tries++)
+    {
+        if(sh->context == NULL && purger_shard_connect(sh, port, redisstat_load) < 0)
+            return NULL;
+
+        argv[1] = redisstat_sha;
+        argvlen[1] = strlen(redisstat_sha);
+        reply = (redisReply *)redisCommandArgv(sh->context, argc, argv, argvlen);
+        if(reply != NULL && (reply->type != REDIS_REPLY_ERROR || strncmp(reply->str, "NOSCRIPT", 8) != 0))
+            return reply;
+
+        LOG(PURGER_LOG_WARN, "Lost %s (%s), sending the call again.", sh->host,
+            reply != NULL ? reply->str : sh->context->errstr);
+        if(reply != NULL)
+            freeReplyObject(reply);
+        purger_shard_drop(sh);
+    }
+
+    return NULL;
+}
+
+/*
+ * Add up part "part" of "parts" of a shard's SCAN into t, one script call
+ * after the other until the cursor leaves the part. Returns the records
+ * seen, or -1 when the shard could not be asked or gave a reply that
+ * makes no sense, with the part's sums so far left in t.
+ */
+long long
+redisstat_part(purger_shard_t *sh, int port, unsigned part, unsigned parts,
+               const redisstat_query_t *q, redisstat_table_t *t, long long *calls)
+{
+    const char *argv[11 + REDISSTAT_AGES_MAX];
+    size_t argvlen[11 + REDISSTAT_AGES_MAX];
+    uint64_t next = purger_scan_part_start(part, parts);
+    redisReply *reply = NULL;
+    redisReply **e = NULL;
+    redisReply **s = NULL;
+    char cursor[32];
+    char low[32];
+    char of[32];
+    char finish[32];
+    long long seen = 0;
+    size_t i = 0;
+    int argc = 0;
+
+    snprintf(low, sizeof(low), "%llu", (unsigned long long)next);
+    snprintf(of, sizeof(of), "%u", parts);
+    snprintf(finish, sizeof(finish), "%llu", (unsigned long long)purger_scan_part_end(part, parts));
+    argv[argc++] = "EVALSHA";
+    argv[argc++] = redisstat_sha;
+    argv[argc++] = "0";
+    argv[argc++] = cursor;
+    argv[argc++] = low;
+    argv[argc++] = of;
+    argv[argc++] = finish;
+    argv[argc++] = q->budget;
+    argv[argc++] = q->count;
+    argv[argc++] = q->digits;
+    argv[argc++] = q->by_gid;
+    for(i = 0; i < (size_t)q->ages; i++)
+        argv[argc++] = q->cutoffs[i];
+    for(i = 0; i < (size_t)argc; i++)
+        argvlen[i] = strlen(argv[i]);
+
+    do
+    {
+        snprintf(cursor, sizeof(cursor), "%llu", (unsigned long long)next);
+        argvlen[3] = strlen(cursor);
+        reply = redisstat_call(sh, port, argc, argv, argvlen);
+        (*calls)++;
+        if(reply == NULL)
+        {
+            LOG(PURGER_LOG_ERR, "Gave up on %s, part %u of %u is incomplete.", sh->host, part, parts);
+            return -1;
+        }
+
+        e = reply->element;
+        if(reply->type != REDIS_REPLY_ARRAY || reply->elements != 3 ||
+                e[0]->type != REDIS_REPLY_STRING || e[1]->type != REDIS_REPLY_INTEGER ||
+                e[2]->type != REDIS_REPLY_ARRAY || e[2]->elements % 4 != 0)
+        {
+            LOG(PURGER_LOG_ERR, "The script on %s failed in part %u of %u: %s", sh->host, part, parts,
+                reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+            freeReplyObject(reply);
+            return -1;
+        }
+
+        for(i = 0; i < e[2]->elements; i += 4)
+        {
+            s = e[2]->element + i;
+            if(s[0]->type != REDIS_REPLY_INTEGER || s[1]->type != REDIS_REPLY_INTEGER ||
+                    s[2]->type != REDIS_REPLY_INTEGER || s[3]->type != REDIS_REPLY_INTEGER ||
+                    s[1]->integer < 0 || s[1]->integer > q->ages)
+            {
+                LOG(PURGER_LOG_ERR, "The script on %s sent back a sum that makes no sense.", sh->host);
+                freeReplyObject(reply);
+                return -1;
+            }
+            if(redisstat_add(t, (uint32_t)s[0]->integer, (int)s[1]->integer,
+                             (uint64_t)s[2]->integer, (uint64_t)s[3]->integer) < 0)
+                MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+
+        seen += e[1]->integer;
+        next = strtoull(e[0]->str, NULL, 10);
+        freeReplyObject(reply);
+    }
+    while(purger_scan_part_owns(next, part, parts));
+
+    LOG(PURGER_LOG_DBG, "Added up %lld records of part %u of %u on %s.", seen, part, parts, sh->host);
+    return seen;
+}
+
+static int
+redisstat_id_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Add up the tables of all ranks on rank 0. The owners are gathered
+ * there and sent back as one sorted list, every rank lays its table out
+ * along it and one MPI_Reduce sums them. Rank 0 then has the owners in
+ * *ids and, for each, its files in every age bucket followed by its
+ * bytes in every age bucket in *sums.
+ */
+int
+redisstat_reduce(redisstat_table_t *t, int ages, int rank, int ranks,
+                 uint32_t **ids, uint64_t **sums, size_t *count)
+{
+    size_t width = 2 * (size_t)(ages + 1);
+    uint32_t *mine = NULL;
+    uint32_t *all = NULL;
+    uint32_t *hit = NULL;
+    uint64_t *dense = NULL;
+    int *counts = NULL;
+    int *displs = NULL;
+    long long m = 0;
+    size_t i = 0;
+    size_t j = 0;
+    int n = 0;
+    int a = 0;
+
+    mine = (uint32_t *)malloc((t->count + 1) * sizeof(uint32_t));
+    if(mine == NULL)
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    for(i = 0; i < t->size; i++)
+        if(t->slots[i].used)
+            mine[n++] = t->slots[i].id;
+
+    if(rank == 0)
+    {
+        counts = (int *)malloc(ranks * sizeof(int));
+        displs = (int *)malloc(ranks * sizeof(int));
+        if(counts == NULL || displs == NULL)
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    MPI_Gather(&n, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if(rank == 0)
+    {
+        for(a = 0; a < ranks; a++)
+        {
+            displs[a] = (int)m;
+            m += counts[a];
+        }
+        all = (uint32_t *)malloc((m + 1) * sizeof(uint32_t));
+        if(all == NULL)
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    MPI_Gatherv(mine, n, MPI_UINT32_T, all, counts, displs, MPI_UINT32_T, 0, MPI_COMM_WORLD);
+
+    if(rank == 0 && m > 0)
+    {
+        qsort(all, (size_t)m, sizeof(uint32_t), redisstat_id_cmp);
+        for(i = 1, j = 1; i < (size_t)m; i++)
+            if(all[i] != all[j - 1])
+                all[j++] = all[i];
+        m = (long long)j;
+    }
+    MPI_Bcast(&m, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    if(rank != 0)
+    {
+        all = (uint32_t *)malloc((m + 1) * sizeof(uint32_t));
+        if(all == NULL)
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    MPI_Bcast(all, (int)m, MPI_UINT32_T, 0, MPI_COMM_WORLD);
+
+    dense = (uint64_t *)calloc((size_t)m * width + 1, sizeof(uint64_t));
+    if(dense == NULL)
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    for(i = 0; i < t->size; i++)
+    {
+        if(!t->slots[i].used)
+            continue;
+        hit = (uint32_t *)bsearch(&t->slots[i].id, all, (size_t)m, sizeof(uint32_t), redisstat_id_cmp);
+        j = (size_t)(hit - all) * width;
+        for(a = 0; a <= ages; a++)
+        {
+            dense[j + a] = t->slots[i].files[a];
+            dense[j + ages + 1 + a] = t->slots[i].bytes[a];
+        }
+    }
+
+    if(rank == 0)
+    {
+        *sums = (uint64_t *)calloc((size_t)m * width + 1, sizeof(uint64_t));
+        if(*sums == NULL)
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    MPI_Reduce(dense, rank == 0 ? *sums : NULL, (int)((size_t)m * width), MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if(rank == 0)
+    {
+        *ids = all;
+        *count = (size_t)m;
+    }
+    else
+    {
+        free(all);
+    }
+    free(dense);
+    free(mine);
+    free(counts);
+    free(displs);
+    return 0;
+}
+
+static int
+redisstat_bytes_cmp(const void *a, const void *b)
+{
+    const redisstat_total_t *x = (const redisstat_total_t *)a;
+    const redisstat_total_t *y = (const redisstat_total_t *)b;
+
+    if(x->bytes != y->bytes)
+        return x->bytes > y->bytes ? -1 : 1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+void
+print_usage(char **argv)
+{
+    fprintf(stderr, "Usage: %s [-h <redis host[:port] or socket path> -p <redis_port> -s <redis_hostlist> -b <days>[,<days>...] -g -c <records per call> -l <log level>]\n", argv[0]);
+}
+
+int
+main (int argc, char **argv)
+{
+    int index;
+    int c;
+
+    char *redis_hostname = "localhost";
+    char *redis_hostlist = NULL;
+    int redis_port = 6379;
+    char *ages_list = REDISSTAT_AGES_DEFAULT;
+    char ages_buf[256];
+    char labels[REDISSTAT_AGES_MAX + 1][64];
+    double days[REDISSTAT_AGES_MAX];
+    long budget = REDISSTAT_BUDGET;
+    int by_gid = 0;
+
+    redisstat_query_t q;
+    redisstat_table_t table;
+    purger_shards_t set;
+    purger_scan_turn_t turn;
+    int s = 0;
+
+    int digits = 0;
+    long long now = 0;
+    long long seen = 0;
+    long long records = 0;
+    long long total_records = 0;
+    long long calls = 0;
+    long long total_calls = 0;
+    int failed = 0;
+    int any_failed = 0;
+
+    uint32_t *ids = NULL;
+    uint64_t *sums = NULL;
+    size_t owners = 0;
+    size_t width = 0;
+    redisstat_total_t *order = NULL;
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    double start = 0.0;
+    char *tok = NULL;
+    size_t i = 0;
+    size_t j = 0;
+    int a = 0;
+    int ranks = 0;
+    int rank = 0;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    PURGER_global_rank = rank;
+    PURGER_debug_stream = stderr;
+    PURGER_debug_level = PURGER_LOG_INFO;
+    memset(&q, 0, sizeof(q));
+    memset(&table, 0, sizeof(table));
+
+    opterr = 0;
+    while((c = getopt(argc, argv, "h:p:s:b:gc:l:")) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+                redis_hostname = optarg;
+                break;
+
+            case 'p':
+                redis_port = atoi(optarg);
+                break;
+
+            case 's':
+                redis_hostlist = optarg;
+                break;
+
+            case 'b':
+                ages_list = optarg;
+                break;
+
+            case 'g':
+                by_gid = 1;
+                break;
+
+            case 'c':
+                budget = atol(optarg);
+                break;
+
+            case 'l':
+                PURGER_debug_level = atoi(optarg);
+                break;
+
+            case '?':
+                if(rank == 0)
+                {
+                    print_usage(argv);
+                    if(optopt == 'h' || optopt == 'p' || optopt == 's' || optopt == 'b' || optopt == 'c' || optopt == 'l')
+                        fprintf(stderr, "Option -%c requires an argument.\n", optopt);
+                    else if(isprint(optopt))
+                        fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+                    else
+                        fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+                }
+                MPI_Finalize();
+                exit(EXIT_FAILURE);
+
+            default:
+                abort();
+        }
+    }
+
+    for(index = optind; index < argc; index++)
+        LOG(PURGER_LOG_WARN, "Non-option argument %s", argv[index]);
+
+    /* The age buckets, cut at ever older days. */
+    snprintf(ages_buf, sizeof(ages_buf), "%s", ages_list);
+    for(tok = strtok(ages_buf, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        if(q.ages == REDISSTAT_AGES_MAX || (days[q.ages] = atof(tok)) <= (q.ages ? days[q.ages - 1] : 0.0))
+        {
+            if(rank == 0)
+            {
+                print_usage(argv);
+                LOG(PURGER_LOG_FATAL, "Age buckets take up to %d days, each more than the one before.", REDISSTAT_AGES_MAX);
+            }
+            MPI_Finalize();
+            exit(EXIT_FAILURE);
+        }
+        q.ages++;
+    }
+    if(budget < 1)
+    {
+        if(rank == 0)
+            print_usage(argv);
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    /* Shards can drop and come back, which must not end the process. */
+    signal(SIGPIPE, SIG_IGN);
+    start = MPI_Wtime();
+
+    /* How the database stores records, and what "now" is for every rank. */
+    digits = purger_shards_schema(redis_hostname, redis_port, rank);
+    if(rank == 0)
+        now = (long long)time(NULL);
+    MPI_Bcast(&now, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    if(digits < 0)
+    {
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(q.digits, sizeof(q.digits), "%d", digits);
+    snprintf(q.by_gid, sizeof(q.by_gid), "%d", by_gid);
+    snprintf(q.budget, sizeof(q.budget), "%ld", budget);
+    /* A bucket holds many records, so take them a bucket at a time. */
+    snprintf(q.count, sizeof(q.count), "%d", digits ? 1 : REDISSTAT_SCAN_COUNT);
+    for(a = 0; a < q.ages; a++)
+        snprintf(q.cutoffs[a], sizeof(q.cutoffs[a]), "%lld", now - (long long)(SECONDS_PER_DAY * days[a]));
+
+    /* The shards, or the one server when the records are not sharded. */
+    purger_shards_init(&set, redis_hostlist != NULL ? redis_hostlist : redis_hostname, redis_port, redisstat_load);
+    if(purger_shards_cut(&set, REDISSTAT_PARTS_PER_RANK, rank, ranks) > 0)
+        failed = rank == 0;
+    if(rank == 0)
+        LOG(PURGER_LOG_INFO, "Adding up %lld keys of %d shards, in up to %u parts each, on %d ranks.",
+            set.keys, set.count, set.most, ranks);
+
+    memset(&turn, 0, sizeof(turn));
+    while((s = purger_scan_part_next(set.parts, set.count, rank, ranks, &turn)) >= 0)
+    {
+        seen = redisstat_part(&set.shards[s], redis_port, turn.part, set.parts[s], &q, &table, &calls);
+        if(seen < 0)
+            failed = 1;
+        else
+            records += seen;
+    }
+
+    redisstat_reduce(&table, q.ages, rank, ranks, &ids, &sums, &owners);
+    MPI_Reduce(&records, &total_records, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&calls, &total_calls, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&failed, &any_failed, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if(rank == 0)
+    {
+        if(q.ages == 0)
+            strcpy(labels[0], "all");
+        for(a = 0; a < q.ages; a++)
+            snprintf(labels[a], sizeof(labels[a]), "%g-%g", a ? days[a - 1] : 0.0, days[a]);
+        if(q.ages > 0)
+            snprintf(labels[q.ages], sizeof(labels[q.ages]), "%g+", days[q.ages - 1]);
+
+        /* Put the owners with the most bytes first. */
+        width = 2 * (size_t)(q.ages + 1);
+        order = (redisstat_total_t *)calloc(owners + 1, sizeof(redisstat_total_t));
+        if(order == NULL)
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        for(i = 0; i < owners; i++)
+        {
+            order[i].id = ids[i];
+            order[i].at = i * width;
+            for(a = 0; a <= q.ages; a++)
+                order[i].bytes += sums[i * width + q.ages + 1 + a];
+        }
+        if(owners > 0)
+            qsort(order, owners, sizeof(redisstat_total_t), redisstat_bytes_cmp);
+
+        printf("%s\tdays\tfiles\tbytes\n", by_gid ? "gid" : "uid");
+        for(i = 0; i < owners; i++)
+        {
+            for(a = 0, j = order[i].at; a <= q.ages; a++)
+            {
+                if(sums[j + a] == 0)
+                    continue;
+                printf("%lu\t%s\t%llu\t%llu\n", (unsigned long)order[i].id, labels[a],
+                       (unsigned long long)sums[j + a], (unsigned long long)sums[j + q.ages + 1 + a]);
+                files += sums[j + a];
+                bytes += sums[j + q.ages + 1 + a];
+            }
+        }
+
+        if(any_failed)
+            LOG(PURGER_LOG_ERR, "Some shards could not be added up, the sums are short.");
+        LOG(PURGER_LOG_INFO, "%llu files (%llu bytes) of %zu owners from %d shards in %.3f s, %lld script calls on %d ranks.",
+            (unsigned long long)files, (unsigned long long)bytes, owners, set.count, MPI_Wtime() - start,
+            total_calls, ranks);
+        if((long long)files != total_records)
+            LOG(PURGER_LOG_WARN, "The scripts saw %lld records but the sums hold %llu.", total_records, (unsigned long long)files);
+    }
+
+    free(ids);
+    free(sums);
+    free(order);
+    purger_shards_free(&set);
+    free(table.slots);
+    MPI_Finalize();
+    exit(any_failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/* EOF */
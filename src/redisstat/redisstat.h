@@ -0,0 +1,64 @@
+#ifndef REDISSTAT_H
+#define REDISSTAT_H
+
+#include <stdint.h>
+
+#include <hiredis.h>
+
+#include "../common/shards.h"
+
+/* Age buckets are cut at up to this many days, one more bucket than that. */
+#define REDISSTAT_AGES_MAX        16
+#define REDISSTAT_AGES_DEFAULT    "30,90,180,365"
+/* Records one script call adds up before it returns, and the COUNT of its
+ * SCANs. A call keeps the server busy for a few milliseconds at most. */
+#define REDISSTAT_BUDGET          20000
+#define REDISSTAT_SCAN_COUNT      1000
+/* SCAN parts per rank working on a shard, so the ranks even out. */
+#define REDISSTAT_PARTS_PER_RANK  4
+/* Slots the owner table starts with, a power of two. */
+#define REDISSTAT_OWNERS          1024
+
+/* Files and bytes of one uid or gid in every age bucket. */
+typedef struct
+{
+    uint32_t id;
+    int      used;
+    uint64_t files[REDISSTAT_AGES_MAX + 1];
+    uint64_t bytes[REDISSTAT_AGES_MAX + 1];
+} redisstat_owner_t;
+
+typedef struct
+{
+    redisstat_owner_t *slots;
+    size_t             size;
+    size_t             count;
+} redisstat_table_t;
+
+/* An owner's bytes in all age buckets, and where its sums start. */
+typedef struct
+{
+    uint32_t id;
+    uint64_t bytes;
+    size_t   at;
+} redisstat_total_t;
+
+/* What every script call is asked, as the strings it is sent. */
+typedef struct
+{
+    char digits[16];
+    char by_gid[2];
+    char budget[32];
+    char count[32];
+    char cutoffs[REDISSTAT_AGES_MAX][32];
+    int  ages;
+} redisstat_query_t;
+
+int       redisstat_add(redisstat_table_t *t, uint32_t id, int age, uint64_t files, uint64_t bytes);
+long long redisstat_part(purger_shard_t *sh, int port, unsigned part, unsigned parts,
+                         const redisstat_query_t *q, redisstat_table_t *t, long long *calls);
+int       redisstat_reduce(redisstat_table_t *t, int ages, int rank, int ranks,
+                           uint32_t **ids, uint64_t **sums, size_t *count);
+void      print_usage(char **argv);
+
+#endif /* REDISSTAT_H */
@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include "snapshotstat.h"
+
+#include "../common/log.h"
+
+FILE *PURGER_debug_stream;
+PURGER_loglevel PURGER_debug_level;
+int PURGER_global_rank;
+
+#define SECONDS_PER_DAY 60.0*60.0*24.0
+
+static double
+snapshotstat_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int
+snapshotstat_grow(snapshotstat_table_t *t)
+{
+    size_t size = t->size ? 2 * t->size : SNAPSHOTSTAT_OWNERS;
+    snapshotstat_owner_t *slots = (snapshotstat_owner_t *)calloc(size, sizeof(snapshotstat_owner_t));
+    size_t i = 0;
+    size_t j = 0;
+
+    if(slots == NULL)
+        return -1;
+
+    for(i = 0; i < t->size; i++)
+    {
+        if(t->slots[i].files == 0)
+            continue;
+        for(j = (t->slots[i].id * 2654435761u) & (size - 1); slots[j].files != 0; j = (j + 1) & (size - 1))
+            ;
+        slots[j] = t->slots[i];
+    }
+
+    free(t->slots);
+    t->slots = slots;
+    t->size = size;
+    return 0;
+}
+
+/* Count "files" of "bytes" against owner "id". */
+int
+snapshotstat_add(snapshotstat_table_t *t, uint32_t id, uint64_t files, uint64_t bytes)
+{
+    size_t i = 0;
+
+    if(2 * (t->count + 1) > t->size && snapshotstat_grow(t) < 0)
+        return -1;
+
+    for(i = (id * 2654435761u) & (t->size - 1); t->slots[i].files != 0; i = (i + 1) & (t->size - 1))
+    {
+        if(t->slots[i].id == id)
+        {
+            t->slots[i].files += files;
+            t->slots[i].bytes += bytes;
+            return 0;
+        }
+    }
+
+    t->slots[i].id = id;
+    t->slots[i].files = files;
+    t->slots[i].bytes = bytes;
+    t->count++;
+    return 0;
+}
+
+/*
+ * Add up the files of one snapshot older than "cutoff" by owner. Zone
+ * maps decide most blocks: one with nothing that old is skipped, one
+ * with nothing newer is taken whole, and one with a single owner is one
+ * sum over its size column. Only the rest have their mtimes compared.
+ */
+int
+snapshotstat_scan(const char *path, int64_t cutoff, int by_gid, snapshotstat_table_t *t, uint64_t *skipped)
+{
+    static uint32_t sel[PURGER_SNAPSHOT_BLOCK];
+    const purger_snapshot_zone_t *z = NULL;
+    const uint32_t *owner = NULL;
+    purger_snapshot_block_t b;
+    purger_snapshot_t s;
+    uint64_t bytes = 0;
+    uint64_t i = 0;
+    size_t n = 0;
+    size_t j = 0;
+    int status = 0;
+
+    if(purger_snapshot_open(&s, path) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to read the snapshot %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    for(i = 0; status == 0 && i < s.blocks; i++)
+    {
+        z = &s.zones[i];
+        if(z->mtime_min >= cutoff)
+        {
+            (*skipped)++;
+            continue;
+        }
+        if(purger_snapshot_block(&s, i, &b) < 0)
+        {
+            LOG(PURGER_LOG_ERR, "Block %llu of %s does not fit in it, skipping the rest.", (unsigned long long)i, path);
+            status = -1;
+            break;
+        }
+        owner = by_gid ? b.gid : b.uid;
+
+        if(z->mtime_max < cutoff && (by_gid ? z->gid_min == z->gid_max : z->uid_min == z->uid_max))
+        {
+            for(bytes = 0, j = 0; j < b.rows; j++)
+                bytes += b.size[j];
+            status = snapshotstat_add(t, owner[0], b.rows, bytes);
+        }
+        else if(z->mtime_max < cutoff)
+        {
+            for(j = 0; status == 0 && j < b.rows; j++)
+                status = snapshotstat_add(t, owner[j], 1, b.size[j]);
+        }
+        else
+        {
+            n = purger_snapshot_select_older(b.mtime, b.rows, cutoff, sel);
+            for(j = 0; status == 0 && j < n; j++)
+                status = snapshotstat_add(t, owner[sel[j]], 1, b.size[sel[j]]);
+        }
+    }
+
+    purger_snapshot_close(&s);
+    return status;
+}
+
+static int
+snapshotstat_bytes_cmp(const void *a, const void *b)
+{
+    const snapshotstat_owner_t *x = (const snapshotstat_owner_t *)a;
+    const snapshotstat_owner_t *y = (const snapshotstat_owner_t *)b;
+
+    if(x->bytes != y->bytes)
+        return x->bytes > y->bytes ? -1 : 1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+void
+print_usage(char **argv)
+{
+    fprintf(stderr, "Usage: %s [-a <days old> -g -l <log level>] <snapshot> ...\n", argv[0]);
+}
+
+int
+main (int argc, char **argv)
+{
+    int index;
+    int c;
+
+    snapshotstat_table_t table;
+    int64_t cutoff = INT64_MAX;
+    int by_gid = 0;
+    int failed = 0;
+    uint64_t skipped = 0;
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    double start = 0.0;
+    size_t i = 0;
+    size_t n = 0;
+
+    PURGER_debug_stream = stderr;
+    PURGER_debug_level = PURGER_LOG_INFO;
+    memset(&table, 0, sizeof(table));
+
+    opterr = 0;
+    while((c = getopt(argc, argv, "a:gl:")) != -1)
+    {
+        switch(c)
+        {
+            case 'a':
+                cutoff = (int64_t)time(NULL) - (int64_t)(SECONDS_PER_DAY * atof(optarg));
+                break;
+
+            case 'g':
+                by_gid = 1;
+                break;
+
+            case 'l':
+                PURGER_debug_level = atoi(optarg);
+                break;
+
+            case '?':
+                if(optopt == 'a' || optopt == 'l')
+                {
+                    print_usage(argv);
+                    fprintf(stderr, "Option -%c requires an argument.\n", optopt);
+                }
+                else if(isprint(optopt))
+                {
+                    print_usage(argv);
+                    fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+                }
+                else
+                {
+                    print_usage(argv);
+                    fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+                }
+                exit(EXIT_FAILURE);
+
+            default:
+                abort();
+        }
+    }
+
+    if(optind == argc)
+    {
+        print_usage(argv);
+        LOG(PURGER_LOG_FATAL, "You must give at least one snapshot.");
+        exit(EXIT_FAILURE);
+    }
+
+    start = snapshotstat_now();
+    for(index = optind; index < argc; index++)
+        if(snapshotstat_scan(argv[index], cutoff, by_gid, &table, &skipped) < 0)
+            failed = 1;
+
+    /* Pack the owners to the front and put the largest first. */
+    for(i = 0, n = 0; i < table.size; i++)
+        if(table.slots[i].files != 0)
+            table.slots[n++] = table.slots[i];
+    if(n > 0)
+        qsort(table.slots, n, sizeof(snapshotstat_owner_t), snapshotstat_bytes_cmp);
+
+    printf("%s\tfiles\tbytes\n", by_gid ? "gid" : "uid");
+    for(i = 0; i < n; i++)
+    {
+        printf("%lu\t%llu\t%llu\n", (unsigned long)table.slots[i].id,
+               (unsigned long long)table.slots[i].files, (unsigned long long)table.slots[i].bytes);
+        files += table.slots[i].files;
+        bytes += table.slots[i].bytes;
+    }
+
+    LOG(PURGER_LOG_INFO, "%llu files (%llu bytes) of %zu owners from %d snapshots in %.3f s, %llu blocks skipped by their zone maps.",
+        (unsigned long long)files, (unsigned long long)bytes, n, argc - optind, snapshotstat_now() - start,
+        (unsigned long long)skipped);
+
+    free(table.slots);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/* EOF */
@@ -0,0 +1,30 @@
+#ifndef SNAPSHOTSTAT_H
+#define SNAPSHOTSTAT_H
+
+#include <stdint.h>
+
+#include "../common/snapshot.h"
+
+/* Slots the owner table starts with, a power of two. */
+#define SNAPSHOTSTAT_OWNERS 1024
+
+/* Files and bytes of one uid or gid. */
+typedef struct
+{
+    uint32_t id;
+    uint64_t files;
+    uint64_t bytes;
+} snapshotstat_owner_t;
+
+typedef struct
+{
+    snapshotstat_owner_t *slots;
+    size_t                size;
+    size_t                count;
+} snapshotstat_table_t;
+
+int  snapshotstat_add(snapshotstat_table_t *t, uint32_t id, uint64_t files, uint64_t bytes);
+int  snapshotstat_scan(const char *path, int64_t cutoff, int by_gid, snapshotstat_table_t *t, uint64_t *skipped);
+void print_usage(char **argv);
+
+#endif /* SNAPSHOTSTAT_H */
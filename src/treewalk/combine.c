@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <hiredis.h>
+#include <mpi.h>
+
+#include "combine.h"
+#include "resp.h"
+#include "log.h"
+
+extern int (*redis_formatted_command_ptr)(int rank, const char * cmd, size_t len);
+extern int sharded_count;
+
+/*
+ * The members waiting for one variadic command on one connection. For
+ * the ZADD every member is a score and a key, for the SADD a uid.
+ */
+typedef struct
+{
+    resp_buf_t args;
+    int        members;
+} treewalk_combine_buf_t;
+
+static treewalk_combine_buf_t *combine_zadd;
+static treewalk_combine_buf_t *combine_sadd;
+static treewalk_uid_set_t combine_uids;
+static resp_buf_t combine_cmd;
+static int combine_members = TREEWALK_COMBINE_MEMBERS;
+static double combine_last;
+
+/* Send "<cmd> <set> <args of b>" to connection "rank" and empty b. */
+static int
+treewalk_combine_send(treewalk_combine_buf_t *b, const char *cmd, const char *set, int argc, int rank)
+{
+    int status = 0;
+
+    if(b->members == 0)
+        return 0;
+
+    resp_reset(&combine_cmd);
+    if(resp_array(&combine_cmd, 2 + (long)argc * b->members) < 0 ||
+            resp_bulk_str(&combine_cmd, cmd) < 0 ||
+            resp_bulk_str(&combine_cmd, set) < 0 ||
+            resp_raw(&combine_cmd, b->args.buf, b->args.len) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Out of memory sending %d members to %s.", b->members, set);
+        status = -1;
+    }
+    else
+    {
+        status = (*redis_formatted_command_ptr)(rank, combine_cmd.buf, combine_cmd.len);
+    }
+
+    resp_reset(&b->args);
+    b->members = 0;
+    return status;
+}
+
+/* Add uid to the set. Returns 1 if it was not there yet, -1 without memory. */
+int
+treewalk_uid_set_add(treewalk_uid_set_t *set, uint32_t uid)
+{
+    uint64_t *old = set->slots;
+    size_t old_size = set->size;
+    size_t i = 0;
+
+    if(2 * (set->count + 1) > set->size)
+    {
+        set->size = old_size ? 2 * old_size : TREEWALK_COMBINE_UIDS;
+        set->slots = (uint64_t *)calloc(set->size, sizeof(uint64_t));
+        if(set->slots == NULL)
+        {
+            set->slots = old;
+            set->size = old_size;
+            return -1;
+        }
+        set->count = 0;
+        for(i = 0; i < old_size; i++)
+            if(old[i] != 0)
+                treewalk_uid_set_add(set, (uint32_t)(old[i] - 1));
+        free(old);
+    }
+
+    for(i = (uid * 2654435761u) & (set->size - 1); set->slots[i] != 0; i = (i + 1) & (set->size - 1))
+        if(set->slots[i] == (uint64_t)uid + 1)
+            return 0;
+
+    set->slots[i] = (uint64_t)uid + 1;
+    set->count++;
+    return 1;
+}
+
+/*
+ * Union the uid sets of all ranks into rank 0's, the only one that then
+ * has anything to send. Every rank has to call this.
+ */
+static int
+treewalk_uid_set_union(treewalk_uid_set_t *set)
+{
+    uint32_t *mine = NULL;
+    uint32_t *all = NULL;
+    int *counts = NULL;
+    int *displs = NULL;
+    int count = (int)set->count;
+    int ranks = 0;
+    int rank = 0;
+    int total = 0;
+    int status = 0;
+    size_t i = 0;
+    int j = 0;
+
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if(ranks == 1)
+        return 0;
+
+    if(rank == 0)
+    {
+        counts = (int *)malloc(ranks * sizeof(int));
+        displs = (int *)malloc(ranks * sizeof(int));
+        if(counts == NULL || displs == NULL)
+        {
+            LOG(PURGER_LOG_FATAL, "Out of memory gathering the owners of expired files.");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+    }
+    mine = (uint32_t *)malloc((set->count + 1) * sizeof(uint32_t));
+    if(mine == NULL)
+    {
+        /* Still take part, with nothing, so the other ranks are not stuck. */
+        LOG(PURGER_LOG_ERR, "Out of memory gathering the owners of expired files.");
+        count = 0;
+        status = -1;
+    }
+    for(i = 0; mine != NULL && i < set->size; i++)
+        if(set->slots[i] != 0)
+            mine[j++] = (uint32_t)(set->slots[i] - 1);
+
+    MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if(rank == 0)
+    {
+        for(j = 0; j < ranks; j++)
+        {
+            displs[j] = total;
+            total += counts[j];
+        }
+        all = (uint32_t *)malloc((total + 1) * sizeof(uint32_t));
+        if(all == NULL)
+        {
+            LOG(PURGER_LOG_FATAL, "Out of memory gathering the owners of expired files.");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+    }
+    MPI_Gatherv(mine, count, MPI_UINT32_T, all, counts, displs, MPI_UINT32_T, 0, MPI_COMM_WORLD);
+
+    if(rank == 0)
+        for(j = 0; j < total; j++)
+            if(treewalk_uid_set_add(set, all[j]) < 0)
+                status = -1;
+
+    if(rank != 0 && set->slots != NULL)
+    {
+        /* Rank 0 sends these now. */
+        memset(set->slots, 0, set->size * sizeof(uint64_t));
+        set->count = 0;
+    }
+
+    free(mine);
+    free(all);
+    free(counts);
+    free(displs);
+    return status;
+}
+
+/* Buffers for every connection, "members" members to a command. */
+int
+treewalk_combine_init(int members, double now)
+{
+    combine_zadd = (treewalk_combine_buf_t *)calloc(sharded_count, sizeof(treewalk_combine_buf_t));
+    combine_sadd = (treewalk_combine_buf_t *)calloc(sharded_count, sizeof(treewalk_combine_buf_t));
+    if(combine_zadd == NULL || combine_sadd == NULL)
+        return -1;
+
+    combine_members = members;
+    combine_last = now;
+    return 0;
+}
+
+/*
+ * Queue an expired file: its mtime and key for the ZADD on the file's
+ * connection, which goes out as soon as it has its members. The owner
+ * only goes into the uid set; the warnlist is written at the end.
+ */
+int
+treewalk_combine_expired(struct stat *st, char *filekey, int key_len, int crc)
+{
+    treewalk_combine_buf_t *z = &combine_zadd[crc];
+
+    if(resp_bulk_long(&z->args, (long long)st->st_mtime) < 0 ||
+            resp_bulk(&z->args, filekey, key_len) < 0 ||
+            treewalk_uid_set_add(&combine_uids, (uint32_t)st->st_uid) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Out of memory combining the expired file %.*s.", key_len, filekey);
+        return -1;
+    }
+
+    if(++z->members >= combine_members)
+        return treewalk_combine_send(z, "ZADD", "mtime", 2, crc);
+    return 0;
+}
+
+/* Only the owner of an expired file, for the warnlist. */
+int
+treewalk_combine_owner(struct stat *st)
+{
+    if(treewalk_uid_set_add(&combine_uids, (uint32_t)st->st_uid) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Out of memory adding uid %lu to the warnlist.", (unsigned long)st->st_uid);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Send the partial commands once they have waited long enough. */
+void
+treewalk_combine_tick(double now)
+{
+    if(combine_zadd == NULL || now - combine_last < TREEWALK_COMBINE_INTERVAL)
+        return;
+
+    treewalk_combine_flush();
+    combine_last = now;
+}
+
+/* Send every partial ZADD. */
+int
+treewalk_combine_flush(void)
+{
+    int status = 0;
+    int i = 0;
+
+    for(i = 0; combine_zadd != NULL && i < sharded_count; i++)
+        if(treewalk_combine_send(&combine_zadd[i], "ZADD", "mtime", 2, i) < 0)
+            status = -1;
+
+    return status;
+}
+
+/*
+ * Send what is left at the end of the run and let go of the buffers.
+ * The owners of every rank's expired files are collected on rank 0,
+ * which adds each of them to the warnlist once. Every rank has to call
+ * this.
+ */
+int
+treewalk_combine_finish(void)
+{
+    int status = treewalk_combine_flush();
+    int uid_rank = 0;
+    size_t i = 0;
+
+    if(treewalk_uid_set_union(&combine_uids) < 0)
+        status = -1;
+    for(i = 0; combine_sadd != NULL && i < combine_uids.size; i++)
+    {
+        if(combine_uids.slots[i] == 0)
+            continue;
+        uid_rank = (int)((combine_uids.slots[i] - 1) % sharded_count);
+        if(resp_bulk_long(&combine_sadd[uid_rank].args, (long long)(combine_uids.slots[i] - 1)) < 0)
+        {
+            LOG(PURGER_LOG_ERR, "Out of memory adding the owners of expired files to the warnlist.");
+            status = -1;
+            break;
+        }
+        if(++combine_sadd[uid_rank].members >= combine_members &&
+                treewalk_combine_send(&combine_sadd[uid_rank], "SADD", "warnlist", 1, uid_rank) < 0)
+            status = -1;
+    }
+    for(uid_rank = 0; combine_sadd != NULL && uid_rank < sharded_count; uid_rank++)
+        if(treewalk_combine_send(&combine_sadd[uid_rank], "SADD", "warnlist", 1, uid_rank) < 0)
+            status = -1;
+
+    for(uid_rank = 0; combine_zadd != NULL && uid_rank < sharded_count; uid_rank++)
+    {
+        resp_free(&combine_zadd[uid_rank].args);
+        resp_free(&combine_sadd[uid_rank].args);
+    }
+
+    free(combine_uids.slots);
+    memset(&combine_uids, 0, sizeof(combine_uids));
+    free(combine_zadd);
+    free(combine_sadd);
+    combine_zadd = NULL;
+    combine_sadd = NULL;
+    resp_free(&combine_cmd);
+    return status;
+}
+
+/* EOF */
@@ -0,0 +1,34 @@
+#ifndef COMBINE_H
+#define COMBINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/* Members per variadic ZADD or SADD unless -m says otherwise. */
+#define TREEWALK_COMBINE_MEMBERS 128
+/* Seconds a member may wait before its partial command is sent anyway. */
+#define TREEWALK_COMBINE_INTERVAL 1.0
+/* Slots the uid set of the warnlist starts with, a power of two. */
+#define TREEWALK_COMBINE_UIDS 4096
+
+/*
+ * The owners of the expired files this rank has seen, open addressed.
+ * A slot holds uid + 1 so that 0 can mean empty and root still fits.
+ */
+typedef struct
+{
+    uint64_t *slots;
+    size_t    size;
+    size_t    count;
+} treewalk_uid_set_t;
+
+int treewalk_uid_set_add(treewalk_uid_set_t *set, uint32_t uid);
+int treewalk_combine_init(int members, double now);
+int treewalk_combine_expired(struct stat *st, char *filekey, int key_len, int crc);
+int treewalk_combine_owner(struct stat *st);
+void treewalk_combine_tick(double now);
+int treewalk_combine_flush(void);
+int treewalk_combine_finish(void);
+
+#endif /* COMBINE_H */
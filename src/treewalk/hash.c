@@ -3,6 +3,12 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "hash.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define TREEWALK_HASH_AVX2 1
+#endif
 static uint32_t crc32_tab[] = {
 	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
 	0xe963a535, 0x9e6495a3,	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
@@ -50,24 +56,428 @@ static uint32_t crc32_tab[] = {
 };
 
 
+/*
+ * Render a digest the way treewalk always has. The historical code printed
+ * each byte with sprintf("%02x", (char) byte), so on platforms with a signed
+ * char every byte >= 0x80 comes out as "ff". Keys already stored in redis
+ * depend on that, so keep producing exactly the same 64 characters.
+ */
+static void
+treewalk_hash_to_hex(unsigned char digest[SHA256_DIGEST_LENGTH], unsigned char out[65])
+{
+    static const char hex[] = "0123456789abcdef";
+    int i = 0;
+
+    for(i = 0; i < SHA256_DIGEST_LENGTH; i++)
+    {
+        if((char) digest[i] < 0)
+        {
+            out[i * 2]     = 'f';
+            out[i * 2 + 1] = 'f';
+        }
+        else
+        {
+            out[i * 2]     = hex[digest[i] >> 4];
+            out[i * 2 + 1] = hex[digest[i] & 0x0f];
+        }
+    }
+
+    out[64] = 0;
+}
+
 int
 treewalk_filename_hash(char *in, unsigned char out[65])
 {
     unsigned char digest[SHA256_DIGEST_LENGTH];
-    int i = 0;
 
     SHA256_CTX ctx;
     SHA256_Init(&ctx);
     SHA256_Update(&ctx, in, strlen(in));
     SHA256_Final(digest, &ctx);
 
-    for(i = 0; i < SHA256_DIGEST_LENGTH; i++)
+    treewalk_hash_to_hex(digest, out);
+    return 0;
+}
+
+void
+treewalk_hash_prefix_set(treewalk_hash_prefix_t *prefix, const char *path, size_t len)
+{
+    if(len >= sizeof(prefix->path))
     {
-        sprintf((char*)out + (i * 2), "%02x", (char) digest[i]);
+        /* Too long to cache, every lookup will hash the full path. */
+        prefix->len = 0;
+        return;
     }
 
-    out[64] = 0;
+    memcpy(prefix->path, path, len);
+    prefix->path[len] = '\0';
+    prefix->len = len;
+
+    SHA256_Init(&prefix->ctx);
+    SHA256_Update(&prefix->ctx, path, len);
+}
+
+/*
+ * Make "prefix" the directory part of "in" ("/some/dir/"), hashing it
+ * unless it is the one cached already. Returns the length of that part,
+ * or 0 when "in" has to be hashed in full: there is no slash, or the
+ * directory is too long to cache.
+ */
+static size_t
+treewalk_hash_prefix_lookup(treewalk_hash_prefix_t *prefix, const char *in)
+{
+    const char *base = strrchr(in, '/');
+    size_t len = 0;
+
+    if(base == NULL)
+    {
+        return 0;
+    }
+
+    /* The prefix includes the trailing slash. */
+    len = (size_t)(base - in) + 1;
+
+    if(prefix->len != len || memcmp(prefix->path, in, len) != 0)
+    {
+        treewalk_hash_prefix_set(prefix, in, len);
+    }
+
+    return prefix->len == len ? len : 0;
+}
+
+/*
+ * Same result as treewalk_filename_hash(), but the directory part of the
+ * path is only run through SHA256 once. The state after the prefix is kept
+ * in "prefix" and every sibling only adds its basename to a copy of it.
+ */
+int
+treewalk_filename_hash_prefixed(treewalk_hash_prefix_t *prefix, char *in, unsigned char out[65])
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256_CTX ctx;
+    size_t len = treewalk_hash_prefix_lookup(prefix, in);
+
+    if(len == 0)
+    {
+        return treewalk_filename_hash(in, out);
+    }
+
+    memcpy(&ctx, &prefix->ctx, sizeof(ctx));
+    SHA256_Update(&ctx, in + len, strlen(in + len));
+    SHA256_Final(digest, &ctx);
+
+    treewalk_hash_to_hex(digest, out);
+    return 0;
+}
+
+#ifdef TREEWALK_HASH_AVX2
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_h0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/* Number of 64 byte blocks in a padded message of "len" bytes. */
+static size_t
+sha256_block_count(size_t len)
+{
+    return (len + 9 + 63) / 64;
+}
+
+/* Big endian words of block "block" of the padded message "in". */
+static void
+sha256_load_block(const unsigned char *in, size_t len, size_t block, uint32_t lane, uint32_t words[16][TREEWALK_HASH_LANES])
+{
+    unsigned char buf[64];
+    size_t off = block * 64;
+    size_t avail = 0;
+    uint64_t bits = (uint64_t)len * 8;
+    int i = 0;
+
+    memset(buf, 0, sizeof(buf));
+
+    if(off < len)
+    {
+        avail = len - off < 64 ? len - off : 64;
+        memcpy(buf, in + off, avail);
+    }
+
+    /* The 0x80 terminator goes right after the last message byte. */
+    if(len >= off && len < off + 64)
+    {
+        buf[len - off] = 0x80;
+    }
+
+    if(block == sha256_block_count(len) - 1)
+    {
+        for(i = 0; i < 8; i++)
+        {
+            buf[63 - i] = (unsigned char)(bits >> (i * 8));
+        }
+    }
 
+    for(i = 0; i < 16; i++)
+    {
+        words[i][lane] = ((uint32_t)buf[i * 4] << 24) | ((uint32_t)buf[i * 4 + 1] << 16) |
+                         ((uint32_t)buf[i * 4 + 2] << 8) | (uint32_t)buf[i * 4 + 3];
+    }
+}
+
+#define ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+
+/*
+ * Eight independent SHA256 computations, one per 32 bit lane of an AVX2
+ * register. Lane "i" starts from the state h[i] reached after the first
+ * skip[i] bytes of its message (a multiple of 64, sha256_h0 for 0) and
+ * runs the remaining blocks. Lanes whose message has fewer blocks simply
+ * stop updating their state once they run out.
+ */
+__attribute__((target("avx2")))
+static void
+sha256_x8(const unsigned char **in, const size_t *len, const size_t *skip, const uint32_t *h[TREEWALK_HASH_LANES],
+          unsigned char digest[TREEWALK_HASH_LANES][SHA256_DIGEST_LENGTH])
+{
+    uint32_t words[16][TREEWALK_HASH_LANES] __attribute__((aligned(32)));
+    uint32_t init[8][TREEWALK_HASH_LANES] __attribute__((aligned(32)));
+    uint32_t out[8][TREEWALK_HASH_LANES] __attribute__((aligned(32)));
+    int32_t blocks[TREEWALK_HASH_LANES];
+    size_t max_blocks = 0;
+    size_t block = 0;
+    __m256i state[8];
+    __m256i w[64];
+    __m256i nblocks;
+    int i = 0;
+    int t = 0;
+
+    for(i = 0; i < TREEWALK_HASH_LANES; i++)
+    {
+        blocks[i] = (int32_t)(sha256_block_count(len[i]) - skip[i] / 64);
+        if((size_t)blocks[i] > max_blocks) max_blocks = blocks[i];
+
+        for(t = 0; t < 8; t++)
+        {
+            init[t][i] = h[i][t];
+        }
+    }
+    nblocks = _mm256_loadu_si256((const __m256i *)blocks);
+
+    for(i = 0; i < 8; i++)
+    {
+        state[i] = _mm256_load_si256((const __m256i *)init[i]);
+    }
+
+    for(block = 0; block < max_blocks; block++)
+    {
+        __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+        __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+        __m256i active = _mm256_cmpgt_epi32(nblocks, _mm256_set1_epi32((int)block));
+
+        for(i = 0; i < TREEWALK_HASH_LANES; i++)
+        {
+            if(block < (size_t)blocks[i])
+                sha256_load_block(in[i], len[i], skip[i] / 64 + block, i, words);
+        }
+
+        for(t = 0; t < 16; t++)
+        {
+            w[t] = _mm256_load_si256((const __m256i *)words[t]);
+        }
+
+        for(t = 16; t < 64; t++)
+        {
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w[t - 15], 7), ROTR8(w[t - 15], 18)),
+                                          _mm256_srli_epi32(w[t - 15], 3));
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w[t - 2], 17), ROTR8(w[t - 2], 19)),
+                                          _mm256_srli_epi32(w[t - 2], 10));
+            w[t] = _mm256_add_epi32(_mm256_add_epi32(w[t - 16], s0), _mm256_add_epi32(w[t - 7], s1));
+        }
+
+        for(t = 0; t < 64; t++)
+        {
+            __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(e, 6), ROTR8(e, 11)), ROTR8(e, 25));
+            __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, S1),
+                         _mm256_add_epi32(_mm256_add_epi32(ch, _mm256_set1_epi32((int)sha256_k[t])), w[t]));
+            __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(a, 2), ROTR8(a, 13)), ROTR8(a, 22));
+            __m256i maj = _mm256_xor_si256(_mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(a, c)),
+                                           _mm256_and_si256(b, c));
+            __m256i t2 = _mm256_add_epi32(S0, maj);
+
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(t1, t2);
+        }
+
+        state[0] = _mm256_blendv_epi8(state[0], _mm256_add_epi32(state[0], a), active);
+        state[1] = _mm256_blendv_epi8(state[1], _mm256_add_epi32(state[1], b), active);
+        state[2] = _mm256_blendv_epi8(state[2], _mm256_add_epi32(state[2], c), active);
+        state[3] = _mm256_blendv_epi8(state[3], _mm256_add_epi32(state[3], d), active);
+        state[4] = _mm256_blendv_epi8(state[4], _mm256_add_epi32(state[4], e), active);
+        state[5] = _mm256_blendv_epi8(state[5], _mm256_add_epi32(state[5], f), active);
+        state[6] = _mm256_blendv_epi8(state[6], _mm256_add_epi32(state[6], g), active);
+        state[7] = _mm256_blendv_epi8(state[7], _mm256_add_epi32(state[7], h), active);
+    }
+
+    for(i = 0; i < 8; i++)
+    {
+        _mm256_store_si256((__m256i *)out[i], state[i]);
+    }
+
+    for(i = 0; i < TREEWALK_HASH_LANES; i++)
+    {
+        for(t = 0; t < 8; t++)
+        {
+            digest[i][t * 4]     = (unsigned char)(out[t][i] >> 24);
+            digest[i][t * 4 + 1] = (unsigned char)(out[t][i] >> 16);
+            digest[i][t * 4 + 2] = (unsigned char)(out[t][i] >> 8);
+            digest[i][t * 4 + 3] = (unsigned char)(out[t][i]);
+        }
+    }
+}
+
+#endif /* TREEWALK_HASH_AVX2 */
+
+/* Use the AVX2 lanes even when SHA-NI is present (for the unit tests). */
+int treewalk_hash_force_lanes = 0;
+
+/*
+ * How many paths treewalk_filename_hash_batch() hashes at once on this
+ * CPU. Callers that see 1 gain nothing from batching: either there is no
+ * AVX2, or the CPU has the SHA extensions, which OpenSSL already uses and
+ * which beat eight AVX2 lanes.
+ */
+int
+treewalk_filename_hash_lanes(void)
+{
+#ifdef TREEWALK_HASH_AVX2
+    static int lanes = 0;
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    if(lanes == 0)
+    {
+        lanes = 1;
+
+        if(__builtin_cpu_supports("avx2"))
+        {
+            /* CPUID leaf 7, EBX bit 29 is SHA-NI. */
+            if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & (1u << 29)))
+            {
+                lanes = TREEWALK_HASH_LANES;
+            }
+        }
+    }
+
+    return lanes;
+#else
+    return 1;
+#endif
+}
+
+/*
+ * Hash "count" paths, producing exactly what treewalk_filename_hash()
+ * would for each of them. Full groups of eight go through the AVX2
+ * multi-buffer code; anything left over (or a CPU without AVX2) uses the
+ * one at a time OpenSSL path, which itself picks SHA-NI when available.
+ * With a "prefix", a lane in the cached directory starts from the state
+ * after it instead of from the first byte of the path.
+ */
+static int
+treewalk_hash_batch(treewalk_hash_prefix_t *prefix, char **in, int count, unsigned char out[][65])
+{
+    int i = 0;
+
+#ifdef TREEWALK_HASH_AVX2
+    if(treewalk_filename_hash_lanes() == TREEWALK_HASH_LANES ||
+       (treewalk_hash_force_lanes && __builtin_cpu_supports("avx2")))
+    {
+        unsigned char digest[TREEWALK_HASH_LANES][SHA256_DIGEST_LENGTH];
+        const unsigned char *lane_in[TREEWALK_HASH_LANES];
+        size_t lane_len[TREEWALK_HASH_LANES];
+        size_t lane_skip[TREEWALK_HASH_LANES];
+        uint32_t lane_h[TREEWALK_HASH_LANES][8];
+        const uint32_t *lane_state[TREEWALK_HASH_LANES];
+        size_t len = 0;
+        int j = 0;
+
+        for(; i + TREEWALK_HASH_LANES <= count; i += TREEWALK_HASH_LANES)
+        {
+            for(j = 0; j < TREEWALK_HASH_LANES; j++)
+            {
+                lane_in[j] = (const unsigned char *)in[i + j];
+                lane_len[j] = strlen(in[i + j]);
+                lane_skip[j] = 0;
+                lane_state[j] = sha256_h0;
+
+                if(prefix != NULL && (len = treewalk_hash_prefix_lookup(prefix, in[i + j])) != 0)
+                {
+                    /*
+                     * Only the whole blocks of the prefix are in ctx.h, the
+                     * last ctx.num bytes still sit in its buffer. Those are
+                     * the same bytes of the path, so the lane picks up there.
+                     * Copied, a later lane may move the prefix on.
+                     */
+                    lane_skip[j] = len - prefix->ctx.num;
+                    memcpy(lane_h[j], prefix->ctx.h, sizeof(lane_h[j]));
+                    lane_state[j] = lane_h[j];
+                }
+            }
+
+            sha256_x8(lane_in, lane_len, lane_skip, lane_state, digest);
+
+            for(j = 0; j < TREEWALK_HASH_LANES; j++)
+            {
+                treewalk_hash_to_hex(digest[j], out[i + j]);
+            }
+        }
+    }
+#endif
+
+    for(; i < count; i++)
+    {
+        if(prefix != NULL)
+            treewalk_filename_hash_prefixed(prefix, in[i], out[i]);
+        else
+            treewalk_filename_hash(in[i], out[i]);
+    }
+
+    return count;
+}
+
+int
+treewalk_filename_hash_batch(char **in, int count, unsigned char out[][65])
+{
+    return treewalk_hash_batch(NULL, in, count, out);
+}
+
+/*
+ * treewalk_filename_hash_batch() for files that mostly share a directory:
+ * the directory part is run through SHA256 once, as in
+ * treewalk_filename_hash_prefixed(), and each lane only hashes the blocks
+ * holding its basename.
+ */
+int
+treewalk_filename_hash_batch_prefixed(treewalk_hash_prefix_t *prefix, char **in, int count, unsigned char out[][65])
+{
+    return treewalk_hash_batch(prefix, in, count, out);
 }
 
 int32_t
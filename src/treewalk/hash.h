@@ -2,8 +2,27 @@
 #define HASH_H
 
 #include <stdint.h>
+#include <limits.h>
 #include <openssl/sha.h>
 
+/* Paths hashed side by side by treewalk_filename_hash_batch(). */
+#define TREEWALK_HASH_LANES 8
+
+/* SHA256 state of a directory prefix ("/some/dir/"), shared by siblings. */
+typedef struct
+{
+    SHA256_CTX ctx;
+    size_t     len;
+    char       path[PATH_MAX];
+} treewalk_hash_prefix_t;
+
 int treewalk_filename_hash(char *in, unsigned char out[65]);
+void treewalk_hash_prefix_set(treewalk_hash_prefix_t *prefix, const char *path, size_t len);
+int treewalk_filename_hash_prefixed(treewalk_hash_prefix_t *prefix, char *in, unsigned char out[65]);
+extern int treewalk_hash_force_lanes;
+
+int treewalk_filename_hash_lanes(void);
+int treewalk_filename_hash_batch(char **in, int count, unsigned char out[][65]);
+int treewalk_filename_hash_batch_prefixed(treewalk_hash_prefix_t *prefix, char **in, int count, unsigned char out[][65]);
 int32_t crc32(const void *buf, size_t size);
 #endif /* HASH_H */
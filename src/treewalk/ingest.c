@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/sha.h>
+
+#include <hiredis.h>
+#include <libcircle.h>
+
+#include "ingest.h"
+#include "record.h"
+#include "resp.h"
+#include "redis.h"
+#include "log.h"
+
+extern int (*redis_template_command_ptr)(int rank, const redisCommandTemplate * t, ...);
+extern int (*redis_formatted_command_ptr)(int rank, const char * cmd, size_t len);
+extern int sharded_count;
+extern int record_digits;
+
+/*
+ * Stores a batch of files server side. ARGV[1] is the mtime files have to
+ * be older than to expire, then every file has four arguments: its key,
+ * its bucket and field (both empty for one hash per file) and its packed
+ * record, see record.h. Does what treewalk_store_file() does for each.
+ */
+static const char treewalk_ingest_script[] =
+    "local cutoff = tonumber(ARGV[1])\n"
+    "local n = 0\n"
+    "for i = 2, #ARGV, 4 do\n"
+    "    local key, bucket, rec = ARGV[i], ARGV[i + 1], ARGV[i + 3]\n"
+    "    local mtime, size, uid, gid = struct.unpack('<i8I8I4I4', rec, 2)\n"
+    "    if bucket == '' then\n"
+    "        redis.call('HMSET', key, 'name', string.sub(rec, 26),\n"
+    "            'gid_decimal', string.format('%.0f', gid),\n"
+    "            'mtime_decimal', string.format('%.0f', mtime),\n"
+    "            'size', string.format('%.0f', size),\n"
+    "            'uid_decimal', string.format('%.0f', uid))\n"
+    "    else\n"
+    "        redis.call('HSET', bucket, ARGV[i + 2], rec)\n"
+    "    end\n"
+    "    if mtime < cutoff then\n"
+    "        redis.call('ZADD', 'mtime', string.format('%.0f', mtime), key)\n"
+    "        redis.call('SADD', 'warnlist', string.format('%.0f', uid))\n"
+    "    end\n"
+    "    n = n + 1\n"
+    "end\n"
+    "return n\n";
+
+/* The arguments of the files waiting for each connection. */
+typedef struct
+{
+    resp_buf_t args;
+    int        files;
+} treewalk_ingest_batch_t;
+
+static treewalk_ingest_batch_t *ingest_batch;
+static resp_buf_t ingest_cmd;
+static char ingest_sha[2 * SHA_DIGEST_LENGTH + 1];
+static char ingest_cutoff[32];
+
+/*
+ * Load the script on every connection. Its SHA1 is worked out here, so
+ * SCRIPT LOAD can go down the pipelines like any other command instead of
+ * waiting for its reply: each EVALSHA follows it on the same connection.
+ * A reconnected connection loads it again before its EVALSHAs are sent
+ * again, in case the server restarted with an empty script cache.
+ */
+int
+treewalk_ingest_init(double cutoff)
+{
+    static redisCommandTemplate *load;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    int i = 0;
+
+    SHA1((const unsigned char *)treewalk_ingest_script, strlen(treewalk_ingest_script), digest);
+    for(i = 0; i < SHA_DIGEST_LENGTH; i++)
+        sprintf(ingest_sha + 2 * i, "%02x", digest[i]);
+    snprintf(ingest_cutoff, sizeof(ingest_cutoff), "%.6f", cutoff);
+
+    ingest_batch = (treewalk_ingest_batch_t *)calloc(sharded_count, sizeof(treewalk_ingest_batch_t));
+    if(ingest_batch == NULL)
+        return -1;
+
+    resp_reset(&ingest_cmd);
+    if(resp_array(&ingest_cmd, 3) < 0 ||
+            resp_bulk_str(&ingest_cmd, "SCRIPT") < 0 ||
+            resp_bulk_str(&ingest_cmd, "LOAD") < 0 ||
+            resp_bulk_str(&ingest_cmd, treewalk_ingest_script) < 0 ||
+            redis_reconnect_prelude(ingest_cmd.buf, ingest_cmd.len) < 0)
+        return -1;
+
+    if(load == NULL)
+        load = redisCompileCommand("SCRIPT LOAD %s");
+    for(i = 0; i < sharded_count; i++)
+    {
+        if((*redis_template_command_ptr)(i, load, treewalk_ingest_script) < 0)
+        {
+            LOG(PURGER_LOG_ERR, "Unable to load the ingest script on connection %d.", i);
+            return -1;
+        }
+    }
+
+    LOG(PURGER_LOG_DBG, "Ingest script %s loaded.", ingest_sha);
+    return 0;
+}
+
+/* Add a file to the batch of its connection, sending the batch once full. */
+int
+treewalk_ingest_file(struct stat *st, char *filename, char *filekey, int key_len, int crc)
+{
+    static char packed[PURGER_RECORD_HEADER + CIRCLE_MAX_STRING_LEN];
+    treewalk_ingest_batch_t *b = &ingest_batch[crc];
+    char bucket[32];
+    const char *field = "";
+    size_t field_len = 0;
+    int bucket_len = 0;
+    size_t len = 0;
+    purger_record_t r;
+
+    r.mtime = st->st_mtime;
+    r.size = st->st_size;
+    r.uid = st->st_uid;
+    r.gid = st->st_gid;
+    r.name = filename;
+    r.name_len = strlen(filename);
+    len = purger_record_pack(packed, sizeof(packed), &r);
+    if(len > sizeof(packed))
+        return -1;
+
+    if(record_digits)
+    {
+        bucket_len = purger_record_bucket(filekey, key_len, record_digits, bucket, sizeof(bucket), &field, &field_len);
+        if(bucket_len < 0)
+            return -1;
+    }
+
+    if(resp_bulk(&b->args, filekey, key_len) < 0 ||
+            resp_bulk(&b->args, bucket, bucket_len) < 0 ||
+            resp_bulk(&b->args, field, field_len) < 0 ||
+            resp_bulk(&b->args, packed, len) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Out of memory batching files for the ingest script.");
+        return -1;
+    }
+
+    if(++b->files >= TREEWALK_INGEST_BATCH)
+        return treewalk_ingest_flush(crc);
+    return 0;
+}
+
+/* Send the files waiting for connection "rank" as one EVALSHA. */
+int
+treewalk_ingest_flush(int rank)
+{
+    treewalk_ingest_batch_t *b = &ingest_batch[rank];
+    int status = 0;
+
+    if(b->files == 0)
+        return 0;
+
+    resp_reset(&ingest_cmd);
+    if(resp_array(&ingest_cmd, 4 + 4 * (long)b->files) < 0 ||
+            resp_bulk_str(&ingest_cmd, "EVALSHA") < 0 ||
+            resp_bulk_str(&ingest_cmd, ingest_sha) < 0 ||
+            resp_bulk_str(&ingest_cmd, "0") < 0 ||
+            resp_bulk_str(&ingest_cmd, ingest_cutoff) < 0 ||
+            resp_raw(&ingest_cmd, b->args.buf, b->args.len) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Out of memory sending %d files to the ingest script.", b->files);
+        status = -1;
+    }
+    else
+    {
+        status = (*redis_formatted_command_ptr)(rank, ingest_cmd.buf, ingest_cmd.len);
+    }
+
+    resp_reset(&b->args);
+    b->files = 0;
+    return status;
+}
+
+/* Send every partial batch and let go of the buffers. */
+int
+treewalk_ingest_finish(void)
+{
+    int status = 0;
+    int i = 0;
+
+    for(i = 0; ingest_batch != NULL && i < sharded_count; i++)
+    {
+        if(treewalk_ingest_flush(i) < 0)
+            status = -1;
+        resp_free(&ingest_batch[i].args);
+    }
+
+    free(ingest_batch);
+    ingest_batch = NULL;
+    resp_free(&ingest_cmd);
+    return status;
+}
+
+/* EOF */
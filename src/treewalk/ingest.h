@@ -0,0 +1,14 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <sys/stat.h>
+
+/* Files sent per EVALSHA of the ingest script. */
+#define TREEWALK_INGEST_BATCH 256
+
+int treewalk_ingest_init(double cutoff);
+int treewalk_ingest_file(struct stat *st, char *filename, char *filekey, int key_len, int crc);
+int treewalk_ingest_flush(int rank);
+int treewalk_ingest_finish(void);
+
+#endif /* INGEST_H */
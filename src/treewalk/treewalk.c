@@ -6,14 +6,23 @@
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <errno.h>
+#include <limits.h>
 
+#include "config.h"
 #include "state.h"
 #include "treewalk.h"
-#include "sprintstatf.h"
 #include "hash.h"
+#include "ingest.h"
+#include "combine.h"
 
 #include "log.h"
 #include "redis.h"
+#include "record.h"
+#include "dirtable.h"
+#include "reclog.h"
+#include "runs.h"
+#include "snapshot.h"
 #include <hiredis.h>
 #include <async.h>
 #include <mpi.h>
@@ -24,18 +33,56 @@ int PURGER_global_rank;
 char         *TOP_DIR;
 
 int (*redis_command_ptr)(int rank, char * cmd);
+int (*redis_template_command_ptr)(int rank, const redisCommandTemplate * t, ...);
+int (*redis_formatted_command_ptr)(int rank, const char * cmd, size_t len);
 double process_objects_total[2];
 double hash_time[2];
 double redis_time[2];
 double stat_time[2];
 double readdir_time[2];
 int benchmarking_flag;
+int inode_key_flag;
+/* Bucket digits of the packed record schema, 0 for one hash per file. */
+int record_digits;
+/* Store files in batches through the ingest script, see ingest.c. */
+int ingest_flag;
+/* Only store files within expired_margin seconds of expiring, see
+ * treewalk_record_wanted(). The others are counted in skipped_files. */
+int expired_only_flag;
+float expired_margin;
+long long skipped_files;
+long long skipped_bytes;
+/* Store directories once in the directory table and files as references
+ * to them, see dirtable.h. */
+int dir_table_flag;
+/* Where the records go: redis, or a log per rank with -o, see store.h. */
+purger_store_t *store;
+/* Files the store would not take. Only the first is logged as an error,
+ * a lost server would otherwise log every file left in the walk. */
+static long long store_failures;
+/* Spill expired files as sorted runs into run_dir instead of adding them
+ * to the mtime zset, see runs.h. */
+char *run_dir;
+static purger_run_buffer_t run_buffer;
+static int run_count;
+/* Every regular file also goes into a columnar snapshot with -C, see
+ * snapshot.h. */
+static purger_snapshot_writer_t *snapshot;
 int sharded_flag;
 int sharded_count;
 time_t time_started;
 time_t time_finished;
 #define SECONDS_PER_DAY 60.0*60.0*24.0
 float expire_threshold = SECONDS_PER_DAY*14.0;
+/* Hash state of the directory whose children are being processed. */
+static treewalk_hash_prefix_t hash_prefix;
+/* Regular files waiting to be hashed together, see treewalk_flush_pending(). */
+static struct
+{
+    char path[CIRCLE_MAX_STRING_LEN];
+    struct stat st;
+} hash_pending[TREEWALK_HASH_LANES];
+static int hash_pending_count;
 
 void
 add_objects(CIRCLE_handle *handle)
@@ -55,6 +102,13 @@ void process_dir(char * parent,char * dir, CIRCLE_handle *handle)
     else
 	{
 	    readdir_time[0] = MPI_Wtime();
+	    /* Hash "dir/" once here, the children only add their own name. */
+	    strcpy(parent,dir);
+	    strcat(parent,"/");
+	    if(store->keyed)
+	        treewalk_hash_prefix_set(&hash_prefix, parent, strlen(parent));
+	    if(store->dir != NULL && !benchmarking_flag)
+	        (*store->dir)(store, dir);
 	    /* Read in each directory entry */
 	    while((current_ent = readdir(current_dir)) != NULL)
 	    {
@@ -75,23 +129,134 @@ void process_dir(char * parent,char * dir, CIRCLE_handle *handle)
 return;
 }
 
+/*
+ * Whether a regular file gets a record in redis. With -e only the files
+ * warnusers and reaper will act on, and those that will expire within
+ * the margin, are worth storing.
+ */
+int
+treewalk_record_wanted(struct stat *st)
+{
+    if(!expired_only_flag)
+        return 1;
+    return difftime(time_started,st->st_mtime) > expire_threshold - expired_margin;
+}
+
+/*
+ * Store one regular file whose key has already been generated, if the
+ * store wants one, and note whether it is expired.
+ */
+void
+treewalk_store_file(char *path, struct stat *st, char *filekey, int key_len)
+{
+    int expired = difftime(time_started,st->st_mtime) > expire_threshold;
+
+    if(expired)
+        LOG(PURGER_LOG_DBG,"File expired: \"%s\"",path);
+
+    redis_time[0] = MPI_Wtime();
+    if(expired && run_dir != NULL)
+        treewalk_run_add(path, st);
+    if((*store->file)(store, path, st, filekey, (size_t)key_len, expired) < 0)
+    {
+        if(store_failures++ == 0)
+            LOG(PURGER_LOG_ERR,"Unable to store \"%s\" in the %s store.",path,store->name);
+        else
+            LOG(PURGER_LOG_DBG,"Unable to store \"%s\" in the %s store.",path,store->name);
+    }
+    redis_time[1] += MPI_Wtime() - redis_time[0];
+}
+
+/* Hold an expired file for the next run, spilling the buffer when full. */
+void
+treewalk_run_add(char *path, struct stat *st)
+{
+    purger_record_t r;
+
+    r.mtime = st->st_mtime;
+    r.size = st->st_size;
+    r.uid = st->st_uid;
+    r.gid = st->st_gid;
+    r.name = path;
+    r.name_len = strlen(path);
+
+    if(purger_run_buffer_add(&run_buffer, &r) == 0)
+        return;
+    treewalk_run_spill();
+    if(purger_run_buffer_add(&run_buffer, &r) < 0)
+        LOG(PURGER_LOG_ERR,"\"%s\" does not fit in a run.",path);
+}
+
+/* Write the expired files held in memory out as this rank's next run. */
+void
+treewalk_run_spill(void)
+{
+    char path[PATH_MAX];
+    size_t records = run_buffer.count;
+
+    if(records == 0)
+        return;
+
+    snprintf(path, sizeof(path), "%s/" PURGER_RUN_PREFIX "%d-%d" PURGER_RUN_SUFFIX, run_dir, PURGER_global_rank, run_count++);
+    if(purger_run_buffer_spill(&run_buffer, path) < 0)
+        LOG(PURGER_LOG_ERR,"Unable to write the run %s: %s",path,strerror(errno));
+    else
+        LOG(PURGER_LOG_DBG,"Spilled %zu expired files to %s.",records,path);
+}
+
+/*
+ * Hash every file waiting in hash_pending in one go and store them, siblings
+ * starting from the cached state of their directory. Also called once after
+ * CIRCLE_begin() returns to pick up a partial batch.
+ */
+void
+treewalk_flush_pending(void)
+{
+    static unsigned char hashes[TREEWALK_HASH_LANES][65];
+    static char filekey[512];
+    char *paths[TREEWALK_HASH_LANES];
+    int key_len = 0;
+    int i = 0;
+
+    if(hash_pending_count == 0)
+        return;
+
+    for(i = 0; i < hash_pending_count; i++)
+        paths[i] = hash_pending[i].path;
+
+    hash_time[0] = MPI_Wtime();
+    treewalk_filename_hash_batch_prefixed(&hash_prefix, paths, hash_pending_count, hashes);
+    hash_time[1] += MPI_Wtime() - hash_time[0];
+
+    for(i = 0; i < hash_pending_count; i++)
+    {
+        key_len = sprintf(filekey, "file:%s\n", hashes[i]);
+        treewalk_store_file(hash_pending[i].path, &hash_pending[i].st, filekey, key_len);
+    }
+
+    hash_pending_count = 0;
+}
+
 void
 process_objects(CIRCLE_handle *handle)
 {
     process_objects_total[0] = MPI_Wtime();
     static char temp[CIRCLE_MAX_STRING_LEN];
     static char stat_temp[CIRCLE_MAX_STRING_LEN];
-    static char redis_cmd_buf[CIRCLE_MAX_STRING_LEN];
     static char filekey[512];
     struct stat st;
     int status = 0;
-    int crc = 0;
+    int key_len = 0;
     /* Pop an item off the queue */ 
     handle->dequeue(temp);
     /* Try and stat it, checking to see if it is a link */
     stat_time[0] = MPI_Wtime();
     status = lstat(temp,&st);
     stat_time[1] += MPI_Wtime()-stat_time[0];
+    /* Whatever else happens to a file, -e included, the snapshot has it. */
+    if(status == EXIT_SUCCESS && snapshot != NULL && !benchmarking_flag && S_ISREG(st.st_mode) &&
+            purger_snapshot_add(snapshot, temp, strlen(temp), &st) < 0)
+        LOG(PURGER_LOG_ERR, "Unable to add \"%s\" to the snapshot: %s", temp, strerror(errno));
     if(status != EXIT_SUCCESS)
     {
             LOG(PURGER_LOG_ERR, "Error: Couldn't stat \"%s\"", temp);
@@ -103,95 +268,210 @@ process_objects(CIRCLE_handle *handle)
         process_dir(stat_temp,temp,handle); 
         readdir_time[1] += MPI_Wtime() - readdir_time[0];
     }
+    else if(!benchmarking_flag && S_ISREG(st.st_mode) && !treewalk_record_wanted(&st))
+    {
+        /* Not hashed or stored, only counted. */
+        skipped_files++;
+        skipped_bytes += st.st_size;
+    }
+    else if(!benchmarking_flag && S_ISREG(st.st_mode) && !store->keyed)
+    {
+        /* Nothing to hash, the store goes by path. */
+        treewalk_store_file(temp, &st, NULL, 0);
+    }
+    else if(!benchmarking_flag && S_ISREG(st.st_mode) && !inode_key_flag && treewalk_filename_hash_lanes() > 1)
+    {
+        /* Hold the file until there is a full batch to hash side by side. */
+        strcpy(hash_pending[hash_pending_count].path, temp);
+        hash_pending[hash_pending_count].st = st;
+        if(++hash_pending_count == treewalk_filename_hash_lanes())
+            treewalk_flush_pending();
+    }
     else if(!benchmarking_flag && S_ISREG(st.st_mode)) 
     {
         /* Hash the file */
         hash_time[0] = MPI_Wtime();
-        treewalk_redis_keygen(filekey, temp);
-        crc = (int)crc32(filekey,32) % sharded_count;
+        if(inode_key_flag)
+            key_len = treewalk_redis_keygen_inode(filekey, &st);
+        else
+            key_len = treewalk_redis_keygen(filekey, temp);
         hash_time[1] += MPI_Wtime() - hash_time[0];
-        
-        /* Create and hset with basic attributes. */
-        treewalk_create_redis_attr_cmd(redis_cmd_buf, &st, temp, filekey);
-        
-        /* Execute the redis command */
-	redis_time[0] = MPI_Wtime();
-        (*redis_command_ptr)(crc,redis_cmd_buf);
-        redis_time[1] += MPI_Wtime() - redis_time[0];
-
-        /* Check to see if the file is expired.
-           If so, zadd it by mtime and add the user id
-           to warnlist */
-        if(difftime(time_started,st.st_mtime) > expire_threshold)
-        {
-            LOG(PURGER_LOG_DBG,"File expired: \"%s\"",temp);
-            redis_time[0] = MPI_Wtime();
-            /* The mtime of the file as a zadd. */
-            treewalk_redis_run_zadd(filekey, (long)st.st_mtime, "mtime",crc);
-            /* add user to warn list */
-            treewalk_redis_run_sadd(&st);
-            redis_time[1] += MPI_Wtime() - redis_time[0];
-        }
+
+        treewalk_store_file(temp, &st, filekey, key_len);
     }
+    treewalk_combine_tick(MPI_Wtime());
     process_objects_total[1] += MPI_Wtime() - process_objects_total[0];
 }
 
-void
-treewalk_redis_run_sadd(struct stat *st)
+/* Store the directory "dir" in the directory table, under its id. */
+int
+treewalk_redis_run_dir(char *dir)
 {
-    char *buf = (char*)malloc(2048 * sizeof(char));
-    sprintf(buf, "SADD warnlist %d",st->st_uid);
-    (*redis_command_ptr)(st->st_uid % sharded_count,buf);
+    static redisCommandTemplate *hset;
+    char id[PURGER_DIR_ID_LEN + 1];
+    size_t len = strlen(dir);
+
+    if(hset == NULL)
+        hset = redisCompileCommand("HSET " PURGER_DIR_TABLE_KEY " %s %b");
+    sprintf(id, "%016llx", (unsigned long long)purger_dir_id(dir, len));
+    return (*redis_template_command_ptr)(0, hset, id, dir, len);
 }
 
+/*
+ * Send "HMSET <key> name <path> gid_decimal <gid> mtime_decimal <mtime>
+ * size <size> uid_decimal <uid>" straight from the stat struct. Every
+ * argument is its own bulk string, so quotes or spaces in the path are fine.
+ */
 int
-treewalk_redis_run_zadd(char *filekey, long val, char *zset, int crc)
+treewalk_redis_run_hmset(struct stat *st, char *filename, char *filekey, int key_len, int crc)
 {
-    int cnt = 0;
-    char *buf = (char *)malloc(2048 * sizeof(char));
+    static redisCommandTemplate *hmset;
 
-    cnt += sprintf(buf, "ZADD %s ", zset);
-    cnt += sprintf(buf + cnt, "%ld ", val);
-    cnt += sprintf(buf + cnt, "%s", filekey);
-    (*redis_command_ptr)(crc, buf);
-    free(buf);
-
-    return cnt;
+    if(hmset == NULL)
+        hmset = redisCompileCommand("HMSET %b name %s gid_decimal %lld mtime_decimal %lld size %lld uid_decimal %lld");
+    return (*redis_template_command_ptr)(crc, hmset, filekey, (size_t)key_len, filename,
+        (long long)st->st_gid, (long long)st->st_mtime, (long long)st->st_size, (long long)st->st_uid);
 }
 
+/*
+ * Store the file as one field of its bucket hash, see record.h. The
+ * packed record replaces the field names and decimal values of the HMSET.
+ */
 int
-treewalk_create_redis_attr_cmd(char *buf, struct stat *st, char *filename, char *filekey)
+treewalk_redis_run_hset_packed(struct stat *st, char *filename, char *filekey, int key_len, int crc)
 {
-    int fmt_cnt = 0;
-    int buf_cnt = 0;
+    static redisCommandTemplate *hset;
+    static char packed[PURGER_RECORD_HEADER + CIRCLE_MAX_STRING_LEN];
+    char bucket[32];
+    const char *field = NULL;
+    size_t field_len = 0;
+    size_t len = 0;
+    purger_record_t r;
+
+    if(hset == NULL)
+        hset = redisCompileCommand("HSET %s %b %b");
+    if(purger_record_bucket(filekey, key_len, record_digits, bucket, sizeof(bucket), &field, &field_len) < 0)
+        return -1;
+
+    r.mtime = st->st_mtime;
+    r.size = st->st_size;
+    r.uid = st->st_uid;
+    r.gid = st->st_gid;
+    r.name = filename;
+    r.name_len = strlen(filename);
+    len = purger_record_pack(packed, sizeof(packed), &r);
+    if(len > sizeof(packed))
+        return -1;
+
+    return (*redis_template_command_ptr)(crc, hset, bucket, field, field_len, packed, len);
+}
 
-    char *redis_cmd_fmt = (char *)malloc(2048 * sizeof(char));
-    char *redis_cmd_fmt_cnt = \
-            "gid_decimal   \"%g\" "
-            "mtime_decimal \"%m\" "
-            "size          \"%s\" "
-            "uid_decimal   \"%u\" ";
+/*
+ * The redis backend of the store. With -D the directory part of the path
+ * is already in the directory table, so only a reference to it is kept.
+ */
+static int
+treewalk_redis_store_dir(purger_store_t *s, const char *path)
+{
+    (void)s;
+    if(!dir_table_flag)
+        return 0;
+    return treewalk_redis_run_dir((char *)path);
+}
 
-    /* Create the start of the command, i.e. "HMSET file:<hash>" */
-    fmt_cnt += sprintf(redis_cmd_fmt + fmt_cnt, "HMSET ");
+/* The HMSET of its attributes and, if it is expired, its mtime and owner. */
+static int
+treewalk_redis_store_file(purger_store_t *s, const char *path, const struct stat *st,
+                          const char *key, size_t key_len, int expired)
+{
+    static char ref[CIRCLE_MAX_STRING_LEN];
+    struct stat *sb = (struct stat *)st;
+    char *filekey = (char *)key;
+    char *name = (char *)path;
+    int status = 0;
+    int crc = 0;
 
-    /* Add in the file key */
-    fmt_cnt += sprintf(redis_cmd_fmt + fmt_cnt, "%s", filekey);
+    (void)s;
+    if(dir_table_flag && purger_dir_ref(path, strlen(path), ref, sizeof(ref)) >= 0)
+        name = ref;
 
-    /* Add the filename itself to the redis set command */
-    fmt_cnt += sprintf(redis_cmd_fmt + fmt_cnt, " name \"%s\"", filename);
+    crc = (int)((uint32_t)crc32(filekey, key_len < 32 ? key_len : 32) % sharded_count);
 
-    /* Add the args for sprintstatf */
-    fmt_cnt += sprintf(redis_cmd_fmt + fmt_cnt, " %s", redis_cmd_fmt_cnt);
+    /* The script does all of the below server side. */
+    if(ingest_flag)
+        return treewalk_ingest_file(sb, name, filekey, (int)key_len, crc);
 
-    /* Add the stat struct values. */
-    buf_cnt += sprintstatf(buf, redis_cmd_fmt, st);
+    if(record_digits)
+        status = treewalk_redis_run_hset_packed(sb, name, filekey, (int)key_len, crc);
+    else
+        status = treewalk_redis_run_hmset(sb, name, filekey, (int)key_len, crc);
+
+    /* The mtime of the file for the mtime zset and its owner for the
+       warn list, both sent with other files' in one command. With -R
+       the mtime went into a run instead. */
+    if(expired && run_dir != NULL && treewalk_combine_owner(sb) < 0)
+        status = -1;
+    else if(expired && run_dir == NULL && treewalk_combine_expired(sb, filekey, (int)key_len, crc) < 0)
+        status = -1;
+    return status;
+}
 
-    free(redis_cmd_fmt);
-    return buf_cnt;
+/* Send what is still batched up. */
+static int
+treewalk_redis_store_close(purger_store_t *s)
+{
+    (void)s;
+    if(ingest_flag)
+        return treewalk_ingest_finish();
+    return treewalk_combine_finish();
 }
 
+static purger_store_t treewalk_redis_store =
+{
+    "redis",
+    1,
+    treewalk_redis_store_dir,
+    treewalk_redis_store_file,
+    treewalk_redis_store_close
+};
+
+/*
+ * With -b and a redis server, measure how fast this rank gets commands
+ * through the configured transport (TCP or unix socket, sharded, clustered
+ * or not, -a, -w and -B all apply). ECHOs the size of a typical HMSET are
+ * pipelined like the real writes, so no keys are touched.
+ */
+void
+treewalk_redis_benchmark(int writer_flag)
+{
+    static redisCommandTemplate *echo;
+    char payload[TREEWALK_BENCH_PAYLOAD];
+    double start = 0.0;
+    double elapsed = 0.0;
+    long i = 0;
+
+    if(echo == NULL)
+        echo = redisCompileCommand("ECHO %b");
+    memset(payload, 'x', sizeof(payload));
+
+    start = MPI_Wtime();
+    for(i = 0; i < TREEWALK_BENCH_COMMANDS; i++)
+        (*redis_template_command_ptr)((int)(i % sharded_count), echo, payload, sizeof(payload));
+
+    if(writer_flag)
+        redis_writer_stop();
+    else if(redis_template_command_ptr == &redis_cluster_command_template)
+        redis_cluster_drain();
+    else if(sharded_flag)
+        for(i = 0; i < sharded_count; i++)
+            redis_pipeline_drain(&redis_shard_pipeline[i]);
+    else
+        redis_pipeline_drain(&redis_pipeline);
+    elapsed = MPI_Wtime() - start;
 
+    LOG(PURGER_LOG_INFO, "Redis transport: %d commands of %zu bytes in %.3f s (%.0f commands/s).",
+        TREEWALK_BENCH_COMMANDS, sizeof(payload), elapsed, TREEWALK_BENCH_COMMANDS / elapsed);
+}
 
 int
 treewalk_redis_keygen(char *buf, char *filename)
@@ -199,11 +479,29 @@ treewalk_redis_keygen(char *buf, char *filename)
     static unsigned char hash_buffer[65];
     int cnt = 0;
 
-    treewalk_filename_hash(filename, hash_buffer);
+    treewalk_filename_hash_prefixed(&hash_prefix, filename, hash_buffer);
     cnt += sprintf(buf, "file:%s\n", hash_buffer);
     
     return cnt;
 }
+/*
+ * Key a record by where the file lives instead of what it is called:
+ * "file:<st_dev>:<st_ino>", plus the inode generation when the platform
+ * reports one. Renames and moves keep the same key and nothing is hashed.
+ */
+int
+treewalk_redis_keygen_inode(char *buf, struct stat *st)
+{
+    int cnt = 0;
+
+    cnt += sprintf(buf, "file:%llx:%llx", (unsigned long long)st->st_dev, (unsigned long long)st->st_ino);
+#ifdef HAVE_STRUCT_STAT_ST_GEN
+    cnt += sprintf(buf + cnt, ":%lx", (unsigned long)st->st_gen);
+#endif
+
+    return cnt;
+}
+
 int
 treewalk_check_state(int rank, int force)
 {
@@ -253,12 +551,42 @@ treewalk_check_state(int rank, int force)
         LOG(PURGER_LOG_ERR,"Unable to %s",getCmd);
         return -1;
     }
+   /* Tell the reaper how this run stores its records. */
+   if(record_digits)
+       sprintf(getCmd,"set %s packed:%d",PURGER_RECORD_SCHEMA_KEY,record_digits);
+   else
+       sprintf(getCmd,"set %s hash",PURGER_RECORD_SCHEMA_KEY);
+   if(rank == 0 && (*redis_command_ptr)(0,getCmd)<0)
+    {
+        LOG(PURGER_LOG_ERR,"Unable to %s",getCmd);
+        return -1;
+    }
   return 0;
 }
+/*
+ * Keep what -e left out of the store: the files and bytes of this rank
+ * under treewalk-skipped-<rank> when storing to redis, and their total in
+ * the log of rank 0.
+ */
+void
+treewalk_store_skipped(int rank)
+{
+    long long mine[2] = { skipped_files, skipped_bytes };
+    long long total[2] = { 0, 0 };
+    char getCmd[256];
+
+    sprintf(getCmd,"hmset treewalk-skipped-%d files %lld bytes %lld",rank,skipped_files,skipped_bytes);
+    if(store == &treewalk_redis_store && redis_blocking_command(getCmd,NULL,INT) < 0)
+        LOG(PURGER_LOG_ERR,"Unable to %s",getCmd);
+
+    MPI_Reduce(mine,total,2,MPI_LONG_LONG,MPI_SUM,0,MPI_COMM_WORLD);
+    if(rank == 0)
+        LOG(PURGER_LOG_INFO,"Left %lld files (%lld bytes) that are not close to expiring out of the %s store.",total[0],total[1],store->name);
+}
 void
 print_usage(char **argv)
 {
-    fprintf(stderr, "Usage: %s -d <starting directory> [-h <redis_hostname> -p <redis_port> -t <days to expire> -f -b]\n", argv[0]);
+    fprintf(stderr, "Usage: %s -d <starting directory> [-h <redis host[:port] or socket path> -p <redis_port> -t <days to expire> -f -b -i -s <redis_hostlist> -c -a -w -B <socket buffer bytes> -z <bucket digits> -L -m <members> -e <days of margin> -D -o <log directory> -R <run directory> -C <snapshot directory>]\n", argv[0]);
 }
 
 int
@@ -269,6 +597,9 @@ main (int argc, char **argv)
 
     char *redis_hostname;
     char *redis_hostlist;
+    char *log_dir = NULL;
+    char *snapshot_dir = NULL;
+    char snapshot_path[PATH_MAX];
     int redis_port;
 
     int time_flag = 0;
@@ -277,14 +608,25 @@ main (int argc, char **argv)
     int restart_flag = 0;
     int redis_hostname_flag = 0;
     benchmarking_flag = 0;
+    inode_key_flag = 0;
     sharded_flag = 0;
+    /* Everything goes to connection 0 unless -s spreads it out. */
+    sharded_count = 1;
     int redis_port_flag = 0;
+    int writer_flag = 0;
+    int cluster_flag = 0;
+    int redis_flag = 0;
+    int combine_members = TREEWALK_COMBINE_MEMBERS;
+    int exit_status = EXIT_SUCCESS;
 
     process_objects_total[2] = 0;
     redis_time[2] = 0;
     stat_time[2] = 0;
     readdir_time[2] = 0;
     redis_command_ptr = &redis_command;
+    redis_template_command_ptr = &redis_command_template;
+    redis_formatted_command_ptr = &redis_command_formatted;
+    store = &treewalk_redis_store;
 
     
     /* Enable logging. */
@@ -293,13 +635,74 @@ main (int argc, char **argv)
     int rank = CIRCLE_init(argc, argv);
     PURGER_global_rank = rank;
     opterr = 0;
-    while((c = getopt(argc, argv, "d:h:p:ft:l:rs:b")) != -1)
+    while((c = getopt(argc, argv, "d:h:p:ft:l:rs:biawB:cz:Lm:e:Do:R:C:")) != -1)
     {
         switch(c)
         {
             case 'b':
 		benchmarking_flag = 1;
 		break;
+            case 'a':
+                redis_async_flag = 1;
+                if(rank == 0) LOG(PURGER_LOG_INFO,"Driving the redis shards from an event loop.");
+                break;
+            case 'B':
+                redis_socket_buffer = atoi(optarg);
+                break;
+            case 'L':
+                ingest_flag = 1;
+                if(rank == 0) LOG(PURGER_LOG_INFO,"Storing files in batches through a server side script.");
+                break;
+            case 'D':
+                dir_table_flag = 1;
+                if(rank == 0) LOG(PURGER_LOG_INFO,"Storing each directory once, files refer to it.");
+                break;
+            case 'o':
+                log_dir = optarg;
+                if(rank == 0) LOG(PURGER_LOG_INFO,"Writing records to a log per rank in %s instead of redis.",log_dir);
+                break;
+            case 'R':
+                run_dir = optarg;
+                if(rank == 0) LOG(PURGER_LOG_INFO,"Spilling expired files as sorted runs into %s instead of the mtime zset.",run_dir);
+                break;
+            case 'C':
+                snapshot_dir = optarg;
+                if(rank == 0) LOG(PURGER_LOG_INFO,"Writing a columnar snapshot per rank into %s.",snapshot_dir);
+                break;
+            case 'e':
+                expired_only_flag = 1;
+                expired_margin = (float)SECONDS_PER_DAY * atof(optarg);
+                if(rank == 0) LOG(PURGER_LOG_INFO,"Only storing files that expire within %.2f days.",expired_margin/(60.0*60.0*24));
+                break;
+            case 'm':
+                combine_members = atoi(optarg);
+                if(combine_members < 1)
+                {
+                    if(rank == 0) LOG(PURGER_LOG_FATAL,"At least one member has to go in each ZADD and SADD.");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                cluster_flag = 1;
+                if(rank == 0) LOG(PURGER_LOG_INFO,"Treating the redis server as a seed node of a Redis Cluster.");
+                break;
+            case 'w':
+                writer_flag = 1;
+                if(rank == 0) LOG(PURGER_LOG_INFO,"Sending redis commands from a writer thread.");
+                break;
+            case 'z':
+                record_digits = atoi(optarg);
+                if(record_digits < 1 || record_digits > PURGER_RECORD_BUCKET_MAX)
+                {
+                    if(rank == 0) LOG(PURGER_LOG_FATAL,"Bucket digits must be between 1 and %d.",PURGER_RECORD_BUCKET_MAX);
+                    exit(EXIT_FAILURE);
+                }
+                if(rank == 0) LOG(PURGER_LOG_INFO,"Packing records into %d buckets.",1 << (4 * record_digits));
+                break;
+            case 'i':
+                inode_key_flag = 1;
+                if(rank == 0) LOG(PURGER_LOG_INFO,"Keying records by device and inode instead of path.");
+                break;
             case 'd':
                 TOP_DIR = realpath(optarg, NULL);
                 if(rank == 0) LOG(PURGER_LOG_INFO,"Using %s as a root path.",TOP_DIR);
@@ -341,7 +744,7 @@ main (int argc, char **argv)
                 break;
             
             case '?':
-                if (optopt == 'd' || optopt == 'h' || optopt == 'p' || optopt == 't' || optopt == 'l' || optopt == 's')
+                if (optopt == 'd' || optopt == 'h' || optopt == 'p' || optopt == 't' || optopt == 'l' || optopt == 's' || optopt == 'z' || optopt == 'm' || optopt == 'e' || optopt == 'o' || optopt == 'R' || optopt == 'C')
                 {
                     print_usage(argv);
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
@@ -382,13 +785,58 @@ main (int argc, char **argv)
          exit(EXIT_FAILURE);
     }
 
-    if(redis_hostname_flag == 0 && !benchmarking_flag)
+    /* A benchmark run only talks to redis when a server is given, and
+     * then measures the transport, see treewalk_redis_benchmark(). */
+    redis_flag = log_dir == NULL && (!benchmarking_flag || redis_hostname_flag || sharded_flag);
+
+    if(log_dir != NULL && (redis_hostname_flag || sharded_flag || cluster_flag || writer_flag || ingest_flag || record_digits || dir_table_flag || inode_key_flag))
+    {
+        if(rank == 0) LOG(PURGER_LOG_WARN, "Writing records to %s, the redis options are ignored.",log_dir);
+    }
+
+    if(log_dir != NULL && !benchmarking_flag)
+    {
+        store = purger_reclog_open(log_dir, rank);
+        if(store == NULL)
+        {
+            LOG(PURGER_LOG_FATAL, "Unable to start the record log of rank %d in %s: %s", rank, log_dir, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(run_dir != NULL && !benchmarking_flag)
+    {
+        if(ingest_flag && log_dir == NULL)
+        {
+            /* The script adds to the zset itself. */
+            if(rank == 0) LOG(PURGER_LOG_FATAL, "The ingest script writes the mtime zset, -L and -R cannot be combined.");
+            exit(EXIT_FAILURE);
+        }
+        if(access(run_dir, W_OK) < 0 || purger_run_buffer_init(&run_buffer, TREEWALK_RUN_MEMORY) < 0)
+        {
+            LOG(PURGER_LOG_FATAL, "Unable to spill runs into %s: %s", run_dir, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(snapshot_dir != NULL && !benchmarking_flag)
+    {
+        purger_snapshot_path(snapshot_path, sizeof(snapshot_path), snapshot_dir, rank);
+        snapshot = purger_snapshot_create(snapshot_path);
+        if(snapshot == NULL)
+        {
+            LOG(PURGER_LOG_FATAL, "Unable to start the snapshot %s: %s", snapshot_path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(redis_hostname_flag == 0 && redis_flag && !benchmarking_flag)
     {
         if(rank == 0) LOG(PURGER_LOG_WARN, "A hostname for redis was not specified, defaulting to localhost.");
         redis_hostname = "localhost";
     }
 
-    if(redis_port_flag == 0 && !benchmarking_flag)
+    if(redis_port_flag == 0 && redis_flag)
     {
         if(rank == 0) LOG(PURGER_LOG_WARN, "A port number for redis was not specified, defaulting to 6379.");
         redis_port = 6379;
@@ -396,31 +844,87 @@ main (int argc, char **argv)
 
     for (index = optind; index < argc; index++)
         LOG(PURGER_LOG_WARN, "Non-option argument %s", argv[index]);
-    if (!benchmarking_flag && redis_init(redis_hostname,redis_port) < 0)
+    if (log_dir == NULL && (!benchmarking_flag || redis_hostname_flag) && redis_init(redis_hostname,redis_port) < 0)
     {
-        LOG(PURGER_LOG_FATAL, "Redis error: %s", REDIS->errstr);
+        LOG(PURGER_LOG_FATAL, "Unable to connect to redis at %s.", redis_hostname);
         exit(EXIT_FAILURE);
     }
+    if(redis_flag && cluster_flag)
+    {
+        if(sharded_flag)
+        {
+            if(rank == 0) LOG(PURGER_LOG_FATAL, "A Redis Cluster shards itself, -c and -s cannot be combined.");
+            exit(EXIT_FAILURE);
+        }
+        if(ingest_flag)
+        {
+            /* A batch touches keys in many slots. */
+            if(rank == 0) LOG(PURGER_LOG_FATAL, "The ingest script cannot run on a Redis Cluster, -c and -L cannot be combined.");
+            exit(EXIT_FAILURE);
+        }
+        if(redis_cluster_init(redis_hostname,redis_port) <= 0)
+            exit(EXIT_FAILURE);
+        redis_command_ptr = &redis_cluster_command;
+        redis_template_command_ptr = &redis_cluster_command_template;
+        redis_formatted_command_ptr = &redis_cluster_command_formatted;
+    }
     
 
    time(&time_started);
-   if(!benchmarking_flag && treewalk_check_state(rank,force_flag) < 0)
+   if(redis_flag && !benchmarking_flag && treewalk_check_state(rank,force_flag) < 0)
        exit(1);
     if(!benchmarking_flag && restart_flag)
         CIRCLE_read_restarts();
-    if(!benchmarking_flag && sharded_flag)
+    if(redis_flag && sharded_flag)
     {
         sharded_count = redis_shard_init(redis_hostlist,redis_port);
+        if(sharded_count <= 0)
+            exit(EXIT_FAILURE);
         redis_command_ptr = &redis_shard_command;
+        redis_template_command_ptr = &redis_shard_command_template;
+        redis_formatted_command_ptr = &redis_shard_command_formatted;
+    }
+    /* Before the writer, which owns the pipelines from then on. */
+    if(redis_flag && ingest_flag && !benchmarking_flag && treewalk_ingest_init((double)time_started - expire_threshold) < 0)
+        exit(EXIT_FAILURE);
+    if(redis_flag && writer_flag)
+    {
+        if(redis_writer_start(REDIS_WRITER_RING) < 0)
+            exit(EXIT_FAILURE);
+        redis_command_ptr = &redis_writer_command;
+        redis_template_command_ptr = &redis_writer_command_template;
+        redis_formatted_command_ptr = &redis_writer_command_formatted;
     }
+    if(redis_flag && !ingest_flag && !benchmarking_flag && treewalk_combine_init(combine_members, MPI_Wtime()) < 0)
+        exit(EXIT_FAILURE);
     CIRCLE_cb_create(&add_objects);
     CIRCLE_cb_process(&process_objects);
     CIRCLE_begin();
+    if(!benchmarking_flag)
+        treewalk_flush_pending();
+    if(!benchmarking_flag && (*store->close)(store) < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to finish writing to the %s store.", store->name);
+        exit_status = EXIT_FAILURE;
+    }
+    if(!benchmarking_flag && run_dir != NULL)
+    {
+        treewalk_run_spill();
+        purger_run_buffer_free(&run_buffer);
+    }
+    if(snapshot != NULL && purger_snapshot_finish(snapshot) < 0)
+        LOG(PURGER_LOG_ERR, "Unable to finish the snapshot %s: %s", snapshot_path, strerror(errno));
+    if(benchmarking_flag && redis_flag)
+        treewalk_redis_benchmark(writer_flag);
+    else if(!benchmarking_flag && writer_flag)
+        redis_writer_stop();
+    if(!benchmarking_flag && expired_only_flag)
+        treewalk_store_skipped(rank);
     CIRCLE_finalize();
     
     char getCmd[256];
     sprintf(getCmd,"set treewalk-rank-%d 0", rank);
-    if(!benchmarking_flag && redis_blocking_command(getCmd,NULL,INT)<0)
+    if(redis_flag && !benchmarking_flag && redis_blocking_command(getCmd,NULL,INT)<0)
     {
         fprintf(stderr,"Unable to %s",getCmd);
         exit(1);
@@ -434,7 +938,7 @@ main (int argc, char **argv)
     strftime(starttime_str, 256, "%b-%d-%Y,%H:%M:%S",localstart);
     strftime(endtime_str, 256, "%b-%d-%Y,%H:%M:%S",localend);
     sprintf(getCmd,"set treewalk_timestamp \"%s\"",endtime_str);
-    if(!benchmarking_flag && redis_blocking_command(getCmd,NULL,INT) < 0)
+    if(redis_flag && !benchmarking_flag && redis_blocking_command(getCmd,NULL,INT) < 0)
     {
         fprintf(stderr,"Unable to %s",getCmd);
     }
@@ -445,18 +949,33 @@ main (int argc, char **argv)
         LOG(PURGER_LOG_INFO, "treewalk run completed at: %s", endtime_str);
         LOG(PURGER_LOG_INFO, "treewalk total time (seconds) for this run: %f",difftime(time_finished,time_started));
         LOG(PURGER_LOG_INFO, "\nTotal time in process_objects: %lf\n\
-                   \tRedis commands: %lf %lf\n\
+                   \tStoring: %lf %lf\n\
                    \tStating:  %lf %lf\n\
                    \tReaddir: %lf %lf\n\
                    \tHashing: %lf %lf\n",
                    process_objects_total[1],redis_time[1],redis_time[1]/process_objects_total[1]*100.0,stat_time[1],stat_time[1]/process_objects_total[1]*100.0,readdir_time[1],readdir_time[1]/process_objects_total[1]*100.0
                    ,hash_time[1],hash_time[1]/process_objects_total[1]*100.0);
     }
-    if(!benchmarking_flag && sharded_flag)
+    if(store_failures > 0)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to store %lld files in the %s store.", store_failures, store->name);
+        exit_status = EXIT_FAILURE;
+    }
+    if(redis_flag && !benchmarking_flag && redis_lost() > 0)
+    {
+        LOG(PURGER_LOG_ERR, "Gave up on %d redis connections, records of this rank are missing.", redis_lost());
+        exit_status = EXIT_FAILURE;
+    }
+    if(redis_flag && sharded_flag)
 	redis_shard_finalize();
-    if(!benchmarking_flag)
+    if(redis_flag && cluster_flag && redis_cluster_finalize() < 0)
+    {
+        LOG(PURGER_LOG_ERR, "Redirected commands of this rank were dropped, records are missing.");
+        exit_status = EXIT_FAILURE;
+    }
+    if(log_dir == NULL && (!benchmarking_flag || redis_hostname_flag))
         redis_finalize(); 
-    _exit(EXIT_SUCCESS);
+    _exit(exit_status);
 }
 
 /* EOF */
@@ -3,11 +3,25 @@
 
 #include <libcircle.h>
 
+/* Commands each rank sends in a -b transport benchmark, and their size. */
+#define TREEWALK_BENCH_COMMANDS 200000
+#define TREEWALK_BENCH_PAYLOAD  200
+/* Bytes of expired files each rank holds before spilling a run with -R. */
+#define TREEWALK_RUN_MEMORY     (256*1024*1024)
+
 void add_objects(CIRCLE_handle *handle);
 void process_objects(CIRCLE_handle *handle);
-int treewalk_create_redis_attr_cmd(char *buf, struct stat *st, char *filename, char *filekey);
-int treewalk_redis_run_zadd(char *filekey, long val, char *zset,int crc);
+int treewalk_record_wanted(struct stat *st);
+void treewalk_store_file(char *path, struct stat *st, char *filekey, int key_len);
+void treewalk_flush_pending(void);
+void treewalk_run_add(char *path, struct stat *st);
+void treewalk_run_spill(void);
+int treewalk_redis_run_dir(char *dir);
+int treewalk_redis_run_hmset(struct stat *st, char *filename, char *filekey, int key_len, int crc);
+int treewalk_redis_run_hset_packed(struct stat *st, char *filename, char *filekey, int key_len, int crc);
 int treewalk_redis_keygen(char *buf, char *filename);
+int treewalk_redis_keygen_inode(char *buf, struct stat *st);
 void print_usage(char **argv);
-void treewalk_redis_run_sadd(struct stat * st);
+void treewalk_redis_benchmark(int writer_flag);
+void treewalk_store_skipped(int rank);
 #endif /* TREEWALK_H */
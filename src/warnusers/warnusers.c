@@ -12,6 +12,8 @@
 #include "mail.h"
 
 #include "../common/log.h"
+#include "../common/endpoint.h"
+#include "../common/command.h"
 
 #include <hiredis.h>
 #include <async.h>
@@ -102,15 +104,27 @@ process_objects(CIRCLE_handle *handle)
 void
 warnusers_redis_run_sadd(int id)
 {
-    char *buf = (char*)malloc(2048 * sizeof(char));
-    sprintf(buf,"SADD warnlist %d",id);
-    warnusers_redis_run_cmd(buf,buf);
+    static redisCommandTemplate *sadd;
+    redisReply *reply = purger_template_command(REDIS, &sadd, "SADD warnlist %d", id);
+    if(reply == NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Unable to SADD warnlist %d: %s", id, REDIS->errstr);
+        return;
+    }
+    if(reply->type == REDIS_REPLY_ERROR)
+        LOG(PURGER_LOG_DBG, "Failed SADD warnlist %d: %s", id, reply->str);
+    freeReplyObject(reply);
 }
 int
 warnusers_redis_run_cmd(char *cmd, char *filename)
 {
     LOG(PURGER_LOG_DBG, "RedisCmd = \"%s\"", cmd);
     redisReply *reply = redisCommand(REDIS, cmd);
+    if(reply == NULL)
+    {
+        LOG(PURGER_LOG_ERR, "Redis error: %s", REDIS->errstr);
+        return -1;
+    }
     if(reply->type != REDIS_REPLY_ERROR)
     {   
         LOG(PURGER_LOG_DBG, "Sent %s to redis", cmd);
@@ -121,10 +135,12 @@ warnusers_redis_run_cmd(char *cmd, char *filename)
         if (REDIS->err)
         {   
             LOG(PURGER_LOG_ERR, "Redis error: %s", REDIS->errstr);
+            freeReplyObject(reply);
             return -1; 
         }   
     
     }   
+    freeReplyObject(reply);
     return 0;
 }
 
@@ -132,48 +148,67 @@ warnusers_redis_run_cmd(char *cmd, char *filename)
 int
 warnusers_redis_run_scard(char * set)
 {
-    char * redis_cmd_buf = (char*)malloc(2048 * sizeof(char));
-    sprintf(redis_cmd_buf,"SCARD %s",set);
-    redisReply *getReply = redisCommand(REDIS,redis_cmd_buf);
-    if(getReply->type == REDIS_REPLY_NIL)
+    static redisCommandTemplate *scard;
+    int ret = -1;
+    redisReply *getReply = purger_template_command(REDIS, &scard,"SCARD %s",set);
+    if(getReply == NULL)
+    {
+        LOG(PURGER_LOG_ERR,"Unable to SCARD %s: %s",set,REDIS->errstr);
         return -1;
+    }
+    if(getReply->type == REDIS_REPLY_NIL)
+        ret = -1;
     else if (getReply->type == REDIS_REPLY_STRING)
     {
         LOG(PURGER_LOG_DBG,"GET returned a string \"%s\"\n",getReply->str);
-        return atoi(getReply->str);
+        ret = atoi(getReply->str);
     }
     else if(getReply->type == REDIS_REPLY_INTEGER)
     {
         LOG(PURGER_LOG_DBG,"GET returned an int: %lld.",getReply->integer);
-        return getReply->integer;
+        ret = getReply->integer;
     }
     else
         LOG(PURGER_LOG_DBG,"GET returned something else.");
-    return -1;
+    freeReplyObject(getReply);
+    return ret;
 }
 int 
 warnusers_redis_run_get(char * key)
 {
-    char * redis_cmd_buf = (char*)malloc(2048 * sizeof(char));
-    sprintf(redis_cmd_buf,"GET %s",key);
-    redisReply *getReply = redisCommand(REDIS,redis_cmd_buf);
-    if(getReply->type == REDIS_REPLY_NIL)
+    static redisCommandTemplate *get;
+    int ret = -1;
+    redisReply *getReply = purger_template_command(REDIS, &get,"GET %s",key);
+    if(getReply == NULL)
+    {
+        LOG(PURGER_LOG_ERR,"Unable to GET %s: %s",key,REDIS->errstr);
         return -1;
+    }
+    if(getReply->type == REDIS_REPLY_NIL)
+        ret = -1;
     else if (getReply->type == REDIS_REPLY_STRING)
     {
         LOG(PURGER_LOG_DBG,"GET returned a string \"%s\"\n",getReply->str);
-        return atoi(getReply->str);
+        ret = atoi(getReply->str);
     }
     else
         LOG(PURGER_LOG_DBG,"GET didn't return a string");
-    return -1;
+    freeReplyObject(getReply);
+    return ret;
 }
 int
 warnusers_redis_run_spop(char * uid)
 {
-   redisReply *spopReply = redisCommand(REDIS,"SPOP warnlist");
-   if(spopReply->type == REDIS_REPLY_NIL)
+   static redisCommandTemplate *spop;
+   int ret = 0;
+   redisReply *spopReply = purger_template_command(REDIS, &spop,"SPOP warnlist");
+   if(spopReply == NULL)
+   {
+       LOG(PURGER_LOG_ERR,"Unable to SPOP warnlist: %s",REDIS->errstr);
        return -1;
+   }
+   if(spopReply->type == REDIS_REPLY_NIL)
+       ret = -1;
    else if(spopReply->type == REDIS_REPLY_STRING)
    {
        LOG(PURGER_LOG_DBG,"SPOP returned a string %s",spopReply->str);
@@ -183,26 +218,33 @@ warnusers_redis_run_spop(char * uid)
    {
        LOG(PURGER_LOG_DBG,"SPOP did not return a string");
    }
-   return 0;
+   freeReplyObject(spopReply);
+   return ret;
 }
 
 int
 warnusers_redis_run_get_str(char * key, char * str)
 {
-    char * redis_cmd_buf = (char*)malloc(2048*sizeof(char));
-    sprintf(redis_cmd_buf, "GET %s",key);
-    redisReply *getReply = redisCommand(REDIS,redis_cmd_buf);
-    if(getReply->type == REDIS_REPLY_NIL)
+    static redisCommandTemplate *get;
+    int ret = -1;
+    redisReply *getReply = purger_template_command(REDIS, &get,"GET %s",key);
+    if(getReply == NULL)
+    {
+        LOG(PURGER_LOG_ERR,"Unable to GET %s: %s",key,REDIS->errstr);
         return -1;
+    }
+    if(getReply->type == REDIS_REPLY_NIL)
+        ret = -1;
     else if(getReply->type == REDIS_REPLY_STRING)
     {
         LOG(PURGER_LOG_DBG,"GET returned a string \"%s\"\n", getReply->str);
         strcpy(str,getReply->str);
-        return 0;
+        ret = 0;
     }
     else
         LOG(PURGER_LOG_DBG,"GET didn't return a string.");
-    return -1;
+    freeReplyObject(getReply);
+    return ret;
 }
 
 
@@ -344,12 +386,22 @@ main (int argc, char **argv)
     for (index = optind; index < argc; index++)
         LOG(PURGER_LOG_WARN, "Non-option argument %s", argv[index]);
 
-    REDIS = redisConnect(redis_hostname, redis_port);
+    REDIS = redis_endpoint_connect(redis_hostname, redis_port, 0);
+    if (REDIS == NULL)
+        exit(EXIT_FAILURE);
     if (REDIS->err)
     {
         LOG(PURGER_LOG_FATAL, "Redis error: %s", REDIS->errstr);
         exit(EXIT_FAILURE);
     }
+    /* Records are spread over the nodes of a cluster by key slot, and
+     * this one reads them from a single server. */
+    if(redis_endpoint_is_cluster(REDIS) == 1)
+    {
+        LOG(PURGER_LOG_FATAL, "warnusers does not support Redis Cluster yet. Point it at a single redis server.");
+        exit(EXIT_FAILURE);
+    }
+    redisReaderSetArena(REDIS->reader);
 
     time(&time_started);
         
@@ -0,0 +1,118 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cluster.h"
+
+START_TEST
+(test_cluster_keyslot)
+{
+    /* Values from the cluster specification and redis-cli. */
+    fail_unless(redis_cluster_keyslot("123456789", 9) == 0x31c3 % REDIS_CLUSTER_SLOTS);
+    fail_unless(redis_cluster_keyslot("foo", 3) == 12182);
+    fail_unless(redis_cluster_keyslot("", 0) == 0);
+
+    /* Only the hash tag counts, unless it is empty. */
+    fail_unless(redis_cluster_keyslot("{user1000}.following", 20) == redis_cluster_keyslot("user1000", 8));
+    fail_unless(redis_cluster_keyslot("foo{}{bar}", 10) == redis_cluster_keyslot("foo{}{bar}", 10));
+    fail_unless(redis_cluster_keyslot("foo{}{bar}", 10) != redis_cluster_keyslot("bar", 3));
+    fail_unless(redis_cluster_keyslot("foo{{bar}}zap", 13) == redis_cluster_keyslot("{bar", 4));
+}
+END_TEST
+
+START_TEST
+(test_cluster_command_key)
+{
+    const char *hmset = "*4\r\n$5\r\nHMSET\r\n$7\r\nfile:ab\r\n$5\r\nmtime\r\n$1\r\n5\r\n";
+    const char *key = NULL;
+    size_t keylen = 0;
+
+    fail_unless(redis_cluster_command_key(hmset, strlen(hmset), &key, &keylen) == 0);
+    fail_unless(keylen == 7 && memcmp(key, "file:ab", 7) == 0);
+
+    fail_unless(redis_cluster_command_key("*1\r\n$4\r\nPING\r\n", 14, &key, &keylen) < 0);
+    /* Cut off inside the key. */
+    fail_unless(redis_cluster_command_key(hmset, 20, &key, &keylen) < 0);
+}
+END_TEST
+
+START_TEST
+(test_cluster_redirect)
+{
+    char host[256];
+    int slot = 0;
+    int port = 0;
+    const char *moved = "MOVED 3999 127.0.0.1:6381";
+    const char *ask = "ASK 12182 ::1:7000";
+
+    fail_unless(redis_cluster_parse_redirect(moved, strlen(moved), &slot, host, sizeof(host), &port) == REDIS_CLUSTER_MOVED);
+    fail_unless(slot == 3999 && port == 6381 && strcmp(host, "127.0.0.1") == 0);
+
+    fail_unless(redis_cluster_parse_redirect(ask, strlen(ask), &slot, host, sizeof(host), &port) == REDIS_CLUSTER_ASK);
+    fail_unless(slot == 12182 && port == 7000 && strcmp(host, "::1") == 0);
+
+    fail_unless(redis_cluster_parse_redirect("ERR wrong type", 14, &slot, host, sizeof(host), &port) == REDIS_CLUSTER_NO_REDIRECT);
+    fail_unless(redis_cluster_parse_redirect("MOVED 99999 h:1", 15, &slot, host, sizeof(host), &port) == REDIS_CLUSTER_NO_REDIRECT);
+    fail_unless(redis_cluster_parse_redirect("MOVED 1 h:x", 11, &slot, host, sizeof(host), &port) == REDIS_CLUSTER_NO_REDIRECT);
+}
+END_TEST
+
+START_TEST
+(test_cluster_slots)
+{
+    redisReader *reader = redisReaderCreate();
+    redis_cluster_range_t *ranges = NULL;
+    void *reply = NULL;
+    const char *slots =
+        "*2\r\n"
+        "*3\r\n:0\r\n:8191\r\n*3\r\n$8\r\n10.0.0.1\r\n:7000\r\n$2\r\nid\r\n"
+        "*4\r\n:8192\r\n:16383\r\n*2\r\n$0\r\n\r\n:7001\r\n*2\r\n$8\r\n10.0.0.9\r\n:7002\r\n";
+
+    redisReaderFeed(reader, slots, strlen(slots));
+    fail_unless(redisReaderGetReply(reader, &reply) == REDIS_OK && reply != NULL);
+
+    fail_unless(redis_cluster_parse_slots((redisReply *)reply, &ranges) == 2);
+    fail_unless(ranges[0].start == 0 && ranges[0].end == 8191);
+    fail_unless(ranges[0].port == 7000 && strcmp(ranges[0].host, "10.0.0.1") == 0);
+    fail_unless(ranges[1].start == 8192 && ranges[1].end == 16383);
+    fail_unless(ranges[1].port == 7001 && ranges[1].host[0] == '\0');
+
+    free(ranges);
+    freeReplyObject(reply);
+    redisReaderFree(reader);
+
+    fail_unless(redis_cluster_parse_slots(NULL, &ranges) < 0);
+}
+END_TEST
+
+Suite *
+check_cluster_suite (void)
+{
+    Suite *s = suite_create("check_cluster");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_cluster_keyslot);
+    tcase_add_test(tc_core, test_cluster_command_key);
+    tcase_add_test(tc_core, test_cluster_redirect);
+    tcase_add_test(tc_core, test_cluster_slots);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+
+    Suite *s = check_cluster_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */
@@ -0,0 +1,227 @@
+#!/bin/sh
+#
+# treewalk -c against a real Redis Cluster on this machine.
+#
+# Starts NODES redis-server processes with cluster support, joins them
+# with redis-cli --cluster create, and walks a tree of FILES expired
+# files with RANKS treewalk processes. While the walk runs, slots keep
+# being migrated from one master to the next, the slot of the mtime zset
+# among them, so commands come back with MOVED and ASK. Afterwards every
+# file has to have its record, its member in the mtime zset, and its
+# owner in the warnlist, and treewalk has to have followed redirects.
+#
+# Run it from the top of a built tree:
+#
+#     tests/check_cluster_live.sh
+#
+# or with "make check", which skips it (exit 77) when redis-server,
+# redis-cli or mpirun are missing. The environment can override
+#
+#     TREEWALK   treewalk binary, src/treewalk/treewalk by default
+#     MPIRUN     e.g. "mpirun --allow-run-as-root"
+#     BASE_PORT  first node port, the others follow (30001)
+#     NODES      masters, at least 3 (3)
+#     FILES      files to walk (40000)
+#     RANKS      treewalk processes (4)
+#     KEEP       set to keep the scratch directory and the server logs
+#
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+TREEWALK=${TREEWALK:-$top/src/treewalk/treewalk}
+MPIRUN=${MPIRUN:-mpirun}
+BASE_PORT=${BASE_PORT:-30001}
+NODES=${NODES:-3}
+FILES=${FILES:-40000}
+RANKS=${RANKS:-4}
+# How long a slot stays half migrated, when missing keys answer ASK.
+ASK_HOLD=${ASK_HOLD:-0.2}
+
+for tool in redis-server redis-cli; do
+    if ! command -v $tool >/dev/null 2>&1; then
+        echo "$tool not found, skipping."
+        exit 77
+    fi
+done
+if ! command -v ${MPIRUN%% *} >/dev/null 2>&1 || [ ! -x "$TREEWALK" ]; then
+    echo "No ${MPIRUN%% *} or no treewalk at $TREEWALK, skipping."
+    exit 77
+fi
+if [ "$NODES" -lt 3 ]; then
+    echo "A cluster needs at least 3 masters."
+    exit 1
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/purger-cluster.XXXXXX")
+work=$(cd "$work" && pwd -P)
+ports=$(seq $BASE_PORT $((BASE_PORT + NODES - 1)))
+mover=
+
+cli() {
+    redis-cli "$@"
+}
+
+cleanup() {
+    if [ -n "$mover" ]; then
+        touch "$work/stop"
+        wait $mover 2>/dev/null
+    fi
+    for port in $ports; do
+        cli -p $port shutdown nosave >/dev/null 2>&1
+    done
+    if [ -z "$KEEP" ]; then
+        rm -rf "$work"
+    else
+        echo "Kept $work"
+    fi
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+#
+# The cluster.
+#
+for port in $ports; do
+    mkdir -p "$work/node-$port"
+    redis-server --port $port --bind 127.0.0.1 --cluster-enabled yes \
+        --cluster-config-file nodes.conf --cluster-node-timeout 5000 \
+        --dir "$work/node-$port" --logfile "$work/node-$port/log" \
+        --save "" --appendonly no --daemonize yes || fail "redis-server on $port did not start"
+done
+for port in $ports; do
+    tries=0
+    until cli -p $port ping >/dev/null 2>&1; do
+        tries=$((tries + 1))
+        [ $tries -gt 50 ] && fail "redis-server on $port does not answer"
+        sleep 0.1
+    done
+done
+
+cli --cluster create $(for port in $ports; do printf '127.0.0.1:%s ' $port; done) \
+    --cluster-replicas 0 --cluster-yes >"$work/create.log" 2>&1 || fail "cluster create, see $work/create.log"
+for port in $ports; do
+    tries=0
+    until cli -p $port cluster info | grep -q "cluster_state:ok"; do
+        tries=$((tries + 1))
+        [ $tries -gt 100 ] && fail "node $port never saw the cluster come up"
+        sleep 0.1
+    done
+done
+
+node_id() {
+    cli -p $1 cluster nodes | awk '/myself/ { print $1 }'
+}
+
+# The port of the master serving slot $1.
+slot_owner() {
+    cli -p $BASE_PORT cluster nodes | awk -v slot=$1 '
+        $3 ~ /master/ {
+            for(i = 9; i <= NF; i++)
+            {
+                if($i ~ /^\[/)
+                    continue
+                n = split($i, range, "-")
+                if(slot >= range[1] && slot <= range[n])
+                {
+                    split($2, address, "[:@]")
+                    print address[2]
+                }
+            }
+        }'
+}
+
+# Move slot $1 and its keys to the next master, the way redis-cli
+# --cluster reshard does, only holding it half moved for ASK_HOLD.
+move_slot() {
+    s=$1
+    src=$(slot_owner $s)
+    [ -n "$src" ] || return 1
+    dst=$((BASE_PORT + (src - BASE_PORT + 1) % NODES))
+    src_id=$(node_id $src)
+    dst_id=$(node_id $dst)
+
+    cli -p $dst cluster setslot $s importing $src_id >/dev/null || return 1
+    cli -p $src cluster setslot $s migrating $dst_id >/dev/null || return 1
+    while keys=$(cli -p $src cluster getkeysinslot $s 100) && [ -n "$keys" ]; do
+        cli -p $src migrate 127.0.0.1 $dst "" 0 10000 keys $keys >/dev/null || return 1
+    done
+    sleep $ASK_HOLD
+    for port in $dst $src $ports; do
+        cli -p $port cluster setslot $s node $dst_id >/dev/null
+    done
+    return 0
+}
+
+#
+# The tree: FILES files in 100 directories, all of them a year old.
+#
+mkdir "$work/tree"
+tree=$(cd "$work/tree" && pwd -P)
+seq 0 99 | sed "s|^|$tree/d|" | xargs mkdir
+seq 0 $((FILES - 1)) | awk -v t="$tree" '{ printf "%s/d%d/f%d\n", t, $1 % 100, $1 }' |
+    xargs touch -d "1 year ago" || fail "unable to make the tree"
+
+#
+# The walk, with slots moving under it. Records are keyed by inode (-i)
+# so the keys print one per line.
+#
+mtime_slot=$(cli -p $BASE_PORT cluster keyslot mtime)
+(
+    slot=0
+    while [ ! -e "$work/stop" ]; do
+        move_slot $mtime_slot || echo "Unable to move slot $mtime_slot"
+        for i in 1 2 3 4 5 6 7 8; do
+            [ $slot -eq $mtime_slot ] && slot=$((slot + 1))
+            move_slot $slot || echo "Unable to move slot $slot"
+            slot=$(((slot + 97) % 16384))
+        done
+    done
+) >"$work/mover.log" 2>&1 &
+mover=$!
+
+$MPIRUN -np $RANKS "$TREEWALK" -c -h 127.0.0.1 -p $BASE_PORT -i -f -t 1 -l 4 -d "$tree" \
+    >"$work/treewalk.log" 2>&1
+status=$?
+
+touch "$work/stop"
+wait $mover
+mover=
+[ -s "$work/mover.log" ] && cat "$work/mover.log"
+[ $status -eq 0 ] || { tail -n 20 "$work/treewalk.log"; fail "treewalk exited with $status"; }
+
+#
+# Everything has to be there.
+#
+find "$tree" -type f | sort >"$work/expected.names"
+: >"$work/keys"
+: >"$work/names"
+for port in $ports; do
+    cli -p $port --scan --pattern 'file:*' >"$work/keys.$port"
+    cat "$work/keys.$port" >>"$work/keys"
+    awk '{ print "HGET", $1, "name" }' "$work/keys.$port" | cli -p $port >>"$work/names"
+done
+sort -o "$work/keys" "$work/keys"
+sort -o "$work/names" "$work/names"
+
+records=$(wc -l <"$work/keys")
+[ $records -eq $FILES ] || fail "$records records for $FILES files"
+[ $(uniq "$work/keys" | wc -l) -eq $FILES ] || fail "a record is on more than one master"
+cmp -s "$work/names" "$work/expected.names" || fail "record names differ from the tree, see $work/names"
+
+cli -c -p $BASE_PORT zrange mtime 0 -1 | sort >"$work/members"
+cmp -s "$work/members" "$work/keys" ||
+    fail "$(wc -l <"$work/members") members in the mtime zset for $FILES records"
+
+[ "$(cli -c -p $BASE_PORT smembers warnlist)" = "$(id -u)" ] || fail "the warnlist is not just $(id -u)"
+
+redirects=$(awk '/Followed [0-9]+ MOVED and [0-9]+ ASK redirects/ {
+                     for(i = 1; i < NF; i++) if($(i + 1) == "MOVED" || $(i + 1) == "ASK") sum += $i
+                 } END { print sum + 0 }' "$work/treewalk.log")
+[ $redirects -gt 0 ] || fail "no redirects were followed, the walk ended before a slot moved; raise FILES"
+
+echo "PASS: $FILES records and zset members on $NODES masters, $redirects redirects followed."
+exit 0
@@ -0,0 +1,239 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <mpi.h>
+#include "combine.h"
+#include "log.h"
+
+int PURGER_global_rank;
+FILE *PURGER_debug_stream;
+PURGER_loglevel PURGER_debug_level = PURGER_LOG_FATAL;
+
+/* What treewalk.c provides: where commands go and how many connections. */
+int (*redis_formatted_command_ptr)(int rank, const char * cmd, size_t len);
+int sharded_count;
+
+/* The commands combine.c sent, in order. */
+static char sent[16][4096];
+static size_t sent_len[16];
+static int sent_rank[16];
+static int sent_count;
+
+static int
+capture(int rank, const char *cmd, size_t len)
+{
+    if(sent_count < 16 && len < sizeof(sent[0]))
+    {
+        memcpy(sent[sent_count], cmd, len);
+        sent[sent_count][len] = '\0';
+        sent_len[sent_count] = len;
+        sent_rank[sent_count] = rank;
+    }
+    sent_count++;
+    return 0;
+}
+
+static void
+setup(int connections)
+{
+    memset(sent, 0, sizeof(sent));
+    sent_count = 0;
+    sharded_count = connections;
+    redis_formatted_command_ptr = &capture;
+}
+
+static void
+expire(long mtime, unsigned uid, const char *key, int crc)
+{
+    struct stat st;
+
+    memset(&st, 0, sizeof(st));
+    st.st_mtime = mtime;
+    st.st_uid = uid;
+    treewalk_combine_expired(&st, (char *)key, strlen(key), crc);
+}
+
+START_TEST
+(test_combine_member_flush)
+{
+    const char *expect = "*6\r\n$4\r\nZADD\r\n$5\r\nmtime\r\n"
+                         "$3\r\n100\r\n$6\r\nfile:a\r\n$3\r\n200\r\n$6\r\nfile:b\r\n";
+
+    setup(2);
+    fail_unless(treewalk_combine_init(2, 0.0) == 0);
+
+    /* Each connection fills up on its own. */
+    expire(100, 1, "file:a", 1);
+    expire(300, 1, "file:c", 0);
+    fail_unless(sent_count == 0);
+
+    expire(200, 1, "file:b", 1);
+    fail_unless(sent_count == 1);
+    fail_unless(sent_rank[0] == 1);
+    fail_unless(sent_len[0] == strlen(expect));
+    fail_unless(strcmp(sent[0], expect) == 0, "sent %s", sent[0]);
+
+    /* The end of the run sends the partial ZADD of connection 0. */
+    fail_unless(treewalk_combine_finish() == 0);
+    fail_unless(sent_count >= 2);
+    fail_unless(sent_rank[1] == 0);
+    fail_unless(strcmp(sent[1], "*4\r\n$4\r\nZADD\r\n$5\r\nmtime\r\n$3\r\n300\r\n$6\r\nfile:c\r\n") == 0,
+                "sent %s", sent[1]);
+}
+END_TEST
+
+START_TEST
+(test_combine_time_flush)
+{
+    setup(1);
+    fail_unless(treewalk_combine_init(100, 10.0) == 0);
+
+    expire(100, 1, "file:a", 0);
+    treewalk_combine_tick(10.5);
+    fail_unless(sent_count == 0);
+
+    /* A member that waited TREEWALK_COMBINE_INTERVAL goes out alone. */
+    treewalk_combine_tick(10.0 + TREEWALK_COMBINE_INTERVAL);
+    fail_unless(sent_count == 1);
+    fail_unless(strcmp(sent[0], "*4\r\n$4\r\nZADD\r\n$5\r\nmtime\r\n$3\r\n100\r\n$6\r\nfile:a\r\n") == 0,
+                "sent %s", sent[0]);
+
+    /* The interval starts again, and nothing empty is ever sent. */
+    expire(200, 1, "file:b", 0);
+    treewalk_combine_tick(10.5 + TREEWALK_COMBINE_INTERVAL);
+    fail_unless(sent_count == 1);
+    treewalk_combine_tick(10.0 + 2 * TREEWALK_COMBINE_INTERVAL);
+    fail_unless(sent_count == 2);
+    treewalk_combine_tick(10.0 + 4 * TREEWALK_COMBINE_INTERVAL);
+    fail_unless(sent_count == 2);
+
+    /* Only the warnlist is left for the end of the run. */
+    fail_unless(treewalk_combine_finish() == 0);
+    fail_unless(sent_count == 3);
+    fail_unless(strcmp(sent[2], "*3\r\n$4\r\nSADD\r\n$8\r\nwarnlist\r\n$1\r\n1\r\n") == 0,
+                "sent %s", sent[2]);
+}
+END_TEST
+
+START_TEST
+(test_uid_set_add)
+{
+    treewalk_uid_set_t set;
+    size_t i = 0;
+    size_t found = 0;
+    uint32_t uid = 0;
+
+    memset(&set, 0, sizeof(set));
+
+    /* Root is stored as 1, an empty slot is 0. */
+    fail_unless(treewalk_uid_set_add(&set, 0) == 1);
+    fail_unless(set.size == TREEWALK_COMBINE_UIDS);
+    fail_unless(set.count == 1);
+    for(i = 0; i < set.size; i++)
+        if(set.slots[i] != 0)
+            fail_unless(set.slots[i] == 1);
+    fail_unless(treewalk_uid_set_add(&set, 0) == 0);
+    fail_unless(set.count == 1);
+
+    /* Up to half full it keeps its size, one more doubles it. */
+    for(uid = 1; uid < TREEWALK_COMBINE_UIDS / 2; uid++)
+        fail_unless(treewalk_uid_set_add(&set, uid * 7919) == 1);
+    fail_unless(set.count == TREEWALK_COMBINE_UIDS / 2);
+    fail_unless(set.size == TREEWALK_COMBINE_UIDS);
+    fail_unless(treewalk_uid_set_add(&set, 7919) == 0);
+    fail_unless(treewalk_uid_set_add(&set, 0xffffffffu) == 1);
+    fail_unless(set.size == 2 * TREEWALK_COMBINE_UIDS);
+    fail_unless(set.count == TREEWALK_COMBINE_UIDS / 2 + 1);
+
+    /* Everything made it through the rehash, once. */
+    for(uid = 0; uid < TREEWALK_COMBINE_UIDS / 2; uid++)
+        fail_unless(treewalk_uid_set_add(&set, uid * 7919) == 0);
+    fail_unless(treewalk_uid_set_add(&set, 0xffffffffu) == 0);
+    for(i = 0; i < set.size; i++)
+        if(set.slots[i] != 0)
+            found++;
+    fail_unless(found == set.count);
+
+    free(set.slots);
+}
+END_TEST
+
+START_TEST
+(test_combine_warnlist_once)
+{
+    int members[2] = { 0, 0 };
+    int i = 0;
+
+    setup(2);
+    fail_unless(treewalk_combine_init(100, 0.0) == 0);
+
+    /* Many files of a few owners, root among them. */
+    for(i = 0; i < 50; i++)
+        expire(100, (unsigned)(i % 3) * 5, "file:a", 0);
+    for(i = 0; i < 5; i++)
+    {
+        struct stat st;
+
+        memset(&st, 0, sizeof(st));
+        st.st_uid = 10;
+        fail_unless(treewalk_combine_owner(&st) == 0);
+    }
+
+    fail_unless(treewalk_combine_finish() == 0);
+
+    /* The ZADD, then one SADD per connection, uid % connections. */
+    fail_unless(sent_count == 3);
+    for(i = 1; i < 3; i++)
+    {
+        fail_unless(strncmp(sent[i], "*", 1) == 0);
+        fail_unless(strstr(sent[i], "$4\r\nSADD\r\n$8\r\nwarnlist\r\n") != NULL);
+        members[sent_rank[i]] = atoi(sent[i] + 1) - 2;
+    }
+    /* 0 and 10 on connection 0, 5 on connection 1. */
+    fail_unless(members[0] == 2 && members[1] == 1);
+    fail_unless(strstr(sent[1], "\r\n$1\r\n0\r\n") != NULL || strstr(sent[2], "\r\n$1\r\n0\r\n") != NULL);
+    fail_unless(strstr(sent[1], "\r\n$2\r\n10\r\n") != NULL || strstr(sent[2], "\r\n$2\r\n10\r\n") != NULL);
+    fail_unless(strstr(sent[1], "\r\n$1\r\n5\r\n") != NULL || strstr(sent[2], "\r\n$1\r\n5\r\n") != NULL);
+}
+END_TEST
+
+Suite *
+check_combine_suite (void)
+{
+    Suite *s = suite_create("check_combine");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_combine_member_flush);
+    tcase_add_test(tc_core, test_combine_time_flush);
+    tcase_add_test(tc_core, test_uid_set_add);
+    tcase_add_test(tc_core, test_combine_warnlist_once);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (int argc, char **argv)
+{
+    int number_failed;
+
+    MPI_Init(&argc, &argv);
+    PURGER_debug_stream = stderr;
+
+    Suite *s = check_combine_suite();
+    SRunner *sr = srunner_create(s);
+
+    /* combine.c runs the MPI union at the end, keep it in this process. */
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    MPI_Finalize();
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */
@@ -0,0 +1,108 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dirtable.h"
+
+START_TEST
+(test_dirtable_ref)
+{
+    char ref[64];
+    char id[PURGER_DIR_ID_LEN + 1];
+    const char *path = "/scratch/user/a file";
+    const char *base = NULL;
+    size_t base_len = 0;
+    uint64_t parsed = 0;
+    int len = 0;
+
+    len = purger_dir_ref(path, strlen(path), ref, sizeof(ref));
+    fail_unless(len == PURGER_DIR_ID_LEN + 1 + 6);
+    fail_unless(strcmp(ref + PURGER_DIR_ID_LEN, "/a file") == 0);
+
+    /* The id is the one process_dir() stores the directory under. */
+    sprintf(id, "%016llx", (unsigned long long)purger_dir_id("/scratch/user", 13));
+    fail_unless(strncmp(ref, id, PURGER_DIR_ID_LEN) == 0);
+
+    fail_unless(purger_dir_ref_parse(ref, len, &parsed, &base, &base_len) == 0);
+    fail_unless(parsed == purger_dir_id("/scratch/user", 13));
+    fail_unless(base_len == 6 && memcmp(base, "a file", 6) == 0);
+
+    /* Files right under the root, however treewalk spelled them. */
+    fail_unless(purger_dir_ref("//x", 3, ref, sizeof(ref)) > 0);
+    fail_unless(strncmp(ref, "/x", 2) != 0);
+    sprintf(id, "%016llx", (unsigned long long)purger_dir_id("/", 1));
+    fail_unless(strncmp(ref, id, PURGER_DIR_ID_LEN) == 0);
+    fail_unless(purger_dir_ref("/x", 2, ref, sizeof(ref)) > 0);
+    fail_unless(strncmp(ref, id, PURGER_DIR_ID_LEN) == 0);
+
+    fail_unless(purger_dir_ref("nodir", 5, ref, sizeof(ref)) < 0);
+    fail_unless(purger_dir_ref(path, strlen(path), ref, PURGER_DIR_ID_LEN + 7) < 0);
+
+    /* Full paths are not references. */
+    fail_unless(purger_dir_ref_parse(path, strlen(path), &parsed, &base, &base_len) < 0);
+    fail_unless(purger_dir_ref_parse("0123456789abcdeg/x", 18, &parsed, &base, &base_len) < 0);
+}
+END_TEST
+
+START_TEST
+(test_dirtable_cache)
+{
+    purger_dir_cache_t c;
+    char dir[32];
+    uint64_t i = 0;
+
+    memset(&c, 0, sizeof(c));
+    fail_unless(purger_dir_cache_get(&c, 42) == NULL);
+
+    for(i = 0; i < 5000; i++)
+    {
+        sprintf(dir, "/d/%llu", (unsigned long long)i);
+        fail_unless(purger_dir_cache_put(&c, i * 1024, dir, strlen(dir)) == 0);
+    }
+    fail_unless(c.count == 5000);
+    for(i = 0; i < 5000; i++)
+    {
+        sprintf(dir, "/d/%llu", (unsigned long long)i);
+        fail_unless(purger_dir_cache_get(&c, i * 1024) != NULL);
+        fail_unless(strcmp(purger_dir_cache_get(&c, i * 1024), dir) == 0);
+    }
+    fail_unless(purger_dir_cache_get(&c, 1) == NULL);
+
+    /* Replacing keeps the count. */
+    fail_unless(purger_dir_cache_put(&c, 0, "/other", 6) == 0);
+    fail_unless(c.count == 5000 && strcmp(purger_dir_cache_get(&c, 0), "/other") == 0);
+
+    purger_dir_cache_free(&c);
+    fail_unless(c.size == 0 && purger_dir_cache_get(&c, 0) == NULL);
+}
+END_TEST
+
+Suite *
+check_dirtable_suite (void)
+{
+    Suite *s = suite_create("check_dirtable");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_dirtable_ref);
+    tcase_add_test(tc_core, test_dirtable_cache);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+
+    Suite *s = check_dirtable_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */
@@ -0,0 +1,154 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "endpoint.h"
+#include "log.h"
+
+int PURGER_global_rank;
+FILE *PURGER_debug_stream;
+PURGER_loglevel PURGER_debug_level;
+
+START_TEST
+(test_endpoint_tcp)
+{
+    redis_endpoint_t ep;
+
+    fail_unless(redis_endpoint_parse("redis1", 6379, &ep) == 0);
+    fail_unless(!ep.unix_socket && ep.port == 6379 && strcmp(ep.address, "redis1") == 0);
+
+    fail_unless(redis_endpoint_parse("10.0.0.5:7001", 6379, &ep) == 0);
+    fail_unless(!ep.unix_socket && ep.port == 7001 && strcmp(ep.address, "10.0.0.5") == 0);
+
+    /* Not a port, so the whole thing is the host. */
+    fail_unless(redis_endpoint_parse("::1", 6379, &ep) == 0);
+    fail_unless(!ep.unix_socket && ep.port == 6379 && strcmp(ep.address, "::1") == 0);
+    fail_unless(redis_endpoint_parse("host:http", 6379, &ep) == 0);
+    fail_unless(ep.port == 6379 && strcmp(ep.address, "host:http") == 0);
+}
+END_TEST
+
+START_TEST
+(test_endpoint_unix)
+{
+    redis_endpoint_t ep;
+    char long_path[300];
+
+    fail_unless(redis_endpoint_parse("/tmp/redis.sock", 6379, &ep) == 0);
+    fail_unless(ep.unix_socket && strcmp(ep.address, "/tmp/redis.sock") == 0);
+
+    fail_unless(redis_endpoint_parse("unix:run/redis.sock", 6379, &ep) == 0);
+    fail_unless(ep.unix_socket && strcmp(ep.address, "run/redis.sock") == 0);
+
+    fail_unless(redis_endpoint_parse("unix:", 6379, &ep) < 0);
+    fail_unless(redis_endpoint_parse("", 6379, &ep) < 0);
+
+    memset(long_path, 'a', sizeof(long_path));
+    long_path[0] = '/';
+    long_path[sizeof(long_path) - 1] = '\0';
+    fail_unless(redis_endpoint_parse(long_path, 6379, &ep) < 0);
+}
+END_TEST
+
+/* Answers the one command of one connection with "reply". */
+typedef struct
+{
+    int listen_fd;
+    int port;
+    const char *reply;
+    pthread_t thread;
+} fake_server_t;
+
+static void *
+fake_server_main(void *arg)
+{
+    fake_server_t *s = (fake_server_t *)arg;
+    int fd = accept(s->listen_fd, NULL, NULL);
+    char request[256];
+
+    if(read(fd, request, sizeof(request)) > 0 && write(fd, s->reply, strlen(s->reply)) < 0)
+        perror("write");
+    close(fd);
+    close(s->listen_fd);
+    return NULL;
+}
+
+static int
+is_cluster(const char *reply)
+{
+    fake_server_t s;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    redisContext *c = NULL;
+    int cluster = 0;
+
+    memset(&s, 0, sizeof(s));
+    s.reply = reply;
+    s.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(s.listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    listen(s.listen_fd, 1);
+    getsockname(s.listen_fd, (struct sockaddr *)&addr, &len);
+    s.port = ntohs(addr.sin_port);
+    pthread_create(&s.thread, NULL, fake_server_main, &s);
+
+    c = redis_endpoint_connect("127.0.0.1", s.port, 0);
+    if(c == NULL || c->err)
+        return -2;
+    cluster = redis_endpoint_is_cluster(c);
+    redisFree(c);
+    pthread_join(s.thread, NULL);
+    return cluster;
+}
+
+START_TEST
+(test_endpoint_is_cluster)
+{
+    const char *node = "$42\r\n# Cluster\r\ncluster_enabled:1\r\nmore:stuff\r\n\r\n";
+    const char *plain = "$30\r\n# Cluster\r\ncluster_enabled:0\r\n\r\n";
+
+    fail_unless(is_cluster(node) == 1);
+    fail_unless(is_cluster(plain) == 0);
+    /* An old server without the section says nothing either way. */
+    fail_unless(is_cluster("$0\r\n\r\n") == 0);
+    fail_unless(is_cluster("-ERR unknown command\r\n") == -1);
+}
+END_TEST
+
+Suite *
+check_endpoint_suite (void)
+{
+    Suite *s = suite_create("check_endpoint");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_endpoint_tcp);
+    tcase_add_test(tc_core, test_endpoint_unix);
+    tcase_add_test(tc_core, test_endpoint_is_cluster);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+
+    Suite *s = check_endpoint_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */
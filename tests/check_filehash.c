@@ -1,5 +1,7 @@
 #include <check.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "hash.h"
 
 START_TEST
@@ -9,6 +11,146 @@ START_TEST
 }
 END_TEST
 
+START_TEST
+(test_filehash_prefixed_matches_full)
+{
+    char *paths[] = {
+        "/scratch/user/run/output.0",
+        "/scratch/user/run/output.1",
+        "/scratch/user/other",
+        "/scratch/user/run/output.2",
+        "/top",
+        "no_slash"
+    };
+    unsigned char full[65];
+    unsigned char prefixed[65];
+    treewalk_hash_prefix_t prefix;
+    size_t i;
+
+    memset(&prefix, 0, sizeof(prefix));
+
+    for(i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+    {
+        treewalk_filename_hash(paths[i], full);
+        treewalk_filename_hash_prefixed(&prefix, paths[i], prefixed);
+        fail_unless(strcmp((char *)full, (char *)prefixed) == 0,
+                    "prefixed hash differs for %s", paths[i]);
+    }
+}
+END_TEST
+
+START_TEST
+(test_filehash_prefix_primed_by_dir)
+{
+    unsigned char full[65];
+    unsigned char prefixed[65];
+    treewalk_hash_prefix_t prefix;
+
+    treewalk_hash_prefix_set(&prefix, "/scratch/dir/", strlen("/scratch/dir/"));
+
+    treewalk_filename_hash("/scratch/dir/file", full);
+    treewalk_filename_hash_prefixed(&prefix, "/scratch/dir/file", prefixed);
+    fail_unless(strcmp((char *)full, (char *)prefixed) == 0);
+    fail_unless(strlen((char *)prefixed) == 64);
+}
+END_TEST
+
+START_TEST
+(test_filehash_batch_matches_single)
+{
+    /* Lengths around the 55/56/64 byte padding edges and several blocks. */
+    static const int lengths[] = { 0, 1, 54, 55, 56, 57, 63, 64, 65, 119, 120, 128, 300, 1000 };
+    static char buf[24][1024];
+    static unsigned char batch[24][65];
+    unsigned char single[65];
+    char *paths[24];
+    int i = 0;
+    int j = 0;
+
+    /* Exercise the AVX2 lanes even on CPUs that would pick SHA-NI. */
+    treewalk_hash_force_lanes = 1;
+
+    for(i = 0; i < 24; i++)
+    {
+        int len = lengths[i % (sizeof(lengths) / sizeof(lengths[0]))] + (i / 14);
+
+        for(j = 0; j < len; j++)
+            buf[i][j] = (j % 10 == 0) ? '/' : (char)('a' + (i * 7 + j) % 26);
+        buf[i][len] = '\0';
+        paths[i] = buf[i];
+    }
+
+    /* 24 is three full lanes; 21 leaves a partial group for the fallback. */
+    fail_unless(treewalk_filename_hash_batch(paths, 24, batch) == 24);
+    for(i = 0; i < 24; i++)
+    {
+        treewalk_filename_hash(paths[i], single);
+        fail_unless(strcmp((char *)single, (char *)batch[i]) == 0,
+                    "batch hash differs for length %zu", strlen(paths[i]));
+    }
+
+    memset(batch, 0, sizeof(batch));
+    fail_unless(treewalk_filename_hash_batch(paths + 3, 21, batch) == 21);
+    for(i = 0; i < 21; i++)
+    {
+        treewalk_filename_hash(paths[i + 3], single);
+        fail_unless(strcmp((char *)single, (char *)batch[i]) == 0);
+    }
+
+    treewalk_hash_force_lanes = 0;
+}
+END_TEST
+
+START_TEST
+(test_filehash_batch_prefixed_matches_single)
+{
+    /* Directory lengths either side of the 64 byte block edges. */
+    static const int dir_lengths[] = { 1, 10, 55, 63, 64, 65, 127, 128, 200 };
+    static char buf[24][512];
+    static unsigned char batch[24][65];
+    unsigned char single[65];
+    treewalk_hash_prefix_t prefix;
+    char *paths[24];
+    int i = 0;
+    int j = 0;
+
+    treewalk_hash_force_lanes = 1;
+    memset(&prefix, 0, sizeof(prefix));
+
+    for(i = 0; i < 24; i++)
+    {
+        /* Runs of three siblings, then a change of directory. */
+        int dir = dir_lengths[(i / 3) % (sizeof(dir_lengths) / sizeof(dir_lengths[0]))];
+
+        for(j = 0; j < dir - 1; j++)
+            buf[i][j] = (j % 10 == 0) ? '/' : (char)('a' + (dir + j) % 26);
+        buf[i][dir - 1] = '/';
+        sprintf(buf[i] + dir, "file.%d%s", i, (i % 2) ? "" : "-with-a-longer-name-than-its-neighbour");
+        paths[i] = buf[i];
+    }
+    paths[5] = "no_slash";
+
+    fail_unless(treewalk_filename_hash_batch_prefixed(&prefix, paths, 24, batch) == 24);
+    for(i = 0; i < 24; i++)
+    {
+        treewalk_filename_hash(paths[i], single);
+        fail_unless(strcmp((char *)single, (char *)batch[i]) == 0,
+                    "prefixed batch hash differs for %s", paths[i]);
+    }
+
+    /* Again with the prefix still holding the last directory. */
+    memset(batch, 0, sizeof(batch));
+    fail_unless(treewalk_filename_hash_batch_prefixed(&prefix, paths + 16, 8, batch) == 8);
+    for(i = 0; i < 8; i++)
+    {
+        treewalk_filename_hash(paths[i + 16], single);
+        fail_unless(strcmp((char *)single, (char *)batch[i]) == 0);
+    }
+
+    treewalk_hash_force_lanes = 0;
+}
+END_TEST
+
 Suite *
 check_filehash_suite (void)
 {
@@ -16,6 +158,10 @@ check_filehash_suite (void)
     TCase *tc_core = tcase_create("Core");
 
     tcase_add_test(tc_core, test_filehash_simple_input);
+    tcase_add_test(tc_core, test_filehash_prefixed_matches_full);
+    tcase_add_test(tc_core, test_filehash_prefix_primed_by_dir);
+    tcase_add_test(tc_core, test_filehash_batch_matches_single);
+    tcase_add_test(tc_core, test_filehash_batch_prefixed_matches_single);
 
     suite_add_tcase(s, tc_core);
 
@@ -0,0 +1,297 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "redis.h"
+
+int PURGER_global_rank;
+FILE *PURGER_debug_stream;
+PURGER_loglevel PURGER_debug_level = PURGER_LOG_ERR;
+
+/* Commands the test sends: ECHO <n>, numbered from 0. */
+#define PIPE_COMMANDS 5000
+/* The first connection answers this many and reads a few more. */
+#define PIPE_ANSWERED 3000
+#define PIPE_UNANSWERED 32
+#define PIPE_PRELUDE -1
+
+/*
+ * A fake redis server in a thread. The first connection answers
+ * PIPE_ANSWERED commands, reads PIPE_UNANSWERED more without answering
+ * and then closes its side. A second connection, if "reconnect" lets
+ * one through, answers everything. It records the number of every
+ * command on each connection, and PIPE_PRELUDE for a PING.
+ */
+typedef struct
+{
+    int listen_fd;
+    int port;
+    int reconnect;
+    long seen[2][PIPE_COMMANDS + 16];
+    int count[2];
+    pthread_t thread;
+} fake_server_t;
+
+static int
+read_line(int fd, char *buf, size_t size)
+{
+    size_t len = 0;
+
+    while(len + 1 < size)
+    {
+        if(read(fd, buf + len, 1) != 1)
+            return -1;
+        if(buf[len++] == '\n')
+            break;
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+/* Read one command and return its number, PIPE_PRELUDE, or -2 at EOF. */
+static long
+read_command(int fd)
+{
+    char line[64];
+    char arg[2][64];
+    long argc = 0;
+    long i = 0;
+
+    if(read_line(fd, line, sizeof(line)) < 0 || line[0] != '*')
+        return -2;
+    argc = atol(line + 1);
+    for(i = 0; i < argc; i++)
+    {
+        if(read_line(fd, line, sizeof(line)) < 0 || read_line(fd, arg[i < 2 ? i : 1], sizeof(arg[0])) < 0)
+            return -2;
+    }
+    if(strncmp(arg[0], "PING", 4) == 0)
+        return PIPE_PRELUDE;
+    return atol(arg[1]);
+}
+
+static void *
+fake_server_main(void *arg)
+{
+    fake_server_t *s = (fake_server_t *)arg;
+    int fd = accept(s->listen_fd, NULL, NULL);
+    int fd2 = -1;
+    long n = 0;
+    char line[4096];
+
+    while(s->count[0] < PIPE_ANSWERED + PIPE_UNANSWERED && (n = read_command(fd)) != -2)
+    {
+        s->seen[0][s->count[0]++] = n;
+        if(s->count[0] <= PIPE_ANSWERED && write(fd, "+OK\r\n", 5) != 5)
+            break;
+    }
+
+    /* Half close: the replies so far still get there, then EOF. */
+    shutdown(fd, SHUT_WR);
+    if(!s->reconnect)
+    {
+        /* Nobody there any more. Wait for the client to let go of the
+         * first connection, so what it has not read yet is not reset. */
+        close(s->listen_fd);
+        s->listen_fd = -1;
+        while(read(fd, line, sizeof(line)) > 0)
+            ;
+    }
+    else
+    {
+        fd2 = accept(s->listen_fd, NULL, NULL);
+        while((n = read_command(fd2)) != -2 && s->count[1] < PIPE_COMMANDS + 16)
+        {
+            s->seen[1][s->count[1]++] = n;
+            if(write(fd2, "+OK\r\n", 5) != 5)
+                break;
+        }
+        close(fd2);
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static void
+fake_server_start(fake_server_t *s, int reconnect)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int on = 1;
+
+    memset(s, 0, sizeof(*s));
+    s->reconnect = reconnect;
+    s->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(s->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    listen(s->listen_fd, 4);
+    getsockname(s->listen_fd, (struct sockaddr *)&addr, &len);
+    s->port = ntohs(addr.sin_port);
+    pthread_create(&s->thread, NULL, fake_server_main, s);
+}
+
+/* Connect one non-async shard to the fake server. */
+static redis_pipeline_t *
+pipeline_connect(fake_server_t *s)
+{
+    static char host[64];
+
+    snprintf(host, sizeof(host), "127.0.0.1:%d", s->port);
+    redis_async_flag = 0;
+    redis_local_pipeline_max = 1000;
+    if(redis_shard_init(host, 0) != 1)
+        return NULL;
+    return &redis_shard_pipeline[0];
+}
+
+static int
+send_echo(long n)
+{
+    char cmd[64];
+    char num[32];
+    int len = snprintf(num, sizeof(num), "%ld", n);
+
+    len = snprintf(cmd, sizeof(cmd), "*2\r\n$4\r\nECHO\r\n$%d\r\n%s\r\n", len, num);
+    return redis_shard_command_formatted(0, cmd, len);
+}
+
+START_TEST
+(test_pipeline_replays_unanswered)
+{
+    fake_server_t *s = calloc(1, sizeof(fake_server_t));
+    redis_pipeline_t *p = NULL;
+    long i = 0;
+
+    fake_server_start(s, 1);
+    p = pipeline_connect(s);
+    fail_unless(p != NULL);
+    redis_reconnect_prelude("*1\r\n$4\r\nPING\r\n", 14);
+
+    for(i = 0; i < PIPE_COMMANDS; i++)
+        fail_unless(send_echo(i) == 0, "command %ld failed", i);
+    fail_unless(redis_pipeline_drain(p) == 0);
+
+    /* Every command was answered once, as far as the pipeline knows. */
+    fail_unless(p->sent == PIPE_COMMANDS);
+    fail_unless(p->received == PIPE_COMMANDS);
+    fail_unless(p->outstanding == 0);
+    fail_unless(!p->dead);
+    fail_unless(redis_lost() == 0);
+
+    redis_shard_finalize();
+    pthread_join(s->thread, NULL);
+
+    /* The first connection saw the commands in order. */
+    fail_unless(s->count[0] == PIPE_ANSWERED + PIPE_UNANSWERED);
+    for(i = 0; i < s->count[0]; i++)
+        fail_unless(s->seen[0][i] == i);
+
+    /* The second one got the prelude, then exactly the unanswered ones
+     * and the rest, in order. */
+    fail_unless(s->count[1] == 1 + PIPE_COMMANDS - PIPE_ANSWERED, "second connection saw %d", s->count[1]);
+    fail_unless(s->seen[1][0] == PIPE_PRELUDE);
+    for(i = 1; i < s->count[1]; i++)
+        fail_unless(s->seen[1][i] == PIPE_ANSWERED + i - 1,
+                    "command %ld on the second connection is %ld", i, s->seen[1][i]);
+
+    close(s->listen_fd);
+    free(s);
+}
+END_TEST
+
+START_TEST
+(test_pipeline_gives_up)
+{
+    fake_server_t *s = calloc(1, sizeof(fake_server_t));
+    redis_pipeline_t *p = NULL;
+    FILE *log = tmpfile();
+    char line[512];
+    int failed = 0;
+    int giving_up = 0;
+    long i = 0;
+
+    PURGER_debug_stream = log;
+    fake_server_start(s, 0);
+    p = pipeline_connect(s);
+    fail_unless(p != NULL);
+
+    for(i = 0; i < PIPE_COMMANDS; i++)
+        if(send_echo(i) < 0)
+            failed++;
+    if(redis_pipeline_drain(p) < 0)
+        failed++;
+
+    /* What was answered counts, the rest is dropped and nothing is kept. */
+    fail_unless(failed > 0);
+    fail_unless(p->dead);
+    fail_unless(p->received == PIPE_ANSWERED);
+    fail_unless(p->outstanding == 0);
+    fail_unless(p->replay == NULL && p->replay_off == NULL);
+    fail_unless(sdslen(p->context->obuf) == 0);
+    fail_unless(redis_lost() == 1);
+
+    /* Later commands fail straight away and are not buffered. */
+    fail_unless(send_echo(PIPE_COMMANDS) == -1);
+    fail_unless(sdslen(p->context->obuf) == 0);
+    fail_unless(p->sent <= PIPE_COMMANDS);
+
+    /* Said once, however many commands were dropped. */
+    rewind(log);
+    while(fgets(line, sizeof(line), log) != NULL)
+        if(strstr(line, "Giving up on redis") != NULL)
+            giving_up++;
+    fail_unless(giving_up == 1, "gave up %d times", giving_up);
+
+    PURGER_debug_stream = stderr;
+    fclose(log);
+    redis_shard_finalize();
+    pthread_join(s->thread, NULL);
+    free(s);
+}
+END_TEST
+
+Suite *
+check_pipeline_suite (void)
+{
+    Suite *s = suite_create("check_pipeline");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_pipeline_replays_unanswered);
+    tcase_add_test(tc_core, test_pipeline_gives_up);
+    tcase_set_timeout(tc_core, 30);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+
+    PURGER_debug_stream = stderr;
+    /* A write to the closed connection has to fail, not end the test. */
+    signal(SIGPIPE, SIG_IGN);
+
+    Suite *s = check_pipeline_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */
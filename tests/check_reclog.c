@@ -0,0 +1,112 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "reclog.h"
+
+#define CHECK_RECLOG_FILES 100000
+
+static char check_reclog_dir[] = "/tmp/check_reclogXXXXXX";
+
+/* Write "n" files through the store ops, every third one expired. */
+static void
+check_reclog_write(int n)
+{
+    purger_store_t *s = purger_reclog_open(check_reclog_dir, 3);
+    struct stat st;
+    char path[64];
+    int i = 0;
+
+    fail_unless(s != NULL);
+    fail_unless(s->keyed == 0 && s->file != NULL && s->close != NULL);
+
+    memset(&st, 0, sizeof(st));
+    for(i = 0; i < n; i++)
+    {
+        sprintf(path, "/scratch/u/file %d", i);
+        st.st_mtime = 1000000 + i;
+        st.st_size = (off_t)i * 4099;
+        st.st_uid = 500 + i % 7;
+        st.st_gid = 100 + i % 3;
+        fail_unless((*s->file)(s, path, &st, NULL, 0, i % 3 == 0) == 0);
+    }
+    fail_unless((*s->close)(s) == 0);
+}
+
+START_TEST
+(test_reclog_roundtrip)
+{
+    purger_reclog_reader_t rd;
+    purger_record_t r;
+    char log[256];
+    char path[64];
+    int flags = 0;
+    int i = 0;
+
+    fail_unless(mkdtemp(check_reclog_dir) != NULL);
+    check_reclog_write(CHECK_RECLOG_FILES);
+
+    purger_reclog_path(log, sizeof(log), check_reclog_dir, 3);
+    fail_unless(purger_reclog_reader_open(&rd, log) == 0);
+    for(i = 0; i < CHECK_RECLOG_FILES; i++)
+    {
+        fail_unless(purger_reclog_next(&rd, &r, &flags) == 1);
+        sprintf(path, "/scratch/u/file %d", i);
+        fail_unless(r.name_len == strlen(path) && memcmp(r.name, path, r.name_len) == 0);
+        fail_unless(r.mtime == 1000000 + i && r.size == (uint64_t)i * 4099);
+        fail_unless(r.uid == (uint32_t)(500 + i % 7) && r.gid == (uint32_t)(100 + i % 3));
+        fail_unless(((flags & PURGER_RECLOG_EXPIRED) != 0) == (i % 3 == 0));
+    }
+    fail_unless(purger_reclog_next(&rd, &r, &flags) == 0);
+    purger_reclog_reader_close(&rd);
+
+    /* A walk that died half way through a record. */
+    fail_unless(truncate(log, 8 + 3 * (5 + PURGER_RECORD_HEADER + 17) + 9) == 0);
+    fail_unless(purger_reclog_reader_open(&rd, log) == 0);
+    for(i = 0; i < 3; i++)
+        fail_unless(purger_reclog_next(&rd, &r, &flags) == 1);
+    fail_unless(purger_reclog_next(&rd, &r, &flags) == -1);
+    purger_reclog_reader_close(&rd);
+
+    /* Not a log at all. */
+    fail_unless(truncate(log, 4) == 0);
+    fail_unless(purger_reclog_reader_open(&rd, log) < 0);
+    fail_unless(unlink(log) == 0);
+    fail_unless(purger_reclog_reader_open(&rd, log) < 0);
+
+    fail_unless(rmdir(check_reclog_dir) == 0);
+    fail_unless(purger_reclog_open(check_reclog_dir, 0) == NULL);
+}
+END_TEST
+
+Suite *
+check_reclog_suite (void)
+{
+    Suite *s = suite_create("check_reclog");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_reclog_roundtrip);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+
+    Suite *s = check_reclog_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */
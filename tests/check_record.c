@@ -0,0 +1,159 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <hiredis.h>
+#include "record.h"
+
+START_TEST
+(test_record_roundtrip)
+{
+    char buf[128];
+    purger_record_t in;
+    purger_record_t out;
+    const char *path = "/scratch/user/a file \"with\" quotes";
+    size_t len = 0;
+
+    in.mtime = -12345678901LL;
+    in.size = 0x0123456789abcdefULL;
+    in.uid = 4294967295u;
+    in.gid = 100;
+    in.name = path;
+    in.name_len = strlen(path);
+
+    /* Too small: only the length comes back. */
+    memset(buf, 'x', sizeof(buf));
+    fail_unless(purger_record_pack(buf, 10, &in) == PURGER_RECORD_HEADER + strlen(path));
+    fail_unless(buf[0] == 'x');
+
+    len = purger_record_pack(buf, sizeof(buf), &in);
+    fail_unless(len == PURGER_RECORD_HEADER + strlen(path));
+    fail_unless(purger_record_unpack(buf, len, &out) == 0);
+    fail_unless(out.mtime == in.mtime && out.size == in.size);
+    fail_unless(out.uid == in.uid && out.gid == in.gid);
+    fail_unless(out.name_len == in.name_len && memcmp(out.name, path, out.name_len) == 0);
+
+    /* Little endian regardless of the host. */
+    fail_unless((unsigned char)buf[9] == 0xef && (unsigned char)buf[16] == 0x01);
+
+    fail_unless(purger_record_unpack(buf, PURGER_RECORD_HEADER - 1, &out) < 0);
+    buf[0] = 'P';
+    fail_unless(purger_record_unpack(buf, len, &out) < 0);
+}
+END_TEST
+
+START_TEST
+(test_record_bucket)
+{
+    char bucket[32];
+    char other[32];
+    const char *field = NULL;
+    size_t field_len = 0;
+    const char *key = "file:9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08\n";
+
+    fail_unless(purger_record_bucket(key, strlen(key), 4, bucket, sizeof(bucket), &field, &field_len) == 11);
+    fail_unless(strncmp(bucket, "bucket:", 7) == 0);
+    fail_unless(field_len == 64 && memcmp(field, key + 5, 64) == 0);
+
+    /* The newline and the prefix do not change where a record goes. */
+    fail_unless(purger_record_bucket(key + 5, 64, 4, other, sizeof(other), &field, &field_len) == 11);
+    fail_unless(strcmp(bucket, other) == 0);
+
+    fail_unless(purger_record_bucket("file:801:1f2e", 13, 2, bucket, sizeof(bucket), &field, &field_len) == 9);
+    fail_unless(field_len == 8 && memcmp(field, "801:1f2e", 8) == 0);
+
+    fail_unless(purger_record_bucket(key, strlen(key), 0, bucket, sizeof(bucket), &field, &field_len) < 0);
+    fail_unless(purger_record_bucket(key, strlen(key), 4, bucket, 8, &field, &field_len) < 0);
+}
+END_TEST
+
+START_TEST
+(test_record_schema)
+{
+    fail_unless(purger_record_schema_parse(NULL) == 0);
+    fail_unless(purger_record_schema_parse("hash") == 0);
+    fail_unless(purger_record_schema_parse("packed:4") == 4);
+    fail_unless(purger_record_schema_parse("packed:9") < 0);
+    fail_unless(purger_record_schema_parse("packed:") < 0);
+    fail_unless(purger_record_schema_parse("columns") < 0);
+}
+END_TEST
+
+START_TEST
+(test_record_hash_decode)
+{
+    char *values[PURGER_RECORD_HASH_COUNT] = { "\"/scratch/a b\"", "\"100\"", "1300000000", "\"4096\"", "4294967295" };
+    redisReply fields[PURGER_RECORD_HASH_COUNT];
+    redisReply *f[PURGER_RECORD_HASH_COUNT];
+    redisReply reply;
+    purger_record_t r;
+    char quoted[] = "\"x\"";
+    char bare[] = "\"";
+    size_t len = 0;
+    int i = 0;
+
+    /* Only a value wrapped in quotes on both ends loses them. */
+    len = strlen(quoted);
+    fail_unless(purger_record_unquote(quoted, &len) == quoted + 1 && len == 1);
+    len = strlen(bare);
+    fail_unless(purger_record_unquote(bare, &len) == bare && len == 1);
+
+    memset(&reply, 0, sizeof(reply));
+    memset(fields, 0, sizeof(fields));
+    for(i = 0; i < PURGER_RECORD_HASH_COUNT; i++)
+    {
+        fields[i].type = REDIS_REPLY_STRING;
+        fields[i].str = values[i];
+        fields[i].len = (int)strlen(values[i]);
+        f[i] = &fields[i];
+    }
+    reply.type = REDIS_REPLY_ARRAY;
+    reply.elements = PURGER_RECORD_HASH_COUNT;
+    reply.element = f;
+
+    /* Old quoted values and new raw ones mixed. */
+    fail_unless(purger_record_hash_decode(&reply, &r) == 0);
+    fail_unless(r.name_len == 12 && memcmp(r.name, "/scratch/a b", 12) == 0);
+    fail_unless(r.gid == 100 && r.mtime == 1300000000 && r.size == 4096 && r.uid == 4294967295u);
+
+    fields[3].type = REDIS_REPLY_NIL;
+    fail_unless(purger_record_hash_decode(&reply, &r) == -2);
+    reply.elements = 2;
+    fail_unless(purger_record_hash_decode(&reply, &r) == -1);
+    reply.type = REDIS_REPLY_ERROR;
+    reply.elements = 0;
+    fail_unless(purger_record_hash_decode(&reply, &r) == -1);
+}
+END_TEST
+
+Suite *
+check_record_suite (void)
+{
+    Suite *s = suite_create("check_record");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_record_roundtrip);
+    tcase_add_test(tc_core, test_record_bucket);
+    tcase_add_test(tc_core, test_record_schema);
+    tcase_add_test(tc_core, test_record_hash_decode);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+
+    Suite *s = check_record_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */
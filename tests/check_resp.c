@@ -0,0 +1,85 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resp.h"
+
+START_TEST
+(test_resp_command)
+{
+    resp_buf_t b;
+    const char *expect = "*3\r\n$4\r\nZADD\r\n$2\r\n-5\r\n$8\r\na \"b\"\r\nc\r\n";
+
+    memset(&b, 0, sizeof(b));
+    resp_array(&b, 3);
+    resp_bulk(&b, "ZADD", 4);
+    resp_bulk_long(&b, -5);
+    resp_bulk_str(&b, "a \"b\"\r\nc");
+
+    fail_unless(b.len == strlen(expect));
+    fail_unless(memcmp(b.buf, expect, b.len) == 0);
+
+    /* Reset keeps the memory, the next command starts from scratch. */
+    resp_reset(&b);
+    resp_bulk_long(&b, 0);
+    fail_unless(b.len == 7 && memcmp(b.buf, "$1\r\n0\r\n", 7) == 0);
+
+    /* Arguments counted after the fact go in behind their header. */
+    resp_reset(&b);
+    resp_array(&b, 1);
+    resp_raw(&b, "$1\r\n0\r\n", 7);
+    fail_unless(b.len == 11 && memcmp(b.buf, "*1\r\n$1\r\n0\r\n", 11) == 0);
+
+    resp_free(&b);
+}
+END_TEST
+
+START_TEST
+(test_resp_grows)
+{
+    resp_buf_t b;
+    char big[10000];
+    int i = 0;
+
+    memset(&b, 0, sizeof(b));
+    memset(big, 'x', sizeof(big));
+
+    for(i = 0; i < 10; i++)
+        fail_unless(resp_bulk(&b, big, sizeof(big)) == 0);
+
+    fail_unless(b.len == 10 * (sizeof(big) + strlen("$10000\r\n\r\n")));
+    fail_unless(b.size >= b.len);
+
+    resp_free(&b);
+}
+END_TEST
+
+Suite *
+check_resp_suite (void)
+{
+    Suite *s = suite_create("check_resp");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_resp_command);
+    tcase_add_test(tc_core, test_resp_grows);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+
+    Suite *s = check_resp_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */
@@ -0,0 +1,165 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ring.h"
+
+#define RING_TEST_RECORDS 200000
+
+START_TEST
+(test_ring_order)
+{
+    ring_t r;
+    char *data = NULL;
+    size_t len = 0;
+    int tag = 0;
+
+    fail_unless(ring_init(&r, 100) == 0);
+    fail_unless(r.size == 4096);
+    fail_unless(ring_read(&r, &tag, &len) == NULL);
+
+    fail_unless(ring_write(&r, 1, "hello", 5) == 0);
+    fail_unless(ring_write(&r, -7, "", 0) == 0);
+
+    data = ring_read(&r, &tag, &len);
+    fail_unless(data != NULL && tag == 1 && len == 5 && memcmp(data, "hello", 5) == 0);
+    ring_read_done(&r);
+
+    data = ring_read(&r, &tag, &len);
+    fail_unless(data != NULL && tag == -7 && len == 0);
+    ring_read_done(&r);
+
+    fail_unless(ring_read(&r, &tag, &len) == NULL);
+
+    /* Too large to ever fit. */
+    fail_unless(ring_write_reserve(&r, r.size) == NULL);
+
+    ring_free(&r);
+}
+END_TEST
+
+START_TEST
+(test_ring_wraps)
+{
+    ring_t r;
+    char rec[1000];
+    char *data = NULL;
+    size_t len = 0;
+    int tag = 0;
+    int i = 0;
+
+    fail_unless(ring_init(&r, 4096) == 0);
+
+    /* Records that do not divide the ring have to skip its tail end. */
+    for(i = 0; i < 50; i++)
+    {
+        memset(rec, 'a' + i % 26, sizeof(rec));
+        fail_unless(ring_write(&r, i, rec, 700 + i) == 0);
+
+        data = ring_read(&r, &tag, &len);
+        fail_unless(data != NULL && tag == i && len == (size_t)(700 + i));
+        fail_unless(data[0] == 'a' + i % 26 && data[len - 1] == 'a' + i % 26);
+        ring_read_done(&r);
+    }
+
+    ring_free(&r);
+}
+END_TEST
+
+static void *
+ring_test_consumer(void *arg)
+{
+    ring_t *r = (ring_t *)arg;
+    long *bad = (long *)calloc(1, sizeof(long));
+    char *data = NULL;
+    size_t len = 0;
+    int expect = 0;
+    int closed = 0;
+    int spins = 0;
+    int tag = 0;
+    int value = 0;
+
+    for(;;)
+    {
+        closed = ring_is_closed(r);
+        data = ring_read(r, &tag, &len);
+        if(data == NULL)
+        {
+            if(closed)
+                break;
+            ring_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+
+        memcpy(&value, data, sizeof(value));
+        if(tag != expect || value != expect || len != sizeof(int) + (size_t)(expect % 37))
+            (*bad)++;
+        expect++;
+        ring_read_done(r);
+    }
+
+    if(expect != RING_TEST_RECORDS)
+        (*bad)++;
+    return bad;
+}
+
+START_TEST
+(test_ring_threads)
+{
+    ring_t r;
+    pthread_t consumer;
+    char rec[64];
+    long *bad = NULL;
+    int i = 0;
+
+    /* Small enough that the producer keeps running into a full ring. */
+    fail_unless(ring_init(&r, 4096) == 0);
+    fail_unless(pthread_create(&consumer, NULL, ring_test_consumer, &r) == 0);
+
+    for(i = 0; i < RING_TEST_RECORDS; i++)
+    {
+        memcpy(rec, &i, sizeof(i));
+        fail_unless(ring_write(&r, i, rec, sizeof(i) + i % 37) == 0);
+    }
+    ring_close(&r);
+
+    pthread_join(consumer, (void **)&bad);
+    fail_unless(*bad == 0);
+
+    free(bad);
+    ring_free(&r);
+}
+END_TEST
+
+Suite *
+check_ring_suite (void)
+{
+    Suite *s = suite_create("check_ring");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_ring_order);
+    tcase_add_test(tc_core, test_ring_wraps);
+    tcase_add_test(tc_core, test_ring_threads);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+
+    Suite *s = check_ring_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */
@@ -0,0 +1,118 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "runs.h"
+
+#define CHECK_RUNS_FILES 20000
+
+static char check_runs_dir[] = "/tmp/check_runsXXXXXX";
+
+START_TEST
+(test_runs_spill)
+{
+    purger_run_buffer_t b;
+    purger_reclog_reader_t rd;
+    purger_run_mark_t *marks = NULL;
+    purger_record_t r;
+    char **paths = NULL;
+    char name[64];
+    char run[256];
+    char idx[256];
+    size_t nmarks = 0;
+    size_t count = 0;
+    int64_t last = 0;
+    int flags = 0;
+    int spilled = 0;
+    int i = 0;
+
+    fail_unless(mkdtemp(check_runs_dir) != NULL);
+    fail_unless(purger_run_buffer_init(&b, 256 * 1024) == 0);
+
+    /* Spill whenever the buffer fills up, like treewalk -R. */
+    for(i = 0; i < CHECK_RUNS_FILES; i++)
+    {
+        sprintf(name, "/scratch/u/%d", i);
+        r.mtime = (i * 7919) % 10007;
+        r.size = i;
+        r.uid = 500;
+        r.gid = 100;
+        r.name = name;
+        r.name_len = strlen(name);
+        if(purger_run_buffer_add(&b, &r) < 0)
+        {
+            sprintf(run, "%s/" PURGER_RUN_PREFIX "0-%d" PURGER_RUN_SUFFIX, check_runs_dir, spilled++);
+            fail_unless(purger_run_buffer_spill(&b, run) == 0);
+            fail_unless(b.count == 0 && b.len == 0);
+            fail_unless(purger_run_buffer_add(&b, &r) == 0);
+        }
+    }
+    sprintf(run, "%s/" PURGER_RUN_PREFIX "0-%d" PURGER_RUN_SUFFIX, check_runs_dir, spilled++);
+    fail_unless(purger_run_buffer_spill(&b, run) == 0);
+    purger_run_buffer_free(&b);
+    fail_unless(spilled > 1);
+
+    fail_unless(purger_run_list(check_runs_dir, PURGER_RUN_PREFIX, &paths, &count) == 0);
+    fail_unless(count == (size_t)spilled);
+
+    /* The first run is in mtime order and its index points at its records. */
+    fail_unless(purger_run_index_read(paths[0], &marks, &nmarks) == 0);
+    fail_unless(nmarks > 1 && marks[0].offset == PURGER_RECLOG_MAGIC_LEN);
+    fail_unless(purger_reclog_reader_open(&rd, paths[0]) == 0);
+    last = -1;
+    while(purger_reclog_next(&rd, &r, &flags) == 1)
+    {
+        fail_unless(r.mtime >= last && (flags & PURGER_RECLOG_EXPIRED));
+        last = r.mtime;
+    }
+
+    fail_unless(purger_reclog_reader_seek(&rd, marks[1].offset) == 0);
+    fail_unless(purger_reclog_next(&rd, &r, &flags) == 1 && r.mtime == marks[1].mtime);
+
+    /* Reading from the mark before an mtime reaches the first record at it. */
+    fail_unless(purger_run_index_seek(marks, nmarks, INT64_MIN) == PURGER_RECLOG_MAGIC_LEN);
+    fail_unless(purger_run_index_seek(marks, nmarks, marks[1].mtime + 1) == marks[1].offset);
+    fail_unless(purger_reclog_reader_seek(&rd, 1ULL << 40) < 0);
+    purger_reclog_reader_close(&rd);
+    free(marks);
+
+    for(i = 0; i < (int)count; i++)
+    {
+        purger_run_index_path(idx, sizeof(idx), paths[i]);
+        fail_unless(unlink(paths[i]) == 0 && unlink(idx) == 0);
+    }
+    purger_run_list_free(paths, count);
+    fail_unless(rmdir(check_runs_dir) == 0);
+}
+END_TEST
+
+Suite *
+check_runs_suite (void)
+{
+    Suite *s = suite_create("check_runs");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_runs_spill);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+
+    Suite *s = check_runs_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */
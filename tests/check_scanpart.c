@@ -0,0 +1,180 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "scanpart.h"
+
+/* One step of the server's walk over a table of "size" buckets. */
+static uint64_t
+check_scanpart_next(uint64_t v, uint64_t size)
+{
+    uint64_t r = 0;
+    int i = 0;
+
+    v |= ~(size - 1);
+    for(i = 0; i < 64; i++)
+        r |= ((v >> i) & 1) << (63 - i);
+    r++;
+    for(v = 0, i = 0; i < 64; i++)
+        v |= ((r >> i) & 1) << (63 - i);
+    return v;
+}
+
+START_TEST
+(test_scanpart_cover)
+{
+    static int visits[1 << 12];
+    unsigned parts = 0;
+    unsigned part = 0;
+    uint64_t size = 0;
+    uint64_t v = 0;
+    uint64_t i = 0;
+
+    /* Every bucket once, whichever part it fell in. */
+    for(parts = 1; parts <= 64; parts <<= 1)
+    {
+        for(size = parts; size <= sizeof(visits) / sizeof(visits[0]); size <<= 1)
+        {
+            memset(visits, 0, sizeof(visits));
+            for(part = 0; part < parts; part++)
+            {
+                v = purger_scan_part_start(part, parts);
+                do
+                {
+                    visits[v & (size - 1)]++;
+                    v = check_scanpart_next(v, size);
+                }
+                while(purger_scan_part_owns(v, part, parts));
+                fail_unless(v == purger_scan_part_end(part, parts));
+            }
+            for(i = 0; i < size; i++)
+                fail_unless(visits[i] == 1, "bucket %llu of %llu seen %d times in %u parts",
+                            (unsigned long long)i, (unsigned long long)size, visits[i], parts);
+        }
+    }
+}
+END_TEST
+
+START_TEST
+(test_scanpart_grow)
+{
+    static int visits[1 << 10];
+    unsigned part = 0;
+    uint64_t v = 0;
+    uint64_t i = 0;
+    int steps = 0;
+
+    /* The table doubles twice halfway through every part. A bucket of
+     * the small table is four of the big one, all of them seen. */
+    for(part = 0; part < 8; part++)
+    {
+        v = purger_scan_part_start(part, 8);
+        steps = 0;
+        do
+        {
+            if(steps < 16)
+            {
+                for(i = v & 255; i < 1024; i += 256)
+                    visits[i]++;
+                v = check_scanpart_next(v, 256);
+            }
+            else
+            {
+                visits[v & 1023]++;
+                v = check_scanpart_next(v, 1024);
+            }
+            steps++;
+        }
+        while(purger_scan_part_owns(v, part, 8));
+    }
+    for(i = 0; i < 1024; i++)
+        fail_unless(visits[i] == 1, "bucket %llu seen %d times", (unsigned long long)i, visits[i]);
+}
+END_TEST
+
+START_TEST
+(test_scanpart_parts)
+{
+    fail_unless(purger_scan_parts(0, 8) == 1);
+    fail_unless(purger_scan_parts(1000000, 0) == 1);
+    fail_unless(purger_scan_parts(1000000, 5) == 8);
+    fail_unless(purger_scan_parts(1000000, 1000) == 128);
+    fail_unless(purger_scan_parts(1LL << 40, 1U << 30) == PURGER_SCAN_PARTS_MAX);
+    fail_unless(purger_scan_part_start(0, 1) == 0);
+    fail_unless(purger_scan_part_start(1, 8) == 4 && purger_scan_part_start(6, 8) == 3);
+}
+END_TEST
+
+START_TEST
+(test_scanpart_next)
+{
+    const unsigned parts[4] = { 2, 0, 1, 8 };
+    int done[4][8];
+    purger_scan_turn_t t;
+    int rank = 0;
+    int s = 0;
+    int n = 0;
+
+    /* Part 0 of every shard first, a shard that was left out has none. */
+    memset(&t, 0, sizeof(t));
+    fail_unless(purger_scan_part_next(parts, 4, 0, 2, &t) == 0 && t.part == 0);
+    fail_unless(purger_scan_part_next(parts, 4, 0, 2, &t) == 3 && t.part == 0);
+    fail_unless(purger_scan_part_next(parts, 4, 0, 2, &t) == 3 && t.part == 1);
+    memset(&t, 0, sizeof(t));
+    fail_unless(purger_scan_part_next(parts, 4, 1, 2, &t) == 2 && t.part == 0);
+    fail_unless(purger_scan_part_next(parts, 4, 1, 2, &t) == 0 && t.part == 1);
+    fail_unless(purger_scan_part_next(parts, 4, 1, 2, &t) == 3 && t.part == 2);
+
+    /* Between them the ranks get every part once. */
+    memset(done, 0, sizeof(done));
+    for(rank = 0; rank < 3; rank++)
+    {
+        memset(&t, 0, sizeof(t));
+        while((s = purger_scan_part_next(parts, 4, rank, 3, &t)) >= 0)
+        {
+            fail_unless(t.part < parts[s]);
+            done[s][t.part]++;
+            n++;
+        }
+        fail_unless(purger_scan_part_next(parts, 4, rank, 3, &t) == -1);
+    }
+    fail_unless(n == 11);
+    for(s = 0; s < 4; s++)
+        for(rank = 0; rank < (int)parts[s]; rank++)
+            fail_unless(done[s][rank] == 1);
+}
+END_TEST
+
+Suite *
+check_scanpart_suite (void)
+{
+    Suite *s = suite_create("check_scanpart");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_scanpart_cover);
+    tcase_add_test(tc_core, test_scanpart_grow);
+    tcase_add_test(tc_core, test_scanpart_parts);
+    tcase_add_test(tc_core, test_scanpart_next);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+
+    Suite *s = check_scanpart_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */
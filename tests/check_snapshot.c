@@ -0,0 +1,129 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+#define CHECK_SNAPSHOT_FILES (2 * PURGER_SNAPSHOT_BLOCK + 100)
+
+static char check_snapshot_path[] = "/tmp/check_snapshotXXXXXX";
+
+START_TEST
+(test_snapshot_roundtrip)
+{
+    purger_snapshot_writer_t *w = NULL;
+    purger_snapshot_block_t b;
+    purger_snapshot_t s;
+    struct stat st;
+    const char *str = NULL;
+    char path[64];
+    size_t len = 0;
+    uint64_t i = 0;
+    int fd = mkstemp(check_snapshot_path);
+
+    fail_unless(fd >= 0);
+    close(fd);
+
+    w = purger_snapshot_create(check_snapshot_path);
+    fail_unless(w != NULL);
+    memset(&st, 0, sizeof(st));
+    for(i = 0; i < CHECK_SNAPSHOT_FILES; i++)
+    {
+        sprintf(path, "/scratch/d%d/f%d", (int)(i % 10), (int)i);
+        st.st_mtime = 1000 + (time_t)i;
+        st.st_size = (off_t)(i * 3);
+        st.st_uid = 500 + i / PURGER_SNAPSHOT_BLOCK;
+        st.st_gid = 100;
+        fail_unless(purger_snapshot_add(w, path, strlen(path), &st) == 0);
+    }
+    fail_unless(purger_snapshot_add(w, "/top", 4, &st) == 0);
+    fail_unless(purger_snapshot_finish(w) == 0);
+
+    fail_unless(purger_snapshot_open(&s, check_snapshot_path) == 0);
+    fail_unless(s.rows == CHECK_SNAPSHOT_FILES + 1 && s.blocks == 3);
+    /* Ten directories, every basename, the root and "top". */
+    fail_unless(s.string_count == 10 + CHECK_SNAPSHOT_FILES + 2);
+
+    fail_unless(s.zones[1].mtime_min == 1000 + PURGER_SNAPSHOT_BLOCK);
+    fail_unless(s.zones[1].mtime_max == 1000 + 2 * PURGER_SNAPSHOT_BLOCK - 1);
+    fail_unless(s.zones[1].uid_min == 501 && s.zones[1].uid_max == 501);
+
+    fail_unless(purger_snapshot_block(&s, 2, &b) == 0);
+    fail_unless(b.rows == 101 && (uintptr_t)b.mtime % PURGER_SNAPSHOT_ALIGN == 0);
+    str = purger_snapshot_string(&s, b.dir[3], &len);
+    fail_unless(str != NULL && len == 11 && memcmp(str, "/scratch/d", 10) == 0);
+    str = purger_snapshot_string(&s, b.name[100], &len);
+    fail_unless(str != NULL && len == 3 && memcmp(str, "top", 3) == 0);
+    str = purger_snapshot_string(&s, b.dir[100], &len);
+    fail_unless(str != NULL && len == 1 && str[0] == '/');
+    fail_unless(purger_snapshot_block(&s, 3, &b) < 0);
+    fail_unless(purger_snapshot_string(&s, (uint32_t)s.string_count, &len) == NULL);
+    purger_snapshot_close(&s);
+
+    /* A snapshot cut short has no footer. */
+    fail_unless(truncate(check_snapshot_path, 4096) == 0);
+    fail_unless(purger_snapshot_open(&s, check_snapshot_path) < 0);
+    fail_unless(unlink(check_snapshot_path) == 0);
+}
+END_TEST
+
+START_TEST
+(test_snapshot_select)
+{
+    int64_t mtime[1003];
+    uint32_t sel[1003];
+    size_t n = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    for(i = 0; i < 1003; i++)
+        mtime[i] = (int64_t)((i * 7919) % 1000) - 500;
+
+    /* Picks the same rows, in order, whichever way it compares. */
+    n = purger_snapshot_select_older(mtime, 1003, 17, sel);
+    for(i = 0, j = 0; i < 1003; i++)
+    {
+        if(mtime[i] < 17)
+        {
+            fail_unless(j < n && sel[j] == i);
+            j++;
+        }
+    }
+    fail_unless(j == n);
+    fail_unless(purger_snapshot_select_older(mtime, 1003, -1000, sel) == 0);
+    fail_unless(purger_snapshot_select_older(mtime, 3, 1000, sel) == 3);
+}
+END_TEST
+
+Suite *
+check_snapshot_suite (void)
+{
+    Suite *s = suite_create("check_snapshot");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_snapshot_roundtrip);
+    tcase_add_test(tc_core, test_snapshot_select);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+
+    Suite *s = check_snapshot_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* EOF */